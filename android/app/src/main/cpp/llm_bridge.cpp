@@ -1,23 +1,47 @@
 // llm_bridge.cpp — Android JNI + FFI bridge for newer llama.cpp (vocab-based API)
+#if defined(__ANDROID__)
 #include <jni.h>
 #include <android/log.h>
+#endif
 
+#include <chrono>
+#include <cmath>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
-#include <algorithm> // std::min
+#include <algorithm> // std::min, heap ops
 
-#include "llama.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-// ---------- logging ----------
-#ifndef LLOG_TAG
-#define LLOG_TAG "LLM_BRIDGE"
-#endif
-#define LLOGI(...) __android_log_print(ANDROID_LOG_INFO,  LLOG_TAG, __VA_ARGS__)
-#define LLOGW(...) __android_log_print(ANDROID_LOG_WARN,  LLOG_TAG, __VA_ARGS__)
-#define LLOGE(...) __android_log_print(ANDROID_LOG_ERROR, LLOG_TAG, __VA_ARGS__)
+#include "llama.h"
+#include "llm_bridge.h"
+#include "llm_choice.h"
+#include "llm_coalesce.h"
+#include "llm_ctx_pool.h"
+#include "llm_gen.h"
+#include "llm_geo.h"
+#include "llm_geo_cluster.h"
+#include "llm_grammar.h"
+#include "llm_idle.h"
+#include "llm_json.h"
+#include "llm_kv.h"
+#include "llm_log.h"
+#include "llm_logbuf.h"
+#include "llm_metrics.h"
+#include "llm_numfmt.h"
+#include "llm_places.h"
+#include "llm_requant.h"
+#include "llm_stream.h"
+#include "llm_template.h"
+#include "llm_vocab.h"
 
 // ---------- export visibility ----------
 #if defined(__GNUC__)
@@ -33,10 +57,109 @@
 #endif
 
 // ---------- globals ----------
+// Locking. g_mutex is the engine lock: generation and every structural change (init,
+// reload/unload, dispose, KV surgery) run under it, through engine_lock. Nothing that
+// only reads takes it: model data is published as immutable snapshots (below), engine
+// stats as a copy refreshed whenever the engine lock is released, metrics and logs are
+// lock-free. Smaller locks, always taken after g_mutex if both are needed:
+// g_sess_mu (session table), g_emb_mu (embedding context), g_snap_mu (stats copy),
+// g_tmpl_mu (prompt templates).
 static std::mutex     g_mutex;
-static llama_model*   g_model   = nullptr;
+static llama_model*   g_model   = nullptr;  // == g_handle->model while loaded; engine lock only
 static llama_context* g_ctx     = nullptr;
+static bool           g_inited  = false;    // llm_init done; model/ctx may be unloaded while idle
+static bool           g_prewarmed = false;  // loaded by llm_prewarm, not yet adopted by llm_init
+static bool           g_prewarm_stop = false;   // llm_dispose: a prewarm not yet loading gives up
+static std::thread    g_prewarm_thread;         // joined by llm_init (adopting), llm_prewarm, llm_dispose
 static int            g_threads = 4;
+static int            g_n_ctx   = 2048;
+static int            g_gpu_layers = 0;
+static std::string    g_model_path;
+static uint64_t       g_model_key = 0;      // identity of the model file; tags the disk caches
+static token_table    g_tokens;             // piece table, built on first constrained request
+static tok_cache      g_tok_cache;          // recent prompt tokenizations
+
+// Published model data. The loaded model is owned by a handle and freed when the last
+// holder lets go, so a reader never sees it vanish mid-call; the metadata outlives idle
+// unloads. Both are swapped with std::atomic_store and read with std::atomic_load.
+struct model_handle {
+    llama_model* model     = nullptr;
+    int          n_threads = 4;
+    ~model_handle() { if (model) llama_model_free(model); }
+};
+struct model_meta {
+    std::string path;
+    std::string info;        // llm_model_info JSON
+    std::string chat_tmpl;   // the GGUF's template, "" = none
+};
+static std::shared_ptr<const model_handle> g_handle;
+static std::shared_ptr<const model_meta>   g_meta;
+
+static std::mutex     g_emb_mu;
+static llama_context* g_emb_ctx = nullptr;    // llm_embed only: mean pooling, made on first use
+static std::shared_ptr<const model_handle> g_emb_model;  // what g_emb_ctx was made from
+
+// KV sequences of g_ctx: seq 0 serves requests without a "session", every open session
+// has its own sequence in the same (unified) cache. The table is guarded by g_sess_mu so
+// opening and closing a session never waits for a generation; a sequence's contents are
+// only touched under the engine lock. Closed sessions wait in g_closed until the engine
+// lock frees their cells (and their sequence id).
+static constexpr int kMaxSeq = 8;
+static kv_seq        g_main;
+static std::mutex    g_sess_mu;
+static std::map<int, std::shared_ptr<kv_seq>> g_sessions;   // by session id
+static std::vector<std::shared_ptr<kv_seq>>   g_closed;
+static std::vector<llama_seq_id>              g_reserved;  // borrowed by llm_infer_batch
+static int           g_next_session = 1;
+static kv_layout             g_layout;           // fragmentation model of g_ctx
+static float                 g_compact_thold = 0.5f;
+static struct {
+    uint64_t          n = 0;
+    kv_compact_report last;
+} g_kstats;
+static llama_batch           g_batch = {};       // n_batch tokens, up to kMaxSeq seqs each; made with g_ctx
+
+// KV paging (llm_kv_paging): sessions idle the longest are spilled to a page file when the
+// resident cells would exceed g_resident_max (0 = n_ctx) and paged back when used
+static kv_pager              g_pager;
+static size_t                g_resident_max = 0;
+static uint64_t              g_use_tick     = 0;
+static struct {
+    uint64_t outs = 0, ins = 0, dropped = 0;
+    double   bytes_out = 0, bytes_in = 0;
+    double   ms_out = 0, ms_in = 0;
+} g_pstats;
+
+// idle unload (see "residency" below)
+static idle_timer     g_idle;
+static int            g_idle_s     = 0;
+static bool           g_idle_model = false;
+static std::string    g_cache_dir;          // "" = next to the model file
+
+// warm standby contexts (llm_pool_configure); g_ctx is checked out of it
+static ctx_pool       g_pool;
+static bool           g_pool_filling = false;
+static bool           g_pool_stop    = false;   // llm_dispose: no new fill, the running one ends
+static std::thread    g_pool_thread;            // joined by the next fill or llm_dispose
+
+static struct {
+    int    n_unloads = 0, n_reloads = 0;
+    double cold_ms = 0, unload_ms = 0, reload_ms = 0;
+    size_t restored_tokens = 0;             // prefix restored from disk by the last (re)load
+    size_t reused_tokens   = 0;             // prompt tokens served from the KV cache, total
+} g_rstats;
+
+// prompt templates (llm_template_register); each is tokenized for the model handle it
+// names and compiled again when a request finds another model loaded
+struct tmpl_entry {
+    std::string                            text;
+    std::shared_ptr<const prompt_template> t;
+    std::weak_ptr<const model_handle>      model;   // what t was tokenized for
+    std::map<std::string, std::vector<double>> priors; // llm_choose calibration, by candidates
+};
+static std::mutex g_tmpl_mu;
+static std::map<int, std::shared_ptr<tmpl_entry>> g_templates;   // by template id
+static int        g_next_template = 1;
 
 // ---------- tiny JSON helpers ----------
 static double jgetd(const char* json, const char* key, double defv) {
@@ -52,13 +175,33 @@ static int jgeti(const char* json, const char* key, int defi) {
     return (int) jgetd(json, key, (double)defi);
 }
 
+// NUL-terminated copy into a caller buffer; -32 (and an empty string) if it does not fit
+static int write_out(const std::string& s, char* buf, int size) {
+    if (!buf || size <= 0) return -30;
+    if ((int)s.size() >= size) { buf[0] = '\0'; return -32; }
+    memcpy(buf, s.data(), s.size());
+    buf[s.size()] = '\0';
+    return 0;
+}
+static void jput_str(json_value& o, const char* k, const char* s) {
+    json_value e; e.kind = json_value::STR; e.str = s ? s : "";
+    o.obj.emplace_back(k, e);
+}
+static void jput_num(json_value& o, const char* k, double d) {
+    json_value e; e.kind = json_value::NUM; e.num = d;
+    char b[32];
+    snprintf(b, sizeof(b), (d == std::floor(d) && std::fabs(d) < 1e15) ? "%.0f" : "%.3f", d);
+    e.str = b;
+    o.obj.emplace_back(k, e);
+}
+
 // ---------- helpers for vocab-based API ----------
 static inline const llama_vocab* get_vocab() {
     return llama_model_get_vocab(g_model);
 }
 
-static inline std::vector<llama_token> tok_prompt(const std::string& s, bool add_special, bool parse_special) {
-    const llama_vocab* vocab = get_vocab();
+static std::vector<llama_token> tokenize(const llama_vocab* vocab, const std::string& s,
+                                         bool add_special, bool parse_special) {
     const char*  text = s.c_str();
     const int32_t len = (int32_t)s.size();
 
@@ -75,6 +218,10 @@ static inline std::vector<llama_token> tok_prompt(const std::string& s, bool add
     return out;
 }
 
+static inline std::vector<llama_token> tok_prompt(const std::string& s, bool add_special, bool parse_special) {
+    return tokenize(get_vocab(), s, add_special, parse_special);
+}
+
 static inline llama_token eos_token() {
     return llama_vocab_eos(get_vocab());
 }
@@ -88,108 +235,2454 @@ static inline void append_piece(llama_token tok, std::string& out) {
     if (n > 0) out.append(buf, (size_t)n);
 }
 
-static bool decode_tokens(const llama_token* data, int n, int& n_past) {
-    llama_batch batch = llama_batch_get_one((llama_token*)data, n);
-    if (llama_decode(g_ctx, batch) != 0) return false;
+// ---------- disk caches ----------
+static double now_ms() {
+    using namespace std::chrono;
+    return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+// FNV-1a over path, size and mtime: a replaced model file (e.g. requantized) gets a new key.
+static uint64_t model_key(const std::string& path) {
+    struct stat st{};
+    stat(path.c_str(), &st);
+    const long long parts[2] = { (long long)st.st_size, (long long)st.st_mtime };
+    uint64_t h = 1469598103934665603ull;
+    auto mix = [&](const void* p, size_t n) {
+        for (size_t i = 0; i < n; ++i) { h ^= ((const uint8_t*)p)[i]; h *= 1099511628211ull; }
+    };
+    mix(path.data(), path.size());
+    mix(parts, sizeof(parts));
+    return h;
+}
+
+static std::string cache_path(const char* ext) {
+    std::string dir = g_cache_dir;
+    if (dir.empty()) {
+        const size_t slash = g_model_path.find_last_of('/');
+        dir = slash == std::string::npos ? "." : g_model_path.substr(0, slash);
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "/llm-%016llx", (unsigned long long)g_model_key);
+    return dir + name + ext;
+}
+
+static inline const token_table& tokens() {
+    if (g_tokens.vocab != get_vocab()) {
+        const std::string path = cache_path(".vocab");
+        if (!token_table_load(path, g_model_key, get_vocab(), g_tokens)) {
+            token_table_build(get_vocab(), g_tokens);
+            token_table_save(g_tokens, path, g_model_key);
+        }
+    }
+    return g_tokens;
+}
+
+static const std::vector<llama_token>& tok_prompt_cached(const std::string& s) {
+    if (const auto* hit = g_tok_cache.find(s)) { metric_add(M_TOK_CACHE_HITS); return *hit; }
+    metric_add(M_TOK_CACHE_MISSES);
+    g_tok_cache.put(s, tok_prompt(s, /*add_special*/true, /*parse_special*/true));
+    return g_tok_cache.entries.front().toks;
+}
+
+// ---------- prompt templates ----------
+// The template, tokenized for the model in h.
+static std::shared_ptr<const prompt_template> template_for(int id, const std::shared_ptr<const model_handle>& h) {
+    std::shared_ptr<tmpl_entry> e;
+    {
+        std::lock_guard<std::mutex> lock(g_tmpl_mu);
+        auto it = g_templates.find(id);
+        if (it == g_templates.end()) return nullptr;
+        e = it->second;
+        if (e->t && e->model.lock() == h) return e->t;
+    }
+    auto t = std::make_shared<prompt_template>();
+    std::string err;
+    template_compile(llama_model_get_vocab(h->model), e->text, *t, err);   // parsed at registration
+    std::lock_guard<std::mutex> lock(g_tmpl_mu);
+    e->t     = t;
+    e->model = h;
+    e->priors.clear();
+    return t;
+}
+
+// Prompt tokens of a request: the template named by "template" in paramsJson with its
+// "slots" filled in, else the prompt text; text (may be NULL) gets the text they spell.
+// Engine lock held, model loaded.
+static int request_tokens(const char* prompt, const char* paramsJson, std::vector<llama_token>& toks,
+                          std::string* text = nullptr) {
+    if (!paramsJson || !strstr(paramsJson, "\"template\"")) {
+        toks = tok_prompt_cached(prompt ? prompt : "");
+        if (text) *text = prompt ? prompt : "";
+        return 0;
+    }
+    json_value doc;
+    size_t err_off = 0;
+    if (!json_parse(paramsJson, strlen(paramsJson), doc, &err_off)) return -3;
+    const json_value* id = doc.get("template");
+    if (!id || !id->is(json_value::NUM)) return -3;
+    const auto t = template_for((int)id->num, std::atomic_load(&g_handle));
+    if (!t) { LLOGE("llm_infer: unknown template %d", (int)id->num); return -42; }
+
+    const json_value* slots = doc.get("slots");
+    const slot_lookup value = [slots](const std::string& name) -> const std::string* {
+        const json_value* v = slots ? slots->get(name.c_str()) : nullptr;
+        return v && (v->is(json_value::STR) || v->is(json_value::NUM)) ? &v->str : nullptr;
+    };
+    std::string err;
+    if (!template_render(get_vocab(), *t, value, toks, err) || (text && !template_text(*t, value, *text, err))) {
+        LLOGE("llm_infer: template %d: %s", (int)id->num, err.c_str());
+        return -43;
+    }
+    metric_add(M_TEMPLATE_TOKENS, (int64_t)t->static_tokens);
+    return 0;
+}
+
+// ---------- logprobs over the top-k ----------
+// The softmax is normalised over the k largest logits only (plus the chosen token if
+// it falls outside them): one heap pass over the vocab instead of exp() over all of it.
+struct cand { float logit; llama_token id; };
+
+static void top_k(const float* logits, int n_vocab, int k, std::vector<cand>& out) {
+    auto gt = [](const cand& a, const cand& b) { return a.logit > b.logit; }; // min-heap
+    out.clear();
+    for (int t = 0; t < n_vocab; ++t) {
+        const float v = logits[t];
+        if ((int)out.size() < k) {
+            out.push_back({v, (llama_token)t});
+            std::push_heap(out.begin(), out.end(), gt);
+        } else if (v > out.front().logit) {
+            std::pop_heap(out.begin(), out.end(), gt);
+            out.back() = {v, (llama_token)t};
+            std::push_heap(out.begin(), out.end(), gt);
+        }
+    }
+    std::sort_heap(out.begin(), out.end(), gt); // descending
+}
+
+// Appends one TOKS record: id, [logprob], [top_n x (id, logprob)].
+static void record_token(const float* logits, int n_vocab, llama_token tok, bool with_lp, int top_n,
+                         std::vector<cand>& scratch, std::vector<uint8_t>& out) {
+    auto put = [&](const void* p, size_t n) { out.insert(out.end(), (const uint8_t*)p, (const uint8_t*)p + n); };
+    put(&tok, 4);
+    if (!with_lp) return;
+
+    top_k(logits, n_vocab, std::max(top_n, 40), scratch);
+    const float mx = scratch.empty() ? logits[tok] : std::max(scratch.front().logit, logits[tok]);
+    double sum = 0.0;
+    bool   seen = false;
+    for (const auto& c : scratch) { sum += std::exp((double)(c.logit - mx)); seen |= (c.id == tok); }
+    if (!seen) sum += std::exp((double)(logits[tok] - mx));
+    const float lse = mx + (float)std::log(sum);
+
+    const float lp = logits[tok] - lse;
+    put(&lp, 4);
+    for (int j = 0; j < top_n; ++j) {
+        const cand c = j < (int)scratch.size() ? scratch[j] : cand{-INFINITY, -1};
+        const float l = c.id >= 0 ? c.logit - lse : -INFINITY;
+        put(&c.id, 4);
+        put(&l, 4);
+    }
+}
+
+// ---------- KV sequences ----------
+// Open sessions' sequences. The pointers stay valid while the engine lock is held: a
+// session closed meanwhile moves to g_closed, which only the engine lock empties.
+static void session_seqs(std::vector<kv_seq*>& out) {
+    out.clear();
+    std::lock_guard<std::mutex> lock(g_sess_mu);
+    for (auto& kv : g_sessions) out.push_back(kv.second.get());
+}
+
+// Every sequence with cells in g_ctx, closed ones not yet reaped included.
+static void all_seqs(std::vector<kv_seq*>& out) {
+    session_seqs(out);
+    out.insert(out.begin(), &g_main);
+    std::lock_guard<std::mutex> lock(g_sess_mu);
+    for (auto& sq : g_closed) out.push_back(sq.get());
+}
+
+static void page_discard(kv_seq& s) {
+    g_pager.release(s.page_off, s.page_len);
+    s.page_off = -1;
+    s.page_len = s.page_k = 0;
+}
+
+static void kv_compact_locked() {
+    std::vector<kv_seq*> seqs;
+    all_seqs(seqs);
+    kv_compact(g_ctx, seqs, g_layout, g_kstats.last);
+    ++g_kstats.n;
+    metric_add(M_KV_COMPACTIONS);
+}
+
+// n_batch-sized chunks at positions n_past.., logits for the last token only.
+static int decode_chunks(kv_seq& s, const llama_token* data, int n, int n_past) {
+    const int cap = (int)llama_n_batch(g_ctx);
+    for (int off = 0; off < n; off += cap) {
+        const int m = std::min(cap, n - off);
+        g_batch.n_tokens = m;
+        for (int i = 0; i < m; ++i) {
+            g_batch.token[i]     = data[off + i];
+            g_batch.pos[i]       = (llama_pos)(n_past + off + i);
+            g_batch.n_seq_id[i]  = 1;
+            g_batch.seq_id[i][0] = s.id;
+            g_batch.logits[i]    = off + i == n - 1;
+        }
+        if (const int rc = llama_decode(g_ctx, g_batch)) return rc;
+        s.tokens.insert(s.tokens.end(), data + off, data + off + m);
+        g_layout.on_decode((size_t)m);
+    }
+    return 0;
+}
+
+static bool evict_one(const kv_seq* keep);
+
+static bool decode_tokens(kv_seq& s, const llama_token* data, int n, int& n_past) {
+    const size_t before = s.tokens.size();
+    int rc = decode_chunks(s, data, n, n_past);
+    if (rc == 1 && g_layout.live() > 0) {
+        // no free KV slot: spill an idle session if paging is on, pack the cache and try
+        // the rest once more
+        LLOGW("llama: KV cache full at %.0f%% fragmentation; compacting", g_layout.fragmentation() * 100);
+        evict_one(&s);
+        kv_compact_locked();
+        if (s.tokens.size() >= before) {
+            const int done = (int)(s.tokens.size() - before);
+            llama_memory_seq_rm(llama_get_memory(g_ctx), s.id, (llama_pos)(n_past + done), -1);
+            rc = decode_chunks(s, data + done, n - done, n_past + done);
+        }
+    }
+    if (rc != 0 || s.tokens.size() != before + (size_t)n) {
+        // partial batches may have landed; this sequence starts from scratch next time
+        kv_trim(g_ctx, s, 0, g_layout);
+        return false;
+    }
     n_past += n;
     return true;
 }
 
-// ---------- API (C symbols) ----------
-LLM_EXTERN_C LLM_EXPORT_ATTR
-int llm_init(const char* modelPath, int n_ctx, int n_gpu_layers, int n_threads, int /*seed*/) {
-    std::lock_guard<std::mutex> lock(g_mutex);
-    if (g_ctx) { LLOGW("llm_init: already initialized"); return 0; }
-    if (!modelPath || !*modelPath) { LLOGE("llm_init: invalid modelPath"); return -3; }
+// Keeps the longest KV prefix of `s` shared with `toks`, drops the rest and returns its
+// length. One prompt token is always left to decode so there are fresh logits to sample from.
+static int reuse_prefix(kv_seq& s, const std::vector<llama_token>& toks) {
+    size_t keep = 0;
+    while (keep < s.tokens.size() && keep < toks.size() && s.tokens[keep] == toks[keep]) ++keep;
+    if (keep == toks.size() && keep > 0) --keep;
 
-    llama_backend_init();
+    kv_trim(g_ctx, s, keep, g_layout);
+    g_rstats.reused_tokens += s.tokens.size();
+    return (int)s.tokens.size();
+}
+
+// ---------- KV paging ----------
+// Longest token prefix `s` shares with a resident sequence other than itself.
+static size_t resident_prefix(const kv_seq& s, size_t max_k, const kv_seq** base) {
+    std::vector<kv_seq*> seqs;
+    all_seqs(seqs);
+    size_t best = 0;
+    *base = nullptr;
+    for (const kv_seq* r : seqs) {
+        if (r == &s || r->paged()) continue;
+        size_t k = 0;
+        const size_t lim = std::min({max_k, r->tokens.size(), s.tokens.size()});
+        while (k < lim && r->tokens[k] == s.tokens[k]) ++k;
+        if (k > best) { best = k; *base = r; }
+    }
+    return best;
+}
+
+// Moves the cells of `s` to the page file. A prefix held by another resident sequence
+// stays out of the file; it is re-shared from there on page-in.
+static bool page_out(kv_seq& s) {
+    if (!g_pager.is_open() || s.paged() || s.tokens.empty()) return false;
+    const double t0 = now_ms();
+    const kv_seq* base = nullptr;
+    const size_t  k    = resident_prefix(s, s.tokens.size(), &base);
+
+    llama_memory_t mem = llama_get_memory(g_ctx);
+    if (k > 0) llama_memory_seq_rm(mem, s.id, 0, (llama_pos)k);
+    const size_t  need = llama_state_seq_get_size(g_ctx, s.id);
+    const int64_t off  = g_pager.alloc(need);
+    const size_t  n    = off >= 0 ? llama_state_seq_get_data(g_ctx, g_pager.at(off), need, s.id) : 0;
+
+    std::vector<llama_token> toks = s.tokens;
+    const size_t plen = s.prompt_len;
+    kv_trim(g_ctx, s, 0, g_layout);
+    if (n == 0) {
+        g_pager.release(off, need);
+        ++g_pstats.dropped;
+        metric_add(M_KV_DROPS);
+        return false;
+    }
+    s.tokens.swap(toks);
+    s.prompt_len = plen;
+    s.page_off   = off;
+    s.page_len   = n;
+    s.page_k     = k;
+    ++g_pstats.outs;
+    metric_add(M_KV_PAGE_OUTS);
+    g_pstats.bytes_out += (double)n;
+    g_pstats.ms_out    += now_ms() - t0;
+    return true;
+}
+
+// Pages out the least recently used resident session other than `keep`.
+static bool evict_one(const kv_seq* keep) {
+    std::vector<kv_seq*> seqs;
+    session_seqs(seqs);
+    kv_seq* lru = nullptr;
+    for (kv_seq* q : seqs) {
+        if (q == keep || q->paged() || q->tokens.empty()) continue;
+        if (!lru || q->last_use < lru->last_use) lru = q;
+    }
+    return lru && page_out(*lru);
+}
+
+// Makes room for `extra` more cells within the resident budget.
+static void enforce_budget(const kv_seq* keep, size_t extra) {
+    if (!g_pager.is_open()) return;
+    const size_t limit = g_resident_max ? g_resident_max : (size_t)g_n_ctx;
+    while (g_layout.live() + extra > limit && evict_one(keep)) {}
+}
+
+// Brings `s` back into the cache. If the prefix it relied on is no longer resident, or
+// the state does not fit, it is dropped and its prompt simply decodes again.
+static void page_in(kv_seq& s) {
+    if (!s.paged()) return;
+    const double t0 = now_ms();
+    enforce_budget(&s, s.tokens.size());   // before looking for the base: it may be evicted
+    const kv_seq* base = nullptr;
+    const size_t  k    = s.page_k ? resident_prefix(s, s.page_k, &base) : 0;
+
+    bool ok = k == s.page_k &&
+              llama_state_seq_set_data(g_ctx, g_pager.at(s.page_off), s.page_len, s.id) != 0;
+    if (ok && k > 0) llama_memory_seq_cp(llama_get_memory(g_ctx), base->id, s.id, 0, (llama_pos)k);
+    const size_t len = s.page_len;
+    page_discard(s);
+    if (!ok) {
+        llama_memory_seq_rm(llama_get_memory(g_ctx), s.id, -1, -1);
+        s.tokens.clear();
+        s.prompt_len = 0;
+        s.shared     = 0;
+        ++g_pstats.dropped;
+        metric_add(M_KV_DROPS);
+        return;
+    }
+    s.shared = k;
+    g_layout.on_decode(s.tokens.size() - k);
+    ++g_pstats.ins;
+    g_pstats.bytes_in += (double)len;
+    g_pstats.ms_in += now_ms() - t0;
+}
+
+// ---------- engine lock / stats snapshot ----------
+// What llm_stats reports, copied out each time the engine lock is released so that
+// reading it never waits for a generation.
+struct engine_stats {
+    const char*          state = "none";
+    bool                 inited = false, prewarmed = false;
+    int                  idle_timeout_s = 0;
+    decltype(g_rstats)   r;
+    decltype(g_pstats)   p;
+    uint64_t             compactions = 0;
+    kv_compact_report    last_compact;
+    size_t               kv_tokens = 0, page_file = 0;
+    int                  sessions = 0, paged = 0;
+    double               frag = 0;
+    ctx_pool::stats      pool;
+};
+static std::mutex   g_snap_mu;
+static engine_stats g_snap;
+
+static void publish_stats() {
+    engine_stats st;
+    st.state          = !g_inited ? "none" : g_ctx ? "ready" : g_model ? "ctx_unloaded" : "unloaded";
+    st.inited         = g_inited;
+    st.prewarmed      = g_prewarmed;
+    st.idle_timeout_s = g_idle_s;
+    st.r              = g_rstats;
+    st.p              = g_pstats;
+    st.compactions    = g_kstats.n;
+    st.last_compact   = g_kstats.last;
+    st.kv_tokens      = g_main.tokens.size();
+    st.page_file      = g_pager.file_bytes();
+    st.frag           = g_layout.fragmentation();
+    st.pool           = g_pool.get_stats();
+    std::vector<kv_seq*> seqs;
+    session_seqs(seqs);
+    st.sessions = (int)seqs.size();
+    for (const kv_seq* sq : seqs) st.paged += sq->paged();
 
+    std::lock_guard<std::mutex> lock(g_snap_mu);
+    g_snap = st;
+}
+
+// Frees the cells of sessions closed since the engine lock was last taken. They leave
+// g_closed only afterwards, so their sequence ids are not handed out while still in use.
+static void reap_closed() {
+    std::vector<std::shared_ptr<kv_seq>> dead;
+    {
+        std::lock_guard<std::mutex> lock(g_sess_mu);
+        if (g_closed.empty()) return;
+        dead = g_closed;
+    }
+    for (auto& sq : dead) {
+        if (sq->paged()) page_discard(*sq);
+        else if (g_ctx) kv_trim(g_ctx, *sq, 0, g_layout);
+    }
+    std::lock_guard<std::mutex> lock(g_sess_mu);
+    g_closed.erase(g_closed.begin(), g_closed.begin() + (ptrdiff_t)dead.size());
+}
+
+// g_mutex for the scope. Everything that decodes or changes what the engine holds
+// goes through this.
+struct engine_lock {
+    std::unique_lock<std::mutex> lock;
+    engine_lock() : lock(g_mutex) { reap_closed(); }
+    ~engine_lock() { publish_stats(); }
+};
+
+// ---------- residency: idle unload / reload ----------
+// After g_idle_s seconds without a request the context (with g_idle_model also the model)
+// is freed. What makes the next request cheap stays on disk, tagged with g_model_key:
+// the piece table, recent prompt tokenizations and the KV state of the last prompt, which
+// is usually the system prompt every request starts with. The model itself is mmapped,
+// so its pages mostly survive in the page cache and remapping is quick.
+static constexpr size_t kMaxSavedPrefix = 1024;
+
+static void describe_model(const llama_model* m, const char* path, std::string& out);
+
+static bool load_model() {
     llama_model_params mparams = llama_model_default_params();
-    mparams.n_gpu_layers = n_gpu_layers;
+    mparams.n_gpu_layers = g_gpu_layers;
     mparams.use_mmap     = true;
     mparams.use_mlock    = false;
 
-    g_model = llama_model_load_from_file(modelPath, mparams);
-    if (!g_model) {
-        LLOGE("llm_init: failed to load model: %s", modelPath);
-        return -1;
-    }
+    g_model = llama_model_load_from_file(g_model_path.c_str(), mparams);
+    if (!g_model) return false;
+
+    auto h = std::make_shared<model_handle>();
+    h->model     = g_model;
+    h->n_threads = g_threads;
+    std::atomic_store(&g_handle, std::shared_ptr<const model_handle>(h));
+    auto meta = std::make_shared<model_meta>();
+    meta->path = g_model_path;
+    describe_model(g_model, g_model_path.c_str(), meta->info);
+    if (const char* t = llama_model_chat_template(g_model, nullptr)) meta->chat_tmpl = t;
+    std::atomic_store(&g_meta, std::shared_ptr<const model_meta>(meta));
+
+    g_model_key = model_key(g_model_path);
+    tok_cache_load(cache_path(".toks"), g_model_key, g_tok_cache);
+    return true;
+}
 
+static bool create_context() {
     llama_context_params cparams = llama_context_default_params();
-    cparams.n_ctx     = (n_ctx > 0) ? n_ctx : 2048;
-    cparams.n_batch   = 256;
-    cparams.n_threads = (n_threads > 0) ? n_threads : 4;
-    g_threads         = cparams.n_threads;
+    cparams.n_batch         = 256;
+    cparams.n_threads       = g_threads;
+    cparams.n_threads_batch = g_threads;
+    cparams.n_seq_max       = kMaxSeq;
+    cparams.kv_unified      = true;   // sessions share cells (forks) and the whole n_ctx
+    g_pool.set_params(cparams);
+
+    g_ctx = g_pool.acquire(g_model, g_n_ctx);
+    if (!g_ctx) return false;
+    if (!g_batch.token) g_batch = llama_batch_init((int32_t)cparams.n_batch, 0, kMaxSeq);
+
+    // saved prompt prefix, if this model left one behind
+    std::vector<llama_token> saved(kMaxSavedPrefix);
+    size_t n = 0;
+    const std::string path = cache_path(".prefix");
+    if (!llama_state_seq_load_file(g_ctx, path.c_str(), 0, saved.data(), saved.size(), &n)) {
+        llama_memory_clear(llama_get_memory(g_ctx), true);
+        n = 0;
+    }
+    saved.resize(n);
+    g_main.tokens.swap(saved);
+    g_main.prompt_len = n;
+    g_layout.reset(n);
+    g_rstats.restored_tokens = n;
+    return true;
+}
+
+// Drops the engine's reference to the model; it is freed once no reader holds the handle.
+// Contexts made from it must be gone by then.
+static void release_model() {
+    g_model = nullptr;
+    std::atomic_store(&g_handle, std::shared_ptr<const model_handle>());
+}
+
+// Persists the prompt part of seq 0 (generated tokens are dropped first).
+static void save_prefix() {
+    const std::string path = cache_path(".prefix");
+    const size_t n = std::min({g_main.prompt_len, g_main.tokens.size(), kMaxSavedPrefix});
+    if (n == 0 || !llama_memory_seq_rm(llama_get_memory(g_ctx), 0, (llama_pos)n, -1) ||
+        !llama_state_seq_save_file(g_ctx, path.c_str(), 0, g_main.tokens.data(), n)) {
+        remove(path.c_str());
+    }
+}
+
+// Hands g_ctx back to the pool (cleared) after persisting its prompt prefix. Sessions
+// stay open: with paging on they go to the page file (state is not tied to a context),
+// otherwise their next request decodes its prompt again.
+static void detach_context() {
+    if (!g_ctx) return;
+    std::vector<kv_seq*> seqs;
+    session_seqs(seqs);
+    for (kv_seq* sq : seqs) page_out(*sq);
+    save_prefix();
+    g_pool.release(g_model, g_ctx);
+    g_ctx = nullptr;
+    all_seqs(seqs);
+    for (kv_seq* sq : seqs) {
+        if (sq->paged()) continue;
+        sq->tokens.clear(); sq->prompt_len = 0; sq->shared = 0;
+    }
+    g_layout.reset(0);
+}
+
+// Standby contexts are created one at a time, each under g_mutex, so a request arriving
+// meanwhile waits for at most one context creation.
+static void pool_fill_run() {
+    for (;;) {
+        engine_lock lock;
+        if (g_pool_stop || !g_inited || !g_model || !g_pool.fill_one(g_model)) {
+            g_pool_filling = false;
+            return;
+        }
+    }
+}
+
+// caller holds g_mutex
+static void pool_fill_async() {
+    if (g_pool_filling || g_pool_stop || !g_model) return;
+    // a filler that cleared g_pool_filling has let go of g_mutex and is returning
+    if (g_pool_thread.joinable()) g_pool_thread.join();
+    g_pool_filling = true;
+    g_pool_thread  = std::thread(pool_fill_run);
+}
+
+static void free_emb_ctx() {
+    std::lock_guard<std::mutex> lock(g_emb_mu);
+    if (g_emb_ctx) { llama_free(g_emb_ctx); g_emb_ctx = nullptr; }
+    g_emb_model.reset();
+}
+
+static void unload_locked(bool model) {
+    const double t0 = now_ms();
+    free_emb_ctx();
+    detach_context();
+    g_pool.clear();   // going idle is about giving the memory back
+    if (model && g_model) {
+        tok_cache_save(g_tok_cache, cache_path(".toks"), g_model_key);
+        g_tok_cache.entries.clear();
+        grammar_reset_masks();
+        g_tokens = token_table();
+        release_model();
+    }
+    g_rstats.unload_ms = now_ms() - t0;
+    ++g_rstats.n_unloads;
+    metric_add(M_UNLOADS);
+    LLOGI("llm: unloaded %s in %.1f ms", model ? "model+ctx" : "ctx", g_rstats.unload_ms);
+}
+
+// Brings back whatever the idle timer freed. 0, or the llm_init error codes.
+static int ensure_loaded() {
+    if (g_ctx) return 0;
+    if (!g_inited) return -10;
+    const double t0 = now_ms();
+    if (!g_model && !load_model()) { LLOGE("llm: reload of %s failed", g_model_path.c_str()); return -1; }
+    if (!create_context()) { LLOGE("llm: context re-creation failed"); return -2; }
+    g_rstats.reload_ms = now_ms() - t0;
+    ++g_rstats.n_reloads;
+    pool_fill_async();
+    LLOGI("llm: reloaded in %.1f ms (cold %.1f ms), prefix %zu tokens",
+          g_rstats.reload_ms, g_rstats.cold_ms, g_rstats.restored_tokens);
+    return 0;
+}
+
+static void on_idle() {
+    engine_lock lock;
+    if (g_idle.idle_seconds() < g_idle_s) return;   // a request ran while we waited for the lock
+    if (!g_ctx && !(g_idle_model && g_model)) return;
+    unload_locked(g_idle_model);
+}
+
+// Marks the engine busy for the scope: the idle countdown restarts when it ends.
+struct idle_activity {
+    idle_activity()  { g_idle.touch(); }
+    ~idle_activity() { g_idle.touch(); }
+};
+
+// ---------- side buffer writer (layout documented in llm_bridge.h) ----------
+struct side_writer {
+    static constexpr int kHeader = 16;
+
+    uint8_t* buf;
+    int      cap;
+    int      used   = 0;
+    uint16_t count  = 0;
+    uint32_t flags  = 0;
 
-    g_ctx = llama_init_from_model(g_model, cparams);
-    if (!g_ctx) {
+    side_writer(uint8_t* b, int c) : buf(b), cap((b && c >= kHeader) ? c : 0) { used = cap ? kHeader : 0; }
+
+    bool enabled() const { return cap > 0; }
+    bool fits(size_t n) const { return enabled() && (size_t)(cap - used) >= 8 + n; }
+
+    void put(const void* p, size_t n) { memcpy(buf + used, p, n); used += (int)n; }
+
+    // one section from up to a few contiguous parts; skipped (and flagged) when it does not fit
+    bool section(uint32_t tag, std::initializer_list<std::pair<const void*, size_t>> parts) {
+        size_t total = 0;
+        for (const auto& pt : parts) total += pt.second;
+        if (!fits(total)) { if (enabled()) flags |= LLM_SIDE_TRUNCATED; return false; }
+        const uint32_t sz = (uint32_t)total;
+        put(&tag, 4);
+        put(&sz, 4);
+        for (const auto& pt : parts) if (pt.second) put(pt.first, pt.second);
+        ++count;
+        return true;
+    }
+
+    void finish() {
+        if (!enabled()) return;
+        const uint32_t magic = LLM_SIDE_MAGIC, u = (uint32_t)used;
+        const uint16_t ver = LLM_SIDE_VERSION;
+        memcpy(buf + 0,  &magic, 4);
+        memcpy(buf + 4,  &ver,   2);
+        memcpy(buf + 6,  &count, 2);
+        memcpy(buf + 8,  &u,     4);
+        memcpy(buf + 12, &flags, 4);
+    }
+};
+
+// Loads model + context into the globals; caller holds g_mutex and g_inited is false.
+static int init_locked(const char* modelPath, int n_ctx, int n_gpu_layers, int n_threads) {
+    log_install();   // model load is where field logs matter most
+    llama_backend_init();
+
+    g_model_path = modelPath;
+    g_n_ctx      = (n_ctx > 0) ? n_ctx : 2048;
+    g_gpu_layers = n_gpu_layers;
+    g_threads    = (n_threads > 0) ? n_threads : 4;
+
+    const double t0 = now_ms();
+    if (!load_model()) {
+        LLOGE("llm_init: failed to load model: %s", modelPath);
+        return -1;
+    }
+    if (!create_context()) {
         LLOGE("llm_init: failed to create context");
-        llama_model_free(g_model); g_model = nullptr;
+        release_model();
+        std::atomic_store(&g_meta, std::shared_ptr<const model_meta>());
         return -2;
     }
+    g_inited         = true;
+    g_rstats.cold_ms = now_ms() - t0;
+    pool_fill_async();
+
+    LLOGI("llm_init: ok (ctx=%d, gpu_layers=%d, threads=%d, %.1f ms)", g_n_ctx, n_gpu_layers, g_threads, g_rstats.cold_ms);
+    return 0;
+}
+
+// ---------- prewarm ----------
+// A host (e.g. the Linux runner) may start the load before Dart asks for it. The prewarm
+// thread does a regular init under g_mutex; llm_init then adopts the result instead of
+// loading again, or blocks on g_mutex until the prewarm is done. The thread stays
+// joinable: a prewarm outliving llm_dispose would load a model nobody frees.
+
+static void prewarm_run(std::string path, int n_ctx, int n_gpu_layers, int n_threads) {
+    // ask the kernel to start pulling the file into the page cache; mmap then mostly hits
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+
+    engine_lock lock;
+    if (g_inited || g_prewarm_stop) return;      // llm_init got there first, or llm_dispose
+    if (init_locked(path.c_str(), n_ctx, n_gpu_layers, n_threads) == 0) {
+        g_prewarmed = true;
+        LLOGI("llm_prewarm: ready in %.1f ms", g_rstats.cold_ms);
+    }
+}
 
-    LLOGI("llm_init: ok (ctx=%d, gpu_layers=%d, threads=%d)", cparams.n_ctx, n_gpu_layers, g_threads);
+// ---------- API (C symbols) ----------
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_prewarm(const char* modelPath, int n_ctx, int n_gpu_layers, int n_threads) {
+    if (!modelPath || !*modelPath) return -3;
+    if (access(modelPath, R_OK) != 0) { LLOGW("llm_prewarm: %s not readable", modelPath); return -1; }
+    std::thread prev;
+    {
+        engine_lock lock;
+        prev = std::move(g_prewarm_thread);
+    }
+    if (prev.joinable()) prev.join();   // it may be waiting for g_mutex
+    engine_lock lock;
+    if (g_prewarm_thread.joinable()) return 0;   // another llm_prewarm got in meanwhile
+    g_prewarm_thread = std::thread(prewarm_run, std::string(modelPath), n_ctx, n_gpu_layers, n_threads);
     return 0;
 }
 
 LLM_EXTERN_C LLM_EXPORT_ATTR
-int llm_infer(const char* prompt, const char* paramsJson, char* outBuf, int outBufSize) {
-    std::lock_guard<std::mutex> lock(g_mutex);
-    if (!g_ctx) { LLOGE("llm_infer: ctx not init"); return -10; }
-    if (!outBuf || outBufSize <= 1) { LLOGE("llm_infer: bad outBuf"); return -30; }
+int llm_init(const char* modelPath, int n_ctx, int n_gpu_layers, int n_threads, int /*seed*/) {
+    engine_lock lock;
+    idle_activity busy;
+    if (!modelPath || !*modelPath) { LLOGE("llm_init: invalid modelPath"); return -3; }
 
-    const int   max_tokens = paramsJson ? jgeti(paramsJson, "max_tokens", 128) : 128;
-    std::string p = prompt ? prompt : "";
+    if (g_inited && g_prewarmed) {
+        g_prewarmed = false;
+        // it set g_prewarmed under g_mutex and has let go of it since: only returning is left
+        if (g_prewarm_thread.joinable()) g_prewarm_thread.join();
+        if (g_model_path != modelPath || g_gpu_layers != n_gpu_layers) {
+            LLOGW("llm_init: prewarmed %s does not match; reloading", g_model_path.c_str());
+            unload_locked(true);
+            g_inited = false;
+        } else {
+            const int want_ctx     = (n_ctx > 0) ? n_ctx : 2048;
+            const int want_threads = (n_threads > 0) ? n_threads : 4;
+            if (g_ctx && (want_ctx != g_n_ctx || want_threads != g_threads)) {
+                // same weights, different context shape: swap in another (pooled) context
+                detach_context();
+            }
+            g_n_ctx   = want_ctx;
+            g_threads = want_threads;
+            if (const int rc = ensure_loaded()) return rc;
+            LLOGI("llm_init: adopted prewarmed model (%.1f ms load was off the critical path)", g_rstats.cold_ms);
+            return 0;
+        }
+    }
+    if (g_inited) { LLOGW("llm_init: already initialized"); return 0; }
 
-    std::vector<llama_token> toks = tok_prompt(p, /*add_special*/true, /*parse_special*/true);
-    int n_past = 0;
-    if (!toks.empty()) {
-        if (!decode_tokens(toks.data(), (int)toks.size(), n_past)) {
+    return init_locked(modelPath, n_ctx, n_gpu_layers, n_threads);
+}
+
+// ---------- generation ----------
+// Length of the longest prefix of s[from..end) that does not end inside a UTF-8 sequence.
+static size_t utf8_complete(const std::string& s, size_t from, size_t end) {
+    for (size_t k = 1; k <= 3 && k <= end - from; ++k) {
+        const uint8_t c = (uint8_t)s[end - k];
+        if ((c & 0xC0) != 0x80) {                       // lead byte found k back
+            const size_t need = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+            return need > k ? end - k - from : end - from;
+        }
+    }
+    return end - from;
+}
+
+struct gen_output {
+    std::string  text;
+    side_writer* side      = nullptr;
+    size_t       max_bytes = (size_t)-1;
+    llm_piece_cb cb        = nullptr;   // streaming: complete UTF-8 only, in order
+    void*        user      = nullptr;
+    const std::atomic<bool>* cancel = nullptr;   // stops the generation before its next token
+    int          n_prompt  = 0;
+    int          n_gen     = 0;
+    double       t0        = now_ms();  // request start, for time to first token
+};
+
+// Brings the prompt into sq: keeps the KV prefix they share and decodes the rest, with
+// room for `extra` more tokens. The last prompt token's logits are then current.
+static int prefill(kv_seq& sq, const std::vector<llama_token>& toks, size_t extra) {
+    sq.last_use = ++g_use_tick;
+    page_in(sq);
+    enforce_budget(&sq, toks.size() + extra);
+    int n_past = toks.empty() ? 0 : reuse_prefix(sq, toks);
+    if (g_compact_thold > 0 && g_layout.fragmentation() > g_compact_thold) {
+        kv_compact_locked();
+        n_past = (int)sq.tokens.size();   // 0 if it did not fit back
+    }
+    const int reused = n_past;
+    if (n_past < (int)toks.size()) {
+        if (!decode_tokens(sq, toks.data() + n_past, (int)toks.size() - n_past, n_past)) {
             LLOGE("llama: decode(prompt) failed");
             return -20;
         }
     }
+    sq.prompt_len = toks.size();
+    metric_add(M_PROMPT_TOKENS, (int64_t)toks.size());
+    metric_add(M_PREFIX_TOKENS, reused);
+    return 0;
+}
+
+// One generation: every token it picks goes through the same stages, in order — limits,
+// token records, text, JSON check, stop strings, sink. gen_run is the coroutine around
+// them; a gen_scheduler steps one (llm_infer_ex, llm_infer_stream) or many side by side
+// (llm_infer_batch), and only the scheduler's decode callback differs.
+struct gen_pipe {
+    grammar_cursor gc;                          // empty: greedy
+    int            max_tokens = 128;
+    size_t         max_bytes  = (size_t)-1;
+    bool           json_check = false;
+    bool           json_stop  = false;         // also stop at the first syntax error
+    json_stream    js;
+    stop_matcher   stops;
+    llm_piece_cb   cb   = nullptr;             // never sees a possible start of a stop string
+    void*          user = nullptr;
+
+    bool                 records = false;      // TOKS side records
+    bool                 with_lp = false;
+    int                  top_n   = 0;
+    std::vector<uint8_t> tok_records;          // TOKS payload after its header
+    std::vector<cand>    lp_scratch;
+    uint32_t             n_recorded = 0;
 
-    std::string result;
-    result.reserve(4096);
+    std::string    text;
+    size_t         emitted = 0;                // bytes already passed to cb
+    int            n_gen   = 0;
+    bool           ended   = false;            // finished by a stage, not cancelled or failed
+    double         t_last  = now_ms();         // last token; before the first, the request start
+};
 
-    for (int i = 0; i < max_tokens; ++i) {
-        const float* logits = llama_get_logits(g_ctx);
-        const int n_vocab   = vocab_size();
+// Options common to single and batched requests.
+static int gen_params(const char* paramsJson, gen_pipe& g) {
+    if (!paramsJson) return 0;
+    g.max_tokens = jgeti(paramsJson, "max_tokens", 128);
+    g.json_check = jgeti(paramsJson, "json", 0) != 0;
+    g.json_stop  = jgeti(paramsJson, "json_stop_on_error", 0) != 0;
+    const int grammar_id = jgeti(paramsJson, "grammar", 0);
+    if (grammar_id > 0 && !grammar_begin(grammar_id, g.gc)) {
+        LLOGE("llm_infer: unknown grammar %d", grammar_id);
+        return -31;
+    }
+    if (strstr(paramsJson, "\"stop\"")) {
+        json_value doc;
+        size_t err_off = 0;
+        if (!json_parse(paramsJson, strlen(paramsJson), doc, &err_off)) return -3;
+        if (const json_value* st = doc.get("stop")) {
+            if (st->is(json_value::STR) && !st->str.empty()) g.stops.words.push_back(st->str);
+            for (const auto& w : st->arr) if (w.is(json_value::STR) && !w.str.empty()) g.stops.words.push_back(w.str);
+        }
+    }
+    return 0;
+}
 
+// Next token, or -1 when the generation is over (EOS, grammar closed or stuck).
+static llama_token gen_pick(gen_pipe& g, const float* logits) {
+    llama_token tok;
+    if (g.gc) {
+        // document closed: nothing left to sample
+        if (grammar_done(g.gc)) return -1;
+        tok = grammar_pick(g.gc, logits, tokens(), eos_token());
+        if (tok == -1) { LLOGW("llm_infer: grammar dead end"); return -1; }
+    } else {
+        const int n_vocab = vocab_size();
         int best_id = 0; float best_v = -1e30f;
         for (int t = 0; t < n_vocab; ++t) {
             float v = logits[t];
             if (v > best_v) { best_v = v; best_id = t; }
         }
+        tok = (llama_token)best_id;
+    }
+    return tok == eos_token() ? -1 : tok;
+}
+
+// The stages after the pick. False when tok is the generation's last token.
+static bool gen_accept(gen_pipe& g, llama_token tok, const float* logits) {
+    ++g.n_gen;
+    const double t_tok = now_ms();
+    metric_observe(g.n_gen == 1 ? H_TTFT : H_TOKEN, t_tok - g.t_last);
+    g.t_last = t_tok;
+
+    if (g.records) {
+        record_token(logits, vocab_size(), tok, g.with_lp, g.top_n, g.lp_scratch, g.tok_records);
+        ++g.n_recorded;
+    }
+
+    std::string& text = g.text;
+    const size_t before = text.size();
+    append_piece(tok, text);
+    bool stop = false;
+    if (g.json_check) {
+        // validate as pieces arrive; stop at the end of the value. A bad byte (a preamble,
+        // a code fence) only marks the output invalid unless json_stop_on_error is set.
+        const auto st = g.js.feed(text.data() + before, text.size() - before);
+        if (st == json_stream::DONE) { text.resize(g.js.offset()); stop = true; }
+        if (st == json_stream::ERROR && g.json_stop) stop = true;
+    }
+    size_t safe = text.size();
+    if (!g.stops.empty()) {
+        const size_t at = g.stops.find(text, before);
+        if (at != std::string::npos) { text.resize(at); safe = at; stop = true; }
+        else safe -= g.stops.hold(text);
+    }
+    if (g.cb && safe > g.emitted) {
+        const size_t n = utf8_complete(text, g.emitted, safe);
+        if (n && g.cb(text.data() + g.emitted, (int)n, g.user) != 0) stop = true;
+        g.emitted += n;
+    }
+    return !stop && text.size() < g.max_bytes && g.n_gen < g.max_tokens;
+}
+
+// After the last token: whatever the sink has not had yet (a held-back partial stop
+// string that never completed, the end of a cut UTF-8 sequence).
+static void gen_flush(gen_pipe& g) {
+    if (g.cb && g.emitted < g.text.size()) g.cb(g.text.data() + g.emitted, (int)(g.text.size() - g.emitted), g.user);
+    g.emitted = g.text.size();
+}
+
+// Starts from the logits in s; each co_await hands the picked token to the scheduler.
+static gen_task gen_run(gen_slot& s, gen_pipe& g) {
+    const float* logits = s.logits;
+    while (g.n_gen < g.max_tokens) {
+        const llama_token tok = gen_pick(g, logits);
+        if (tok < 0 || !gen_accept(g, tok, logits)) break;
+        logits = co_await gen_step{s, tok};
+        if (!logits) co_return;
+    }
+    g.ended = true;
+}
+
+// One request's generation, on seq 0 or its session's sequence. Caller holds g_mutex and
+// has called ensure_loaded().
+static int generate(const char* prompt, const char* paramsJson, gen_output& out) {
+    const int   json_indent = paramsJson ? jgeti(paramsJson, "json_indent", 0) : 0;
+    const int   top_n       = paramsJson ? std::max(0, std::min(20, jgeti(paramsJson, "top_logprobs", 0))) : 0;
+    const bool  with_lp     = top_n > 0 || (paramsJson && jgeti(paramsJson, "logprobs", 0) != 0);
+    const bool  with_ids    = with_lp || (paramsJson && jgeti(paramsJson, "output_ids", 0) != 0);
+    const int   session     = paramsJson ? jgeti(paramsJson, "session", 0) : 0;
+    std::string p = prompt ? prompt : "";
+
+    kv_seq* sq = &g_main;
+    std::shared_ptr<kv_seq> held;      // a close meanwhile only queues it for reaping
+    if (session != 0) {
+        std::lock_guard<std::mutex> lock(g_sess_mu);
+        auto it = g_sessions.find(session);
+        if (it == g_sessions.end()) { LLOGE("llm_infer: unknown session %d", session); return -41; }
+        held = it->second;
+        sq   = held.get();
+    }
+
+    side_writer& side = *out.side;
+    gen_pipe g;
+    if (const int rc = gen_params(paramsJson, g)) return rc;
+    g.js        = json_stream(side.enabled());
+    g.max_bytes = out.max_bytes;
+    g.cb        = out.cb;
+    g.user      = out.user;
+    g.records   = with_ids && side.enabled();
+    g.with_lp   = with_lp;
+    g.top_n     = top_n;
+    g.t_last    = out.t0;
+    g.text.reserve(4096);
+
+    std::vector<llama_token> toks;
+    if (const int rc = request_tokens(p.c_str(), paramsJson, toks)) return rc;
+    if (const int rc = prefill(*sq, toks, (size_t)std::max(0, g.max_tokens))) return rc;
+    int n_past = (int)sq->tokens.size();
+    out.n_prompt = (int)toks.size();
+
+    gen_slot slot;
+    slot.seq    = sq->id;
+    slot.logits = llama_get_logits(g_ctx);
+    slot.cancel = out.cancel;
+    gen_scheduler sched;
+    sched.add(gen_run(slot, g), slot);
+    sched.run([&](std::vector<gen_slot*>& slots) {
+        gen_slot& s = *slots[0];
+        if (decode_tokens(*sq, &s.pending, 1, n_past)) s.logits = llama_get_logits(g_ctx);
+        else LLOGW("llama: decode(step) failed; stop");
+    });
+    gen_flush(g);
+    out.n_gen = g.n_gen;
+    std::string& result = out.text;
+    result.swap(g.text);
+
+    if (g.json_check) {
+        const auto st = g.js.finish();
+        if (st == json_stream::DONE && json_indent > 0) {
+            std::string pretty;
+            pretty.reserve(result.size() * 2);
+            json_reindent(result.data(), result.size(), json_indent, pretty);
+            result.swap(pretty);
+        }
+        const int32_t head[2] = {
+            st == json_stream::DONE ? 0 : (g.js.offset() >= result.size() ? 1 : 2),
+            (int32_t)g.js.offset(),
+        };
+        if (!side.section(LLM_SIDE_JSON, {{head, sizeof(head)}, {g.js.tree().data(), g.js.tree().size()}})) {
+            side.section(LLM_SIDE_JSON, {{head, sizeof(head)}}); // status without the tree
+        }
+    }
+    if (with_ids) {
+        const uint32_t head[2] = { g.n_recorded, (uint32_t)top_n | (with_lp ? (LLM_TOK_LOGPROB << 16) : 0u) };
+        side.section(LLM_SIDE_TOKENS, {{head, sizeof(head)}, {g.tok_records.data(), g.tok_records.size()}});
+    }
+    side.finish();
+    metric_add(M_GEN_TOKENS, out.n_gen);
+    return 0;
+}
+
+// ---------- request coalescing ----------
+// Sampling is greedy, so identical requests give identical output. A duplicate that comes
+// in while the first one is still queued or running follows it instead of decoding again
+// (see llm_coalesce.h). "coalesce": 0 in paramsJson opts out.
+static flight_table g_flights;
+
+static bool coalescable(const char* paramsJson) {
+    return !paramsJson || jgeti(paramsJson, "coalesce", 1) != 0;
+}
+
+// Everything that can change the result: prompt, params and the output limits.
+// Object keys sorted at every level, so key order does not split identical requests.
+static void sort_keys(json_value& v) {
+    for (auto& e : v.arr) sort_keys(e);
+    for (auto& e : v.obj) sort_keys(e.second);
+    std::stable_sort(v.obj.begin(), v.obj.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+}
+
+static std::string request_ident(const char* prompt, const char* paramsJson, size_t max_bytes, int side_size) {
+    std::string id = prompt ? prompt : "";
+    id += '\0';
+    json_value doc;
+    size_t err_off = 0;
+    if (paramsJson && json_parse(paramsJson, strlen(paramsJson), doc, &err_off) && doc.is(json_value::OBJ)) {
+        // how the output is delivered does not change it
+        doc.obj.erase(std::remove_if(doc.obj.begin(), doc.obj.end(), [](const auto& e) {
+            return e.first == "stream_policy" || e.first == "stream_buffer";
+        }), doc.obj.end());
+        sort_keys(doc);
+        json_dump(doc, id);
+    } else {
+        id += paramsJson ? paramsJson : "";
+    }
+    id += '\0';
+    id += std::to_string(max_bytes);
+    id += '/';
+    id += std::to_string(side_size);
+    return id;
+}
+
+// Leader's piece callback: publishes to the followers, then forwards to its own consumer.
+struct lead_ctx {
+    const std::string*      ident;
+    std::shared_ptr<flight> fl;
+    llm_piece_cb            cb   = nullptr;
+    void*                   user = nullptr;
+    bool                    cb_stopped = false;
+};
+
+static int lead_piece(const char* piece, int len, void* user) {
+    lead_ctx& c = *(lead_ctx*)user;
+    g_flights.append(*c.fl, piece, (size_t)len);
+    if (c.cb && !c.cb_stopped && c.cb(piece, len, c.user) != 0) c.cb_stopped = true;
+    // the leader's consumer is gone, but followers still want the full output
+    return c.cb_stopped && g_flights.may_stop(*c.ident, c.fl) ? 1 : 0;
+}
+
+// Holding-the-engine gauge for the scope.
+struct active_request {
+    active_request()  { metric_add(M_ACTIVE,  1); }
+    ~active_request() { metric_add(M_ACTIVE, -1); }
+};
 
-        const llama_token tok = (llama_token)best_id;
-        if (tok == eos_token() || tok == -1) break;
+static int run_locked(const char* prompt, const char* paramsJson, gen_output& out) {
+    const double t0 = now_ms();
+    metric_add(M_QUEUE_DEPTH, 1);
+    engine_lock lock;
+    metric_add(M_QUEUE_DEPTH, -1);
+    metric_observe(H_QUEUE_WAIT, now_ms() - t0);
+    active_request active;
+    idle_activity busy;
+    if (const int rc = ensure_loaded()) { LLOGE("llm_infer: ctx not init"); return rc; }
+    return generate(prompt, paramsJson, out);
+}
 
-        append_piece(tok, result);
-        if ((int)result.size() >= outBufSize - 1) break;
+static int infer_ex(const char* prompt, const char* paramsJson, char* outBuf, int outBufSize,
+                    unsigned char* sideBuf, int sideBufSize) {
+    if (!outBuf || outBufSize <= 1) { LLOGE("llm_infer: bad outBuf"); return -30; }
 
-        if (!decode_tokens(&tok, 1, n_past)) {
-            LLOGW("llama: decode(step) failed; stop");
-            break;
+    std::string             ident;
+    std::shared_ptr<flight> fl;
+    if (coalescable(paramsJson)) {
+        ident = request_ident(prompt, paramsJson, (size_t)outBufSize - 1, sideBuf ? sideBufSize : 0);
+        bool leader = false;
+        fl = g_flights.join(ident, leader);
+        if (!leader) {
+            metric_add(M_COALESCED);
+            if (const int rc = g_flights.wait(fl)) return rc;
+            // same limits as the leader, so everything fits as it did there
+            memcpy(outBuf, fl->final_text.data(), fl->final_text.size());
+            outBuf[fl->final_text.size()] = '\0';
+            if (!fl->side.empty()) memcpy(sideBuf, fl->side.data(), fl->side.size());
+            return 0;
         }
     }
 
-    const int n = std::min((int)result.size(), outBufSize - 1);
-    memcpy(outBuf, result.data(), (size_t)n);
-    outBuf[n] = '\0';
+    side_writer side(sideBuf, sideBufSize);
+    gen_output  out;
+    out.side      = &side;
+    out.max_bytes = (size_t)outBufSize - 1;
+    lead_ctx lc{&ident, fl};
+    if (fl) { out.cb = lead_piece; out.user = &lc; }
+
+    const int rc = run_locked(prompt, paramsJson, out);
+
+    std::string& result = out.text;
+    if (result.size() > out.max_bytes) result.resize(out.max_bytes);
+    if (fl) {
+        const int usage[2] = { out.n_prompt, out.n_gen };
+        g_flights.finish(ident, fl, rc, result, sideBuf, (size_t)side.used, usage);
+    }
+    if (rc) return rc;
+
+    memcpy(outBuf, result.data(), result.size());
+    outBuf[result.size()] = '\0';
     return 0;
 }
 
+// Request count, errors and end-to-end latency, recorded however the request returns.
+struct request_metrics {
+    double t0 = now_ms();
+    int    rc = 0;
+    request_metrics() { metric_add(M_REQUESTS); }
+    ~request_metrics() {
+        if (rc < 0) metric_add(M_REQUEST_ERRORS);
+        metric_observe(H_REQUEST, now_ms() - t0);
+    }
+};
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_infer_ex(const char* prompt, const char* paramsJson, char* outBuf, int outBufSize,
+                 unsigned char* sideBuf, int sideBufSize) {
+    request_metrics m;
+    return m.rc = infer_ex(prompt, paramsJson, outBuf, outBufSize, sideBuf, sideBufSize);
+}
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_infer(const char* prompt, const char* paramsJson, char* outBuf, int outBufSize) {
+    return llm_infer_ex(prompt, paramsJson, outBuf, outBufSize, nullptr, 0);
+}
+
+static int infer_stream(const char* prompt, const char* paramsJson, llm_piece_cb cb, void* user, int* usage,
+                        const std::atomic<bool>* cancel = nullptr) {
+    if (!cb) return -30;
+
+    std::string             ident;
+    std::shared_ptr<flight> fl;
+    if (coalescable(paramsJson)) {
+        ident = request_ident(prompt, paramsJson, (size_t)-1, 0);
+        bool leader = false;
+        fl = g_flights.join(ident, leader);
+        if (!leader) {
+            metric_add(M_COALESCED);
+            return g_flights.stream(fl, cb, user, usage);
+        }
+    }
+
+    // cb runs on the stream's delivery thread; the decode loop only copies into its ring
+    const int policy = paramsJson ? jgeti(paramsJson, "stream_policy", LLM_STREAM_SPILL) : LLM_STREAM_SPILL;
+    const int buffer = paramsJson ? jgeti(paramsJson, "stream_buffer", 16 * 1024) : 16 * 1024;
+    token_stream ts((size_t)std::max(0, buffer),
+                    policy >= LLM_STREAM_SPILL && policy <= LLM_STREAM_DROP ? (stream_policy)policy : STREAM_SPILL,
+                    cb, user);
+
+    side_writer side(nullptr, 0);
+    gen_output  out;
+    out.side = &side;
+    out.cb   = token_stream::publish_cb;
+    out.user = &ts;
+    lead_ctx lc{&ident, fl, token_stream::publish_cb, &ts};
+    if (fl) { out.cb = lead_piece; out.user = &lc; }
+    else    out.cancel = cancel;   // a leader's followers still want the rest
+
+    const int rc = run_locked(prompt, paramsJson, out);
+    ts.close();
+    if (ts.dropped()) {
+        LLOGW("llm_infer_stream: consumer fell behind; %llu bytes dropped", (unsigned long long)ts.dropped());
+        metric_add(M_STREAM_DROPPED, (int64_t)ts.dropped());
+    }
+    if (usage) { usage[0] = out.n_prompt; usage[1] = out.n_gen; }
+    if (fl) {
+        const int u[2] = { out.n_prompt, out.n_gen };
+        g_flights.finish(ident, fl, rc, out.text, nullptr, 0, u);
+    }
+    return rc;
+}
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_infer_stream(const char* prompt, const char* paramsJson, llm_piece_cb cb, void* user, int* usage) {
+    request_metrics m;
+    return m.rc = infer_stream(prompt, paramsJson, cb, user, usage);
+}
+
+// llm_stream_start: llm_infer_stream on a thread of its own, for callers (Dart
+// NativeCallable.listener) whose callbacks are posted rather than run in place.
+struct stream_job {
+    int               id   = 0;
+    llm_stream_cb     cb   = nullptr;
+    void*             user = nullptr;
+    std::atomic<bool> cancel{false};
+};
+static std::mutex g_stream_mu;
+static std::map<int, std::shared_ptr<stream_job>> g_streams;   // running, by stream id
+static int        g_next_stream = 1;
+
+static int stream_piece(const char* piece, int len, void* user) {
+    stream_job& j = *(stream_job*)user;
+    if (j.cancel.load()) return 1;
+    char* copy = (char*)malloc((size_t)len + 1);
+    if (!copy) return 1;
+    memcpy(copy, piece, (size_t)len);
+    copy[len] = '\0';
+    j.cb(j.id, copy, len, j.user);
+    return 0;
+}
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_stream_start(const char* prompt, const char* paramsJson, llm_stream_cb cb, void* user) {
+    if (!cb) return -30;
+    auto job = std::make_shared<stream_job>();
+    job->cb   = cb;
+    job->user = user;
+    {
+        std::lock_guard<std::mutex> lock(g_stream_mu);
+        job->id = g_next_stream++;
+        g_streams[job->id] = job;
+    }
+    const bool  has_prompt = prompt != nullptr;
+    std::string p = prompt ? prompt : "", pj = paramsJson ? paramsJson : "";
+    const bool  has_params = paramsJson != nullptr;
+    std::thread([job, p, pj, has_prompt, has_params]() {
+        request_metrics m;
+        m.rc = infer_stream(has_prompt ? p.c_str() : nullptr, has_params ? pj.c_str() : nullptr,
+                            stream_piece, job.get(), nullptr, &job->cancel);
+        {
+            std::lock_guard<std::mutex> lock(g_stream_mu);
+            g_streams.erase(job->id);
+        }
+        job->cb(job->id, nullptr, m.rc, job->user);
+    }).detach();
+    return job->id;
+}
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_stream_cancel(int stream) {
+    std::lock_guard<std::mutex> lock(g_stream_mu);
+    auto it = g_streams.find(stream);
+    if (it == g_streams.end()) return -44;
+    it->second->cancel.store(true);
+    return 0;
+}
+
+// ---------- batched requests ----------
+// Items of one llm_infer_batch call run side by side, each in a sequence of its own
+// borrowed from the free session slots. The longest token prefix common to all prompts
+// (typically the instructions) is decoded once into the default sequence, where the next
+// call or llm_infer can reuse it, and shared into every item's sequence; the rest of the
+// prompts is prefilled together and then the items' generations are stepped by one
+// gen_scheduler, each step decoding one token for every item still running. Items that
+// do not fit next to each other (sequences or n_ctx) run in further waves.
+struct batch_item {
+    const char*    prompt      = nullptr;
+    const char*    params      = nullptr;
+    std::vector<llama_token> toks;
+    kv_seq         seq;
+    gen_pipe       gen;
+    gen_slot       slot;
+    int            json_indent = 0;
+    int            status      = 0;
+    double         ms          = 0;       // call start to last token
+};
+
+struct batch_report {
+    size_t shared = 0, prompt = 0, prefill = 0, gen = 0;
+    int    waves = 0, steps = 0;
+    double ms = 0;
+};
+
+// Free sequence ids, held in g_reserved until batch_release so sessions opened meanwhile
+// do not take them.
+static void batch_reserve(size_t max_n, std::vector<llama_seq_id>& out) {
+    out.clear();
+    std::lock_guard<std::mutex> lock(g_sess_mu);
+    for (llama_seq_id id = 1; id < kMaxSeq && out.size() < max_n; ++id) {
+        bool used = false;
+        for (const auto& kv : g_sessions) used |= kv.second->id == id;
+        for (const auto& sq : g_closed)   used |= sq->id == id;
+        for (llama_seq_id r : g_reserved) used |= r == id;
+        if (!used) out.push_back(id);
+    }
+    g_reserved.insert(g_reserved.end(), out.begin(), out.end());
+}
+
+static void batch_release(const std::vector<llama_seq_id>& ids) {
+    std::lock_guard<std::mutex> lock(g_sess_mu);
+    for (llama_seq_id id : ids) g_reserved.erase(std::find(g_reserved.begin(), g_reserved.end(), id));
+}
+
+// One wave: prefill every item's prompt after the shared prefix, then step until all
+// are done. Caller holds the engine lock; the prefix is already in g_main.
+static void batch_wave(std::vector<batch_item*>& wave, size_t shared, batch_report& rep) {
+    llama_memory_t mem = llama_get_memory(g_ctx);
+    batch_item* by_seq[kMaxSeq] = {};
+    for (batch_item* it : wave) {
+        if (shared > 0) llama_memory_seq_cp(mem, g_main.id, it->seq.id, 0, (llama_pos)shared);
+        it->seq.tokens.assign(it->toks.begin(), it->toks.begin() + (ptrdiff_t)shared);
+        it->seq.shared = shared;
+        by_seq[it->seq.id] = it;
+    }
+
+    // prefill: the suffixes back to back, n_batch tokens per decode; an item's generation
+    // starts as soon as the chunk holding its last prompt token is decoded
+    const int cap = (int)llama_n_batch(g_ctx);
+    size_t k = 0, off = shared;
+    bool   ok = true;
+    gen_scheduler sched;
+    while (ok && k < wave.size()) {
+        std::vector<std::pair<batch_item*, int>> ends;   // item, batch index of its logits
+        int m = 0;
+        while (m < cap && k < wave.size()) {
+            batch_item& it = *wave[k];
+            const size_t n = std::min(it.toks.size() - off, (size_t)(cap - m));
+            for (size_t j = 0; j < n; ++j, ++m) {
+                g_batch.token[m]     = it.toks[off + j];
+                g_batch.pos[m]       = (llama_pos)(off + j);
+                g_batch.n_seq_id[m]  = 1;
+                g_batch.seq_id[m][0] = it.seq.id;
+                g_batch.logits[m]    = off + j == it.toks.size() - 1;
+            }
+            it.seq.tokens.insert(it.seq.tokens.end(), it.toks.begin() + (ptrdiff_t)off,
+                                 it.toks.begin() + (ptrdiff_t)(off + n));
+            off += n;
+            if (off == it.toks.size()) { ends.emplace_back(&it, m - 1); ++k; off = shared; }
+        }
+        g_batch.n_tokens = m;
+        if (llama_decode(g_ctx, g_batch) != 0) { ok = false; break; }
+        g_layout.on_decode((size_t)m);
+        rep.prefill += (size_t)m;
+        for (auto& e : ends) {
+            batch_item& it = *e.first;
+            it.slot.seq    = it.seq.id;
+            it.slot.logits = llama_get_logits_ith(g_ctx, e.second);
+            sched.add(gen_run(it.slot, it.gen), it.slot);
+        }
+    }
+
+    // steps: one token for every generation still running
+    if (ok) {
+        sched.run([&](std::vector<gen_slot*>& slots) {
+            const int m = (int)slots.size();
+            for (int j = 0; j < m; ++j) {
+                kv_seq& sq = by_seq[slots[j]->seq]->seq;
+                g_batch.token[j]     = slots[j]->pending;
+                g_batch.pos[j]       = (llama_pos)sq.tokens.size();
+                g_batch.n_seq_id[j]  = 1;
+                g_batch.seq_id[j][0] = sq.id;
+                g_batch.logits[j]    = 1;
+                sq.tokens.push_back(slots[j]->pending);
+            }
+            g_batch.n_tokens = m;
+            if (llama_decode(g_ctx, g_batch) != 0) { ok = false; return; }   // every generation ends
+            g_layout.on_decode((size_t)m);
+            for (int j = 0; j < m; ++j) slots[j]->logits = llama_get_logits_ith(g_ctx, j);
+        });
+        rep.steps += sched.steps();
+    }
+
+    for (batch_item* it : wave) {
+        if (!it->gen.ended) { it->status = -20; it->gen.text.clear(); }
+        kv_trim(g_ctx, it->seq, 0, g_layout);
+        rep.gen += (size_t)it->gen.n_gen;
+    }
+    if (!ok) LLOGE("llm_infer_batch: decode failed; %zu item(s) of this wave dropped", wave.size());
+}
+
+static int infer_batch_locked(std::vector<batch_item>& items, batch_report& rep) {
+    const double t0 = now_ms();
+    for (batch_item& it : items) {
+        if (it.status != 0) continue;
+        it.gen.t_last = t0;
+        if (const int rc = request_tokens(it.prompt, it.params, it.toks)) it.status = rc;
+        else if (it.toks.empty()) it.status = -3;
+        rep.prompt += it.toks.size();
+    }
+
+    // prefix shared by every prompt, one token short of the shortest so that each item
+    // still decodes something and gets its own logits
+    std::vector<batch_item*> todo;
+    for (batch_item& it : items) if (it.status == 0) todo.push_back(&it);
+    if (todo.empty()) return 0;
+    size_t shared = todo[0]->toks.size() - 1;
+    for (batch_item* it : todo) {
+        size_t k = 0;
+        while (k < shared && k < it->toks.size() - 1 && it->toks[k] == todo[0]->toks[k]) ++k;
+        shared = k;
+    }
+    std::vector<llama_seq_id> ids;
+    batch_reserve(todo.size(), ids);
+    if (todo.size() == 1 || ids.empty()) shared = 0;   // nothing to share, or nowhere to run
+
+    if (shared > 0) {
+        // into the default sequence: llm_infer with the same instructions reuses it
+        g_main.last_use = ++g_use_tick;
+        page_in(g_main);
+        size_t keep = 0;
+        while (keep < g_main.tokens.size() && keep < shared && g_main.tokens[keep] == todo[0]->toks[keep]) ++keep;
+        kv_trim(g_ctx, g_main, keep, g_layout);
+        int n_past = (int)keep;
+        g_rstats.reused_tokens += keep;
+        metric_add(M_PREFIX_TOKENS, (int64_t)keep);
+        if (keep < shared &&
+            !decode_tokens(g_main, todo[0]->toks.data() + keep, (int)(shared - keep), n_past)) {
+            shared = 0;   // the items decode all of their prompt instead
+        } else {
+            rep.prefill += shared - keep;
+        }
+        g_main.prompt_len = g_main.tokens.size();
+    }
+    rep.shared = shared;
+
+    if (ids.empty()) {
+        // every sequence belongs to a session: one item after the other on seq 0
+        for (batch_item* it : todo) {
+            side_writer side(nullptr, 0);
+            gen_output  out;
+            out.side      = &side;
+            out.max_bytes = it->gen.max_bytes;
+            out.t0        = t0;
+            it->status = generate(it->prompt, it->params, out);
+            if (out.text.size() > it->gen.max_bytes) out.text.resize(it->gen.max_bytes);
+            it->gen.text.swap(out.text);
+            it->gen.n_gen = out.n_gen;
+            it->ms    = now_ms() - t0;
+            rep.gen  += (size_t)out.n_gen;
+        }
+        rep.ms = now_ms() - t0;
+        return 0;
+    }
+
+    size_t next = 0;
+    const size_t n_ctx = (size_t)g_n_ctx;
+    while (next < todo.size()) {
+        // as many items as there are sequences and as fit in the cache at once
+        std::vector<batch_item*> wave;
+        size_t need = 0;
+        while (next < todo.size() && wave.size() < ids.size()) {
+            batch_item& it = *todo[next];
+            const size_t n = it.toks.size() - shared + (size_t)std::max(0, it.gen.max_tokens);
+            if (!wave.empty() && g_layout.live() + need + n > n_ctx) break;
+            it.seq    = kv_seq();
+            it.seq.id = ids[wave.size()];
+            wave.push_back(&it);
+            need += n;
+            ++next;
+        }
+        enforce_budget(&g_main, need);
+        if (g_layout.live() + need > n_ctx && g_layout.fragmentation() > 0) kv_compact_locked();
+        ++rep.waves;
+        batch_wave(wave, shared, rep);
+    }
+    batch_release(ids);
+
+    for (batch_item* it : todo) {
+        it->ms = it->gen.t_last - t0;
+        if (it->status != 0 || !it->gen.json_check || it->json_indent <= 0) continue;
+        if (it->gen.js.finish() != json_stream::DONE) continue;
+        std::string pretty;
+        json_reindent(it->gen.text.data(), it->gen.text.size(), it->json_indent, pretty);
+        if (pretty.size() <= it->gen.max_bytes) it->gen.text.swap(pretty);
+    }
+    rep.ms = now_ms() - t0;
+    metric_add(M_PROMPT_TOKENS, (int64_t)rep.prompt);
+    metric_add(M_GEN_TOKENS, (int64_t)rep.gen);
+    return 0;
+}
+
+static void batch_stats_json(const std::vector<batch_item>& items, const batch_report& r, std::string& out) {
+    json_value v;
+    v.kind = json_value::OBJ;
+    jput_num(v, "items",                (double)items.size());
+    jput_num(v, "waves",                r.waves);
+    jput_num(v, "steps",                r.steps);
+    jput_num(v, "shared_prefix_tokens", (double)r.shared);
+    jput_num(v, "prompt_tokens",        (double)r.prompt);
+    jput_num(v, "prefill_tokens",       (double)r.prefill);
+    jput_num(v, "gen_tokens",           (double)r.gen);
+    jput_num(v, "ms",                   r.ms);
+    json_value arr;
+    arr.kind = json_value::ARR;
+    for (const batch_item& it : items) {
+        json_value o;
+        o.kind = json_value::OBJ;
+        jput_num(o, "status",        it.status);
+        jput_num(o, "prompt_tokens", (double)it.toks.size());
+        jput_num(o, "gen_tokens",    it.gen.n_gen);
+        jput_num(o, "ms",            it.ms);
+        arr.arr.push_back(std::move(o));
+    }
+    v.obj.emplace_back("results", std::move(arr));
+    json_dump(v, out);
+}
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_infer_batch(const char* const* prompts, const char* const* paramsJson, int n,
+                    char* outSlots, int slotSize, int* status, char* statsJson, int statsSize) {
+    request_metrics m;
+    if (!prompts || n <= 0 || !outSlots || slotSize <= 1) return m.rc = -30;
+
+    std::vector<batch_item> items((size_t)n);
+    for (int i = 0; i < n; ++i) {
+        batch_item& it = items[(size_t)i];
+        const char* pj = paramsJson ? paramsJson[i] : nullptr;
+        it.prompt        = prompts[i];
+        it.params        = pj;
+        it.gen.max_bytes = (size_t)slotSize - 1;
+        it.json_indent   = pj ? jgeti(pj, "json_indent", 0) : 0;
+        it.status        = it.prompt ? gen_params(pj, it.gen) : -3;
+    }
+
+    batch_report rep;
+    const double t0 = now_ms();
+    metric_add(M_QUEUE_DEPTH, 1);
+    {
+        engine_lock lock;
+        metric_add(M_QUEUE_DEPTH, -1);
+        metric_observe(H_QUEUE_WAIT, now_ms() - t0);
+        active_request active;
+        idle_activity busy;
+        if (const int rc = ensure_loaded()) { LLOGE("llm_infer_batch: ctx not init"); return m.rc = rc; }
+        infer_batch_locked(items, rep);
+    }
+
+    for (int i = 0; i < n; ++i) {
+        const batch_item& it = items[(size_t)i];
+        char* slot = outSlots + (size_t)i * (size_t)slotSize;
+        const size_t len = it.status == 0 ? std::min(it.gen.text.size(), it.gen.max_bytes) : 0;
+        memcpy(slot, it.gen.text.data(), len);
+        slot[len] = '\0';
+        if (status) status[i] = it.status;
+    }
+    LLOGI("llm_infer_batch: %d items, %zu shared prefix tokens, %d waves, %d steps, %.1f ms",
+          n, rep.shared, rep.waves, rep.steps, rep.ms);
+    if (!statsJson) return 0;
+    std::string out;
+    batch_stats_json(items, rep, out);
+    return m.rc = write_out(out, statsJson, statsSize);
+}
+
+// ---------- choice requests ----------
+// llm_choose scores a fixed set of answers instead of generating one. The prompt goes
+// into the default sequence as for llm_infer; the candidates' trie nodes (llm_choice.h)
+// then go in as one batch, each node tagged with the sequence of every candidate passing
+// through it, so a prefix several candidates share is decoded once and all of them
+// attend to it. A wave holds as many candidates as there are free sequences plus the
+// default one; most calls need a single decode after the prompt, and single-token
+// candidates none at all.
+struct choice_report {
+    size_t prompt = 0, decoded = 0;
+    int    waves  = 0;
+};
+
+// Scores every node of t with children. The prompt is in g_main and its logits current;
+// afterwards g_main holds just the prompt again.
+static int choice_decode(choice_trie& t, choice_report& rep) {
+    const int n_vocab = vocab_size();
+    choice_take_logits(t, 0, llama_get_logits(g_ctx), n_vocab);
+
+    std::vector<llama_seq_id> ids;
+    batch_reserve(std::min(t.order.size(), (size_t)kMaxSeq) - 1, ids);
+    ids.insert(ids.begin(), g_main.id);
+    llama_memory_t mem  = llama_get_memory(g_ctx);
+    const size_t   base = g_main.tokens.size();
+    const size_t   cap  = (size_t)llama_n_batch(g_ctx);
+    int rc = 0;
+    for (size_t w = 0; rc == 0 && w < t.order.size(); w += ids.size()) {
+        const size_t n = std::min(ids.size(), t.order.size() - w);
+        // the wave's nodes with children, parents first, and the sequences through each
+        std::vector<std::vector<llama_seq_id>> through(t.nodes.size());
+        for (size_t j = 0; j < n; ++j)
+            for (int at = t.leaf[(size_t)t.order[w + j]]; at > 0; at = t.nodes[(size_t)at].parent)
+                if (!t.nodes[(size_t)at].kids.empty()) through[(size_t)at].push_back(ids[j]);
+        std::vector<int> todo;
+        bool fresh = false;
+        for (size_t i = 1; i < through.size(); ++i) {
+            if (through[i].empty()) continue;
+            todo.push_back((int)i);
+            fresh |= !t.nodes[i].scored;
+        }
+        if (!fresh) continue;
+        std::stable_sort(todo.begin(), todo.end(),
+                         [&](int a, int b) { return t.nodes[(size_t)a].depth < t.nodes[(size_t)b].depth; });
+
+        for (size_t j = 1; j < n; ++j) llama_memory_seq_cp(mem, g_main.id, ids[j], 0, (llama_pos)base);
+        ++rep.waves;
+        size_t landed = 0;
+        for (size_t off = 0; off < todo.size(); off += cap) {
+            const size_t m = std::min(cap, todo.size() - off);
+            for (size_t b = 0; b < m; ++b) {
+                const choice_trie::node& nd = t.nodes[(size_t)todo[off + b]];
+                const std::vector<llama_seq_id>& sq = through[(size_t)todo[off + b]];
+                g_batch.token[b]    = nd.tok;
+                g_batch.pos[b]      = (llama_pos)(base + (size_t)nd.depth - 1);
+                g_batch.n_seq_id[b] = (int32_t)sq.size();
+                std::copy(sq.begin(), sq.end(), g_batch.seq_id[b]);
+                g_batch.logits[b]   = !nd.scored;
+            }
+            g_batch.n_tokens = (int32_t)m;
+            if (llama_decode(g_ctx, g_batch) != 0) { rc = -20; break; }
+            g_layout.on_decode(m);
+            landed += m;
+            for (size_t b = 0; b < m; ++b)
+                if (!t.nodes[(size_t)todo[off + b]].scored)
+                    choice_take_logits(t, todo[off + b], llama_get_logits_ith(g_ctx, (int32_t)b), n_vocab);
+        }
+        rep.decoded += landed;
+        llama_memory_seq_rm(mem, g_main.id, (llama_pos)base, -1);
+        for (size_t j = 1; j < n; ++j) llama_memory_seq_rm(mem, ids[j], -1, -1);
+        g_layout.on_drop(landed);
+    }
+    ids.erase(ids.begin());
+    batch_release(ids);
+    if (rc) LLOGE("llm_choose: decode failed");
+    return rc;
+}
+
+// Candidates as the model would write them after the prompt: the tokens of text + name
+// past those it shares with the prompt's. A candidate tokenized on its own is not that
+// (SPM vocabs give " yes" a second space prefix). Where a candidate merges with the end
+// of the prompt, the shared prompt stops before the merge and every candidate carries
+// the rest of the prompt's text in its own tokens. False if a candidate adds no tokens.
+static bool choice_tokens(std::vector<llama_token>& toks, const std::string& text,
+                          const std::vector<std::string>& names, std::vector<std::vector<llama_token>>& cands) {
+    std::vector<std::vector<llama_token>> whole(names.size());
+    size_t shared = toks.size();
+    for (size_t i = 0; i < names.size(); ++i) {
+        whole[i] = tok_prompt(text + names[i], /*add_special*/true, /*parse_special*/true);
+        const size_t n = std::min(toks.size(), whole[i].size());
+        size_t k = 0;
+        while (k < n && toks[k] == whole[i][k]) ++k;
+        shared = std::min(shared, k);
+    }
+    toks.resize(shared);
+    cands.assign(names.size(), {});
+    for (size_t i = 0; i < names.size(); ++i) {
+        cands[i].assign(whole[i].begin() + (ptrdiff_t)shared, whole[i].end());
+        if (cands[i].empty()) return false;
+    }
+    return true;
+}
+
+// Restricted log-probabilities of the candidates after the prompt toks.
+static int choice_score(const std::vector<llama_token>& toks, const std::vector<std::vector<llama_token>>& cands,
+                        std::vector<double>& logp, double* coverage, choice_report& rep) {
+    choice_trie t;
+    choice_build(cands, t);
+    if (const int rc = prefill(g_main, toks, t.nodes.size())) return rc;
+    rep.prompt += toks.size();
+    if (const int rc = choice_decode(t, rep)) return rc;
+    choice_logprobs(t, logp);
+    if (coverage) *coverage = choice_coverage(t);
+    return 0;
+}
+
+// Contextual calibration: the candidates' probabilities for the request's template with
+// every slot set to content-free text ("calibrate": "N/A", or 1 for that), cached per
+// template and candidate list until the template is compiled for another model.
+static int choice_prior(const json_value& doc, const std::vector<std::string>& choices,
+                        std::vector<double>& prior, choice_report& rep) {
+    const json_value* cal = doc.get("calibrate");
+    const json_value* id  = doc.get("template");
+    if (!cal || (cal->is(json_value::NUM) && cal->num == 0)) return 0;
+    if (!id || !id->is(json_value::NUM)) { LLOGE("llm_choose: calibrate needs a template"); return -3; }
+    const std::string filler = cal->is(json_value::STR) ? cal->str : "N/A";
+
+    std::shared_ptr<tmpl_entry> e;
+    {
+        std::lock_guard<std::mutex> lock(g_tmpl_mu);
+        auto it = g_templates.find((int)id->num);
+        if (it != g_templates.end()) e = it->second;
+    }
+    const auto t = e ? template_for((int)id->num, std::atomic_load(&g_handle)) : nullptr;
+    if (!t) { LLOGE("llm_choose: unknown template %d", (int)id->num); return -42; }
+
+    std::string key = filler;
+    for (const std::string& c : choices) { key += '\x1f'; key += c; }
+    {
+        std::lock_guard<std::mutex> lock(g_tmpl_mu);
+        auto it = e->priors.find(key);
+        if (it != e->priors.end()) { prior = it->second; return 0; }
+    }
+
+    std::vector<llama_token> toks;
+    std::string text, err;
+    const slot_lookup value = [&filler](const std::string&) { return &filler; };
+    if (!template_render(get_vocab(), *t, value, toks, err) || !template_text(*t, value, text, err)) return -3;
+    std::vector<std::vector<llama_token>> cands;
+    if (!choice_tokens(toks, text, choices, cands) || toks.empty()) return -3;
+    std::vector<double> logp;
+    if (const int rc = choice_score(toks, cands, logp, nullptr, rep)) return rc;
+    prior.resize(logp.size());
+    for (size_t i = 0; i < logp.size(); ++i) prior[i] = std::exp(logp[i]);
+    std::lock_guard<std::mutex> lock(g_tmpl_mu);
+    e->priors[key] = prior;
+    return 0;
+}
+
+static void jput_nums(json_value& o, const char* k, const std::vector<double>& v) {
+    json_value a;
+    a.kind = json_value::ARR;
+    for (double d : v) {
+        json_value e; e.kind = json_value::NUM; e.num = d;
+        char b[32];
+        snprintf(b, sizeof(b), std::isfinite(d) ? "%.6g" : "-1e308", d);
+        e.str = b;
+        a.arr.push_back(std::move(e));
+    }
+    o.obj.emplace_back(k, std::move(a));
+}
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_choose(const char* prompt, const char* paramsJson, const char* const* choices, int n,
+               float* probs, char* statsJson, int statsSize) {
+    request_metrics m;
+    if (!choices || n <= 0) return m.rc = -30;
+    std::vector<std::string> names((size_t)n);
+    for (int i = 0; i < n; ++i) {
+        if (!choices[i] || !*choices[i]) return m.rc = -3;
+        names[(size_t)i] = choices[i];
+    }
+    json_value doc;
+    size_t err_off = 0;
+    if (paramsJson && !json_parse(paramsJson, strlen(paramsJson), doc, &err_off)) return m.rc = -3;
+    std::vector<double> prior;
+    if (const json_value* pr = doc.get("prior")) {
+        if (!pr->is(json_value::ARR) || pr->arr.size() != (size_t)n) return m.rc = -3;
+        for (const json_value& v : pr->arr) prior.push_back(v.num);
+    }
+    const double temperature = paramsJson ? jgetd(paramsJson, "temperature", 1.0) : 1.0;
+
+    std::vector<double> logp, p;
+    double coverage = 0;
+    choice_report rep;
+    const double t0 = now_ms();
+    metric_add(M_QUEUE_DEPTH, 1);
+    {
+        engine_lock lock;
+        metric_add(M_QUEUE_DEPTH, -1);
+        metric_observe(H_QUEUE_WAIT, now_ms() - t0);
+        active_request active;
+        idle_activity busy;
+        if (const int rc = ensure_loaded()) { LLOGE("llm_choose: ctx not init"); return m.rc = rc; }
+
+        if (prior.empty())
+            if (const int rc = choice_prior(doc, names, prior, rep)) return m.rc = rc;
+        std::vector<llama_token> toks;
+        std::vector<std::vector<llama_token>> cands;
+        std::string text;
+        if (const int rc = request_tokens(prompt, paramsJson, toks, &text)) return m.rc = rc;
+        if (!choice_tokens(toks, text, names, cands) || toks.empty()) return m.rc = -3;
+        if (const int rc = choice_score(toks, cands, logp, &coverage, rep)) return m.rc = rc;
+    }
+    choice_calibrate(logp, prior.empty() ? nullptr : &prior, temperature, p);
+    const int best = (int)(std::max_element(p.begin(), p.end()) - p.begin());
+    if (probs) for (int i = 0; i < n; ++i) probs[i] = (float)p[(size_t)i];
+    LLOGI("llm_choose: %d candidates, %zu prompt tokens, %zu decoded in %d wave(s), %.1f ms",
+          n, rep.prompt, rep.decoded, rep.waves, now_ms() - t0);
+    if (!statsJson) return best;
+
+    json_value v;
+    v.kind = json_value::OBJ;
+    jput_num(v, "index", best);
+    jput_nums(v, "probs", p);
+    jput_nums(v, "logprobs", logp);
+    if (!prior.empty()) jput_nums(v, "prior", prior);
+    json_value cov; cov.kind = json_value::NUM; cov.num = coverage;
+    char b[32];
+    snprintf(b, sizeof(b), "%.6g", coverage);
+    cov.str = b;
+    v.obj.emplace_back("coverage", cov);
+    jput_num(v, "prompt_tokens",  (double)rep.prompt);
+    jput_num(v, "decoded_tokens", (double)rep.decoded);
+    jput_num(v, "waves",          rep.waves);
+    jput_num(v, "ms",             now_ms() - t0);
+    std::string out;
+    json_dump(v, out);
+    if (const int rc = write_out(out, statsJson, statsSize)) return m.rc = rc;
+    return best;
+}
+
+// ---------- chat template / embeddings / token counts ----------
+// These read the published model snapshot and never queue behind a generation; the
+// engine lock is only taken to bring the model back after an idle unload.
+static std::shared_ptr<const model_handle> loaded_model(int& rc) {
+    rc = 0;
+    if (auto h = std::atomic_load(&g_handle)) return h;
+    engine_lock lock;
+    if ((rc = ensure_loaded()) != 0) return nullptr;
+    return std::atomic_load(&g_handle);
+}
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_chat_prompt(const char* messagesJson, char* outBuf, int outBufSize) {
+    json_value doc;
+    size_t     err = 0;
+    if (!messagesJson || !json_parse(messagesJson, strlen(messagesJson), doc, &err) || !doc.is(json_value::ARR)) {
+        return -3;
+    }
+    std::vector<llama_chat_message> msgs;
+    for (const auto& m : doc.arr) {
+        const json_value* role    = m.get("role");
+        const json_value* content = m.get("content");
+        if (!role || !content || !role->is(json_value::STR) || !content->is(json_value::STR)) return -3;
+        msgs.push_back({role->str.c_str(), content->str.c_str()});
+    }
+
+    const auto meta = std::atomic_load(&g_meta);
+    if (!meta) return -10;
+
+    // the model's own template; GGUFs without one get chatml
+    const char* tmpl = meta->chat_tmpl.empty() ? nullptr : meta->chat_tmpl.c_str();
+    std::string buf(4096, '\0');
+    int32_t n = llama_chat_apply_template(tmpl ? tmpl : "chatml", msgs.data(), msgs.size(), true,
+                                          &buf[0], (int32_t)buf.size());
+    if (n > (int32_t)buf.size()) {
+        buf.resize((size_t)n);
+        n = llama_chat_apply_template(tmpl ? tmpl : "chatml", msgs.data(), msgs.size(), true,
+                                      &buf[0], (int32_t)buf.size());
+    }
+    if (n < 0) { LLOGE("llm_chat_prompt: template not supported"); return -33; }
+    buf.resize((size_t)n);
+    return write_out(buf, outBuf, outBufSize);
+}
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_embed(const char* text, float* out, int outDim) {
+    idle_activity busy;
+    int rc = 0;
+    const auto h = loaded_model(rc);
+    if (!h) return rc;
+
+    const int n_embd = llama_model_n_embd(h->model);
+    if (!text) return n_embd;                       // dimension query
+    if (!out || outDim < n_embd) return -32;
+
+    // own context and lock: embeddings run next to a generation, not after it
+    std::lock_guard<std::mutex> lock(g_emb_mu);
+    if (g_emb_ctx && g_emb_model != h) { llama_free(g_emb_ctx); g_emb_ctx = nullptr; }
+    if (!g_emb_ctx) {
+        llama_context_params cparams = llama_context_default_params();
+        cparams.n_ctx        = 512;
+        cparams.n_batch      = 512;
+        cparams.n_ubatch     = 512;
+        cparams.n_threads    = h->n_threads;
+        cparams.embeddings   = true;
+        cparams.pooling_type = LLAMA_POOLING_TYPE_MEAN;
+        g_emb_ctx = llama_init_from_model(h->model, cparams);
+        if (!g_emb_ctx) { LLOGE("llm_embed: failed to create context"); return -2; }
+        g_emb_model = h;
+    }
+
+    std::vector<llama_token> toks = tokenize(llama_model_get_vocab(h->model), text,
+                                             /*add_special*/true, /*parse_special*/false);
+    if (toks.size() > 512) toks.resize(512);
+    if (toks.empty()) return -3;
+
+    llama_memory_clear(llama_get_memory(g_emb_ctx), true);
+    if (llama_decode(g_emb_ctx, llama_batch_get_one(toks.data(), (int32_t)toks.size())) != 0) {
+        LLOGE("llm_embed: decode failed");
+        return -20;
+    }
+    const float* e = llama_get_embeddings_seq(g_emb_ctx, 0);
+    if (!e) return -20;
+
+    double norm = 0.0;
+    for (int i = 0; i < n_embd; ++i) norm += (double)e[i] * e[i];
+    const float inv = norm > 0 ? (float)(1.0 / std::sqrt(norm)) : 0.f;
+    for (int i = 0; i < n_embd; ++i) out[i] = e[i] * inv;
+    return n_embd;
+}
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_token_count(const char* text) {
+    if (!text) return -3;
+    int rc = 0;
+    const auto h = loaded_model(rc);
+    if (!h) return rc;
+    return (int)tokenize(llama_model_get_vocab(h->model), text, /*add_special*/true, /*parse_special*/true).size();
+}
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_grammar_compile(const char* schemaJson, char* errBuf, int errBufSize) {
+    engine_lock lock;
+    if (!schemaJson) { LLOGE("llm_grammar_compile: null schema"); return -1; }
+
+    std::string err;
+    // with a model loaded, precompute the token mask of every state now
+    const int id = grammar_compile(schemaJson, strlen(schemaJson), g_model ? &tokens() : nullptr, err);
+    if (id < 0) {
+        LLOGE("llm_grammar_compile: %s", err.c_str());
+        if (errBuf && errBufSize > 0) {
+            const int n = std::min((int)err.size(), errBufSize - 1);
+            memcpy(errBuf, err.data(), (size_t)n);
+            errBuf[n] = '\0';
+        }
+    }
+    return id;
+}
+
+// ---------- model info / requantization ----------
+static void describe_model(const llama_model* m, const char* path, std::string& out) {
+    char desc[256] = "", ftype[32] = "";
+    llama_model_desc(m, desc, sizeof(desc));
+    llama_model_meta_val_str(m, "general.file_type", ftype, sizeof(ftype));
+
+    json_value v;
+    v.kind = json_value::OBJ;
+    auto str = [&](const char* k, const char* s) { jput_str(v, k, s); };
+    auto num = [&](const char* k, double d) { jput_num(v, k, d); };
+    str("path", path);
+    str("desc", desc);
+    num("ftype",       atoi(ftype));
+    num("size",        (double)llama_model_size(m));
+    num("n_params",    (double)llama_model_n_params(m));
+    num("n_vocab",     llama_vocab_n_tokens(llama_model_get_vocab(m)));
+    num("n_ctx_train", llama_model_n_ctx_train(m));
+    num("n_embd",      llama_model_n_embd(m));
+    num("n_layer",     llama_model_n_layer(m));
+    json_dump(v, out);
+}
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_model_info(const char* modelPath, char* outJson, int outSize) {
+    log_install();
+    if (!modelPath || !*modelPath) {
+        // described at load time; still valid while the model is unloaded for idleness
+        const auto meta = std::atomic_load(&g_meta);
+        if (!meta) return -10;
+        return write_out(meta->info, outJson, outSize);
+    }
+    std::string out;
+
+    llama_backend_init();
+    llama_model_params mp = llama_model_default_params();
+    mp.use_mmap = true;   // metadata + mapping only; no tensor data is touched
+    llama_model* m = llama_model_load_from_file(modelPath, mp);
+    if (!m) { LLOGE("llm_model_info: cannot load %s", modelPath); return -1; }
+    describe_model(m, modelPath, out);
+    llama_model_free(m);
+    return write_out(out, outJson, outSize);
+}
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_requant_start(const char* srcPath, const char* dstPath, int budgetMb, int nCtx, int ftype, int nThreads) {
+    if (!srcPath || !*srcPath) { LLOGE("llm_requant_start: invalid srcPath"); return -3; }
+    if (ftype < 0 && budgetMb <= 0) { LLOGE("llm_requant_start: need budgetMb or ftype"); return -3; }
+    const std::string dst = (dstPath && *dstPath) ? dstPath : srcPath;
+    return requant_start(srcPath, dst, budgetMb, nCtx, ftype, nThreads);
+}
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_requant_poll(float* progress, int* ftype, char* msgBuf, int msgBufSize) {
+    std::string msg;
+    const int st = requant_poll(progress, ftype, &msg);
+    if (msgBuf && msgBufSize > 0) {
+        const int n = std::min((int)msg.size(), msgBufSize - 1);
+        memcpy(msgBuf, msg.data(), (size_t)n);
+        msgBuf[n] = '\0';
+    }
+    return st;
+}
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+void llm_requant_cancel(void) {
+    requant_cancel();
+}
+
+// ---------- sessions / KV compaction ----------
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_session_open(void) {
+    if (!std::atomic_load(&g_meta)) return -10;
+    std::lock_guard<std::mutex> lock(g_sess_mu);
+    for (llama_seq_id id = 1; id < kMaxSeq; ++id) {
+        bool used = false;
+        for (const auto& kv : g_sessions) used |= kv.second->id == id;
+        for (const auto& sq : g_closed)   used |= sq->id == id;   // cells not freed yet
+        for (llama_seq_id r : g_reserved) used |= r == id;
+        if (used) continue;
+        const int sid = g_next_session++;
+        auto sq = std::make_shared<kv_seq>();
+        sq->id = id;
+        g_sessions[sid] = sq;
+        return sid;
+    }
+    LLOGW("llm_session_open: all %d sequences in use", kMaxSeq - 1);
+    return -40;
+}
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_session_fork(int session) {
+    const int sid = llm_session_open();
+    if (sid < 0) return sid;
+
+    engine_lock lock;
+    std::shared_ptr<kv_seq> src_held, dst_held;
+    {
+        std::lock_guard<std::mutex> slock(g_sess_mu);
+        auto it = g_sessions.find(session);
+        if (it != g_sessions.end()) src_held = it->second;
+        it = g_sessions.find(sid);
+        if (it != g_sessions.end()) dst_held = it->second;
+    }
+    kv_seq* src = session == 0 ? &g_main : src_held.get();
+    if (!src || !dst_held) { llm_session_close(sid); return -41; }
+    if (g_ctx) page_in(*src);
+
+    kv_seq& dst = *dst_held;
+    if (g_ctx && !src->tokens.empty()) {
+        // the copy shares cells with the source until one of them diverges
+        llama_memory_seq_cp(llama_get_memory(g_ctx), src->id, dst.id, -1, -1);
+        dst.tokens     = src->tokens;
+        dst.prompt_len = src->prompt_len;
+        dst.shared     = src->tokens.size();
+    }
+    return sid;
+}
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_session_close(int session) {
+    std::lock_guard<std::mutex> lock(g_sess_mu);
+    auto it = g_sessions.find(session);
+    if (it == g_sessions.end()) return -41;
+    g_closed.push_back(std::move(it->second));   // cells freed by the next engine_lock
+    g_sessions.erase(it);
+    return 0;
+}
+
+static void compact_report_json(const kv_compact_report& r, std::string& out) {
+    json_value v;
+    v.kind = json_value::OBJ;
+    jput_num(v, "fragmentation_before", r.frag_before);
+    jput_num(v, "fragmentation_after",  r.frag_after);
+    jput_num(v, "bytes_moved",          (double)r.bytes_moved);
+    jput_num(v, "ms",                   r.ms);
+    jput_num(v, "sequences",            r.seqs);
+    jput_num(v, "dropped",              r.dropped);
+    json_dump(v, out);
+}
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_kv_compact(char* outJson, int outSize) {
+    engine_lock lock;
+    if (!g_inited) return -10;
+    kv_compact_report r;    // unloaded: nothing to compact
+    if (g_ctx) { kv_compact_locked(); r = g_kstats.last; }
+    if (!outJson) return 0;
+    std::string out;
+    compact_report_json(r, out);
+    return write_out(out, outJson, outSize);
+}
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_kv_set_compact_threshold(float threshold) {
+    if (!(threshold >= 0.0f && threshold <= 1.0f)) return -3;
+    engine_lock lock;
+    g_compact_thold = threshold;
+    return 0;
+}
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_kv_paging(int enable, int maxResidentTokens, const char* pageFile) {
+    engine_lock lock;
+    g_resident_max = (size_t)std::max(0, maxResidentTokens);
+    if (!enable) {
+        // whatever is paged out is lost; those sessions decode their prompt again
+        std::vector<kv_seq*> seqs;
+        session_seqs(seqs);
+        for (kv_seq* sq : seqs) {
+            if (!sq->paged()) continue;
+            page_discard(*sq);
+            sq->tokens.clear();
+            sq->prompt_len = 0;
+        }
+        g_pager.close();
+        return 0;
+    }
+    if (g_pager.is_open()) return 0;
+    const std::string path = pageFile && *pageFile ? std::string(pageFile) : cache_path(".kvpage");
+    if (!g_pager.open(path)) return -1;
+    LLOGI("llm_kv_paging: page file %s, resident budget %zu tokens", path.c_str(), g_resident_max);
+    return 0;
+}
+
+// ---------- context pool ----------
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_pool_configure(const int* sizes, int nSizes, int budgetMb) {
+    if (nSizes < 0 || (nSizes > 0 && !sizes) || budgetMb < 0) return -3;
+    std::vector<int> v;
+    for (int i = 0; i < nSizes; ++i) if (sizes[i] > 0) v.push_back(sizes[i]);
+    std::sort(v.begin(), v.end());
+    v.erase(std::unique(v.begin(), v.end()), v.end());
+
+    engine_lock lock;
+    g_pool.configure(v, (size_t)budgetMb * 1024 * 1024);
+    pool_fill_async();
+    return 0;
+}
+
+// ---------- prompt templates ----------
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_template_register(const char* text, char* errBuf, int errBufSize) {
+    std::string err;
+    auto e = std::make_shared<tmpl_entry>();
+    e->text = text ? text : "";
+    auto t  = std::make_shared<prompt_template>();
+    int rc  = 0;
+    const auto h = e->text.empty() ? nullptr : std::atomic_load(&g_handle);
+    if (e->text.empty()) err = "empty template";
+    else if (template_compile(h ? llama_model_get_vocab(h->model) : nullptr, e->text, *t, err)) {
+        if (h) { e->t = t; e->model = h; }
+        std::lock_guard<std::mutex> lock(g_tmpl_mu);
+        rc = g_next_template++;
+        g_templates[rc] = e;
+    }
+    if (rc > 0) {
+        LLOGI("template %d: %zu slot(s), %zu static tokens%s", rc, t->slots.size(), t->static_tokens,
+              !h ? " (tokenized on first use)" : t->spliced ? "" : " (special tokens strip whitespace: whole-prompt tokenization)");
+        return rc;
+    }
+    LLOGE("llm_template_register: %s", err.c_str());
+    if (errBuf && errBufSize > 0) {
+        const int n = std::min((int)err.size(), errBufSize - 1);
+        memcpy(errBuf, err.data(), (size_t)n);
+        errBuf[n] = '\0';
+    }
+    return -3;
+}
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_template_free(int id) {
+    std::lock_guard<std::mutex> lock(g_tmpl_mu);
+    return g_templates.erase(id) ? 0 : -42;
+}
+
+// ---------- prompt tables ----------
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_encode_table(const double* values, int rows, int cols, const char* columnsJson,
+                     char* out, int outSize, char* reportJson, int reportSize) {
+    if (rows < 0 || cols <= 0 || (rows > 0 && !values) || !columnsJson) return -3;
+    json_value doc;
+    size_t err = 0;
+    if (!json_parse(columnsJson, strlen(columnsJson), doc, &err) || !doc.is(json_value::ARR) ||
+        doc.arr.size() != (size_t)cols) return -3;
+    std::vector<num_column> spec((size_t)cols);
+    for (size_t c = 0; c < spec.size(); ++c) {
+        const json_value& o = doc.arr[c];
+        const json_value* name = o.get("name");
+        const json_value* kind = o.get("kind");
+        const json_value* step = o.get("step");
+        spec[c].name = name && name->is(json_value::STR) ? name->str : "c" + std::to_string(c);
+        if (kind && kind->is(json_value::STR) && kind->str == "time") {
+            spec[c].kind = num_column::TIME;
+            spec[c].step = 60;
+        }
+        if (step && step->is(json_value::NUM) && step->num > 0) spec[c].step = step->num;
+    }
+
+    int rc = 0;
+    const auto h = loaded_model(rc);
+    if (!h) return rc;
+    const llama_vocab* vocab = llama_model_get_vocab(h->model);
+    const token_counter count = [vocab](const std::string& s) {
+        return tokenize(vocab, s, /*add_special*/false, /*parse_special*/false).size();
+    };
+
+    std::string text;
+    num_table_report rep;
+    num_encode_table(values, (size_t)rows, spec, count, text, rep);
+    if ((rc = write_out(text, out, outSize)) != 0) return rc;
+
+    if (reportJson && reportSize > 0) {
+        json_value v;
+        v.kind = json_value::OBJ;
+        jput_num(v, "rows",            rows);
+        jput_num(v, "tokens",          (double)rep.tokens);
+        jput_num(v, "baseline_tokens", (double)rep.baseline);
+        json_value colsv, saved;
+        colsv.kind = saved.kind = json_value::ARR;
+        for (size_t c = 0; c < spec.size(); ++c) {
+            json_value o;
+            o.kind = json_value::OBJ;
+            jput_str(o, "name",     spec[c].name.c_str());
+            jput_str(o, "encoding", num_encoding_name(rep.cols[c].enc));
+            json_value ref;   // full precision, unlike jput_num
+            ref.kind = json_value::NUM;
+            ref.num  = rep.cols[c].ref;
+            char b[32];
+            snprintf(b, sizeof(b), "%.12g", ref.num);
+            ref.str = b;
+            o.obj.emplace_back("ref", std::move(ref));
+            jput_num(o, "tokens",          (double)rep.cols[c].tokens);
+            jput_num(o, "baseline_tokens", (double)rep.cols[c].baseline);
+            colsv.arr.push_back(std::move(o));
+        }
+        for (int d : rep.row_saved) {
+            json_value e;
+            e.kind = json_value::NUM;
+            e.num  = d;
+            e.str  = std::to_string(d);
+            saved.arr.push_back(std::move(e));
+        }
+        v.obj.emplace_back("columns",   std::move(colsv));
+        v.obj.emplace_back("row_saved", std::move(saved));
+        std::string js;
+        json_dump(v, js);
+        if ((rc = write_out(js, reportJson, reportSize)) != 0) return rc;
+    }
+    return (int)text.size();
+}
+
+// ---------- geo ----------
+// No engine state and no locks.
+static_assert(LLM_GEO_DIST_M == GEO_DIST_M && LLM_GEO_POINTS == GEO_POINTS &&
+              LLM_GEO_COLUMNS == GEO_COLUMNS, "llm_bridge.h geo columns");
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_geo_aggregate(const double* pts, int n, double t0, double bucketS, int nBuckets,
+                      double stillMps, double maxGapS, float* out, int outLen) {
+    if (n < 0 || (n > 0 && !pts) || !out || nBuckets <= 0 || !(bucketS > 0)) return -3;
+    if (outLen < nBuckets * LLM_GEO_COLUMNS) return -32;
+    geo_params p;
+    p.t0        = t0;
+    p.bucket_s  = bucketS;
+    p.n_buckets = nBuckets;
+    p.still_mps = stillMps >= 0 ? stillMps : p.still_mps;
+    if (maxGapS > 0) p.max_gap_s = maxGapS;
+    return (int)geo_aggregate(pts, (size_t)n, p, out);
+}
+
+// The map index is built on the caller's thread and swapped in whole, like g_handle;
+// queries read whichever index is current without locking.
+static std::shared_ptr<const geo_index> g_geo_index;
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_geo_index_build(const double* pts, int n, int radiusPx, int maxZoom) {
+    if (n < 0 || (n > 0 && !pts) || radiusPx <= 0 || maxZoom < 0 || maxZoom > 24) return -3;
+    auto idx = std::make_shared<geo_index>();
+    const auto t0 = std::chrono::steady_clock::now();
+    idx->build(pts, (size_t)n, radiusPx, maxZoom);
+    LLOGI("geo index: %d points, zoom 0..%d, %lld ms", n, maxZoom,
+          (long long)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count());
+    std::atomic_store(&g_geo_index, std::shared_ptr<const geo_index>(idx));
+    return n;
+}
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_geo_clusters(double west, double south, double east, double north, int zoom,
+                     double* out, int maxItems) {
+    if (maxItems < 0 || (maxItems > 0 && !out)) return -3;
+    const auto idx = std::atomic_load(&g_geo_index);
+    if (!idx) return 0;
+    thread_local std::vector<geo_item> items;
+    const size_t total = idx->clusters(west, south, east, north, zoom, items);
+    const size_t m = std::min(total, (size_t)maxItems);
+    for (size_t i = 0; i < m; ++i) {
+        out[4 * i]     = items[i].lat;
+        out[4 * i + 1] = items[i].lng;
+        out[4 * i + 2] = items[i].count;
+        out[4 * i + 3] = items[i].id;
+    }
+    return (int)total;
+}
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_geo_polyline(double west, double south, double east, double north, int zoom,
+                     double* out, int maxPairs) {
+    if (maxPairs < 0 || (maxPairs > 0 && !out)) return -3;
+    const auto idx = std::atomic_load(&g_geo_index);
+    if (!idx) return 0;
+    thread_local std::vector<double> line;
+    const size_t total = idx->polyline(west, south, east, north, zoom, line);
+    std::copy(line.begin(), line.begin() + (ptrdiff_t)(2 * std::min(total, (size_t)maxPairs)), out);
+    return (int)total;
+}
+
+// Place index for reverse geocoding; mmapped, swapped in whole like the map index.
+static std::shared_ptr<const places_index> g_places;
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_places_build(const char* gazetteerPath, const char* indexPath, int minPopulation) {
+    if (!gazetteerPath || !*gazetteerPath || !indexPath || !*indexPath) return -3;
+    return (int)places_build(gazetteerPath, indexPath, std::max(0, minPopulation));
+}
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_places_open(const char* indexPath) {
+    if (!indexPath || !*indexPath) {
+        std::atomic_store(&g_places, std::shared_ptr<const places_index>());
+        return 0;
+    }
+    int rc = 0;
+    auto idx = places_index::open(indexPath, rc);
+    if (!idx) return rc;
+    LLOGI("places: opened %s (%zu places)", indexPath, idx->size());
+    std::atomic_store(&g_places, idx);
+    return (int)idx->size();
+}
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_places_nearest(double lat, double lng, int k, char* out, int outSize, float* distM) {
+    if (k <= 0 || !out || outSize <= 0 || !std::isfinite(lat) || !std::isfinite(lng)) return -3;
+    const auto idx = std::atomic_load(&g_places);
+    if (!idx) return -10;
+    place_hit hits[64];
+    const size_t found = idx->nearest(lat, lng, std::min<size_t>((size_t)k, 64), hits);
+    size_t used = 0, written = 0;
+    for (; written < found; ++written) {
+        const char*  nm  = idx->name(hits[written].id);
+        const size_t len = strlen(nm);
+        if (used + (written ? 1 : 0) + len + 1 > (size_t)outSize) break;
+        if (written) out[used++] = '\n';
+        memcpy(out + used, nm, len);
+        used += len;
+        if (distM) distM[written] = hits[written].dist_m;
+    }
+    out[used] = 0;
+    return found && !written ? -32 : (int)written;
+}
+
+// ---------- logs ----------
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_log_config(int minLevel, const char* filePath, int maxFileKb, int maxFiles) {
+    if (minLevel < LLM_LOG_DEBUG || minLevel > LLM_LOG_ERROR) return -3;
+    log_install();
+    log_set_level(minLevel);
+    const std::string path = filePath ? filePath : "";
+    if (!log_file(path, (size_t)std::max(0, maxFileKb) * 1024, maxFiles)) {
+        LLOGW("llm_log_config: cannot write %s", path.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_log_read(unsigned long long* cursor, char* out, int outSize) {
+    if (!cursor || !out || outSize < 1024) return -32;
+    uint64_t c = *cursor;
+    std::string s;
+    log_read(c, s, (size_t)outSize - 512);   // a line is at most ~330 bytes
+    *cursor = c;
+    const int n = (int)std::min(s.size(), (size_t)outSize - 1);
+    memcpy(out, s.data(), (size_t)n);
+    out[n] = '\0';
+    return n;
+}
+
+// ---------- metrics ----------
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_metrics(int format, char* out, int outSize) {
+    std::string s;
+    if (format == LLM_METRICS_JSON) metrics_json(s);
+    else if (format == LLM_METRICS_PROMETHEUS) metrics_prometheus(s);
+    else return -3;
+    return write_out(s, out, outSize);
+}
+
+// ---------- idle unload / stats ----------
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_set_idle_unload(int idleSeconds, int unloadModel, const char* cacheDir) {
+    {
+        engine_lock lock;
+        g_idle_s     = std::max(0, idleSeconds);
+        g_idle_model = unloadModel != 0;
+        g_cache_dir  = cacheDir ? cacheDir : "";
+        while (g_cache_dir.size() > 1 && g_cache_dir.back() == '/') g_cache_dir.pop_back();
+    }
+    // outside g_mutex: restarting joins the timer thread, which may be waiting for it
+    g_idle.start(std::max(0, idleSeconds), on_idle);
+    return 0;
+}
+
+LLM_EXTERN_C LLM_EXPORT_ATTR
+int llm_stats(char* outJson, int outSize) {
+    engine_stats st;
+    {
+        std::lock_guard<std::mutex> lock(g_snap_mu);
+        st = g_snap;
+    }
+    json_value v;
+    v.kind = json_value::OBJ;
+    jput_str(v, "state", st.state);
+    jput_num(v, "idle_s",                 st.inited ? std::floor(g_idle.idle_seconds()) : 0);
+    jput_num(v, "idle_timeout_s",         st.idle_timeout_s);
+    jput_num(v, "cold_load_ms",           st.r.cold_ms);
+    jput_num(v, "prewarm_pending",        st.prewarmed ? 1 : 0);
+    jput_num(v, "unloads",                st.r.n_unloads);
+    jput_num(v, "reloads",                st.r.n_reloads);
+    jput_num(v, "last_unload_ms",         st.r.unload_ms);
+    jput_num(v, "last_reload_ms",         st.r.reload_ms);
+    jput_num(v, "restored_prefix_tokens", (double)st.r.restored_tokens);
+    jput_num(v, "reused_prompt_tokens",   (double)st.r.reused_tokens);
+    jput_num(v, "kv_tokens",              (double)st.kv_tokens);
+    jput_num(v, "sessions",               st.sessions);
+    jput_num(v, "kv_fragmentation",       st.frag);
+    jput_num(v, "kv_compactions",         (double)st.compactions);
+    jput_num(v, "last_compact_ms",        st.last_compact.ms);
+    jput_num(v, "last_compact_bytes",     (double)st.last_compact.bytes_moved);
+    jput_num(v, "paged_sessions",         st.paged);
+    jput_num(v, "page_file_mb",           st.page_file / (1024.0 * 1024.0));
+    jput_num(v, "page_outs",              (double)st.p.outs);
+    jput_num(v, "page_ins",               (double)st.p.ins);
+    jput_num(v, "page_drops",             (double)st.p.dropped);
+    jput_num(v, "page_out_mb",            st.p.bytes_out / (1024.0 * 1024.0));
+    jput_num(v, "page_in_mb",             st.p.bytes_in / (1024.0 * 1024.0));
+    jput_num(v, "page_out_mb_s",          st.p.ms_out > 0 ? st.p.bytes_out / 1024.0 / st.p.ms_out * 1000.0 / 1024.0 : 0);
+    jput_num(v, "page_in_mb_s",           st.p.ms_in > 0 ? st.p.bytes_in / 1024.0 / st.p.ms_in * 1000.0 / 1024.0 : 0);
+    jput_num(v, "coalesced_requests",     (double)g_flights.coalesced());
+    jput_num(v, "pool_idle",              st.pool.idle);
+    jput_num(v, "pool_mb",                st.pool.bytes / (1024.0 * 1024.0));
+    jput_num(v, "pool_hits",              (double)st.pool.hits);
+    jput_num(v, "pool_misses",            (double)st.pool.misses);
+    std::string out;
+    json_dump(v, out);
+    return write_out(out, outJson, outSize);
+}
+
 LLM_EXTERN_C LLM_EXPORT_ATTR
 void llm_dispose(void) {
-    std::lock_guard<std::mutex> lock(g_mutex);
+    g_idle.stop();
+    std::thread filler, prewarm;
+    {
+        engine_lock lock;
+        g_pool_stop    = true;
+        g_prewarm_stop = true;
+        filler  = std::move(g_pool_thread);
+        prewarm = std::move(g_prewarm_thread);
+    }
+    // both need g_mutex to see their stop flag; a prewarm already loading finishes and
+    // is freed below
+    if (filler.joinable()) filler.join();
+    if (prewarm.joinable()) prewarm.join();
+    engine_lock lock;
+    if (g_ctx) save_prefix();  // the next cold start begins warm
+    if (g_model) tok_cache_save(g_tok_cache, cache_path(".toks"), g_model_key);
+    grammar_reset_masks();
+    g_tokens = token_table();
+    g_tok_cache.entries.clear();
+    g_main = kv_seq();
+    {
+        std::lock_guard<std::mutex> slock(g_sess_mu);
+        g_sessions.clear();
+        g_closed.clear();
+    }
+    g_pager.close();
+    g_layout.reset(0);
+    g_inited     = false;
+    g_prewarmed  = false;
+    free_emb_ctx();
     if (g_ctx)   { llama_free(g_ctx);         g_ctx   = nullptr; }
-    if (g_model) { llama_model_free(g_model); g_model = nullptr; }
-    llama_backend_free();
+    g_pool.clear();
+    if (g_batch.token) { llama_batch_free(g_batch); g_batch = {}; }
+    release_model();
+    std::atomic_store(&g_meta, std::shared_ptr<const model_meta>());
+    // a running requant job still needs the backend
+    if (requant_poll(nullptr, nullptr, nullptr) != LLM_REQUANT_RUNNING) llama_backend_free();
+    g_pool_stop    = false;
+    g_prewarm_stop = false;
     LLOGI("llm_dispose: freed");
 }
 
+#if defined(__ANDROID__)
 // ---------- JNI sanity probe ----------
 extern "C"
 JNIEXPORT jstring JNICALL
@@ -202,3 +2695,4 @@ __attribute__((constructor))
 static void on_load() {
     __android_log_print(ANDROID_LOG_INFO, "LLM_BRIDGE", ">>>> libllama_android.so loaded");
 }
+#endif // __ANDROID__
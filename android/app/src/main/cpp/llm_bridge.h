@@ -3,14 +3,301 @@
 extern "C" {
 #endif
 
-// Returns 0 on success
+// Returns 0 on success. Adopts a model already loaded by llm_prewarm with the same path.
 int llm_init(const char* modelPath, int n_ctx, int n_gpu_layers, int n_threads, int seed);
 
-// paramsJson supports keys: temperature, top_p, top_k, repeat_penalty, max_tokens
+// Starts loading modelPath (readahead, mmap, context) on a background thread so that
+// a later llm_init with the same path returns at once. For hosts that know the model
+// before the UI asks for it. Returns 0 if started, -1 if the file is not readable.
+int llm_prewarm(const char* modelPath, int n_ctx, int n_gpu_layers, int n_threads);
+
+// paramsJson supports keys: temperature, top_p, top_k, repeat_penalty, max_tokens,
+// grammar (id from llm_grammar_compile; output is constrained to that schema),
+// json (1 = validate output as JSON while generating; stops at the end of the value),
+// json_stop_on_error (1 = also stop at the first syntax error; by default invalid output
+// runs on and is only reported), json_indent (re-indent valid JSON output, in spaces),
+// stop (string or array of strings: output ends before the first one; streamed text
+// never includes a prefix of one that might still complete),
+// output_ids / logprobs / top_logprobs (0..20) (llm_infer_ex only, see LLM_SIDE_TOKENS)
+// coalesce (default 1; 0 = never share a generation with an identical in-flight request)
+// session (id from llm_session_open/fork; its KV is kept between requests; -41 if unknown)
+// template (id from llm_template_register; the prompt is ignored and may be NULL; -42 if
+// unknown) with slots ({"name": "value", ...}; -43 if one is missing or refused, see
+// llm_template_register)
 // Writes UTF-8 into outBuf (NUL-terminated) up to outBufSize bytes.
 // Returns 0 on success
 int llm_infer(const char* prompt, const char* paramsJson, char* outBuf, int outBufSize);
 
+// ---------- side buffer ----------
+// Little-endian. Header (16 bytes): u32 magic, u16 version, u16 section count,
+// u32 bytes used, u32 flags. Then sections of: u32 tag, u32 payload size, payload.
+#define LLM_SIDE_MAGIC     0x534D4C4Cu /* "LLMS" */
+#define LLM_SIDE_VERSION   1
+#define LLM_SIDE_TRUNCATED 0x1u        /* a section (or part of it) did not fit */
+
+// "json": i32 status (0 valid, 1 incomplete, 2 syntax error), i32 offset (first bad
+// byte, or end of the value in the raw output), then the parsed value as a preorder
+// binary tree (json_tree_type layout in llm_json.h); the tree is left out if it does not fit.
+#define LLM_SIDE_JSON      0x4E4F534Au /* "JSON" */
+
+// "TOKS": u32 count, u16 top_n, u16 flags, then `count` records for the generated
+// tokens: i32 id, [f32 logprob, top_n x (i32 id, f32 logprob) when LLM_TOK_LOGPROB].
+// Log-probabilities are normalised over the top max(top_n, 40) logits only.
+#define LLM_SIDE_TOKENS    0x534B4F54u /* "TOKS" */
+#define LLM_TOK_LOGPROB    0x1u
+
+// llm_infer plus structured results in sideBuf (may be NULL); sections depend on paramsJson.
+int llm_infer_ex(const char* prompt, const char* paramsJson, char* outBuf, int outBufSize,
+                 unsigned char* sideBuf, int sideBufSize);
+
+// ---------- batches ----------
+// Runs n prompts together: the token prefix they all share is decoded once, the rest of
+// each prompt is prefilled in one batch and generation steps decode every item at once.
+// paramsJson is NULL or n entries (NULL = defaults) with max_tokens, grammar, json,
+// json_indent, stop, template and slots as in llm_infer. Output i goes to
+// outSlots + i * slotSize (NUL-terminated, truncated to the slot) and status[i] (may be
+// NULL) receives 0 or the item's error.
+// statsJson (may be NULL): items, waves, steps, shared_prefix_tokens, prompt_tokens,
+// prefill_tokens, gen_tokens, ms, and results[] of {status, prompt_tokens, gen_tokens, ms}.
+// Returns 0 when the batch ran (see status), or an llm_infer error for the whole call.
+int llm_infer_batch(const char* const* prompts, const char* const* paramsJson, int n,
+                    char* outSlots, int slotSize, int* status, char* statsJson, int statsSize);
+
+// ---------- choices ----------
+// Scores n candidate answers to the prompt instead of generating one: nothing is sampled.
+// Candidates are tokenized as they would follow the prompt text (include the leading
+// space a model would write, e.g. " yes") and decoded together after the prompt, a
+// prefix they share only once.
+// probs (may be NULL) receives n probabilities over the candidate set that sum to 1: at
+// each token the model is restricted to the tokens that continue some candidate.
+// paramsJson (may be NULL): template and slots as in llm_infer; temperature (scales the
+// log-probabilities, default 1); prior ([n] probabilities to divide out); calibrate (with
+// a template: the prior is the candidates' probability with every slot set to "N/A", or
+// to the given string, computed once and cached).
+// statsJson (may be NULL): index, probs[], logprobs[] (before calibration), prior[],
+// coverage (share of the model's next-token mass after the prompt on the candidates'
+// first tokens; low means the prompt does not lead to any of them), prompt_tokens,
+// decoded_tokens, waves, ms.
+// Returns the index of the most probable candidate, or an llm_infer error.
+int llm_choose(const char* prompt, const char* paramsJson, const char* const* choices, int n,
+               float* probs, char* statsJson, int statsSize);
+
+// ---------- prompt templates ----------
+// Registers prompt text with {{name}} slots for requests that pass "template": id and
+// "slots" in paramsJson. The static text is tokenized here (or on first use if no model
+// is loaded yet); a request tokenizes only the slot values plus the few bytes of static
+// text next to them that could merge with them, and splices the tokens in. The result is
+// the tokenization of the filled-in text, except that slot values never turn into
+// special tokens. Vocabs that prefix every tokenization with a space (SPM) splice at the
+// template's special tokens instead; where even that is not possible the filled-in text
+// is tokenized whole and a request whose slot values hold special token text fails with
+// -43. Returns an id > 0, or -3 with a message in errBuf (may be NULL).
+int llm_template_register(const char* text, char* errBuf, int errBufSize);
+// Returns 0, or -42 if id is unknown.
+int llm_template_free(int id);
+
+// Compiles a JSON Schema into a token-level automaton, cached by schema hash
+// (compiling the same schema again is free). Returns a grammar id > 0 to pass as
+// "grammar" in paramsJson, or < 0 on error with a message in errBuf (may be NULL).
+int llm_grammar_compile(const char* schemaJson, char* errBuf, int errBufSize);
+
+// Model metadata as JSON: path, desc, ftype, size, n_params, n_vocab, n_ctx_train,
+// n_embd, n_layer. modelPath NULL/"" describes the loaded model; otherwise the file is
+// mapped just long enough to read it. Returns 0, or -32 if outJson is too small.
+int llm_model_info(const char* modelPath, char* outJson, int outSize);
+
+// ---------- streaming / chat / embeddings ----------
+// llm_chat_prompt, llm_embed, llm_token_count, llm_model_info, llm_stats and llm_metrics
+// do not wait for a running generation (embeddings use their own context); only
+// reloading a model that was unloaded for idleness does.
+// Receives generated text as it is produced, split only at UTF-8 character boundaries.
+// Return nonzero to stop generation.
+typedef int (*llm_piece_cb)(const char* piece, int len, void* user);
+
+// Same params as llm_infer; text goes to cb instead of a buffer (the json check still
+// applies, side results are not produced). usage, if non-NULL, receives
+// {prompt tokens, generated tokens}.
+// cb runs on a delivery thread: the decode loop copies pieces into a ring buffer of
+// stream_buffer bytes (paramsJson, default 16384) and never calls cb itself. A consumer
+// that falls behind gets what accumulated in one call. When the ring is full,
+// stream_policy decides (LLM_STREAM_*). Returns once cb has had everything.
+#define LLM_STREAM_SPILL 0   /* default: keep the text aside, hand it over as room frees up */
+#define LLM_STREAM_BLOCK 1   /* wait for room: generation runs at the consumer's pace */
+#define LLM_STREAM_DROP  2   /* discard it; the consumer misses that text (stream_dropped metric) */
+int llm_infer_stream(const char* prompt, const char* paramsJson, llm_piece_cb cb, void* user, int* usage);
+
+// llm_infer_stream on a thread of its own; returns a stream id (> 0) at once. piece is
+// malloc'd, NUL-terminated and owned by the callee (free() it), so cb may be called
+// asynchronously (Dart NativeCallable.listener). The last call has piece NULL and len
+// set to the request's result (0 or an llm_infer error).
+typedef void (*llm_stream_cb)(int stream, char* piece, int len, void* user);
+int llm_stream_start(const char* prompt, const char* paramsJson, llm_stream_cb cb, void* user);
+// Stops generation before its next token. Returns 0, or -44 if the stream has ended.
+int llm_stream_cancel(int stream);
+
+// Renders a JSON array of {"role","content"} messages with the model's chat template
+// (chatml if it has none), ready for llm_infer. -33 if the template is unsupported.
+int llm_chat_prompt(const char* messagesJson, char* outBuf, int outBufSize);
+
+// L2-normalised mean-pooled embedding of text (first 512 tokens). Returns the dimension
+// (text NULL: just the dimension), or -32 when outDim is smaller than that.
+int llm_embed(const char* text, float* out, int outDim);
+
+// Number of tokens text encodes to as a prompt (BOS and special tokens included).
+int llm_token_count(const char* text);
+
+// ---------- prompt tables ----------
+// Writes a rows x cols table of doubles (row-major, NaN = empty cell) as compact CSV
+// for a prompt, picking per column the format with the fewest tokens under the loaded
+// vocab: plain fixed-point, integer steps from a reference, or integer steps from the
+// previous row. A "# ..." line first says how to read the columns that need it.
+// columnsJson: array of cols {"name", "kind": "number"|"time" (unix seconds, shown in
+// UTC), "step"}: the precision needed (default 0.01, time 60 s).
+// reportJson (may be NULL): rows, tokens, baseline_tokens (plain fixed-point and
+// "YYYY-MM-DD HH:MM:SS" cells), columns[] of {name, encoding (abs|ref|delta), ref,
+// tokens, baseline_tokens} and row_saved[] (tokens saved by each row).
+// Returns the bytes written to out, -3 on bad arguments or -32 if a buffer is too small.
+int llm_encode_table(const double* values, int rows, int cols, const char* columnsJson,
+                     char* out, int outSize, char* reportJson, int reportSize);
+
+// ---------- requantization (background job, one at a time) ----------
+#define LLM_REQUANT_IDLE      0
+#define LLM_REQUANT_RUNNING   1
+#define LLM_REQUANT_DONE      2
+#define LLM_REQUANT_FAILED    3
+#define LLM_REQUANT_CANCELLED 4
+
+// Requantizes srcPath into dstPath (NULL = replace srcPath) via a temp file that is
+// verified with llm_model_info and then renamed over the destination.
+// ftype < 0 picks the best llama_ftype whose weights + nCtx KV cache fit budgetMb.
+// Returns 0 when started, -1 if a job is already running.
+int  llm_requant_start(const char* srcPath, const char* dstPath, int budgetMb, int nCtx, int ftype, int nThreads);
+// Returns LLM_REQUANT_*; progress 0..1, chosen ftype and the last message
+// (model info JSON when done) are written to the non-NULL arguments.
+int  llm_requant_poll(float* progress, int* ftype, char* msgBuf, int msgBufSize);
+// Stops at the next tensor boundary; the temp file is removed.
+void llm_requant_cancel(void);
+
+// ---------- idle unload ----------
+// After idleSeconds without a request (0 disables) the context is freed, and with
+// unloadModel the model too; the next call reloads transparently. Warm-start caches
+// (piece table, recent prompt tokens, KV state of the last prompt) are written to
+// cacheDir, NULL/"" = next to the model file. Callable before or after llm_init.
+int llm_set_idle_unload(int idleSeconds, int unloadModel, const char* cacheDir);
+
+// ---------- sessions / KV compaction ----------
+// A session is its own sequence in the engine's KV cache, kept between requests that
+// pass "session": id; requests without one use the default sequence. Up to 7 sessions
+// (-40 when none is free). Fork copies a session (0 = the default sequence) sharing its
+// cells. Returns the session id (> 0) or a negative error.
+int llm_session_open(void);
+int llm_session_fork(int session);
+int llm_session_close(int session);
+
+// Rewrites all sequences densely from the start of the KV cache. With outJson, writes
+// fragmentation_before/after (estimated holes / used span), bytes_moved, ms, sequences
+// and dropped (sequences that no longer fit; they re-decode on next use).
+int llm_kv_compact(char* outJson, int outSize);
+// Compacts before a request whenever the estimated fragmentation exceeds threshold
+// (0..1, default 0.5; 0 = only when a decode finds no free slot).
+int llm_kv_set_compact_threshold(float threshold);
+
+// Spills the KV state of the sessions idle the longest to an mmapped page file whenever
+// the resident cells would exceed maxResidentTokens (0 = n_ctx), and pages them back on
+// their next request. Cells shared with a resident sequence (e.g. the system prompt in the
+// default sequence) stay out of the file and are re-shared on page-in. Idle unload pages
+// out every session instead of dropping it. pageFile NULL/"" = next to the other caches.
+// enable 0 closes the file; sessions that were paged out decode their prompt again.
+int llm_kv_paging(int enable, int maxResidentTokens, const char* pageFile);
+
+// ---------- context pool ----------
+// Keeps one warm standby context per size in sizes[] (created in the background, one
+// decode done, KV cleared) and reuses contexts that are given back instead of freeing
+// them, as long as everything idle in the pool fits budgetMb. A checkout takes the
+// smallest idle context with n_ctx between the request and twice that. budgetMb 0
+// (the default) disables pooling. Idle unload and llm_dispose empty the pool.
+int llm_pool_configure(const int* sizes, int nSizes, int budgetMb);
+
+// ---------- geo: location history ----------
+// A series is n packed (t, lat, lng) double triples: unix seconds and degrees, ascending t.
+
+// Per-bucket aggregates of a series over nBuckets buckets of bucketS seconds from t0,
+// written column after column: out[col * nBuckets + b] for the LLM_GEO_* columns
+// (outLen >= nBuckets * LLM_GEO_COLUMNS). Segments slower than stillMps count as
+// stationary; segments longer than maxGapS (0 = 900) add distance but no time.
+// Returns the number of points inside the range, -3 on bad arguments, -32 if out is short.
+#define LLM_GEO_DIST_M   0   /* metres travelled */
+#define LLM_GEO_MOVING_S 1   /* seconds moving */
+#define LLM_GEO_STILL_S  2   /* seconds stationary */
+#define LLM_GEO_ROG_M    3   /* radius of gyration, metres */
+#define LLM_GEO_POINTS   4   /* points in the bucket */
+#define LLM_GEO_COLUMNS  5
+int llm_geo_aggregate(const double* pts, int n, double t0, double bucketS, int nBuckets,
+                      double stillMps, double maxGapS, float* out, int outLen);
+
+// Map index over a series for drawing it: markers clustered per zoom level (within
+// radiusPx pixels of 256 px tiles, zoom 0..maxZoom; above maxZoom every point is its own
+// marker) and the track simplified to about a pixel per zoom. Replaces the previous
+// index; queries running meanwhile finish on the old one. Returns n, or -3.
+int llm_geo_index_build(const double* pts, int n, int radiusPx, int maxZoom);
+// Markers inside the box (degrees; west > east crosses the antimeridian) at zoom, as
+// (lat, lng, count, id) quads: id is the point's index in the series when count is 1, else
+// the index of one of the cluster's points. Writes at most maxItems and returns how many
+// there are in the box (0 without an index).
+int llm_geo_clusters(double west, double south, double east, double north, int zoom,
+                     double* out, int maxItems);
+// The simplified track where it crosses the box as (lat, lng) pairs, runs separated by
+// a (NaN, NaN) pair. Writes at most maxPairs and returns the number of pairs in the box.
+int llm_geo_polyline(double west, double south, double east, double north, int zoom,
+                     double* out, int maxPairs);
+
+// ---------- geo: places (offline reverse geocoding) ----------
+// Compiles a tab-separated gazetteer (a GeoNames dump such as cities15000.txt, or
+// "name<TAB>lat<TAB>lng[<TAB>country]" lines) into a compact index file; GeoNames places
+// below minPopulation are skipped. Returns the number of places, -1 if a file cannot be
+// read or written, -3 if nothing parsed.
+int llm_places_build(const char* gazetteerPath, const char* indexPath, int minPopulation);
+// Maps an index file read-only and makes it current (NULL closes it). Queries running
+// meanwhile finish on the previous one. Returns the number of places, -1 or -3.
+int llm_places_open(const char* indexPath);
+// The k (<= 64) places nearest to lat/lng, nearest first, as "Name, CC" lines in out
+// (NUL-terminated; places that do not fit are left out) with great-circle metres in
+// distM (may be NULL). Returns the number of places written, -10 without an index, or
+// -32 if not even the first fits.
+int llm_places_nearest(double lat, double lng, int k, char* out, int outSize, float* distM);
+
+// ---------- logs ----------
+#define LLM_LOG_DEBUG 0
+#define LLM_LOG_INFO  1
+#define LLM_LOG_WARN  2
+#define LLM_LOG_ERROR 3
+// llama/ggml and bridge messages at minLevel and above are kept in an in-memory ring
+// (the last 1024 lines). With filePath they are also appended to that file once a second
+// by a background thread, rotated to filePath.1 .. filePath.<maxFiles-1> past maxFileKb.
+// filePath NULL stops the file. Default: LLM_LOG_INFO, no file.
+int llm_log_config(int minLevel, const char* filePath, int maxFileKb, int maxFiles);
+// Lines newer than *cursor (start with 0), one per line: "date time L tid tag: text".
+// *cursor is advanced past what was returned; call again while the result is non-zero.
+// Returns the number of bytes written (NUL-terminated), or -32 if outSize < 1024.
+int llm_log_read(unsigned long long* cursor, char* out, int outSize);
+
+// ---------- metrics ----------
+#define LLM_METRICS_JSON       0
+#define LLM_METRICS_PROMETHEUS 1
+// Snapshot of the request/token/cache/eviction counters, queue depth and the latency
+// histograms (queue wait, TTFT, per token, request). Recording is per thread and
+// lock-free; this call sums the threads and never takes the engine lock.
+// Returns 0, -3 for an unknown format, or -32 if out is too small.
+int llm_metrics(int format, char* out, int outSize);
+
+// Engine stats as JSON: state (none|ready|ctx_unloaded|unloaded), idle_s, cold_load_ms,
+// prewarm_pending, unloads, reloads, last_unload_ms, last_reload_ms,
+// restored_prefix_tokens, reused_prompt_tokens, kv_tokens, coalesced_requests, pool_idle,
+// pool_mb, pool_hits, pool_misses, sessions, kv_fragmentation, kv_compactions,
+// last_compact_ms, last_compact_bytes, paged_sessions, page_file_mb, page_outs, page_ins,
+// page_drops, page_out_mb, page_in_mb, page_out_mb_s, page_in_mb_s. Returns 0, or -32 if outJson is too small.
+int llm_stats(char* outJson, int outSize);
+
 // Free global context/model
 void llm_dispose(void);
 
@@ -0,0 +1,108 @@
+// llm_choice.cpp — candidate trie, restricted log-probabilities, calibration
+#include "llm_choice.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace {
+
+double logsumexp(const float* v, size_t n) {
+    float m = -INFINITY;
+    for (size_t i = 0; i < n; ++i) m = std::max(m, v[i]);
+    if (!std::isfinite(m)) return m;
+    double s = 0;
+    for (size_t i = 0; i < n; ++i) s += std::exp((double)(v[i] - m));
+    return (double)m + std::log(s);
+}
+
+} // namespace
+
+void choice_build(const std::vector<std::vector<llama_token>>& cands, choice_trie& t) {
+    t = choice_trie();
+    t.nodes.emplace_back();
+    t.leaf.assign(cands.size(), 0);
+    t.order.resize(cands.size());
+    std::iota(t.order.begin(), t.order.end(), 0);
+    std::stable_sort(t.order.begin(), t.order.end(), [&](int a, int b) { return cands[(size_t)a] < cands[(size_t)b]; });
+
+    for (int c : t.order) {
+        int at = 0;
+        for (llama_token tok : cands[(size_t)c]) {
+            int next = -1;
+            for (int k : t.nodes[(size_t)at].kids)
+                if (t.nodes[(size_t)k].tok == tok) { next = k; break; }
+            if (next < 0) {
+                next = (int)t.nodes.size();
+                choice_trie::node n;
+                n.tok    = tok;
+                n.parent = at;
+                n.depth  = t.nodes[(size_t)at].depth + 1;
+                t.nodes.push_back(n);
+                t.nodes[(size_t)at].kids.push_back(next);
+            }
+            at = next;
+        }
+        t.nodes[(size_t)at].ends.push_back(c);
+        t.leaf[(size_t)c] = at;
+    }
+}
+
+void choice_take_logits(choice_trie& t, int i, const float* logits, int n_vocab) {
+    choice_trie::node& n = t.nodes[(size_t)i];
+    n.kid_logit.resize(n.kids.size());
+    for (size_t k = 0; k < n.kids.size(); ++k) {
+        const llama_token tok = t.nodes[(size_t)n.kids[k]].tok;
+        n.kid_logit[k] = tok >= 0 && tok < n_vocab ? logits[tok] : -INFINITY;
+    }
+    if (t.needs_lse(i)) n.lse = logsumexp(logits, (size_t)n_vocab);
+    n.scored = true;
+}
+
+void choice_logprobs(const choice_trie& t, std::vector<double>& out) {
+    // per node: log of the probability of stepping into it from its parent
+    std::vector<double> step(t.nodes.size(), 0.0), end_lp(t.nodes.size(), 0.0);
+    for (size_t i = 0; i < t.nodes.size(); ++i) {
+        const choice_trie::node& n = t.nodes[i];
+        if (n.kids.empty()) continue;
+        const bool full = i != 0 && !n.ends.empty();
+        const double z = full ? n.lse : logsumexp(n.kid_logit.data(), n.kid_logit.size());
+        double cont = 0;
+        for (size_t k = 0; k < n.kids.size(); ++k) {
+            step[(size_t)n.kids[k]] = (double)n.kid_logit[k] - z;
+            cont += std::exp(step[(size_t)n.kids[k]]);
+        }
+        if (full) end_lp[i] = std::log(std::max(1e-12, 1.0 - cont));
+    }
+    out.assign(t.leaf.size(), 0.0);
+    for (size_t c = 0; c < t.leaf.size(); ++c) {
+        const int leaf = t.leaf[c];
+        double lp = end_lp[(size_t)leaf] - std::log((double)t.nodes[(size_t)leaf].ends.size());
+        for (int at = leaf; at > 0; at = t.nodes[(size_t)at].parent) lp += step[(size_t)at];
+        out[c] = lp;
+    }
+}
+
+double choice_coverage(const choice_trie& t) {
+    const choice_trie::node& root = t.nodes[0];
+    if (!root.scored) return 0;
+    double p = 0;
+    for (float l : root.kid_logit) p += std::exp((double)l - root.lse);
+    return std::min(1.0, p);
+}
+
+void choice_calibrate(const std::vector<double>& logp, const std::vector<double>* prior, double temperature,
+                      std::vector<double>& probs) {
+    const double inv_t = temperature > 0 ? 1.0 / temperature : 1.0;
+    probs.resize(logp.size());
+    double m = -INFINITY;
+    for (size_t i = 0; i < logp.size(); ++i) {
+        double l = logp[i];
+        if (prior && i < prior->size()) l -= std::log(std::max(1e-12, (*prior)[i]));
+        probs[i] = l * inv_t;
+        m = std::max(m, probs[i]);
+    }
+    double s = 0;
+    for (double& p : probs) s += (p = std::isfinite(m) ? std::exp(p - m) : 1.0);
+    for (double& p : probs) p /= s;
+}
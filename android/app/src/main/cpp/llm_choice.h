@@ -0,0 +1,50 @@
+// llm_choice.h — scoring a fixed set of answers instead of generating one
+#pragma once
+#include <cstddef>
+#include <vector>
+
+#include "llama.h"
+
+// The candidates' token sequences merged into a trie. Node 0 is the end of the prompt;
+// every other node is one candidate token at position prompt_len + depth - 1. A node's
+// logits are only needed if it has children, and candidates that share a prefix share
+// its nodes, so each distinct prefix is decoded once.
+struct choice_trie {
+    struct node {
+        llama_token        tok    = -1;
+        int                parent = -1;
+        int                depth  = 0;
+        std::vector<int>   kids;
+        std::vector<int>   ends;           // candidates whose last token this is
+        std::vector<float> kid_logit;      // per kids[i], once scored
+        double             lse    = 0;     // log-sum-exp over the vocab (root, and ends with kids)
+        bool               scored = false;
+    };
+    std::vector<node> nodes;
+    std::vector<int>  leaf;                // per candidate: its last node
+    std::vector<int>  order;               // candidates in trie order (shared prefixes adjacent)
+
+    bool needs_lse(int i) const { return i == 0 || !nodes[(size_t)i].ends.empty(); }
+};
+
+// Every candidate must have at least one token.
+void choice_build(const std::vector<std::vector<llama_token>>& cands, choice_trie& t);
+
+// Keeps what scoring needs from the logits that follow node i: its children's logits and,
+// where needs_lse(i), one pass over the vocab for the normaliser.
+void choice_take_logits(choice_trie& t, int i, const float* logits, int n_vocab);
+
+// Log-probability of each candidate with the model restricted to the candidate set: at
+// each branch the children are renormalised among themselves, so the results sum to 1.
+// Where a candidate ends at a node others continue from, "ends here" gets the vocab mass
+// that does not go to a continuation. Every node with children must be scored.
+void choice_logprobs(const choice_trie& t, std::vector<double>& out);
+
+// Share of the model's next-token mass after the prompt that starts some candidate.
+double choice_coverage(const choice_trie& t);
+
+// probs[i] ~ exp((logp[i] - log prior[i]) / temperature), normalised. prior (may be null)
+// is the candidates' probability for a content-free input: dividing it out removes the
+// model's bias towards particular labels.
+void choice_calibrate(const std::vector<double>& logp, const std::vector<double>* prior, double temperature,
+                      std::vector<double>& probs);
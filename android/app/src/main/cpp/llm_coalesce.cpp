@@ -0,0 +1,91 @@
+// llm_coalesce.cpp — flight_table
+#include "llm_coalesce.h"
+
+std::shared_ptr<flight> flight_table::join(const std::string& ident, bool& leader) {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto it = live_.find(ident);
+    if (it != live_.end()) {
+        ++it->second->followers;
+        ++coalesced_;
+        leader = false;
+        return it->second;
+    }
+    auto f = std::make_shared<flight>();
+    live_.emplace(ident, f);
+    leader = true;
+    return f;
+}
+
+void flight_table::append(flight& f, const char* piece, size_t n) {
+    {
+        std::lock_guard<std::mutex> lock(f.mu);
+        f.text.append(piece, n);
+    }
+    f.cv.notify_all();
+}
+
+bool flight_table::may_stop(const std::string& ident, const std::shared_ptr<flight>& f) {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (f->followers > 0) return false;
+    // truncated output must not be handed to anyone who shows up later
+    auto it = live_.find(ident);
+    if (it != live_.end() && it->second == f) live_.erase(it);
+    return true;
+}
+
+void flight_table::finish(const std::string& ident, const std::shared_ptr<flight>& f, int rc,
+                          std::string final_text, const uint8_t* side, size_t side_n, const int usage[2]) {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        auto it = live_.find(ident);
+        if (it != live_.end() && it->second == f) live_.erase(it);
+    }
+    {
+        std::lock_guard<std::mutex> lock(f->mu);
+        f->rc         = rc;
+        f->final_text = std::move(final_text);
+        if (side && side_n) f->side.assign(side, side + side_n);
+        f->usage[0]   = usage[0];
+        f->usage[1]   = usage[1];
+        f->done       = true;
+    }
+    f->cv.notify_all();
+}
+
+int flight_table::wait(const std::shared_ptr<flight>& f) {
+    {
+        std::unique_lock<std::mutex> lock(f->mu);
+        f->cv.wait(lock, [&] { return f->done; });
+    }
+    leave(f);
+    return f->rc;
+}
+
+void flight_table::leave(const std::shared_ptr<flight>& f) {
+    std::lock_guard<std::mutex> lock(mu_);
+    --f->followers;
+}
+
+int flight_table::stream(const std::shared_ptr<flight>& f, llm_piece_cb cb, void* user, int* usage) {
+    size_t      sent = 0;
+    std::string chunk;
+    for (;;) {
+        bool done;
+        {
+            std::unique_lock<std::mutex> lock(f->mu);
+            f->cv.wait(lock, [&] { return f->done || f->text.size() > sent; });
+            chunk.assign(f->text, sent, std::string::npos);
+            sent = f->text.size();
+            done = f->done;
+            if (done && usage) { usage[0] = f->usage[0]; usage[1] = f->usage[1]; }
+        }
+        // replayed backlog and live pieces alike, outside the lock
+        if (!chunk.empty() && cb(chunk.data(), (int)chunk.size(), user) != 0) {
+            leave(f);
+            return 0;
+        }
+        if (done) break;
+    }
+    leave(f);
+    return f->rc;
+}
@@ -0,0 +1,57 @@
+// llm_coalesce.h — identical in-flight requests share one generation
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "llm_bridge.h"
+
+// One generation and everything its followers need to replay it.
+struct flight {
+    std::mutex              mu;
+    std::condition_variable cv;
+    std::string             text;        // streamed so far, UTF-8-complete pieces in order
+    std::string             final_text;  // what the leader returned (json_indent applied); set when done
+    std::vector<uint8_t>    side;        // the leader's side buffer, bytes used; set when done
+    int                     usage[2] = {0, 0};
+    int                     rc       = 0;
+    bool                    done     = false;
+
+    int                     followers = 0;  // guarded by the table lock
+};
+
+// Keyed by the exact request identity (prompt, params, output limits). The first request
+// for a key leads and registers a flight; identical requests arriving before it finishes
+// follow it instead of decoding themselves.
+class flight_table {
+public:
+    std::shared_ptr<flight> join(const std::string& ident, bool& leader);
+
+    // Leader side.
+    void append(flight& f, const char* piece, size_t n);
+    // The leader's own consumer wants to stop. True if nobody else is listening (the flight
+    // is then closed to newcomers); false means keep generating for the followers.
+    bool may_stop(const std::string& ident, const std::shared_ptr<flight>& f);
+    void finish(const std::string& ident, const std::shared_ptr<flight>& f, int rc,
+                std::string final_text, const uint8_t* side, size_t side_n, const int usage[2]);
+
+    // Follower side: blocks until done. Returns the leader's rc.
+    int wait(const std::shared_ptr<flight>& f);
+    // Streams the flight into cb from the first byte on, then waits for the end. A nonzero
+    // return from cb detaches this follower. Returns the leader's rc (0 when detached).
+    int stream(const std::shared_ptr<flight>& f, llm_piece_cb cb, void* user, int* usage);
+
+    uint64_t coalesced() const { return coalesced_.load(); }
+
+private:
+    void leave(const std::shared_ptr<flight>& f);
+
+    std::mutex                                               mu_;
+    std::unordered_map<std::string, std::shared_ptr<flight>> live_;
+    std::atomic<uint64_t>                                    coalesced_{0};
+};
@@ -0,0 +1,107 @@
+// llm_ctx_pool.cpp — ctx_pool
+#include "llm_ctx_pool.h"
+
+#include <algorithm>
+
+#include "llm_log.h"
+
+size_t ctx_pool::estimate_bytes(const llama_model* model, int n_ctx, int n_batch) {
+    // f16 K and V for every layer, plus logits and a compute buffer of the same order
+    const double n_head = std::max(1, llama_model_n_head(model));
+    const double kv_dim = (double)llama_model_n_embd(model) * llama_model_n_head_kv(model) / n_head;
+    const double kv     = 2.0 * n_ctx * llama_model_n_layer(model) * kv_dim * 2.0;
+    const double logits = (double)n_batch * llama_vocab_n_tokens(llama_model_get_vocab(model)) * 4.0;
+    return (size_t)(kv + 2.0 * logits);
+}
+
+void ctx_pool::configure(const std::vector<int>& sizes, size_t budget_bytes) {
+    sizes_  = sizes;
+    budget_ = budget_bytes;
+    // shrink to the new budget, largest first
+    std::sort(idle_.begin(), idle_.end(), [](const entry& a, const entry& b) { return a.bytes < b.bytes; });
+    while (!idle_.empty() && bytes_ > budget_) {
+        bytes_ -= idle_.back().bytes;
+        llama_free(idle_.back().ctx);
+        idle_.pop_back();
+    }
+}
+
+llama_context* ctx_pool::create(llama_model* model, int n_ctx) {
+    llama_context_params p = base_;
+    p.n_ctx = (uint32_t)n_ctx;
+    llama_context* ctx = llama_init_from_model(model, p);
+    if (!ctx) return nullptr;
+
+    // one real decode touches the compute buffers and weights the first request would
+    llama_token bos = llama_vocab_bos(llama_model_get_vocab(model));
+    if (bos >= 0 && llama_decode(ctx, llama_batch_get_one(&bos, 1)) != 0) {
+        LLOGW("ctx_pool: warm-up decode failed (n_ctx=%d)", n_ctx);
+    }
+    llama_memory_clear(llama_get_memory(ctx), true);
+    return ctx;
+}
+
+llama_context* ctx_pool::acquire(llama_model* model, int n_ctx) {
+    auto best = idle_.end();
+    for (auto it = idle_.begin(); it != idle_.end(); ++it) {
+        if (it->n_ctx < n_ctx || it->n_ctx > 2 * n_ctx) continue;
+        if (best == idle_.end() || it->n_ctx < best->n_ctx) best = it;
+    }
+    if (best != idle_.end()) {
+        llama_context* ctx = best->ctx;
+        bytes_ -= best->bytes;
+        idle_.erase(best);
+        llama_set_n_threads(ctx, base_.n_threads, base_.n_threads_batch);
+        ++hits_;
+        return ctx;
+    }
+    ++misses_;
+    llama_context_params p = base_;
+    p.n_ctx = (uint32_t)n_ctx;
+    return llama_init_from_model(model, p);   // cold path: the caller is waiting anyway
+}
+
+void ctx_pool::release(llama_model* model, llama_context* ctx) {
+    if (!ctx) return;
+    const int    n     = (int)llama_n_ctx(ctx);
+    const size_t bytes = estimate_bytes(model, n, (int)llama_n_batch(ctx));
+    if (bytes_ + bytes > budget_) {
+        llama_free(ctx);
+        return;
+    }
+    llama_memory_clear(llama_get_memory(ctx), true);
+    idle_.push_back({ctx, n, bytes});
+    bytes_ += bytes;
+}
+
+bool ctx_pool::fill_one(llama_model* model) {
+    if (!model) return false;
+    for (int n : sizes_) {
+        const bool have = std::any_of(idle_.begin(), idle_.end(), [&](const entry& e) { return e.n_ctx == n; });
+        if (have) continue;
+        const size_t bytes = estimate_bytes(model, n, (int)base_.n_batch);
+        if (bytes_ + bytes > budget_) continue;
+        llama_context* ctx = create(model, n);
+        if (!ctx) { LLOGW("ctx_pool: cannot create standby n_ctx=%d", n); return false; }
+        idle_.push_back({ctx, n, bytes});
+        bytes_ += bytes;
+        LLOGI("ctx_pool: standby n_ctx=%d ready (%.1f MiB pooled)", n, bytes_ / (1024.0 * 1024.0));
+        return true;
+    }
+    return false;
+}
+
+void ctx_pool::clear() {
+    for (auto& e : idle_) llama_free(e.ctx);
+    idle_.clear();
+    bytes_ = 0;
+}
+
+ctx_pool::stats ctx_pool::get_stats() const {
+    stats s;
+    s.idle   = (int)idle_.size();
+    s.bytes  = bytes_;
+    s.hits   = hits_;
+    s.misses = misses_;
+    return s;
+}
@@ -0,0 +1,56 @@
+// llm_ctx_pool.h — warm standby llama_contexts, reused instead of re-created
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "llama.h"
+
+// Contexts for one model, kept after use with their KV cleared (llama_memory_clear) so
+// the next checkout skips allocating KV and compute buffers. Standard sizes are created
+// ahead of time by fill_one(); everything the pool holds stays within a byte budget.
+// Not thread-safe: the bridge calls it under its engine lock.
+class ctx_pool {
+public:
+    struct stats {
+        int      idle     = 0;   // contexts waiting in the pool
+        size_t   bytes    = 0;   // their estimated size
+        uint64_t hits     = 0;
+        uint64_t misses   = 0;
+    };
+
+    // Sizes to keep one warm standby of, and the budget for everything idle in the pool.
+    void configure(const std::vector<int>& sizes, size_t budget_bytes);
+    // Thread/batch settings for new contexts (n_ctx is per checkout).
+    void set_params(const llama_context_params& base) { base_ = base; }
+
+    // Smallest idle context with n_ctx in [n, 2n], else a new one; nullptr if creation fails.
+    llama_context* acquire(llama_model* model, int n_ctx);
+    // Clears and keeps ctx if the budget allows, frees it otherwise.
+    void release(llama_model* model, llama_context* ctx);
+    // Creates one missing standby context; false once every standard size has one (or
+    // the budget is used up).
+    bool fill_one(llama_model* model);
+    // Frees every idle context (before the model goes away, or to give memory back).
+    void clear();
+
+    stats get_stats() const;
+    static size_t estimate_bytes(const llama_model* model, int n_ctx, int n_batch);
+
+private:
+    struct entry {
+        llama_context* ctx;
+        int            n_ctx;
+        size_t         bytes;
+    };
+
+    llama_context* create(llama_model* model, int n_ctx);
+
+    std::vector<entry>   idle_;
+    std::vector<int>     sizes_;
+    size_t               budget_ = 0;
+    size_t               bytes_  = 0;
+    llama_context_params base_   = llama_context_default_params();
+    uint64_t             hits_   = 0;
+    uint64_t             misses_ = 0;
+};
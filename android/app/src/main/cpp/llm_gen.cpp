@@ -0,0 +1,23 @@
+// llm_gen.cpp — stop_matcher
+#include "llm_gen.h"
+
+#include <algorithm>
+
+size_t stop_matcher::find(const std::string& s, size_t from) const {
+    size_t best = std::string::npos;
+    for (const auto& w : words) {
+        const size_t at = s.find(w, from > w.size() ? from - w.size() : 0);
+        if (at != std::string::npos) best = std::min(best, at);
+    }
+    return best;
+}
+
+size_t stop_matcher::hold(const std::string& s) const {
+    size_t h = 0;
+    for (const auto& w : words) {
+        for (size_t k = std::min(w.size() - 1, s.size()); k > h; --k) {
+            if (s.compare(s.size() - k, k, w, 0, k) == 0) { h = k; break; }
+        }
+    }
+    return h;
+}
@@ -0,0 +1,126 @@
+// llm_gen.h — generations as coroutines, stepped together by a scheduler
+#pragma once
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "llama.h"
+
+// What a suspended generation and the scheduler exchange: the token it wants decoded
+// next, and the logits that follow it once decoded.
+struct gen_slot {
+    llama_seq_id                  seq     = 0;
+    llama_token                   pending = -1;
+    const float*                  logits  = nullptr;   // nullptr: the decode failed
+    const std::atomic<bool>*      cancel  = nullptr;   // set from any thread; checked between steps
+
+    bool cancelled() const { return cancel && cancel->load(std::memory_order_relaxed); }
+};
+
+// A generation coroutine. It starts suspended; the scheduler runs it.
+class gen_task {
+public:
+    struct promise_type {
+        gen_task get_return_object() { return gen_task(handle::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }   // the engine does not use exceptions
+    };
+    using handle = std::coroutine_handle<promise_type>;
+
+    gen_task() = default;
+    gen_task(gen_task&& o) noexcept : h_(std::exchange(o.h_, {})) {}
+    gen_task& operator=(gen_task&& o) noexcept {
+        if (this != &o) { reset(); h_ = std::exchange(o.h_, {}); }
+        return *this;
+    }
+    ~gen_task() { reset(); }
+
+    bool done() const { return !h_ || h_.done(); }
+    void resume() { h_.resume(); }
+    // Destroying a suspended generation unwinds its locals like a return would.
+    void reset() { if (h_) { h_.destroy(); h_ = {}; } }
+
+private:
+    explicit gen_task(handle h) : h_(h) {}
+    handle h_;
+};
+
+// co_await gen_step{slot, tok}: hands tok over for decoding and resumes with the logits
+// after it (nullptr if the decode failed).
+struct gen_step {
+    gen_slot&   slot;
+    llama_token tok;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<>) noexcept { slot.pending = tok; slot.logits = nullptr; }
+    const float* await_resume() const noexcept { return slot.logits; }
+};
+
+// Steps generations in lockstep on the calling thread. add() runs a generation up to its
+// first token, from the logits in its slot; run() then decodes the token of every live
+// generation in one call and resumes each with its logits, until all are finished.
+// A cancelled generation is destroyed before its next decode.
+class gen_scheduler {
+public:
+    void add(gen_task t, gen_slot& s) {
+        if (s.cancelled()) return;
+        t.resume();
+        if (!t.done()) live_.push_back({std::move(t), &s});
+    }
+
+    // decode(std::vector<gen_slot*>& slots): decodes every slot's pending token and sets
+    // its logits (nullptr on failure).
+    template <class Decode>
+    void run(Decode&& decode) {
+        std::vector<gen_slot*> slots;
+        while (!live_.empty()) {
+            size_t k = 0;
+            for (size_t i = 0; i < live_.size(); ++i) {
+                if (live_[i].slot->cancelled()) { live_[i].task.reset(); continue; }
+                if (k != i) live_[k] = std::move(live_[i]);
+                ++k;
+            }
+            live_.resize(k);
+            if (live_.empty()) break;
+
+            slots.clear();
+            for (const entry& e : live_) slots.push_back(e.slot);
+            decode(slots);
+            ++steps_;
+
+            k = 0;
+            for (size_t i = 0; i < live_.size(); ++i) {
+                live_[i].task.resume();
+                if (live_[i].task.done()) { live_[i].task.reset(); continue; }
+                if (k != i) live_[k] = std::move(live_[i]);
+                ++k;
+            }
+            live_.resize(k);
+        }
+    }
+
+    size_t live()  const { return live_.size(); }
+    int    steps() const { return steps_; }
+
+private:
+    struct entry { gen_task task; gen_slot* slot; };
+    std::vector<entry> live_;
+    int                steps_ = 0;
+};
+
+// Stop strings over generated text.
+struct stop_matcher {
+    std::vector<std::string> words;
+
+    bool empty() const { return words.empty(); }
+    // earliest match in s that ends after `from`, npos if none
+    size_t find(const std::string& s, size_t from) const;
+    // bytes at the end of s that could still grow into a stop string
+    size_t hold(const std::string& s) const;
+};
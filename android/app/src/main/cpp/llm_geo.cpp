@@ -0,0 +1,109 @@
+// llm_geo.cpp — location history aggregation
+#include "llm_geo.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+constexpr double kEarthR = 6371008.8;                 // mean radius, metres
+constexpr double kDegM   = kEarthR * 3.14159265358979323846 / 180.0;
+
+struct series {
+    std::vector<double> t, lat, lng, cs;   // cs = cos(lat)
+};
+
+void unpack(const double* pts, size_t n, series& s) {
+    s.t.resize(n); s.lat.resize(n); s.lng.resize(n); s.cs.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        s.t[i]   = pts[3 * i];
+        s.lat[i] = pts[3 * i + 1];
+        s.lng[i] = pts[3 * i + 2];
+    }
+    for (size_t i = 0; i < n; ++i) s.cs[i] = std::cos(s.lat[i] * (kDegM / kEarthR));
+}
+
+// Length of segment i -> i+1 in metres, all segments at once.
+void segment_lengths(const series& s, std::vector<double>& d) {
+    const size_t n = s.t.size();
+    d.resize(n > 0 ? n - 1 : 0);
+    for (size_t i = 0; i + 1 < n; ++i) {
+        double dl = s.lng[i + 1] - s.lng[i];
+        dl = dl > 180.0 ? dl - 360.0 : dl < -180.0 ? dl + 360.0 : dl;   // across the antimeridian
+        const double dx = dl * 0.5 * (s.cs[i] + s.cs[i + 1]) * kDegM;
+        const double dy = (s.lat[i + 1] - s.lat[i]) * kDegM;
+        d[i] = std::sqrt(dx * dx + dy * dy);
+    }
+}
+
+} // namespace
+
+size_t geo_aggregate(const double* pts, size_t n, const geo_params& p, float* out) {
+    const int nb = std::max(0, p.n_buckets);
+    std::fill(out, out + (size_t)nb * GEO_COLUMNS, 0.0f);
+    if (!pts || n == 0 || nb == 0 || !(p.bucket_s > 0)) return 0;
+
+    series s;
+    unpack(pts, n, s);
+    std::vector<double> d;
+    segment_lengths(s, d);
+
+    const double t_end = p.t0 + p.bucket_s * nb;
+    std::vector<double> dist((size_t)nb), moving((size_t)nb), still((size_t)nb);
+
+    // segments: distance and time, split over the buckets they overlap
+    for (size_t i = 0; i + 1 < n; ++i) {
+        const double a = s.t[i], b = s.t[i + 1], dt = b - a;
+        if (!(dt > 0) || b <= p.t0 || a >= t_end) continue;
+        const bool timed  = dt <= p.max_gap_s;
+        const bool moving_seg = d[i] / dt >= p.still_mps;
+        const int  b0 = std::max(0, (int)std::floor((a - p.t0) / p.bucket_s));
+        const int  b1 = std::min(nb - 1, (int)std::floor((b - p.t0) / p.bucket_s));
+        for (int k = b0; k <= b1; ++k) {
+            const double lo = std::max(a, p.t0 + p.bucket_s * k);
+            const double hi = std::min(b, p.t0 + p.bucket_s * (k + 1));
+            if (hi <= lo) continue;
+            dist[(size_t)k] += d[i] * ((hi - lo) / dt);
+            if (timed) (moving_seg ? moving : still)[(size_t)k] += hi - lo;
+        }
+    }
+
+    // points: count and radius of gyration in a local plane around the first point
+    std::vector<double> x(n), y(n);
+    const double lat0 = s.lat[0], lng0 = s.lng[0], c0 = s.cs[0] * kDegM;
+    for (size_t i = 0; i < n; ++i) {
+        double dl = s.lng[i] - lng0;
+        dl = dl > 180.0 ? dl - 360.0 : dl < -180.0 ? dl + 360.0 : dl;
+        x[i] = dl * c0;
+        y[i] = (s.lat[i] - lat0) * kDegM;
+    }
+    std::vector<double> cnt((size_t)nb), sx((size_t)nb), sy((size_t)nb), sq((size_t)nb);
+    size_t used = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (s.t[i] < p.t0 || s.t[i] >= t_end) continue;
+        const size_t k = std::min((size_t)nb - 1, (size_t)((s.t[i] - p.t0) / p.bucket_s));
+        cnt[k] += 1;
+        sx[k]  += x[i];
+        sy[k]  += y[i];
+        sq[k]  += x[i] * x[i] + y[i] * y[i];
+        ++used;
+    }
+
+    float* o_dist = out + (size_t)GEO_DIST_M   * nb;
+    float* o_mov  = out + (size_t)GEO_MOVING_S * nb;
+    float* o_sti  = out + (size_t)GEO_STILL_S  * nb;
+    float* o_rog  = out + (size_t)GEO_ROG_M    * nb;
+    float* o_pts  = out + (size_t)GEO_POINTS   * nb;
+    for (int k = 0; k < nb; ++k) {
+        const double c  = cnt[(size_t)k];
+        const double mx = c > 0 ? sx[(size_t)k] / c : 0, my = c > 0 ? sy[(size_t)k] / c : 0;
+        const double r2 = c > 0 ? sq[(size_t)k] / c - (mx * mx + my * my) : 0;
+        o_dist[k] = (float)dist[(size_t)k];
+        o_mov[k]  = (float)moving[(size_t)k];
+        o_sti[k]  = (float)still[(size_t)k];
+        o_rog[k]  = (float)std::sqrt(std::max(0.0, r2));
+        o_pts[k]  = (float)c;
+    }
+    return used;
+}
@@ -0,0 +1,31 @@
+// llm_geo.h — aggregation kernels over location history
+#pragma once
+#include <cstddef>
+
+// A series is packed as (t, lat, lng) triples of doubles: unix seconds and degrees,
+// ascending in t. The kernels work on structure-of-arrays copies so the per-point and
+// per-segment passes are plain loops the compiler vectorizes; only the scatter into
+// buckets is scalar.
+
+enum geo_column {
+    GEO_DIST_M,      // metres travelled
+    GEO_MOVING_S,    // seconds spent above the stationary speed
+    GEO_STILL_S,     // seconds spent below it
+    GEO_ROG_M,       // radius of gyration of the bucket's points, metres
+    GEO_POINTS,      // points in the bucket
+    GEO_COLUMNS
+};
+
+struct geo_params {
+    double t0         = 0;     // start of bucket 0, unix seconds
+    double bucket_s   = 3600;
+    int    n_buckets  = 24;
+    double still_mps  = 0.5;   // segments slower than this count as stationary
+    double max_gap_s  = 900;   // longer segments add distance but no time
+};
+
+// Fills out[col * n_buckets + b] for every geo_column (n_buckets * GEO_COLUMNS floats).
+// A segment's distance and time are split over the buckets it spans in proportion to
+// time. Distances use the equirectangular approximation, well below GPS noise at the
+// spacing of a tracked series. Returns the number of points that fell inside the range.
+size_t geo_aggregate(const double* pts, size_t n, const geo_params& p, float* out);
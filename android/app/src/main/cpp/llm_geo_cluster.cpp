@@ -0,0 +1,288 @@
+// llm_geo_cluster.cpp — hierarchical point clustering and polyline level of detail
+#include "llm_geo_cluster.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+namespace {
+
+constexpr double kPi      = 3.14159265358979323846;
+constexpr double kMaxLat  = 85.0511287798066;   // Web Mercator limit
+constexpr double kTilePx  = 256.0;
+constexpr size_t kNodeSize = 32;                // k-d leaves scanned linearly
+constexpr size_t kSegs     = 32;                // track segments per bounding box
+
+double lng_x(double lng) { return lng / 360.0 + 0.5; }
+double lat_y(double lat) {
+    const double s = std::sin(std::max(-kMaxLat, std::min(kMaxLat, lat)) * kPi / 180.0);
+    return 0.5 - 0.25 * std::log((1 + s) / (1 - s)) / kPi;
+}
+double x_lng(double x) { return (x - 0.5) * 360.0; }
+double y_lat(double y) { return std::atan(std::sinh(kPi * (1 - 2 * y))) * 180.0 / kPi; }
+
+// One pixel at zoom z, in units of the Mercator square.
+double px(int z) { return 1.0 / (kTilePx * std::ldexp(1.0, z)); }
+
+// The box as one or two x ranges (two when it crosses the antimeridian).
+struct viewport {
+    double x0[2], x1[2], y0, y1;
+    int    n;
+};
+
+viewport make_viewport(double west, double south, double east, double north) {
+    viewport v;
+    v.y0 = lat_y(std::max(south, north));
+    v.y1 = lat_y(std::min(south, north));
+    if (east - west >= 360.0) {
+        v.x0[0] = 0; v.x1[0] = 1; v.n = 1;
+    } else if (west > east) {
+        v.x0[0] = lng_x(west); v.x1[0] = 1;
+        v.x0[1] = 0;           v.x1[1] = lng_x(east);
+        v.n = 2;
+    } else {
+        v.x0[0] = lng_x(west); v.x1[0] = lng_x(east); v.n = 1;
+    }
+    return v;
+}
+
+bool overlaps(const viewport& v, double x0, double y0, double x1, double y1) {
+    if (y1 < v.y0 || y0 > v.y1) return false;
+    for (int k = 0; k < v.n; ++k)
+        if (x1 >= v.x0[k] && x0 <= v.x1[k]) return true;
+    return false;
+}
+
+// Distance from p to segment a-b.
+double seg_dist(double px_, double py, double ax, double ay, double bx, double by) {
+    const double dx = bx - ax, dy = by - ay, l2 = dx * dx + dy * dy;
+    double t = l2 > 0 ? ((px_ - ax) * dx + (py - ay) * dy) / l2 : 0;
+    t = std::max(0.0, std::min(1.0, t));
+    const double ex = ax + t * dx - px_, ey = ay + t * dy - py;
+    return std::sqrt(ex * ex + ey * ey);
+}
+
+} // namespace
+
+// ---------- k-d tree ----------
+// Arrays are reordered in place so that every range [l, r] has its split point at the
+// middle, as kdbush does: no node storage at all.
+void geo_index::kd_sort(level& lv) {
+    const size_t n = lv.x.size();
+    std::vector<uint32_t> ord(n);
+    std::iota(ord.begin(), ord.end(), 0u);
+
+    struct range { size_t l, r; int axis; };
+    std::vector<range> stack;
+    if (n) stack.push_back({0, n - 1, 0});
+    while (!stack.empty()) {
+        const range g = stack.back();
+        stack.pop_back();
+        if (g.r - g.l <= kNodeSize) continue;
+        const size_t m = (g.l + g.r) / 2;
+        const std::vector<double>& c = g.axis ? lv.y : lv.x;
+        std::nth_element(ord.begin() + (ptrdiff_t)g.l, ord.begin() + (ptrdiff_t)m, ord.begin() + (ptrdiff_t)g.r + 1,
+                         [&c](uint32_t a, uint32_t b) { return c[a] < c[b]; });
+        stack.push_back({g.l, m - 1, 1 - g.axis});
+        stack.push_back({m + 1, g.r, 1 - g.axis});
+    }
+
+    level out;
+    out.x.resize(n); out.y.resize(n); out.count.resize(n); out.id.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        const uint32_t k = ord[i];
+        out.x[i] = lv.x[k]; out.y[i] = lv.y[k]; out.count[i] = lv.count[k]; out.id[i] = lv.id[k];
+    }
+    lv = std::move(out);
+}
+
+void geo_index::kd_range(const level& lv, double x0, double y0, double x1, double y1,
+                         std::vector<uint32_t>& hits) {
+    const size_t n = lv.x.size();
+    if (!n) return;
+    struct range { size_t l, r; int axis; };
+    range stack[64];   // depth is log2(n / kNodeSize)
+    int   top = 0;
+    stack[top++] = {0, n - 1, 0};
+    while (top) {
+        const range g = stack[--top];
+        if (g.r - g.l <= kNodeSize) {
+            for (size_t i = g.l; i <= g.r; ++i)
+                if (lv.x[i] >= x0 && lv.x[i] <= x1 && lv.y[i] >= y0 && lv.y[i] <= y1) hits.push_back((uint32_t)i);
+            continue;
+        }
+        const size_t m = (g.l + g.r) / 2;
+        const double x = lv.x[m], y = lv.y[m];
+        if (x >= x0 && x <= x1 && y >= y0 && y <= y1) hits.push_back((uint32_t)m);
+        if (g.axis ? y0 <= y : x0 <= x) stack[top++] = {g.l, m - 1, 1 - g.axis};
+        if (g.axis ? y1 >= y : x1 >= x) stack[top++] = {m + 1, g.r, 1 - g.axis};
+    }
+}
+
+// ---------- build ----------
+void geo_index::build(const double* pts, size_t n, int radius_px, int max_zoom) {
+    n = std::min(n, (size_t)std::numeric_limits<uint32_t>::max());
+    max_zoom = std::max(0, std::min(24, max_zoom));
+    lat_.resize(n); lng_.resize(n); mx_.resize(n); my_.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        lat_[i] = pts[3 * i + 1];
+        lng_[i] = pts[3 * i + 2];
+        mx_[i]  = lng_x(lng_[i]);
+        my_[i]  = lat_y(lat_[i]);
+    }
+
+    // points: the raw level, then each zoom clusters the one above it
+    levels_.assign((size_t)max_zoom + 2, level());
+    level& raw = levels_.back();
+    raw.x = mx_; raw.y = my_;
+    raw.count.assign(n, 1);
+    raw.id.resize(n);
+    std::iota(raw.id.begin(), raw.id.end(), 0u);
+    kd_sort(raw);
+
+    std::vector<uint32_t> hits;
+    std::vector<char>     done;
+    for (int z = max_zoom; z >= 0; --z) {
+        const level& src = levels_[(size_t)z + 1];
+        level&       dst = levels_[(size_t)z];
+        const double r = radius_px * px(z), r2 = r * r;
+        done.assign(src.x.size(), 0);
+        for (size_t i = 0; i < src.x.size(); ++i) {
+            if (done[i]) continue;
+            done[i] = 1;
+            const double x = src.x[i], y = src.y[i];
+            double   wx = x * src.count[i], wy = y * src.count[i];
+            uint32_t cnt = src.count[i];
+            hits.clear();
+            kd_range(src, x - r, y - r, x + r, y + r, hits);
+            for (uint32_t k : hits) {
+                if (done[k]) continue;
+                const double dx = src.x[k] - x, dy = src.y[k] - y;
+                if (dx * dx + dy * dy > r2) continue;
+                done[k] = 1;
+                wx  += src.x[k] * src.count[k];
+                wy  += src.y[k] * src.count[k];
+                cnt += src.count[k];
+            }
+            dst.x.push_back(wx / cnt);
+            dst.y.push_back(wy / cnt);
+            dst.count.push_back(cnt);
+            dst.id.push_back(src.id[i]);
+        }
+        kd_sort(dst);
+    }
+
+    // track: Douglas-Peucker significance, capped by the enclosing split so that a fix
+    // kept at some tolerance implies every fix above it in the recursion is kept too
+    std::vector<double> sig(n, 0.0);
+    if (n) sig[0] = sig[n - 1] = std::numeric_limits<double>::infinity();
+    struct span { size_t a, b; double cap; };
+    std::vector<span> stack;
+    if (n > 2) stack.push_back({0, n - 1, std::numeric_limits<double>::infinity()});
+    while (!stack.empty()) {
+        const span s = stack.back();
+        stack.pop_back();
+        if (s.b - s.a < 2) continue;
+        size_t best = s.a + 1;
+        double dmax = -1;
+        for (size_t i = s.a + 1; i < s.b; ++i) {
+            const double d = seg_dist(mx_[i], my_[i], mx_[s.a], my_[s.a], mx_[s.b], my_[s.b]);
+            if (d > dmax) { dmax = d; best = i; }
+        }
+        const double v = std::min(dmax, s.cap);
+        sig[best] = v;
+        stack.push_back({s.a, best, v});
+        stack.push_back({best, s.b, v});
+    }
+    lod_.assign(levels_.size(), track());
+    for (size_t z = 0; z < lod_.size(); ++z) {
+        track& t = lod_[z];
+        if ((int)z > max_zoom) {   // the raw level keeps every fix
+            t.keep.resize(n);
+            std::iota(t.keep.begin(), t.keep.end(), 0u);
+        } else {
+            const double tol = px((int)z);
+            for (size_t i = 0; i < n; ++i)
+                if (sig[i] >= tol) t.keep.push_back((uint32_t)i);
+        }
+        // boxes; a segment across the antimeridian is never drawn and adds nothing
+        const box none = {1, 1, 0, 0};
+        const size_t segs = t.keep.empty() ? 0 : t.keep.size() - 1;
+        t.fine.assign((segs + kSegs - 1) / kSegs, none);
+        t.coarse.assign((t.fine.size() + kSegs - 1) / kSegs, none);
+        for (size_t j = 0; j < segs; ++j) {
+            const uint32_t a = t.keep[j], b = t.keep[j + 1];
+            if (std::fabs(mx_[a] - mx_[b]) > 0.5) continue;
+            for (box* bx : {&t.fine[j / kSegs], &t.coarse[j / (kSegs * kSegs)]}) {
+                bx->x0 = std::min(bx->x0, std::min(mx_[a], mx_[b]));
+                bx->y0 = std::min(bx->y0, std::min(my_[a], my_[b]));
+                bx->x1 = std::max(bx->x1, std::max(mx_[a], mx_[b]));
+                bx->y1 = std::max(bx->y1, std::max(my_[a], my_[b]));
+            }
+        }
+    }
+}
+
+// ---------- queries ----------
+size_t geo_index::clusters(double west, double south, double east, double north, int zoom,
+                           std::vector<geo_item>& out) const {
+    out.clear();
+    if (levels_.empty()) return 0;
+    const level& lv = levels_[(size_t)std::max(0, std::min((int)levels_.size() - 1, zoom))];
+    const viewport v = make_viewport(west, south, east, north);
+    thread_local std::vector<uint32_t> hits;
+    hits.clear();
+    for (int k = 0; k < v.n; ++k) kd_range(lv, v.x0[k], v.y0, v.x1[k], v.y1, hits);
+    out.reserve(hits.size());
+    for (uint32_t i : hits) {
+        geo_item it;
+        it.count = lv.count[i];
+        it.id    = lv.id[i];
+        if (it.count == 1) {   // exact position, not the projected round trip
+            it.lat = lat_[it.id];
+            it.lng = lng_[it.id];
+        } else {
+            it.lat = y_lat(lv.y[i]);
+            it.lng = x_lng(lv.x[i]);
+        }
+        out.push_back(it);
+    }
+    return out.size();
+}
+
+size_t geo_index::polyline(double west, double south, double east, double north, int zoom,
+                           std::vector<double>& out) const {
+    out.clear();
+    if (lod_.empty()) return 0;
+    const track&   t   = lod_[(size_t)std::max(0, std::min((int)lod_.size() - 1, zoom))];
+    const viewport v   = make_viewport(west, south, east, north);
+    const double   nan = std::numeric_limits<double>::quiet_NaN();
+    const size_t   segs = t.keep.empty() ? 0 : t.keep.size() - 1;
+
+    bool open = false;
+    for (size_t c = 0; c < t.coarse.size(); ++c) {
+        const box& cb = t.coarse[c];
+        if (!overlaps(v, cb.x0, cb.y0, cb.x1, cb.y1)) { open = false; continue; }
+        const size_t f1 = std::min(t.fine.size(), (c + 1) * kSegs);
+        for (size_t f = c * kSegs; f < f1; ++f) {
+            const box& fb = t.fine[f];
+            if (!overlaps(v, fb.x0, fb.y0, fb.x1, fb.y1)) { open = false; continue; }
+            const size_t j1 = std::min(segs, (f + 1) * kSegs);
+            for (size_t j = f * kSegs; j < j1; ++j) {
+                const uint32_t a = t.keep[j], b = t.keep[j + 1];
+                const bool vis = std::fabs(mx_[a] - mx_[b]) <= 0.5 &&
+                                 overlaps(v, std::min(mx_[a], mx_[b]), std::min(my_[a], my_[b]),
+                                          std::max(mx_[a], mx_[b]), std::max(my_[a], my_[b]));
+                if (!vis) { open = false; continue; }
+                if (!open) {
+                    if (!out.empty()) { out.push_back(nan); out.push_back(nan); }
+                    out.push_back(lat_[a]); out.push_back(lng_[a]);
+                    open = true;
+                }
+                out.push_back(lat_[b]); out.push_back(lng_[b]);
+            }
+        }
+    }
+    return out.size() / 2;
+}
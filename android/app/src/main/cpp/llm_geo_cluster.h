@@ -0,0 +1,57 @@
+// llm_geo_cluster.h — hierarchical point clustering and polyline level of detail for maps
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// One marker: a single fix (count 1, id = its index in the series) or a cluster (id =
+// index of one of its fixes). Cluster positions are the count-weighted centroid.
+struct geo_item {
+    double   lat, lng;
+    uint32_t count;
+    uint32_t id;
+};
+
+// Built once per series, then queried per frame. Points are projected to Web Mercator
+// (the unit square); every zoom level from max_zoom down to 0 clusters the level above
+// it greedily within radius_px screen pixels (256 px tiles), as supercluster does.
+// Each level is stored as a static k-d tree, so a viewport query costs O(log n + hits).
+// The track is ranked once with Douglas-Peucker; a zoom level keeps the fixes whose
+// deviation is at least a pixel there.
+class geo_index {
+public:
+    // pts: (t, lat, lng) triples in time order, as for geo_aggregate
+    void build(const double* pts, size_t n, int radius_px, int max_zoom);
+
+    // Items inside the box at zoom (clamped to 0..max_zoom+1, where max_zoom+1 is the raw
+    // fixes). west > east means the box crosses the antimeridian. Returns out.size().
+    size_t clusters(double west, double south, double east, double north, int zoom,
+                    std::vector<geo_item>& out) const;
+
+    // The simplified track where it crosses the box: (lat, lng) pairs, with a NaN pair
+    // between separate runs. Returns the number of pairs.
+    size_t polyline(double west, double south, double east, double north, int zoom,
+                    std::vector<double>& out) const;
+
+    size_t size() const { return lat_.size(); }
+    int    max_zoom() const { return (int)levels_.size() - 2; }
+
+private:
+    struct level {
+        std::vector<double>   x, y;      // Mercator, k-d ordered
+        std::vector<uint32_t> count, id;
+    };
+    // Bounding boxes over runs of track segments, so a query skips what is off screen.
+    struct box { double x0, y0, x1, y1; };
+    struct track {
+        std::vector<uint32_t> keep;            // fixes kept at this zoom, time order
+        std::vector<box>      fine, coarse;    // per kSegs segments / per kSegs fine boxes
+    };
+    static void kd_sort(level& lv);
+    static void kd_range(const level& lv, double x0, double y0, double x1, double y1,
+                         std::vector<uint32_t>& hits);
+
+    std::vector<double> lat_, lng_, mx_, my_;   // the fixes, time order
+    std::vector<level>  levels_;                // [zoom], last = raw fixes
+    std::vector<track>  lod_;                   // [zoom]
+};
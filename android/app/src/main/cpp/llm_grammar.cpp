@@ -0,0 +1,599 @@
+// llm_grammar.cpp — schema compiler, subset construction, token masks
+//
+// A (non-recursive) JSON Schema describes a regular language, so it is compiled
+// straight to a byte-level DFA instead of going through GBNF. For every DFA state
+// the set of vocab tokens whose whole piece stays inside the language is found by
+// walking the piece trie once; after that, constraining a step is a scan over a
+// precomputed edge list. Edge lists are cached per grammar up to kMaskBudget bytes;
+// past it the least recently used ones are dropped and rebuilt on their next visit.
+#include "llm_grammar.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+#include "llm_json.h"
+#include "llm_vocab.h"
+
+struct grammar_dfa {
+    using edges = std::vector<grammar_edge>;
+
+    uint64_t             hash     = 0;
+    int32_t              n_states = 0;
+    std::vector<int32_t> next;      // n_states * 256, -1 = reject
+    std::vector<uint8_t> accept;    // per state
+    std::vector<uint8_t> has_out;   // per state: some byte is still allowed
+
+    std::mutex                                mu;        // guards the mask cache below
+    uint32_t                                  mask_serial = 0;
+    size_t                                    mask_bytes  = 0;
+    uint64_t                                  mask_tick   = 0;
+    std::vector<std::shared_ptr<const edges>> masks;     // per state; null = not built
+    std::vector<uint64_t>                     mask_use;  // per state, for eviction
+};
+
+namespace {
+
+constexpr size_t  kMaxNfaStates  = 200000;
+constexpr int32_t kMaxDfaStates  = 4096;
+constexpr int     kGenericDepth  = 3;  // nesting allowed for untyped "{}" schemas
+constexpr int     kMaxRefDepth   = 8;
+constexpr int     kMaxUnroll     = 16; // minItems/maxItems bounds expanded inline
+constexpr size_t  kMaxGrammars   = 32;
+constexpr size_t  kMaskBudget    = 8u << 20; // cached edge bytes per grammar
+
+// ---------- NFA, built back to front (each builder gets its continuation) ----------
+struct nfa_state {
+    std::bitset<256>     on;      // byte edge (empty = none)
+    int32_t              to = -1;
+    std::vector<int32_t> eps;
+};
+
+struct nfa_builder {
+    std::vector<nfa_state> st;
+    const json_value*      root = nullptr;
+    std::string            err;
+    int                    ref_depth = 0;
+
+    int32_t add() {
+        if (st.size() >= kMaxNfaStates && err.empty()) err = "schema too large";
+        st.emplace_back();
+        return (int32_t)st.size() - 1;
+    }
+    int32_t split(std::initializer_list<int32_t> outs) {
+        const int32_t s = add();
+        st[s].eps.assign(outs.begin(), outs.end());
+        return s;
+    }
+    int32_t bytes(const std::bitset<256>& on, int32_t cont) {
+        const int32_t s = add();
+        st[s].on = on;
+        st[s].to = cont;
+        return s;
+    }
+    int32_t byte(uint8_t b, int32_t cont) {
+        std::bitset<256> on;
+        on.set(b);
+        return bytes(on, cont);
+    }
+    int32_t lit(const std::string& s, int32_t cont) {
+        for (size_t k = s.size(); k-- > 0;) cont = byte((uint8_t)s[k], cont);
+        return cont;
+    }
+    // Optional single space. Keeping whitespace this tight keeps outputs compact.
+    int32_t ws(int32_t cont) {
+        const int32_t s = byte(' ', cont);
+        st[s].eps.push_back(cont);
+        return s;
+    }
+
+    static std::bitset<256> range(int lo, int hi) {
+        std::bitset<256> b;
+        for (int c = lo; c <= hi; ++c) b.set((size_t)c);
+        return b;
+    }
+    static std::bitset<256> chars(const char* s) {
+        std::bitset<256> b;
+        for (; *s; ++s) b.set((uint8_t)*s);
+        return b;
+    }
+
+    // ---------- primitives ----------
+    int32_t string(int32_t cont) {
+        const int32_t loop  = add();
+        const int32_t close = byte('"', cont);
+
+        std::bitset<256> plain = range(0x20, 0xFF);
+        plain.reset('"');
+        plain.reset('\\');
+        const int32_t ch = bytes(plain, loop);
+
+        const std::bitset<256> hex = range('0', '9') | range('a', 'f') | range('A', 'F');
+        int32_t u = loop;
+        for (int k = 0; k < 4; ++k) u = bytes(hex, u);
+        u = byte('u', u);
+        const int32_t simple = bytes(chars("\"\\/bfnrt"), loop);
+        const int32_t esc    = byte('\\', split({simple, u}));
+
+        st[loop].eps = {close, ch, esc};
+        return byte('"', loop);
+    }
+    int32_t digits0(int32_t cont) {
+        const int32_t s = add();
+        st[s].on  = range('0', '9');
+        st[s].to  = s;
+        st[s].eps = {cont};
+        return s;
+    }
+    int32_t digits1(int32_t cont) {
+        return bytes(range('0', '9'), digits0(cont));
+    }
+    int32_t integer(int32_t cont) {
+        const int32_t body = split({byte('0', cont), bytes(range('1', '9'), digits0(cont))});
+        return split({byte('-', body), body});
+    }
+    int32_t number(int32_t cont) {
+        const int32_t d   = digits1(cont);
+        const int32_t exp = bytes(chars("eE"), split({bytes(chars("+-"), d), d}));
+        const int32_t tail = split({cont, exp});
+        const int32_t frac = byte('.', digits1(tail));
+        return integer(split({tail, frac}));
+    }
+
+    // ---------- untyped values (bounded depth) ----------
+    int32_t any(int32_t cont, int depth) {
+        std::vector<int32_t> alts = {
+            string(cont), number(cont),
+            lit("true", cont), lit("false", cont), lit("null", cont),
+        };
+        if (depth > 0) {
+            const int32_t close_a = ws(byte(']', cont));
+            const int32_t loop_a  = add();
+            const int32_t item    = ws(any(loop_a, depth - 1));
+            st[loop_a].eps = {close_a, byte(',', item)};
+            alts.push_back(byte('[', split({close_a, item})));
+
+            const int32_t close_o = ws(byte('}', cont));
+            const int32_t loop_o  = add();
+            const int32_t member  = ws(string(ws(byte(':', ws(any(loop_o, depth - 1))))));
+            st[loop_o].eps = {close_o, byte(',', member)};
+            alts.push_back(byte('{', split({close_o, member})));
+        }
+        const int32_t s = add();
+        st[s].eps = alts;
+        return s;
+    }
+
+    // ---------- schema keywords ----------
+    const json_value* resolve(const std::string& ref) {
+        if (ref == "#") return root;
+        if (ref.compare(0, 2, "#/") != 0) return nullptr;
+        const json_value* cur = root;
+        size_t p = 2;
+        while (cur && p <= ref.size()) {
+            size_t q = ref.find('/', p);
+            if (q == std::string::npos) q = ref.size();
+            std::string seg = ref.substr(p, q - p);
+            for (size_t k = 0; (k = seg.find('~', k)) != std::string::npos; ++k) {
+                if (k + 1 < seg.size()) seg.replace(k, 2, seg[k + 1] == '1' ? "/" : "~");
+            }
+            cur = cur->get(seg.c_str());
+            p = q + 1;
+        }
+        return cur;
+    }
+
+    int32_t object(const json_value& s, int32_t cont, int depth) {
+        const json_value* props = s.get("properties");
+        if (!props || !props->is(json_value::OBJ) || props->obj.empty()) {
+            return depth > 0 ? any_object(cont, depth) : lit("{}", cont);
+        }
+
+        std::vector<std::string> required;
+        if (const json_value* r = s.get("required")) {
+            for (const auto& e : r->arr) if (e.is(json_value::STR)) required.push_back(e.str);
+        }
+        auto is_required = [&](const std::string& k) {
+            for (const auto& r : required) if (r == k) return true;
+            return false;
+        };
+
+        // rest[i][first]: remaining members i..n, `first` = nothing emitted yet (no comma).
+        const size_t n = props->obj.size();
+        std::vector<int32_t> rest_first(n + 1), rest_more(n + 1);
+        rest_first[n] = rest_more[n] = ws(byte('}', cont));
+        for (size_t i = n; i-- > 0;) {
+            const auto& kv = props->obj[i];
+            json_value key;
+            key.kind = json_value::STR;
+            key.str  = kv.first;
+            std::string key_lit;
+            json_dump(key, key_lit);
+
+            const int32_t v      = value(kv.second, rest_more[i + 1], depth);
+            const int32_t member = ws(lit(key_lit, byte(':', ws(v))));
+            const int32_t comma  = byte(',', member);
+            if (is_required(kv.first)) {
+                rest_first[i] = member;
+                rest_more[i]  = comma;
+            } else {
+                rest_first[i] = split({member, rest_first[i + 1]});
+                rest_more[i]  = split({comma, rest_more[i + 1]});
+            }
+        }
+        return byte('{', rest_first[0]);
+    }
+
+    int32_t any_object(int32_t cont, int depth) {
+        const int32_t close  = ws(byte('}', cont));
+        const int32_t loop   = add();
+        const int32_t member = ws(string(ws(byte(':', ws(any(loop, depth - 1))))));
+        st[loop].eps = {close, byte(',', member)};
+        return byte('{', split({close, member}));
+    }
+
+    int32_t array(const json_value& s, int32_t cont, int depth) {
+        static const json_value kAny = [] { json_value v; v.kind = json_value::BOOL; v.b = true; return v; }();
+        const json_value* items = s.get("items");
+        if (!items) items = &kAny;
+
+        int min_items = 0, max_items = -1;
+        if (const json_value* v = s.get("minItems")) min_items = std::max(0, (int)v->num);
+        if (const json_value* v = s.get("maxItems")) max_items = (int)v->num;
+        if (min_items > kMaxUnroll) { err = "minItems too large"; return cont; }
+        if (max_items >= 0 && max_items < min_items) { err = "maxItems < minItems"; return cont; }
+
+        const int32_t close = ws(byte(']', cont));
+        auto item = [&](int32_t next) { return ws(value(*items, next, depth)); };
+
+        if (max_items >= 0 && max_items <= kMaxUnroll) {
+            // after[k]: state after k items
+            std::vector<int32_t> after((size_t)max_items + 1);
+            after[max_items] = close;
+            for (int k = max_items - 1; k >= 0; --k) {
+                const int32_t it = k == 0 ? item(after[1]) : byte(',', item(after[k + 1]));
+                after[k] = (k >= min_items) ? split({close, it}) : it;
+            }
+            return byte('[', after[0]);
+        }
+
+        const int32_t loop = add();
+        const int32_t more = byte(',', item(loop));
+        st[loop].eps = {close, more};
+        const int mandatory = std::max(min_items, 1);
+        int32_t next = loop;
+        for (int k = mandatory - 1; k >= 1; --k) next = byte(',', item(next));
+        const int32_t first = item(next);
+        return byte('[', min_items == 0 ? split({close, first}) : first);
+    }
+
+    int32_t typed(const json_value& s, const std::string& type, int32_t cont, int depth) {
+        if (type == "string")  return string(cont);
+        if (type == "integer") return integer(cont);
+        if (type == "number")  return number(cont);
+        if (type == "boolean") return split({lit("true", cont), lit("false", cont)});
+        if (type == "null")    return lit("null", cont);
+        if (type == "object")  return object(s, cont, depth);
+        if (type == "array")   return array(s, cont, depth);
+        err = "unsupported type: " + type;
+        return cont;
+    }
+
+    int32_t value(const json_value& s, int32_t cont, int depth) {
+        if (!err.empty()) return cont;
+        if (s.is(json_value::BOOL)) {
+            if (!s.b) err = "schema 'false' accepts nothing";
+            return any(cont, kGenericDepth);
+        }
+        if (!s.is(json_value::OBJ)) { err = "schema must be an object"; return cont; }
+
+        if (const json_value* ref = s.get("$ref")) {
+            const json_value* target = ref->is(json_value::STR) ? resolve(ref->str) : nullptr;
+            if (!target) { err = "unresolved $ref"; return cont; }
+            if (++ref_depth > kMaxRefDepth) { err = "recursive $ref not supported"; return cont; }
+            const int32_t r = value(*target, cont, depth);
+            --ref_depth;
+            return r;
+        }
+        if (const json_value* c = s.get("const")) {
+            std::string l;
+            json_dump(*c, l);
+            return lit(l, cont);
+        }
+        if (const json_value* e = s.get("enum")) {
+            const int32_t sp = add();
+            std::vector<int32_t> alts;
+            for (const auto& v : e->arr) {
+                std::string l;
+                json_dump(v, l);
+                alts.push_back(lit(l, cont));
+            }
+            if (alts.empty()) err = "empty enum";
+            st[sp].eps = alts;
+            return sp;
+        }
+        const json_value* alt = s.get("anyOf");
+        if (!alt) alt = s.get("oneOf");
+        if (alt && alt->is(json_value::ARR)) {
+            std::vector<int32_t> outs;
+            for (const auto& a : alt->arr) outs.push_back(value(a, cont, depth));
+            const int32_t sp = add();
+            st[sp].eps = outs;
+            return sp;
+        }
+        if (const json_value* all = s.get("allOf")) {
+            if (all->arr.size() != 1) { err = "allOf with several schemas not supported"; return cont; }
+            return value(all->arr[0], cont, depth);
+        }
+
+        if (const json_value* t = s.get("type")) {
+            if (t->is(json_value::STR)) return typed(s, t->str, cont, depth);
+            if (t->is(json_value::ARR)) {
+                std::vector<int32_t> outs;
+                for (const auto& e : t->arr) if (e.is(json_value::STR)) outs.push_back(typed(s, e.str, cont, depth));
+                const int32_t sp = add();
+                st[sp].eps = outs;
+                return sp;
+            }
+        }
+        if (s.get("properties")) return object(s, cont, depth);
+        if (s.get("items"))      return array(s, cont, depth);
+        return any(cont, kGenericDepth);
+    }
+};
+
+// ---------- subset construction ----------
+void closure(const std::vector<nfa_state>& st, std::vector<int32_t>& set, std::vector<uint8_t>& seen) {
+    std::vector<int32_t> stack(set.begin(), set.end());
+    set.clear();
+    while (!stack.empty()) {
+        const int32_t s = stack.back();
+        stack.pop_back();
+        if (seen[s]) continue;
+        seen[s] = 1;
+        set.push_back(s);
+        for (int32_t e : st[s].eps) if (!seen[e]) stack.push_back(e);
+    }
+    for (int32_t s : set) seen[s] = 0;
+    std::sort(set.begin(), set.end());
+}
+
+bool determinize(const std::vector<nfa_state>& st, int32_t start, int32_t final_state,
+                 grammar_dfa& g, std::string& err) {
+    std::map<std::vector<int32_t>, int32_t> ids;
+    std::vector<std::vector<int32_t>>       sets;
+    std::vector<uint8_t>                    seen(st.size(), 0);
+
+    std::vector<int32_t> init = {start};
+    closure(st, init, seen);
+    ids.emplace(init, 0);
+    sets.push_back(init);
+
+    for (size_t cur = 0; cur < sets.size(); ++cur) {
+        g.next.resize((cur + 1) * 256, -1);
+        std::map<std::vector<int32_t>, int32_t> local; // raw move set -> dfa id, per state
+        for (int b = 0; b < 256; ++b) {
+            std::vector<int32_t> mv;
+            for (int32_t s : sets[cur]) {
+                if (st[s].to >= 0 && st[s].on.test((size_t)b)) mv.push_back(st[s].to);
+            }
+            if (mv.empty()) continue;
+            auto lit = local.find(mv);
+            if (lit != local.end()) { g.next[cur * 256 + b] = lit->second; continue; }
+
+            std::vector<int32_t> key = mv;
+            closure(st, key, seen);
+            auto it = ids.find(key);
+            int32_t id;
+            if (it == ids.end()) {
+                if ((int32_t)sets.size() >= kMaxDfaStates) { err = "schema too complex"; return false; }
+                id = (int32_t)sets.size();
+                ids.emplace(key, id);
+                sets.push_back(std::move(key));
+            } else {
+                id = it->second;
+            }
+            local.emplace(std::move(mv), id);
+            g.next[cur * 256 + b] = id;
+        }
+    }
+
+    g.n_states = (int32_t)sets.size();
+    g.next.resize((size_t)g.n_states * 256, -1);
+    g.accept.assign((size_t)g.n_states, 0);
+    g.has_out.assign((size_t)g.n_states, 0);
+    for (int32_t i = 0; i < g.n_states; ++i) {
+        g.accept[i] = std::binary_search(sets[i].begin(), sets[i].end(), final_state) ? 1 : 0;
+        for (int b = 0; b < 256; ++b) {
+            if (g.next[(size_t)i * 256 + b] >= 0) { g.has_out[i] = 1; break; }
+        }
+    }
+    return true;
+}
+
+// ---------- token masks ----------
+void build_mask(const grammar_dfa& g, int32_t state, const token_table& tt, std::vector<grammar_edge>& out) {
+    out.clear();
+    std::vector<std::pair<int32_t, int32_t>> stack = {{0, state}};
+    while (!stack.empty()) {
+        const auto top = stack.back();
+        stack.pop_back();
+        for (int32_t c = tt.trie[top.first].first_child; c >= 0; c = tt.trie[c].next_sibling) {
+            const int32_t ns = g.next[(size_t)top.second * 256 + tt.trie[c].byte];
+            if (ns < 0) continue;
+            for (int32_t t = tt.trie[c].token; t >= 0; t = tt.tok_next[t]) out.push_back({t, ns});
+            if (tt.trie[c].first_child >= 0) stack.emplace_back(c, ns);
+        }
+    }
+}
+
+size_t mask_size(const grammar_dfa::edges& m) { return m.capacity() * sizeof(grammar_edge); }
+
+// Drops least recently used masks until `need` more bytes fit the budget (or none are left).
+void evict_masks(grammar_dfa& g, size_t need) {
+    while (g.mask_bytes + need > kMaskBudget) {
+        int32_t lru = -1;
+        for (int32_t s = 0; s < g.n_states; ++s) {
+            if (g.masks[s] && (lru < 0 || g.mask_use[s] < g.mask_use[lru])) lru = s;
+        }
+        if (lru < 0) return;
+        g.mask_bytes -= mask_size(*g.masks[lru]);
+        g.masks[lru].reset();
+    }
+}
+
+std::shared_ptr<const grammar_dfa::edges> mask_for(grammar_dfa& g, int32_t state, const token_table& tt) {
+    std::lock_guard<std::mutex> lock(g.mu);
+    if (g.mask_serial != tt.serial) {
+        g.masks.assign((size_t)g.n_states, nullptr);
+        g.mask_use.assign((size_t)g.n_states, 0);
+        g.mask_bytes  = 0;
+        g.mask_serial = tt.serial;
+    }
+    g.mask_use[state] = ++g.mask_tick;
+    if (!g.masks[state]) {
+        auto m = std::make_shared<grammar_dfa::edges>();
+        build_mask(g, state, tt, *m);
+        m->shrink_to_fit();
+        evict_masks(g, mask_size(*m));   // a cursor still holding an evicted mask keeps it alive
+        g.mask_bytes += mask_size(*m);
+        g.masks[state] = std::move(m);
+    }
+    return g.masks[state];
+}
+
+uint64_t fnv1a(const std::string& s) {
+    uint64_t h = 1469598103934665603ull;
+    for (unsigned char c : s) { h ^= c; h *= 1099511628211ull; }
+    return h;
+}
+
+// ---------- cache ----------
+struct cache_entry {
+    std::shared_ptr<grammar_dfa> g;
+    uint64_t                     last_use = 0;
+};
+
+std::mutex                             g_cache_mu;
+std::map<int, cache_entry>             g_cache;
+std::unordered_map<uint64_t, int>      g_by_hash;
+int                                    g_next_id = 1;
+uint64_t                               g_tick    = 0;
+
+} // namespace
+
+int grammar_compile(const char* schema, size_t len, const token_table* tokens, std::string& err) {
+    json_value doc;
+    size_t off = 0;
+    if (!schema || !json_parse(schema, len, doc, &off)) {
+        err = "schema is not valid JSON (offset " + std::to_string(off) + ")";
+        return -1;
+    }
+    std::string canon;
+    json_dump(doc, canon);
+    const uint64_t h = fnv1a(canon);
+
+    {
+        std::lock_guard<std::mutex> lock(g_cache_mu);
+        auto it = g_by_hash.find(h);
+        if (it != g_by_hash.end()) {
+            g_cache[it->second].last_use = ++g_tick;
+            return it->second;
+        }
+    }
+
+    nfa_builder nb;
+    nb.root = &doc;
+    const int32_t final_state = nb.add();
+    const int32_t start       = nb.ws(nb.value(doc, final_state, kGenericDepth));
+    if (!nb.err.empty()) { err = nb.err; return -2; }
+
+    auto g = std::make_shared<grammar_dfa>();
+    g->hash = h;
+    if (!determinize(nb.st, start, final_state, *g, err)) return -3;
+
+    if (tokens) {   // up front while they fit; the rest on first visit
+        for (int32_t s = 0; s < g->n_states && g->mask_bytes < kMaskBudget / 2; ++s) mask_for(*g, s, *tokens);
+    }
+
+    std::lock_guard<std::mutex> lock(g_cache_mu);
+    auto it = g_by_hash.find(h); // raced with an identical compile
+    if (it != g_by_hash.end()) return it->second;
+
+    const int id = g_next_id++;
+    g_cache[id] = cache_entry{g, ++g_tick};
+    g_by_hash[h] = id;
+    while (g_cache.size() > kMaxGrammars) {
+        auto lru = g_cache.begin();
+        for (auto e = g_cache.begin(); e != g_cache.end(); ++e) {
+            if (e->second.last_use < lru->second.last_use) lru = e;
+        }
+        g_by_hash.erase(lru->second.g->hash);
+        g_cache.erase(lru);
+    }
+    return id;
+}
+
+bool grammar_begin(int id, grammar_cursor& cur) {
+    std::lock_guard<std::mutex> lock(g_cache_mu);
+    auto it = g_cache.find(id);
+    if (it == g_cache.end()) return false;
+    it->second.last_use = ++g_tick;
+    cur.g     = it->second.g;
+    cur.state = 0;
+    return true;
+}
+
+bool grammar_accepting(const grammar_cursor& cur) {
+    return cur.g && cur.state >= 0 && cur.g->accept[cur.state];
+}
+
+bool grammar_done(const grammar_cursor& cur) {
+    return grammar_accepting(cur) && !cur.g->has_out[cur.state];
+}
+
+std::shared_ptr<const std::vector<grammar_edge>> grammar_allowed(grammar_cursor& cur, const token_table& tokens) {
+    return mask_for(*cur.g, cur.state, tokens);
+}
+
+llama_token grammar_pick(grammar_cursor& cur, const float* logits, const token_table& tokens, llama_token eos) {
+    const auto mask = grammar_allowed(cur, tokens);
+    const auto& edges = *mask;
+
+    llama_token best = -1;
+    int32_t     best_next = -1;
+    float       best_v = -INFINITY;
+    for (const auto& e : edges) {
+        const float v = logits[e.token];
+        if (v > best_v) { best_v = v; best = e.token; best_next = e.next; }
+    }
+    if (eos >= 0 && grammar_accepting(cur) && logits[eos] > best_v) return eos;
+    if (best >= 0) cur.state = best_next;
+    return best;
+}
+
+bool grammar_advance(grammar_cursor& cur, llama_token tok, const token_table& tokens) {
+    if (tok < 0 || tok >= tokens.n_vocab) return false;
+    const int32_t n = tokens.piece_len(tok);
+    if (n == 0) return grammar_accepting(cur);
+    const char* p = tokens.piece(tok);
+    int32_t s = cur.state;
+    for (int32_t k = 0; k < n && s >= 0; ++k) s = cur.g->next[(size_t)s * 256 + (uint8_t)p[k]];
+    if (s < 0) return false;
+    cur.state = s;
+    return true;
+}
+
+void grammar_reset_masks() {
+    std::lock_guard<std::mutex> lock(g_cache_mu);
+    for (auto& e : g_cache) {
+        std::lock_guard<std::mutex> ml(e.second.g->mu);
+        e.second.g->masks.clear();
+        e.second.g->mask_use.clear();
+        e.second.g->mask_bytes  = 0;
+        e.second.g->mask_serial = 0;
+    }
+}
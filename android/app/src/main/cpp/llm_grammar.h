@@ -0,0 +1,54 @@
+// llm_grammar.h — JSON Schema -> byte-level DFA with cached per-state token masks
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "llama.h"
+
+struct token_table;
+struct grammar_dfa;
+
+// One allowed token from a DFA state and the state it leads to.
+struct grammar_edge {
+    llama_token token;
+    int32_t     next;
+};
+
+// Per-request position inside a compiled grammar.
+struct grammar_cursor {
+    std::shared_ptr<grammar_dfa> g;
+    int32_t                      state = -1;
+
+    explicit operator bool() const { return g != nullptr; }
+};
+
+// Compiles a schema, or returns the cached id for an identical (hash-equal) one.
+// When `tokens` is given, masks are computed up front for as many DFA states as
+// half the grammar's mask budget holds.
+// Returns id > 0, or < 0 with a message in err.
+int  grammar_compile(const char* schema, size_t len, const token_table* tokens, std::string& err);
+
+// Starts a cursor at the initial state; false if the id is unknown or evicted.
+bool grammar_begin(int id, grammar_cursor& cur);
+
+bool grammar_accepting(const grammar_cursor& cur);
+
+// True once the cursor sits in an accepting state with no way to extend the document.
+bool grammar_done(const grammar_cursor& cur);
+
+// Tokens allowed from the current state; computed on first visit, then cached while
+// the grammar's masks fit its budget (the least recently used are rebuilt when needed).
+std::shared_ptr<const std::vector<grammar_edge>> grammar_allowed(grammar_cursor& cur, const token_table& tokens);
+
+// Greedy pick over the allowed tokens (plus eos when accepting). Returns -1 if
+// nothing is allowed. Advances the cursor on success.
+llama_token grammar_pick(grammar_cursor& cur, const float* logits, const token_table& tokens, llama_token eos);
+
+// Moves the cursor over a token chosen elsewhere; false if the grammar rejects it.
+bool grammar_advance(grammar_cursor& cur, llama_token tok, const token_table& tokens);
+
+// Masks depend on the vocab; drop them when the model goes away.
+void grammar_reset_masks();
@@ -0,0 +1,58 @@
+// llm_idle.cpp — idle_timer
+#include "llm_idle.h"
+
+void idle_timer::start(int seconds, std::function<void()> fn) {
+    stop();
+    if (seconds <= 0 || !fn) return;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        fn_      = std::move(fn);
+        timeout_ = std::chrono::seconds(seconds);
+        stop_    = false;
+        fired_   = false;
+    }
+    last_ns_ = clock::now().time_since_epoch().count();
+    thread_  = std::thread(&idle_timer::loop, this);
+}
+
+void idle_timer::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) thread_.join();
+}
+
+void idle_timer::touch() {
+    last_ns_ = clock::now().time_since_epoch().count();
+    std::lock_guard<std::mutex> lock(mu_);
+    if (fired_) {
+        fired_ = false;
+        cv_.notify_all();
+    }
+}
+
+double idle_timer::idle_seconds() const {
+    const int64_t d = clock::now().time_since_epoch().count() - last_ns_.load();
+    return std::chrono::duration<double>(clock::duration(d)).count();
+}
+
+void idle_timer::loop() {
+    std::unique_lock<std::mutex> lock(mu_);
+    while (!stop_) {
+        if (fired_) {                      // already unloaded: sleep until the next touch
+            cv_.wait(lock);
+            continue;
+        }
+        const clock::time_point deadline = clock::time_point(clock::duration(last_ns_.load())) + timeout_;
+        if (clock::now() < deadline) {
+            cv_.wait_until(lock, deadline);
+            continue;                      // re-read last_ns_: touch() may have moved it
+        }
+        fired_ = true;
+        lock.unlock();
+        fn_();
+        lock.lock();
+    }
+}
@@ -0,0 +1,37 @@
+// llm_idle.h — inactivity timer used to unload the model when the app sits idle
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Calls `fn` once on its own thread after `seconds` without touch(); touch() re-arms it.
+// `fn` runs without the timer lock held, so it may take other locks freely, but it must
+// not call stop() (stop() joins the timer thread).
+class idle_timer {
+public:
+    ~idle_timer() { stop(); }
+
+    void start(int seconds, std::function<void()> fn);
+    void stop();
+    void touch();
+
+    // seconds since the last touch()
+    double idle_seconds() const;
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    void loop();
+
+    std::mutex                 mu_;
+    std::condition_variable    cv_;
+    std::thread                thread_;
+    std::function<void()>      fn_;
+    std::chrono::seconds       timeout_{0};
+    std::atomic<int64_t>       last_ns_{0};
+    bool                       stop_  = false;
+    bool                       fired_ = false;
+};
@@ -0,0 +1,580 @@
+// llm_json.cpp — recursive-descent JSON parser + compact writer
+#include "llm_json.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+const json_value* json_value::get(const char* key) const {
+    if (kind != OBJ) return nullptr;
+    for (const auto& kv : obj) {
+        if (kv.first == key) return &kv.second;
+    }
+    return nullptr;
+}
+
+// ---------- parser ----------
+namespace {
+
+struct parser {
+    const char* s;
+    size_t      n;
+    size_t      i = 0;
+    int         depth = 0;
+
+    static constexpr int kMaxDepth = 64;
+
+    void ws() {
+        while (i < n && (s[i] == ' ' || s[i] == '\t' || s[i] == '\n' || s[i] == '\r')) ++i;
+    }
+    bool lit(const char* w) {
+        const size_t k = strlen(w);
+        if (n - i < k || memcmp(s + i, w, k) != 0) return false;
+        i += k;
+        return true;
+    }
+
+    static int hexv(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+    static void put_utf8(unsigned cp, std::string& out) {
+        if (cp < 0x80) {
+            out += (char)cp;
+        } else if (cp < 0x800) {
+            out += (char)(0xC0 | (cp >> 6));
+            out += (char)(0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+            out += (char)(0xE0 | (cp >> 12));
+            out += (char)(0x80 | ((cp >> 6) & 0x3F));
+            out += (char)(0x80 | (cp & 0x3F));
+        } else {
+            out += (char)(0xF0 | (cp >> 18));
+            out += (char)(0x80 | ((cp >> 12) & 0x3F));
+            out += (char)(0x80 | ((cp >> 6) & 0x3F));
+            out += (char)(0x80 | (cp & 0x3F));
+        }
+    }
+
+    bool hex4(unsigned& cp) {
+        if (n - i < 4) return false;
+        cp = 0;
+        for (int k = 0; k < 4; ++k) {
+            const int h = hexv(s[i + k]);
+            if (h < 0) { i += k; return false; }
+            cp = (cp << 4) | (unsigned)h;
+        }
+        i += 4;
+        return true;
+    }
+
+    bool string(std::string& out) {
+        if (i >= n || s[i] != '"') return false;
+        ++i;
+        while (i < n) {
+            const unsigned char c = (unsigned char)s[i];
+            if (c == '"') { ++i; return true; }
+            if (c < 0x20) return false;
+            if (c != '\\') { out += (char)c; ++i; continue; }
+            if (++i >= n) return false;
+            const char e = s[i++];
+            switch (e) {
+                case '"':  out += '"';  break;
+                case '\\': out += '\\'; break;
+                case '/':  out += '/';  break;
+                case 'b':  out += '\b'; break;
+                case 'f':  out += '\f'; break;
+                case 'n':  out += '\n'; break;
+                case 'r':  out += '\r'; break;
+                case 't':  out += '\t'; break;
+                case 'u': {
+                    unsigned cp;
+                    if (!hex4(cp)) return false;
+                    if (cp >= 0xD800 && cp < 0xDC00 && n - i >= 6 && s[i] == '\\' && s[i + 1] == 'u') {
+                        i += 2;
+                        unsigned lo;
+                        if (!hex4(lo)) return false;
+                        if (lo >= 0xDC00 && lo < 0xE000) cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                    }
+                    put_utf8(cp, out);
+                    break;
+                }
+                default: --i; return false;
+            }
+        }
+        return false;
+    }
+
+    bool number(json_value& v) {
+        const size_t b = i;
+        if (i < n && s[i] == '-') ++i;
+        if (i >= n) return false;
+        if (s[i] == '0') {
+            ++i;
+        } else if (s[i] >= '1' && s[i] <= '9') {
+            while (i < n && s[i] >= '0' && s[i] <= '9') ++i;
+        } else {
+            return false;
+        }
+        if (i < n && s[i] == '.') {
+            ++i;
+            if (i >= n || s[i] < '0' || s[i] > '9') return false;
+            while (i < n && s[i] >= '0' && s[i] <= '9') ++i;
+        }
+        if (i < n && (s[i] == 'e' || s[i] == 'E')) {
+            ++i;
+            if (i < n && (s[i] == '+' || s[i] == '-')) ++i;
+            if (i >= n || s[i] < '0' || s[i] > '9') return false;
+            while (i < n && s[i] >= '0' && s[i] <= '9') ++i;
+        }
+        v.kind = json_value::NUM;
+        v.str.assign(s + b, i - b);
+        v.num = strtod(v.str.c_str(), nullptr);
+        return true;
+    }
+
+    bool value(json_value& v) {
+        ws();
+        if (i >= n) return false;
+        switch (s[i]) {
+            case 'n': v.kind = json_value::NUL; return lit("null");
+            case 't': v.kind = json_value::BOOL; v.b = true;  return lit("true");
+            case 'f': v.kind = json_value::BOOL; v.b = false; return lit("false");
+            case '"': v.kind = json_value::STR; return string(v.str);
+            case '[': {
+                if (++depth > kMaxDepth) return false;
+                ++i;
+                v.kind = json_value::ARR;
+                ws();
+                if (i < n && s[i] == ']') { ++i; --depth; return true; }
+                for (;;) {
+                    v.arr.emplace_back();
+                    if (!value(v.arr.back())) return false;
+                    ws();
+                    if (i < n && s[i] == ',') { ++i; continue; }
+                    if (i < n && s[i] == ']') { ++i; --depth; return true; }
+                    return false;
+                }
+            }
+            case '{': {
+                if (++depth > kMaxDepth) return false;
+                ++i;
+                v.kind = json_value::OBJ;
+                ws();
+                if (i < n && s[i] == '}') { ++i; --depth; return true; }
+                for (;;) {
+                    ws();
+                    v.obj.emplace_back();
+                    if (!string(v.obj.back().first)) return false;
+                    ws();
+                    if (i >= n || s[i] != ':') return false;
+                    ++i;
+                    if (!value(v.obj.back().second)) return false;
+                    ws();
+                    if (i < n && s[i] == ',') { ++i; continue; }
+                    if (i < n && s[i] == '}') { ++i; --depth; return true; }
+                    return false;
+                }
+            }
+            default:
+                return number(v);
+        }
+    }
+};
+
+void dump_str(const std::string& s, std::string& out) {
+    static const char* hex = "0123456789abcdef";
+    out += '"';
+    for (unsigned char c : s) {
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n";  break;
+            case '\r': out += "\\r";  break;
+            case '\t': out += "\\t";  break;
+            default:
+                if (c < 0x20) {
+                    out += "\\u00";
+                    out += hex[c >> 4];
+                    out += hex[c & 15];
+                } else {
+                    out += (char)c;
+                }
+        }
+    }
+    out += '"';
+}
+
+} // namespace
+
+bool json_parse(const char* s, size_t n, json_value& out, size_t* err_off) {
+    parser p{s, n};
+    out = json_value();
+    bool ok = p.value(out);
+    if (ok) {
+        p.ws();
+        ok = (p.i == n);
+    }
+    if (!ok && err_off) *err_off = p.i;
+    return ok;
+}
+
+void json_dump(const json_value& v, std::string& out) {
+    switch (v.kind) {
+        case json_value::NUL:  out += "null"; break;
+        case json_value::BOOL: out += v.b ? "true" : "false"; break;
+        case json_value::NUM:  out += v.str.empty() ? std::to_string(v.num) : v.str; break;
+        case json_value::STR:  dump_str(v.str, out); break;
+        case json_value::ARR:
+            out += '[';
+            for (size_t k = 0; k < v.arr.size(); ++k) {
+                if (k) out += ',';
+                json_dump(v.arr[k], out);
+            }
+            out += ']';
+            break;
+        case json_value::OBJ:
+            out += '{';
+            for (size_t k = 0; k < v.obj.size(); ++k) {
+                if (k) out += ',';
+                dump_str(v.obj[k].first, out);
+                out += ':';
+                json_dump(v.obj[k].second, out);
+            }
+            out += '}';
+            break;
+    }
+}
+
+// ---------- streaming validation ----------
+json_stream::json_stream(bool build_tree) : build_(build_tree) {}
+
+void json_stream::put_u32(uint32_t v) {
+    if (!build_) return;
+    const size_t at = tree_.size();
+    tree_.resize(at + 4);
+    memcpy(tree_.data() + at, &v, 4);
+}
+
+void json_stream::patch_u32(size_t at, uint32_t v) {
+    if (build_) memcpy(tree_.data() + at, &v, 4);
+}
+
+json_stream::status json_stream::feed(const char* s, size_t n) {
+    for (size_t i = 0; i < n && st_ == MORE; ++i) {
+        if (!step((unsigned char)s[i])) {
+            st_ = ERROR;
+            return st_;
+        }
+        if (st_ == DONE && delim_pending_) return st_;
+        ++off_;
+    }
+    return st_;
+}
+
+json_stream::status json_stream::finish() {
+    if (st_ != MORE) return st_;
+    const bool num_ok = mode_ == M_NUM && (num_st_ == 1 || num_st_ == 2 || num_st_ == 4 || num_st_ == 7);
+    if (num_ok && stack_.empty()) {
+        end_number();
+    } else {
+        st_ = ERROR;
+    }
+    return st_;
+}
+
+bool json_stream::value_start(unsigned char c) {
+    if (stack_.size() >= 256) return false;
+    if (!stack_.empty() && !stack_.back().obj) stack_.back().count++;
+    switch (c) {
+        case '{':
+        case '[': {
+            const bool obj = (c == '{');
+            if (build_) tree_.push_back(obj ? JT_OBJECT : JT_ARRAY);
+            stack_.push_back({obj, tree_.size(), 0});
+            put_u32(0);
+            mode_ = obj ? M_OBJ_FIRST : M_ARR_FIRST;
+            return true;
+        }
+        case '"':
+            if (build_) tree_.push_back(JT_STRING);
+            str_is_key_ = false;
+            str_len_at_ = tree_.size();
+            str_len_    = 0;
+            put_u32(0);
+            mode_ = M_STR;
+            return true;
+        case 't': lit_ = "true";  lit_pos_ = 1; mode_ = M_LIT; return true;
+        case 'f': lit_ = "false"; lit_pos_ = 1; mode_ = M_LIT; return true;
+        case 'n': lit_ = "null";  lit_pos_ = 1; mode_ = M_LIT; return true;
+        default:
+            if (c == '-' || (c >= '0' && c <= '9')) {
+                num_.assign(1, (char)c);
+                num_st_ = c == '-' ? 0 : (c == '0' ? 1 : 2);
+                mode_   = M_NUM;
+                return true;
+            }
+            return false;
+    }
+}
+
+void json_stream::value_done() {
+    if (stack_.empty()) {
+        st_ = DONE;
+        return;
+    }
+    mode_ = stack_.back().obj ? M_OBJ_NEXT : M_ARR_NEXT;
+}
+
+bool json_stream::end_number() {
+    if (build_) {
+        const bool integral = num_.find_first_of(".eE") == std::string::npos;
+        errno = 0;
+        char* end = nullptr;
+        const long long iv = integral ? strtoll(num_.c_str(), &end, 10) : 0;
+        if (integral && errno == 0) {
+            tree_.push_back(JT_INT);
+            const int64_t v = iv;
+            const size_t at = tree_.size();
+            tree_.resize(at + 8);
+            memcpy(tree_.data() + at, &v, 8);
+        } else {
+            tree_.push_back(JT_DOUBLE);
+            const double v = strtod(num_.c_str(), nullptr);
+            const size_t at = tree_.size();
+            tree_.resize(at + 8);
+            memcpy(tree_.data() + at, &v, 8);
+        }
+    }
+    value_done();
+    return true;
+}
+
+bool json_stream::step(unsigned char c) {
+    const bool ws = (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+    switch (mode_) {
+        case M_VALUE:
+            return ws || value_start(c);
+
+        case M_ARR_FIRST:
+            if (ws) return true;
+            if (c != ']') return value_start(c);
+            [[fallthrough]]; // empty array
+        case M_ARR_NEXT:
+            if (ws) return true;
+            if (c == ',') { mode_ = M_VALUE; return true; }
+            if (c != ']') return false;
+            patch_u32(stack_.back().count_at, stack_.back().count);
+            stack_.pop_back();
+            value_done();
+            return true;
+
+        case M_OBJ_FIRST:
+        case M_OBJ_KEY:
+            if (ws) return true;
+            if (c == '}' && mode_ == M_OBJ_FIRST) {
+                patch_u32(stack_.back().count_at, 0);
+                stack_.pop_back();
+                value_done();
+                return true;
+            }
+            if (c != '"') return false;
+            stack_.back().count++;
+            str_is_key_ = true;
+            str_len_at_ = tree_.size();
+            str_len_    = 0;
+            put_u32(0);
+            mode_ = M_STR;
+            return true;
+
+        case M_COLON:
+            if (ws) return true;
+            if (c != ':') return false;
+            mode_ = M_VALUE;
+            return true;
+
+        case M_OBJ_NEXT:
+            if (ws) return true;
+            if (c == ',') { mode_ = M_OBJ_KEY; return true; }
+            if (c != '}') return false;
+            patch_u32(stack_.back().count_at, stack_.back().count);
+            stack_.pop_back();
+            value_done();
+            return true;
+
+        case M_STR:
+            if (hi_surrogate_ && c != '\\') {
+                // unpaired high surrogate
+                if (build_) { tree_.insert(tree_.end(), {0xEF, 0xBF, 0xBD}); str_len_ += 3; }
+                hi_surrogate_ = 0;
+            }
+            if (c == '"') {
+                patch_u32(str_len_at_, str_len_);
+                if (str_is_key_) {
+                    mode_ = M_COLON;
+                } else {
+                    value_done();
+                }
+                return true;
+            }
+            if (c == '\\') { mode_ = M_STR_ESC; return true; }
+            if (c < 0x20) return false;
+            if (build_) { tree_.push_back(c); ++str_len_; }
+            return true;
+
+        case M_STR_ESC: {
+            char out;
+            switch (c) {
+                case '"':  out = '"';  break;
+                case '\\': out = '\\'; break;
+                case '/':  out = '/';  break;
+                case 'b':  out = '\b'; break;
+                case 'f':  out = '\f'; break;
+                case 'n':  out = '\n'; break;
+                case 'r':  out = '\r'; break;
+                case 't':  out = '\t'; break;
+                case 'u':
+                    hex_val_  = 0;
+                    hex_left_ = 4;
+                    mode_     = M_STR_HEX;
+                    return true;
+                default:
+                    return false;
+            }
+            if (hi_surrogate_) {
+                if (build_) { tree_.insert(tree_.end(), {0xEF, 0xBF, 0xBD}); str_len_ += 3; }
+                hi_surrogate_ = 0;
+            }
+            if (build_) { tree_.push_back((uint8_t)out); ++str_len_; }
+            mode_ = M_STR;
+            return true;
+        }
+
+        case M_STR_HEX: {
+            int h;
+            if (c >= '0' && c <= '9')      h = c - '0';
+            else if (c >= 'a' && c <= 'f') h = c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') h = c - 'A' + 10;
+            else return false;
+            hex_val_ = (hex_val_ << 4) | (unsigned)h;
+            if (--hex_left_ > 0) return true;
+
+            mode_ = M_STR;
+            unsigned cp = hex_val_;
+            if (cp >= 0xD800 && cp < 0xDC00) {
+                if (hi_surrogate_ && build_) { tree_.insert(tree_.end(), {0xEF, 0xBF, 0xBD}); str_len_ += 3; }
+                hi_surrogate_ = cp;
+                return true;
+            }
+            if (cp >= 0xDC00 && cp < 0xE000) {
+                cp = hi_surrogate_ ? 0x10000 + ((hi_surrogate_ - 0xD800) << 10) + (cp - 0xDC00) : 0xFFFD;
+            } else if (hi_surrogate_ && build_) {
+                tree_.insert(tree_.end(), {0xEF, 0xBF, 0xBD});
+                str_len_ += 3;
+            }
+            hi_surrogate_ = 0;
+            if (build_) {
+                std::string u;
+                parser::put_utf8(cp, u);
+                tree_.insert(tree_.end(), u.begin(), u.end());
+                str_len_ += (uint32_t)u.size();
+            }
+            return true;
+        }
+
+        case M_NUM: {
+            const bool digit = (c >= '0' && c <= '9');
+            int next = -1;
+            switch (num_st_) {
+                case 0: if (c == '0') next = 1; else if (digit) next = 2; break;
+                case 1: if (c == '.') next = 3; else if (c == 'e' || c == 'E') next = 5; break;
+                case 2: if (digit) next = 2; else if (c == '.') next = 3; else if (c == 'e' || c == 'E') next = 5; break;
+                case 3: if (digit) next = 4; break;
+                case 4: if (digit) next = 4; else if (c == 'e' || c == 'E') next = 5; break;
+                case 5: if (c == '+' || c == '-') next = 6; else if (digit) next = 7; break;
+                case 6:
+                case 7: if (digit) next = 7; break;
+            }
+            if (next >= 0) {
+                num_st_ = (uint8_t)next;
+                num_ += (char)c;
+                return true;
+            }
+            if (num_st_ != 1 && num_st_ != 2 && num_st_ != 4 && num_st_ != 7) return false;
+            end_number();
+            if (st_ == DONE) {
+                delim_pending_ = true;
+                return true;
+            }
+            return step(c);
+        }
+
+        case M_LIT:
+            if (c != (unsigned char)lit_[lit_pos_]) return false;
+            if (lit_[++lit_pos_] == '\0') {
+                if (build_) tree_.push_back(lit_[0] == 't' ? JT_TRUE : lit_[0] == 'f' ? JT_FALSE : JT_NULL);
+                value_done();
+            }
+            return true;
+    }
+    return false;
+}
+
+void json_reindent(const char* s, size_t n, int indent, std::string& out) {
+    int  level  = 0;
+    bool in_str = false, esc = false;
+    auto newline = [&] {
+        if (indent <= 0) return;
+        out += '\n';
+        out.append((size_t)(level * indent), ' ');
+    };
+    for (size_t i = 0; i < n; ++i) {
+        const char c = s[i];
+        if (in_str) {
+            out += c;
+            if (esc) esc = false;
+            else if (c == '\\') esc = true;
+            else if (c == '"') in_str = false;
+            continue;
+        }
+        switch (c) {
+            case ' ': case '\t': case '\n': case '\r':
+                break;
+            case '"':
+                in_str = true;
+                out += c;
+                break;
+            case '{':
+            case '[': {
+                out += c;
+                size_t j = i + 1;
+                while (j < n && (s[j] == ' ' || s[j] == '\t' || s[j] == '\n' || s[j] == '\r')) ++j;
+                if (j < n && (s[j] == '}' || s[j] == ']')) {
+                    out += s[j];
+                    i = j;
+                } else {
+                    ++level;
+                    newline();
+                }
+                break;
+            }
+            case '}':
+            case ']':
+                --level;
+                newline();
+                out += c;
+                break;
+            case ',':
+                out += c;
+                newline();
+                break;
+            case ':':
+                out += indent > 0 ? ": " : ":";
+                break;
+            default:
+                out += c;
+        }
+    }
+}
@@ -0,0 +1,102 @@
+// llm_json.h — small JSON DOM for schemas and structured request options
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct json_value {
+    enum kind_t { NUL, BOOL, NUM, STR, ARR, OBJ };
+
+    kind_t      kind = NUL;
+    bool        b    = false;
+    double      num  = 0.0;
+    std::string str;   // STR payload; for NUM the literal as written
+    std::vector<json_value> arr;
+    std::vector<std::pair<std::string, json_value>> obj; // document order kept
+
+    bool is(kind_t k) const { return kind == k; }
+    const json_value* get(const char* key) const;
+};
+
+// Parses one complete document (surrounding whitespace allowed).
+// On failure returns false and stores the offending byte offset in *err_off.
+bool json_parse(const char* s, size_t n, json_value& out, size_t* err_off);
+
+// Compact serialization, key order preserved. Used for literals and cache keys.
+void json_dump(const json_value& v, std::string& out);
+
+// ---------- streaming validation ----------
+//
+// Binary tree layout (little-endian, preorder), produced while validating:
+//   u8 type, then
+//     JT_NULL / JT_FALSE / JT_TRUE : nothing
+//     JT_INT                       : i64
+//     JT_DOUBLE                    : f64
+//     JT_STRING                    : u32 byte length, UTF-8 bytes
+//     JT_ARRAY                     : u32 count, `count` child nodes
+//     JT_OBJECT                    : u32 count, `count` x (u32 key length, key bytes, child node)
+enum json_tree_type : uint8_t {
+    JT_NULL = 0, JT_FALSE = 1, JT_TRUE = 2, JT_INT = 3, JT_DOUBLE = 4,
+    JT_STRING = 5, JT_ARRAY = 6, JT_OBJECT = 7,
+};
+
+// Incremental validator for generated text: fed piece by piece, it reports the
+// first syntax error as soon as the offending byte arrives and notices the end
+// of the root value without waiting for more input.
+class json_stream {
+public:
+    enum status { MORE, DONE, ERROR };
+
+    explicit json_stream(bool build_tree = false);
+
+    // Consumes bytes until the root value completes or an error is found;
+    // anything after that is ignored.
+    status feed(const char* s, size_t n);
+    // End of input: completes a bare root number, otherwise MORE becomes ERROR.
+    status finish();
+
+    status state() const { return st_; }
+    // Absolute offset of the first bad byte (ERROR), or one past the root value (DONE).
+    size_t offset() const { return off_; }
+    const std::vector<uint8_t>& tree() const { return tree_; }
+
+private:
+    enum mode : uint8_t {
+        M_VALUE, M_OBJ_FIRST, M_OBJ_KEY, M_COLON, M_OBJ_NEXT, M_ARR_FIRST, M_ARR_NEXT,
+        M_STR, M_STR_ESC, M_STR_HEX, M_NUM, M_LIT,
+    };
+    struct frame { bool obj; size_t count_at; uint32_t count; };
+
+    bool step(unsigned char c);
+    bool value_start(unsigned char c);
+    void value_done();
+    bool end_number();
+
+    void put_u32(uint32_t v);
+    void patch_u32(size_t at, uint32_t v);
+
+    bool                 build_;
+    status               st_   = MORE;
+    size_t               off_  = 0;
+    mode                 mode_ = M_VALUE;
+    std::vector<frame>   stack_;
+    std::vector<uint8_t> tree_;
+
+    bool        str_is_key_ = false;
+    size_t      str_len_at_ = 0;
+    uint32_t    str_len_    = 0;
+    unsigned    hex_val_    = 0;
+    int         hex_left_   = 0;
+    unsigned    hi_surrogate_ = 0;
+    std::string num_;
+    uint8_t     num_st_ = 0;
+    bool        delim_pending_ = false; // a root number was ended by a byte it did not consume
+    const char* lit_ = nullptr;
+    size_t      lit_pos_ = 0;
+};
+
+// Rewrites already validated JSON with `indent` spaces per level (0 = compact),
+// copying strings and numbers verbatim. Matches Dart's JsonEncoder.withIndent layout.
+void json_reindent(const char* s, size_t n, int indent, std::string& out);
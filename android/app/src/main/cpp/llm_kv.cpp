@@ -0,0 +1,191 @@
+// llm_kv.cpp — kv_layout, kv_trim, kv_compact
+#include "llm_kv.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "llm_log.h"
+
+void kv_layout::on_decode(size_t n) {
+    const size_t fill = std::min(holes_, n);
+    holes_ -= fill;
+    span_  += n - fill;
+    live_  += n;
+}
+
+void kv_layout::on_drop(size_t cells) {
+    cells  = std::min(cells, live_);
+    live_ -= cells;
+    holes_ += cells;
+    if (live_ == 0) span_ = holes_ = 0;   // nothing left: the allocator starts over
+}
+
+bool kv_trim(llama_context* ctx, kv_seq& s, size_t keep, kv_layout& layout) {
+    if (keep >= s.tokens.size()) return true;
+    const size_t unique_from = std::max(keep, s.shared);
+    const size_t freed = s.tokens.size() > unique_from ? s.tokens.size() - unique_from : 0;
+
+    llama_memory_t mem = llama_get_memory(ctx);
+    bool ok = llama_memory_seq_rm(mem, s.id, (llama_pos)keep, -1);
+    if (!ok) {
+        llama_memory_seq_rm(mem, s.id, -1, -1);
+        keep = 0;
+    }
+    layout.on_drop(ok ? freed : s.tokens.size() - std::min(s.shared, s.tokens.size()));
+    s.tokens.resize(keep);
+    s.shared = std::min(s.shared, keep);
+    s.prompt_len = std::min(s.prompt_len, keep);
+    return ok;
+}
+
+void kv_compact(llama_context* ctx, const std::vector<kv_seq*>& seqs, kv_layout& layout, kv_compact_report& r) {
+    const auto t0 = std::chrono::steady_clock::now();
+    r = kv_compact_report();
+    r.frag_before = layout.fragmentation();
+
+    struct saved {
+        kv_seq*              s;
+        int                  base = -1;   // index into `order` whose prefix this one re-shares
+        size_t               k    = 0;    // length of that prefix
+        std::vector<uint8_t> data;
+        bool                 ok   = false;
+    };
+    std::vector<saved> order;
+    for (kv_seq* s : seqs) {
+        if (!s || s->tokens.empty() || s->paged()) continue;
+        order.emplace_back();
+        order.back().s = s;
+    }
+
+    llama_memory_t mem = llama_get_memory(ctx);
+    for (size_t i = 0; i < order.size(); ++i) {
+        saved& e = order[i];
+        for (size_t j = 0; j < i; ++j) {
+            const auto& a = order[j].s->tokens;
+            const auto& b = e.s->tokens;
+            size_t k = 0;
+            while (k < a.size() && k < b.size() && a[k] == b[k]) ++k;
+            if (k > e.k) { e.k = k; e.base = (int)j; }
+        }
+        // only the part not covered by the base is serialized
+        if (e.k > 0) llama_memory_seq_rm(mem, e.s->id, 0, (llama_pos)e.k);
+        e.data.resize(llama_state_seq_get_size(ctx, e.s->id));
+        e.data.resize(llama_state_seq_get_data(ctx, e.data.data(), e.data.size(), e.s->id));
+        r.bytes_moved += e.data.size();
+    }
+
+    llama_memory_clear(mem, false);
+    size_t live = 0;
+    for (saved& e : order) {
+        const bool base_ok = e.base < 0 || order[e.base].ok;
+        e.ok = base_ok && llama_state_seq_set_data(ctx, e.data.data(), e.data.size(), e.s->id) != 0;
+        if (e.ok && e.k > 0) llama_memory_seq_cp(mem, order[e.base].s->id, e.s->id, 0, (llama_pos)e.k);
+        if (!e.ok) {
+            llama_memory_seq_rm(mem, e.s->id, -1, -1);
+            e.s->tokens.clear();
+            e.s->prompt_len = 0;
+            e.s->shared     = 0;
+            ++r.dropped;
+            continue;
+        }
+        e.s->shared = e.k;
+        live += e.s->tokens.size() - e.k;
+        ++r.seqs;
+    }
+    layout.reset(live);
+
+    r.frag_after = layout.fragmentation();
+    r.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    LLOGI("kv: compacted %d seqs (%d dropped), %.1f%% -> %.1f%% fragmented, %zu bytes in %.1f ms",
+          r.seqs, r.dropped, r.frag_before * 100, r.frag_after * 100, r.bytes_moved, r.ms);
+}
+
+// ---------- page file ----------
+static constexpr size_t kPageUnit = 64 * 1024;
+
+static size_t round_up(size_t n) { return (n + kPageUnit - 1) / kPageUnit * kPageUnit; }
+
+bool kv_pager::open(const std::string& path) {
+    close();
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd_ < 0) { LLOGE("kv_pager: cannot open %s", path.c_str()); return false; }
+    path_ = path;
+    return true;
+}
+
+void kv_pager::close() {
+    if (base_) munmap(base_, size_);
+    if (fd_ >= 0) {
+        ::close(fd_);
+        remove(path_.c_str());
+    }
+    fd_   = -1;
+    base_ = nullptr;
+    size_ = used_ = 0;
+    free_.clear();
+}
+
+bool kv_pager::grow(size_t min_size) {
+    const size_t old = size_;
+    size_t sz = std::max(old * 2, (size_t)(16u << 20));
+    while (sz < min_size) sz *= 2;
+    if (ftruncate(fd_, (off_t)sz) != 0) { LLOGE("kv_pager: cannot grow to %zu bytes", sz); return false; }
+    void* m = mmap(nullptr, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (m == MAP_FAILED) { LLOGE("kv_pager: mmap of %zu bytes failed", sz); return false; }
+    if (base_) munmap(base_, old);
+    base_ = (uint8_t*)m;
+    size_ = sz;
+    add_free(old, sz - old);
+    return true;
+}
+
+int64_t kv_pager::alloc(size_t n) {
+    if (fd_ < 0) return -1;
+    n = round_up(std::max<size_t>(n, 1));
+    for (int pass = 0; pass < 2; ++pass) {
+        for (size_t i = 0; i < free_.size(); ++i) {
+            if (free_[i].second < n) continue;
+            const size_t off = free_[i].first;
+            free_[i].first  += n;
+            free_[i].second -= n;
+            if (free_[i].second == 0) free_.erase(free_.begin() + (ptrdiff_t)i);
+            used_ += n;
+            return (int64_t)off;
+        }
+        // grow by at least n beyond a free tail, if any
+        const size_t tail = !free_.empty() && free_.back().first + free_.back().second == size_ ? free_.back().second : 0;
+        if (pass == 0 && !grow(size_ + n - tail)) return -1;
+    }
+    return -1;
+}
+
+void kv_pager::release(int64_t off, size_t n) {
+    if (off < 0 || !n) return;
+    n = round_up(n);
+    used_ -= std::min(used_, n);
+#if defined(FALLOC_FL_PUNCH_HOLE) && defined(FALLOC_FL_KEEP_SIZE)
+    fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)off, (off_t)n);
+#else
+    madvise(base_ + off, n, MADV_DONTNEED);
+#endif
+    add_free((size_t)off, n);
+}
+
+void kv_pager::add_free(size_t off, size_t n) {
+    auto it = std::lower_bound(free_.begin(), free_.end(), std::make_pair(off, (size_t)0));
+    it = free_.insert(it, {off, n});
+    // merge with the neighbours
+    if (it + 1 != free_.end() && it->first + it->second == (it + 1)->first) {
+        it->second += (it + 1)->second;
+        free_.erase(it + 1);
+    }
+    if (it != free_.begin() && (it - 1)->first + (it - 1)->second == it->first) {
+        (it - 1)->second += it->second;
+        free_.erase(it);
+    }
+}
@@ -0,0 +1,94 @@
+// llm_kv.h — KV cache bookkeeping for the sequences sharing the engine context
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "llama.h"
+
+// One sequence of the (unified) KV cache and the tokens it holds.
+struct kv_seq {
+    llama_seq_id             id = 0;
+    std::vector<llama_token> tokens;         // in position order
+    size_t                   prompt_len = 0; // prompt part of the last request
+    size_t                   shared     = 0; // leading cells shared with the sequence it was forked from
+    uint64_t                 last_use   = 0; // request tick, for choosing what to page out
+
+    // paged out (kv_pager): the cells after page_k live in the page file; the first page_k
+    // are re-shared from a resident sequence with the same tokens on page-in
+    int64_t                  page_off   = -1;
+    size_t                   page_len   = 0;
+    size_t                   page_k     = 0;
+    bool paged() const { return page_off >= 0; }
+};
+
+// llama.cpp does not expose where cells live, so fragmentation is modelled from what we
+// do to the cache: freed cells become holes, new tokens fill holes before growing the
+// used span (the allocator restarts its search at the first freed cell). Attention runs
+// over the whole span, so holes cost time on every decode even when nothing fails.
+class kv_layout {
+public:
+    void on_decode(size_t n);
+    void on_drop(size_t cells);
+    void reset(size_t live) { live_ = span_ = live; holes_ = 0; }
+
+    double fragmentation() const { return span_ ? (double)holes_ / (double)span_ : 0.0; }
+    size_t live()  const { return live_; }
+    size_t span()  const { return span_; }
+
+private:
+    size_t live_  = 0;
+    size_t span_  = 0;
+    size_t holes_ = 0;
+};
+
+// Removes cells [keep, end) of s; false (sequence emptied) if llama refused a partial removal.
+bool kv_trim(llama_context* ctx, kv_seq& s, size_t keep, kv_layout& layout);
+
+struct kv_compact_report {
+    double frag_before = 0;
+    double frag_after  = 0;
+    size_t bytes_moved = 0;
+    double ms          = 0;
+    int    seqs        = 0;    // sequences rewritten
+    int    dropped     = 0;    // sequences that did not fit back (emptied; re-decoded on next use)
+};
+
+// Page file for sequence state spilled out of the KV cache. Extents are allocated first
+// fit in 64 KiB units; llama_state_seq_get_data writes straight into the mapping and
+// llama_state_seq_set_data reads from it. Freed extents are coalesced and, where the file
+// system allows, punched out so idle sessions only cost disk for what they hold.
+class kv_pager {
+public:
+    ~kv_pager() { close(); }
+
+    bool open(const std::string& path);   // creates/truncates
+    void close();                         // and deletes the file
+    bool is_open() const { return fd_ >= 0; }
+
+    int64_t  alloc(size_t n);             // -1 if the file cannot grow
+    void     release(int64_t off, size_t n);
+    uint8_t* at(int64_t off) const { return base_ + off; }
+
+    size_t file_bytes() const { return size_; }
+    size_t used_bytes() const { return used_; }
+
+private:
+    bool grow(size_t min_size);
+    void add_free(size_t off, size_t n);
+
+    std::string                            path_;
+    int                                    fd_   = -1;
+    uint8_t*                               base_ = nullptr;
+    size_t                                 size_ = 0;
+    size_t                                 used_ = 0;
+    std::vector<std::pair<size_t, size_t>> free_;   // (offset, length), sorted by offset
+};
+
+// Rewrites every resident, non-empty sequence densely from the start of the cache: each is
+// serialized, the cache cleared, and each restored in turn. A sequence that starts with
+// the tokens of one restored before it only moves its own suffix and re-shares that
+// prefix (seq_cp), so forks stay cheap. Between decodes only; ctx must be idle.
+void kv_compact(llama_context* ctx, const std::vector<kv_seq*>& seqs, kv_layout& layout, kv_compact_report& r);
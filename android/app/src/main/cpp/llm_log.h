@@ -0,0 +1,17 @@
+// llm_log.h — logging macros shared by the bridge translation units
+#pragma once
+
+#ifndef LLOG_TAG
+#define LLOG_TAG "LLM_BRIDGE"
+#endif
+
+#include "llm_bridge.h"
+
+// Formats once, writes to logcat (Android) or stderr (host builds) and into the log ring
+// (llm_logbuf.h). Debug lines only go anywhere when the ring's level lets them through.
+void llm_log_emit(int level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#define LLOGD(...) llm_log_emit(LLM_LOG_DEBUG, __VA_ARGS__)
+#define LLOGI(...) llm_log_emit(LLM_LOG_INFO,  __VA_ARGS__)
+#define LLOGW(...) llm_log_emit(LLM_LOG_WARN,  __VA_ARGS__)
+#define LLOGE(...) llm_log_emit(LLM_LOG_ERROR, __VA_ARGS__)
@@ -0,0 +1,281 @@
+// llm_logbuf.cpp — log ring, llama log callback, rotating file writer
+#include "llm_logbuf.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <ctime>
+#include <thread>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__ANDROID__)
+#include <android/log.h>
+#endif
+
+#include "llama.h"
+#include "llm_bridge.h"
+#include "llm_log.h"
+
+namespace {
+
+constexpr size_t kSlots = 1024;          // power of two
+constexpr size_t kWords = 28;            // 224 bytes of text per line
+
+// Seqlock slot: ver is 2*seq+1 while being written, 2*seq+2 once complete. Payload words
+// are relaxed atomics so a reader racing a writer sees torn data, never UB, and the
+// version check throws it away.
+struct slot {
+    std::atomic<uint64_t> ver{0};
+    std::atomic<int64_t>  ts_ms{0};
+    std::atomic<uint64_t> meta{0};       // tid << 32 | level << 24 | src << 16 | len
+    std::atomic<uint64_t> words[kWords];
+};
+
+slot                  g_ring[kSlots];
+std::atomic<uint64_t> g_head{0};
+std::atomic<int>      g_min_level{LLM_LOG_INFO};
+std::atomic<log_tap>  g_tap{nullptr};
+
+uint32_t thread_id() {
+    thread_local const uint32_t tid = (uint32_t)syscall(SYS_gettid);
+    return tid;
+}
+
+int64_t wall_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+struct line {
+    int64_t     ts_ms;
+    uint32_t    tid;
+    int         level;
+    int         src;
+    std::string text;
+};
+
+// false if the slot no longer (or not yet) holds `seq`
+bool read_slot(uint64_t seq, line& out) {
+    const slot& s = g_ring[seq & (kSlots - 1)];
+    const uint64_t v = s.ver.load(std::memory_order_acquire);
+    if (v != 2 * seq + 2) return false;
+    const uint64_t meta = s.meta.load(std::memory_order_relaxed);
+    out.ts_ms = s.ts_ms.load(std::memory_order_relaxed);
+    out.tid   = (uint32_t)(meta >> 32);
+    out.level = (int)((meta >> 24) & 0xff);
+    out.src   = (int)((meta >> 16) & 0xff);
+    const size_t len = std::min<size_t>(meta & 0xffff, kWords * 8);
+    uint64_t w[kWords];
+    for (size_t i = 0; i < (len + 7) / 8; ++i) w[i] = s.words[i].load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (s.ver.load(std::memory_order_relaxed) != v) return false;
+    out.text.assign((const char*)w, len);
+    return true;
+}
+
+void format_line(const line& l, std::string& out) {
+    static const char kLevel[] = "DIWE";
+    const time_t secs = (time_t)(l.ts_ms / 1000);
+    struct tm tm;
+    localtime_r(&secs, &tm);
+    char head[96];
+    const int n = snprintf(head, sizeof(head), "%04d-%02d-%02d %02d:%02d:%02d.%03d %c %u %s: ",
+                           tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                           (int)(l.ts_ms % 1000), kLevel[std::min(3, std::max(0, l.level))], l.tid,
+                           l.src == LOG_SRC_LLAMA ? "llama" : LLOG_TAG);
+    out.append(head, (size_t)std::max(0, n));
+    out += l.text;
+    out += '\n';
+}
+
+// ---------- llama/ggml callback ----------
+int from_ggml(int level) {
+    switch (level) {
+        case GGML_LOG_LEVEL_DEBUG: return LLM_LOG_DEBUG;
+        case GGML_LOG_LEVEL_WARN:  return LLM_LOG_WARN;
+        case GGML_LOG_LEVEL_ERROR: return LLM_LOG_ERROR;
+        default:                   return LLM_LOG_INFO;
+    }
+}
+
+// llama logs in fragments (GGML_LOG_LEVEL_CONT continues the previous one); lines are
+// assembled per thread and pushed when complete.
+void llama_route(ggml_log_level level, const char* text, void*) {
+    if (!text) return;
+    if (log_tap tap = g_tap.load(std::memory_order_acquire)) {
+        if (tap((int)level, text)) return;
+    }
+    thread_local std::string pending;
+    thread_local int         cur = LLM_LOG_INFO;
+    if (level != GGML_LOG_LEVEL_CONT) {
+        cur = from_ggml((int)level);
+        pending.clear();
+    }
+    if (!log_enabled(cur)) return;
+
+    pending += text;
+    size_t start = 0, nl;
+    while ((nl = pending.find('\n', start)) != std::string::npos) {
+        if (nl > start) {
+            log_push(cur, LOG_SRC_LLAMA, pending.data() + start, nl - start);
+#if defined(__ANDROID__)
+            if (cur >= LLM_LOG_WARN) {
+                __android_log_print(cur == LLM_LOG_WARN ? ANDROID_LOG_WARN : ANDROID_LOG_ERROR, "llama",
+                                    "%.*s", (int)(nl - start), pending.data() + start);
+            }
+#else
+            if (cur >= LLM_LOG_WARN) fprintf(stderr, "%c/llama: %.*s\n", cur == LLM_LOG_WARN ? 'W' : 'E',
+                                             (int)(nl - start), pending.data() + start);
+#endif
+        }
+        start = nl + 1;
+    }
+    pending.erase(0, start);
+}
+
+// ---------- file writer ----------
+std::mutex              g_file_mu;
+std::condition_variable g_file_cv;
+std::thread             g_file_thread;
+std::string             g_file_path;
+size_t                  g_file_max   = 0;
+int                     g_file_count = 0;
+bool                    g_file_stop  = false;
+
+void rotate() {
+    for (int i = g_file_count - 1; i >= 1; --i) {
+        const std::string from = i == 1 ? g_file_path : g_file_path + "." + std::to_string(i - 1);
+        rename(from.c_str(), (g_file_path + "." + std::to_string(i)).c_str());
+    }
+    if (g_file_count <= 1) remove(g_file_path.c_str());
+}
+
+void file_loop() {
+    const uint64_t head = g_head.load();
+    uint64_t cursor = head > kSlots ? head - kSlots : 0;   // what the ring still has, then new lines
+    std::unique_lock<std::mutex> lock(g_file_mu);
+    for (;;) {
+        g_file_cv.wait_for(lock, std::chrono::seconds(1), [] { return g_file_stop; });
+        const bool stop = g_file_stop;
+        const std::string path = g_file_path;
+        const size_t max = g_file_max;
+        lock.unlock();
+
+        std::string chunk;
+        do {
+            chunk.clear();
+            log_read(cursor, chunk, 64 * 1024);
+            if (chunk.empty()) break;
+            if (FILE* f = fopen(path.c_str(), "ab")) {
+                fwrite(chunk.data(), 1, chunk.size(), f);
+                const long size = ftell(f);
+                fclose(f);
+                if (max && size > 0 && (size_t)size >= max) {
+                    std::lock_guard<std::mutex> relock(g_file_mu);
+                    rotate();
+                }
+            }
+        } while (chunk.size() >= 60 * 1024);
+
+        lock.lock();
+        if (stop) return;
+    }
+}
+
+} // namespace
+
+void log_install() {
+    static std::once_flag once;
+    std::call_once(once, [] { llama_log_set(llama_route, nullptr); });
+}
+
+void log_set_tap(log_tap tap) { g_tap.store(tap, std::memory_order_release); }
+
+void log_set_level(int min_level) { g_min_level.store(min_level, std::memory_order_relaxed); }
+
+bool log_enabled(int level) { return level >= g_min_level.load(std::memory_order_relaxed); }
+
+void log_push(int level, log_source src, const char* text, size_t n) {
+    if (!log_enabled(level)) return;
+    n = std::min(n, kWords * 8);
+    const uint64_t seq = g_head.fetch_add(1, std::memory_order_relaxed);
+    slot& s = g_ring[seq & (kSlots - 1)];
+    s.ver.store(2 * seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s.ts_ms.store(wall_ms(), std::memory_order_relaxed);
+    s.meta.store((uint64_t)thread_id() << 32 | (uint64_t)(level & 0xff) << 24 | (uint64_t)(src & 0xff) << 16 | n,
+                 std::memory_order_relaxed);
+    uint64_t w[kWords];
+    memcpy(w, text, n);
+    for (size_t i = 0; i < (n + 7) / 8; ++i) s.words[i].store(w[i], std::memory_order_relaxed);
+    s.ver.store(2 * seq + 2, std::memory_order_release);
+}
+
+void log_read(uint64_t& cursor, std::string& out, size_t max_bytes) {
+    const uint64_t head = g_head.load(std::memory_order_acquire);
+    uint64_t seq  = std::max(cursor, head > kSlots ? head - kSlots : 0);
+    uint64_t lost = seq - std::min(seq, cursor);
+    line l;
+    for (; seq < head && out.size() < max_bytes; ++seq) {
+        if (!read_slot(seq, l)) {
+            // still being written: stop here and pick it up next time
+            if (g_ring[seq & (kSlots - 1)].ver.load(std::memory_order_acquire) == 2 * seq + 1) break;
+            ++lost;
+            continue;
+        }
+        if (lost) {
+            char m[48];
+            snprintf(m, sizeof(m), "... %llu lines lost\n", (unsigned long long)lost);
+            out += m;
+            lost = 0;
+        }
+        format_line(l, out);
+    }
+    cursor = seq;
+}
+
+bool log_file(const std::string& path, size_t max_bytes, int max_files) {
+    {
+        std::lock_guard<std::mutex> lock(g_file_mu);
+        g_file_stop = true;
+    }
+    g_file_cv.notify_all();
+    if (g_file_thread.joinable()) g_file_thread.join();
+    if (path.empty()) return true;
+
+    FILE* f = fopen(path.c_str(), "ab");
+    if (!f) return false;
+    fclose(f);
+    std::lock_guard<std::mutex> lock(g_file_mu);
+    g_file_path  = path;
+    g_file_max   = max_bytes;
+    g_file_count = std::max(1, max_files);
+    g_file_stop  = false;
+    g_file_thread = std::thread(file_loop);
+    return true;
+}
+
+void llm_log_emit(int level, const char* fmt, ...) {
+    if (level < LLM_LOG_INFO && !log_enabled(level)) return;   // before paying for the format
+    char buf[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    n = std::min(n, (int)sizeof(buf) - 1);
+#if defined(__ANDROID__)
+    static const int kPrio[] = {ANDROID_LOG_DEBUG, ANDROID_LOG_INFO, ANDROID_LOG_WARN, ANDROID_LOG_ERROR};
+    __android_log_write(kPrio[std::min(3, std::max(0, level))], LLOG_TAG, buf);
+#else
+    fprintf(stderr, "%c/" LLOG_TAG ": %s\n", "DIWE"[std::min(3, std::max(0, level))], buf);
+#endif
+    log_push(level, LOG_SRC_BRIDGE, buf, (size_t)n);
+}
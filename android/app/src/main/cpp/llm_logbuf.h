@@ -0,0 +1,35 @@
+// llm_logbuf.h — in-memory log ring for llama/ggml and bridge messages
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Every line goes into a fixed ring of slots (oldest overwritten, writers never block or
+// allocate) stamped with wall-clock time and thread id. Lines below the minimum level are
+// dropped before any formatting, so verbose llama logging costs one atomic load per call.
+// An optional writer thread copies the ring to a size-rotated file.
+
+enum log_source { LOG_SRC_BRIDGE = 0, LOG_SRC_LLAMA = 1 };
+
+// Routes llama/ggml logging here (idempotent). Everything else still reaches logcat or
+// stderr at warning and above.
+void log_install();
+
+// Raw llama/ggml text is offered to the tap first; returning true swallows it. One tap at
+// a time (requantization reads its progress from the log this way). May throw: the
+// exception unwinds into the llama call that logged.
+typedef bool (*log_tap)(int ggml_level, const char* text);
+void log_set_tap(log_tap tap);
+
+void log_push(int level, log_source src, const char* text, size_t n);
+void log_set_level(int min_level);
+bool log_enabled(int level);
+
+// Lines after `cursor` as "YYYY-MM-DD hh:mm:ss.mmm L tid tag: text\n", up to max_bytes;
+// cursor advances past what was returned. Overwritten lines show up as one
+// "... N lines lost" marker.
+void log_read(uint64_t& cursor, std::string& out, size_t max_bytes);
+
+// path empty: no file. Otherwise the writer thread appends every second and rotates to
+// path.1 .. path.<max_files-1> past max_bytes.
+bool log_file(const std::string& path, size_t max_bytes, int max_files);
@@ -0,0 +1,184 @@
+// llm_metrics.cpp — per-thread metric shards
+#include "llm_metrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+
+namespace {
+
+// Log-spaced buckets over microseconds, 4 per octave: bucket b holds values below
+// 2^((b+1)/4) µs, the last one everything above ~16 s.
+constexpr int kBuckets = 96;
+
+int bucket_of(double us) {
+    if (!(us >= 1.0)) return 0;
+    const int b = (int)(std::log2(us) * 4.0);
+    return std::min(b, kBuckets - 1);
+}
+
+double bucket_upper_us(int b) { return std::exp2((b + 1) / 4.0); }
+
+struct alignas(64) shard {
+    std::atomic<int64_t>  counters[M_COUNTER_COUNT];
+    std::atomic<uint64_t> buckets[H_HIST_COUNT][kBuckets];
+    std::atomic<double>   sum_us[H_HIST_COUNT];
+    std::atomic<double>   max_us[H_HIST_COUNT];
+    std::atomic<bool>     owned{false};
+    shard*                next = nullptr;
+
+    shard() {
+        for (auto& c : counters) c.store(0, std::memory_order_relaxed);
+        for (auto& h : buckets) for (auto& b : h) b.store(0, std::memory_order_relaxed);
+        for (auto& s : sum_us) s.store(0, std::memory_order_relaxed);
+        for (auto& m : max_us) m.store(0, std::memory_order_relaxed);
+    }
+};
+
+// Append-only list: shards are never freed, a thread that exits hands its shard (and the
+// values in it) to the next new thread.
+std::atomic<shard*> g_shards{nullptr};
+
+shard* claim() {
+    for (shard* s = g_shards.load(std::memory_order_acquire); s; s = s->next) {
+        bool expected = false;
+        if (!s->owned.load(std::memory_order_relaxed) &&
+            s->owned.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            return s;
+        }
+    }
+    shard* s = new shard();
+    s->owned.store(true, std::memory_order_relaxed);
+    s->next = g_shards.load(std::memory_order_relaxed);
+    while (!g_shards.compare_exchange_weak(s->next, s, std::memory_order_release, std::memory_order_relaxed)) {}
+    return s;
+}
+
+struct shard_ref {
+    shard* s = claim();
+    ~shard_ref() { s->owned.store(false, std::memory_order_release); }
+};
+
+shard& mine() {
+    thread_local shard_ref ref;
+    return *ref.s;
+}
+
+// single writer: load + store, no atomic RMW needed
+template <typename T> void bump(std::atomic<T>& a, T v) {
+    a.store(a.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+}
+
+const char* const kCounterNames[M_COUNTER_COUNT] = {
+    "requests", "request_errors", "coalesced", "prompt_tokens", "generated_tokens",
+    "prefix_tokens", "tok_cache_hits", "tok_cache_misses", "template_tokens", "stream_dropped", "kv_page_outs", "kv_drops",
+    "kv_compactions", "unloads", "queue_depth", "active",
+};
+const char* const kHistNames[H_HIST_COUNT] = {
+    "queue_wait", "ttft", "token", "request",
+};
+
+bool is_gauge(int c) { return c == M_QUEUE_DEPTH || c == M_ACTIVE; }
+
+struct snapshot {
+    int64_t  counters[M_COUNTER_COUNT] = {};
+    uint64_t buckets[H_HIST_COUNT][kBuckets] = {};
+    uint64_t count[H_HIST_COUNT] = {};
+    double   sum_us[H_HIST_COUNT] = {};
+    double   max_us[H_HIST_COUNT] = {};
+};
+
+void take(snapshot& out) {
+    for (shard* s = g_shards.load(std::memory_order_acquire); s; s = s->next) {
+        for (int c = 0; c < M_COUNTER_COUNT; ++c) out.counters[c] += s->counters[c].load(std::memory_order_relaxed);
+        for (int h = 0; h < H_HIST_COUNT; ++h) {
+            for (int b = 0; b < kBuckets; ++b) {
+                const uint64_t n = s->buckets[h][b].load(std::memory_order_relaxed);
+                out.buckets[h][b] += n;
+                out.count[h]      += n;
+            }
+            out.sum_us[h] += s->sum_us[h].load(std::memory_order_relaxed);
+            out.max_us[h]  = std::max(out.max_us[h], s->max_us[h].load(std::memory_order_relaxed));
+        }
+    }
+}
+
+// upper bound of the bucket holding quantile q, capped at the observed max
+double quantile_us(const snapshot& s, int h, double q) {
+    if (!s.count[h]) return 0;
+    const double rank = q * (double)s.count[h];
+    uint64_t seen = 0;
+    for (int b = 0; b < kBuckets; ++b) {
+        seen += s.buckets[h][b];
+        if ((double)seen >= rank) return std::min(bucket_upper_us(b), s.max_us[h]);
+    }
+    return s.max_us[h];
+}
+
+void appendf(std::string& out, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+void appendf(std::string& out, const char* fmt, ...) {
+    char buf[256];
+    va_list ap;
+    va_start(ap, fmt);
+    const int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (n > 0) out.append(buf, (size_t)std::min(n, (int)sizeof(buf) - 1));
+}
+
+} // namespace
+
+void metric_add(metric_counter c, int64_t v) {
+    bump(mine().counters[c], v);
+}
+
+void metric_observe(metric_hist h, double ms) {
+    shard& s = mine();
+    const double us = std::max(0.0, ms * 1000.0);
+    bump(s.buckets[h][bucket_of(us)], (uint64_t)1);
+    bump(s.sum_us[h], us);
+    if (us > s.max_us[h].load(std::memory_order_relaxed)) s.max_us[h].store(us, std::memory_order_relaxed);
+}
+
+void metrics_json(std::string& out) {
+    snapshot s;
+    take(s);
+    out = "{\"counters\":{";
+    for (int c = 0; c < M_COUNTER_COUNT; ++c) {
+        appendf(out, "%s\"%s\":%lld", c ? "," : "", kCounterNames[c], (long long)s.counters[c]);
+    }
+    out += "},\"histograms_ms\":{";
+    for (int h = 0; h < H_HIST_COUNT; ++h) {
+        appendf(out, "%s\"%s\":{\"count\":%llu,\"sum\":%.3f,\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"max\":%.3f}",
+                h ? "," : "", kHistNames[h], (unsigned long long)s.count[h], s.sum_us[h] / 1000.0,
+                quantile_us(s, h, 0.50) / 1000.0, quantile_us(s, h, 0.90) / 1000.0,
+                quantile_us(s, h, 0.99) / 1000.0, s.max_us[h] / 1000.0);
+    }
+    out += "}}";
+}
+
+void metrics_prometheus(std::string& out) {
+    snapshot s;
+    take(s);
+    out.clear();
+    for (int c = 0; c < M_COUNTER_COUNT; ++c) {
+        const bool g = is_gauge(c);
+        appendf(out, "# TYPE llm_%s%s %s\nllm_%s%s %lld\n", kCounterNames[c], g ? "" : "_total",
+                g ? "gauge" : "counter", kCounterNames[c], g ? "" : "_total", (long long)s.counters[c]);
+    }
+    for (int h = 0; h < H_HIST_COUNT; ++h) {
+        const char* name = kHistNames[h];
+        appendf(out, "# TYPE llm_%s_seconds histogram\n", name);
+        // one `le` per octave keeps the exposition short; counts stay cumulative
+        uint64_t cum = 0;
+        for (int b = 0; b < kBuckets - 1; ++b) {
+            cum += s.buckets[h][b];
+            if ((b + 1) % 4 == 0) appendf(out, "llm_%s_seconds_bucket{le=\"%g\"} %llu\n", name,
+                                          bucket_upper_us(b) / 1e6, (unsigned long long)cum);
+        }
+        appendf(out, "llm_%s_seconds_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)s.count[h]);
+        appendf(out, "llm_%s_seconds_sum %.6f\nllm_%s_seconds_count %llu\n", name, s.sum_us[h] / 1e6,
+                name, (unsigned long long)s.count[h]);
+    }
+}
@@ -0,0 +1,44 @@
+// llm_metrics.h — lock-free counters and latency histograms, aggregated on read
+#pragma once
+#include <cstdint>
+#include <string>
+
+// Counters are per thread: each thread writes its own cache-line-aligned shard with plain
+// relaxed stores (one writer, no read-modify-write), so recording never contends with
+// inference or with other threads. A snapshot sums the shards. Values are signed so a
+// gauge is simply a counter moved up and down by the same thread.
+enum metric_counter {
+    M_REQUESTS,
+    M_REQUEST_ERRORS,
+    M_COALESCED,          // requests served by an identical in-flight one
+    M_PROMPT_TOKENS,
+    M_GEN_TOKENS,
+    M_PREFIX_TOKENS,      // prompt tokens found already in the KV cache
+    M_TOK_CACHE_HITS,
+    M_TOK_CACHE_MISSES,
+    M_TEMPLATE_TOKENS,    // prompt tokens taken pre-tokenized from templates
+    M_STREAM_DROPPED,     // streamed bytes a slow consumer missed (LLM_STREAM_DROP)
+    M_KV_PAGE_OUTS,       // sessions evicted to the page file
+    M_KV_DROPS,           // sessions whose KV was discarded
+    M_KV_COMPACTIONS,
+    M_UNLOADS,
+    M_QUEUE_DEPTH,        // gauge: requests waiting for the engine
+    M_ACTIVE,             // gauge: requests holding the engine
+    M_COUNTER_COUNT
+};
+
+enum metric_hist {
+    H_QUEUE_WAIT,         // waiting for the engine lock
+    H_TTFT,               // request start to first generated token
+    H_TOKEN,              // between consecutive generated tokens
+    H_REQUEST,            // whole request
+    H_HIST_COUNT
+};
+
+void metric_add(metric_counter c, int64_t v = 1);
+void metric_observe(metric_hist h, double ms);
+
+// "json": counters plus count/sum/p50/p90/p99/max per histogram (milliseconds);
+// "prometheus": text exposition format, histograms in seconds.
+void metrics_json(std::string& out);
+void metrics_prometheus(std::string& out);
@@ -0,0 +1,184 @@
+// llm_numfmt.cpp — token-frugal number formats for tables in prompts
+#include "llm_numfmt.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+
+namespace {
+
+int decimals(double step) {
+    if (!(step > 0) || step >= 1) return 0;
+    return std::min(12, (int)std::ceil(-std::log10(step) - 1e-9));
+}
+
+std::string fixed(double v, int d) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*f", d, v);
+    return buf;
+}
+
+// fixed() without trailing zeros: "23.7800" -> "23.78", "5.0" -> "5", "-0" -> "0"
+std::string fixed_short(double v, int d) {
+    std::string s = fixed(v, d);
+    if (s.find('.') != std::string::npos) {
+        while (s.back() == '0') s.pop_back();
+        if (s.back() == '.') s.pop_back();
+    }
+    if (s == "-0") s = "0";
+    return s;
+}
+
+std::string utc(double t, bool seconds) {
+    const time_t tt = (time_t)std::llround(t);
+    struct tm tm;
+    gmtime_r(&tt, &tm);
+    char buf[32];
+    strftime(buf, sizeof(buf), seconds ? "%Y-%m-%d %H:%M:%S" : "%Y-%m-%d %H:%M", &tm);
+    return buf;
+}
+
+std::string time_unit(double step) {
+    if (step == 1)     return "s";
+    if (step == 60)    return "min";
+    if (step == 3600)  return "h";
+    if (step == 86400) return "d";
+    return fixed_short(step, 3) + " s";
+}
+
+std::string join(const std::vector<std::string>& cells) {
+    std::string s;
+    for (size_t i = 0; i < cells.size(); ++i) {
+        if (i) s += ',';
+        s += cells[i];
+    }
+    return s;
+}
+
+// One column under one encoding: its cells and its part of the header line.
+struct rendering {
+    std::vector<std::string> cells;
+    std::string              header;
+    double                   ref = 0;
+};
+
+void render(const double* v, size_t rows, size_t stride, const num_column& c, num_encoding enc,
+            rendering& r) {
+    const bool   time  = c.kind == num_column::TIME;
+    const double step  = c.step > 0 ? c.step : 1;
+    const int    d     = decimals(step);
+    const bool   secs  = step < 60;
+
+    std::vector<int64_t> q(rows);
+    int64_t qmin = INT64_MAX, qfirst = INT64_MAX;
+    for (size_t i = 0; i < rows; ++i) {
+        const double x = v[i * stride];
+        if (std::isnan(x)) continue;
+        q[i] = std::llround(x / step);
+        qmin = std::min(qmin, q[i]);
+        if (qfirst == INT64_MAX) qfirst = q[i];
+    }
+    r.cells.assign(rows, std::string());
+    if (qmin == INT64_MAX) { r.header.clear(); return; }   // all empty
+
+    const int64_t qref = enc == NUM_DELTA ? qfirst : qmin;
+    r.ref = enc == NUM_ABS ? 0 : (double)qref * step;
+    int64_t prev = qref;
+    for (size_t i = 0; i < rows; ++i) {
+        if (std::isnan(v[i * stride])) continue;
+        switch (enc) {
+        case NUM_ABS:
+            r.cells[i] = time ? utc((double)q[i] * step, secs) : fixed_short((double)q[i] * step, d);
+            break;
+        case NUM_REF:
+            r.cells[i] = std::to_string(q[i] - qref);
+            break;
+        case NUM_DELTA:
+            r.cells[i] = std::to_string(q[i] - prev);
+            prev = q[i];
+            break;
+        }
+    }
+
+    const std::string unit = time ? " " + time_unit(step) : "*" + fixed_short(step, d);
+    const std::string base = time ? utc(r.ref, secs) + " UTC" : fixed_short(r.ref, d);
+    switch (enc) {
+    case NUM_ABS:   r.header = time ? c.name + " in UTC" : ""; break;
+    case NUM_REF:   r.header = c.name + " = " + base + " + n" + unit; break;
+    case NUM_DELTA: r.header = c.name + " = " + base + " + running sum of n" + unit; break;
+    }
+}
+
+// The plain cell a prompt builder would write without this.
+std::string plain(double x, const num_column& c) {
+    if (std::isnan(x)) return std::string();
+    if (c.kind == num_column::TIME) return utc(x, true);
+    return fixed(x, decimals(c.step));
+}
+
+} // namespace
+
+const char* num_encoding_name(num_encoding e) {
+    switch (e) {
+    case NUM_ABS:   return "abs";
+    case NUM_REF:   return "ref";
+    case NUM_DELTA: return "delta";
+    }
+    return "abs";
+}
+
+void num_encode_table(const double* v, size_t rows, const std::vector<num_column>& cols,
+                      const token_counter& count, std::string& out, num_table_report& rep) {
+    const size_t nc = cols.size();
+    rep = num_table_report();
+    rep.cols.resize(nc);
+    out.clear();
+
+    // per column: the cheapest encoding, header share included
+    std::vector<rendering> best(nc);
+    for (size_t c = 0; c < nc; ++c) {
+        std::vector<std::string> pc(rows);
+        for (size_t i = 0; i < rows; ++i) pc[i] = plain(v[i * nc + c], cols[c]);
+        rep.cols[c].baseline = count(join(pc));
+
+        size_t best_tokens = SIZE_MAX;
+        for (num_encoding e : {NUM_ABS, NUM_REF, NUM_DELTA}) {
+            rendering r;
+            render(v + c, rows, nc, cols[c], e, r);
+            const size_t t = count(join(r.cells)) + (r.header.empty() ? 0 : count(r.header));
+            if (t < best_tokens) {
+                best_tokens     = t;
+                best[c]         = std::move(r);
+                rep.cols[c].enc = e;
+                rep.cols[c].ref = best[c].ref;
+            }
+        }
+        rep.cols[c].tokens = best_tokens;
+    }
+
+    std::string head, title, plain_table;
+    for (size_t c = 0; c < nc; ++c) {
+        if (!best[c].header.empty()) head += (head.empty() ? "# " : "; ") + best[c].header;
+        title += (c ? "," : "") + cols[c].name;
+    }
+    if (!head.empty()) out += head + "\n";
+    out += title + "\n";
+    plain_table = title + "\n";
+
+    rep.row_saved.resize(rows);
+    std::vector<std::string> er(nc), pr(nc);
+    for (size_t i = 0; i < rows; ++i) {
+        for (size_t c = 0; c < nc; ++c) {
+            er[c] = best[c].cells[i];
+            pr[c] = plain(v[i * nc + c], cols[c]);
+        }
+        const std::string e = join(er), p = join(pr);
+        rep.row_saved[i] = (int)count(p) - (int)count(e);
+        out += e + "\n";
+        plain_table += p + "\n";
+    }
+    rep.tokens   = count(out);
+    rep.baseline = count(plain_table);
+}
@@ -0,0 +1,41 @@
+// llm_numfmt.h — token-frugal number formats for tables in prompts
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct num_column {
+    enum kind_t { NUMBER, TIME };
+    std::string name;
+    kind_t      kind = NUMBER;
+    double      step = 0.01;   // precision the model needs: NUMBER in its own units, TIME in seconds
+};
+
+// How a column is written. Cells of REF and DELTA are integers in units of the step,
+// from a reference stated once in the header (DELTA: from the previous row).
+enum num_encoding { NUM_ABS, NUM_REF, NUM_DELTA };
+
+struct num_column_report {
+    num_encoding enc      = NUM_ABS;
+    double       ref      = 0;
+    size_t       tokens   = 0;   // cells + header part, as chosen
+    size_t       baseline = 0;   // cells written plainly (fixed decimals / "YYYY-MM-DD HH:MM:SS")
+};
+
+struct num_table_report {
+    std::vector<num_column_report> cols;
+    std::vector<int> row_saved;   // baseline row tokens - encoded row tokens
+    size_t tokens   = 0;          // whole encoded table
+    size_t baseline = 0;          // whole plain table
+};
+
+using token_counter = std::function<size_t(const std::string&)>;
+
+// Encodes rows x cols.size() values (row-major, NaN = empty cell) as a header line that
+// says how to read each column, a CSV title row and the data rows. Each column gets the
+// encoding with the fewest tokens under count, header share included.
+void num_encode_table(const double* v, size_t rows, const std::vector<num_column>& cols,
+                      const token_counter& count, std::string& out, num_table_report& rep);
+
+const char* num_encoding_name(num_encoding e);
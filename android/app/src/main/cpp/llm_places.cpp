@@ -0,0 +1,230 @@
+// llm_places.cpp — offline reverse geocoding over an mmapped place index
+#include "llm_places.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "llm_log.h"
+
+namespace {
+
+constexpr double kEarthR   = 6371008.8;
+constexpr double kRad      = 3.14159265358979323846 / 180.0;
+constexpr size_t kLeaf     = 8;     // k-d ranges this small are scanned linearly
+constexpr size_t kMaxK     = 64;
+
+struct header {
+    uint32_t magic, version, count, flags;
+    uint64_t names_off, names_size;
+};
+static_assert(sizeof(header) == 32, "places header layout");
+
+void unit(double lat, double lng, float v[3]) {
+    const double a = lat * kRad, b = lng * kRad;
+    v[0] = (float)(std::cos(a) * std::cos(b));
+    v[1] = (float)(std::cos(a) * std::sin(b));
+    v[2] = (float)std::sin(a);
+}
+
+float chord_to_m(float d2) {
+    return (float)(2.0 * kEarthR * std::asin(std::min(1.0, std::sqrt((double)d2) * 0.5)));
+}
+
+// Splits a line on tabs, in place.
+void split_tabs(char* s, std::vector<char*>& f) {
+    f.clear();
+    f.push_back(s);
+    for (char* p = s; *p; ++p)
+        if (*p == '\t') { *p = 0; f.push_back(p + 1); }
+}
+
+bool parse_num(const char* s, double& v) {
+    char* end = nullptr;
+    v = strtod(s, &end);
+    return end != s && std::isfinite(v);
+}
+
+} // namespace
+
+// ---------- index ----------
+places_index::~places_index() {
+    if (base_) munmap(base_, size_);
+}
+
+std::shared_ptr<const places_index> places_index::open(const std::string& path, int& rc) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { rc = -1; return nullptr; }
+    struct stat st;
+    void* m = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(header))
+        m = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) { rc = -1; return nullptr; }
+
+    std::shared_ptr<places_index> idx(new places_index());
+    idx->base_ = m;
+    idx->size_ = (size_t)st.st_size;
+    const header& h = *(const header*)m;
+    const size_t recs_end = sizeof(header) + (size_t)h.count * sizeof(rec);
+    if (h.magic != kPlacesMagic || h.version != kPlacesVersion || recs_end > idx->size_ ||
+        h.names_off < recs_end || h.names_off > idx->size_ || h.names_size > idx->size_ - h.names_off ||
+        (h.names_size && ((const char*)m)[h.names_off + h.names_size - 1] != 0)) {
+        LLOGE("places: %s is not a place index", path.c_str());
+        rc = -3;
+        return nullptr;
+    }
+    idx->n_          = h.count;
+    idx->recs_       = (const rec*)((const char*)m + sizeof(header));
+    idx->names_      = (const char*)m + h.names_off;
+    idx->names_size_ = (size_t)h.names_size;
+    madvise(m, idx->size_, MADV_RANDOM);   // a query touches a few dozen records
+    rc = 0;
+    return idx;
+}
+
+const char* places_index::name(uint32_t id) const {
+    if (id >= n_ || recs_[id].name >= names_size_) return "";
+    return names_ + recs_[id].name;
+}
+
+// Depth-first, near side first; best[] is kept sorted by best_d2[] (squared chords).
+void places_index::search(size_t l, size_t r, int axis, const float q[3], size_t k,
+                          place_hit* best, float* best_d2, size_t& found) const {
+    auto offer = [&](size_t i) {
+        const rec& p = recs_[i];
+        const float dx = p.x - q[0], dy = p.y - q[1], dz = p.z - q[2];
+        const float d2 = dx * dx + dy * dy + dz * dz;
+        if (found == k && d2 >= best_d2[k - 1]) return;
+        size_t j = found < k ? found++ : k - 1;
+        for (; j > 0 && best_d2[j - 1] > d2; --j) {
+            best[j] = best[j - 1];
+            best_d2[j] = best_d2[j - 1];
+        }
+        best[j].id = (uint32_t)i;
+        best_d2[j] = d2;
+    };
+    if (r - l < kLeaf) {
+        for (size_t i = l; i <= r; ++i) offer(i);
+        return;
+    }
+    const size_t m = (l + r) / 2;
+    offer(m);
+    const float* pm = &recs_[m].x;
+    const float diff = q[axis] - pm[axis];
+    const int next = (axis + 1) % 3;
+    if (diff < 0) {
+        if (m > l) search(l, m - 1, next, q, k, best, best_d2, found);
+        if (found < k || diff * diff < best_d2[k - 1]) search(m + 1, r, next, q, k, best, best_d2, found);
+    } else {
+        search(m + 1, r, next, q, k, best, best_d2, found);
+        if (m > l && (found < k || diff * diff < best_d2[k - 1])) search(l, m - 1, next, q, k, best, best_d2, found);
+    }
+}
+
+size_t places_index::nearest(double lat, double lng, size_t k, place_hit* out) const {
+    k = std::min(k, kMaxK);
+    if (!n_ || !k) return 0;
+    float q[3];
+    unit(lat, lng, q);
+    float  d2[kMaxK];
+    size_t found = 0;
+    search(0, n_ - 1, 0, q, k, out, d2, found);
+    for (size_t i = 0; i < found; ++i) out[i].dist_m = chord_to_m(d2[i]);
+    return found;
+}
+
+// ---------- build ----------
+long places_build(const std::string& src, const std::string& dst, long min_population) {
+    FILE* f = fopen(src.c_str(), "rb");
+    if (!f) { LLOGE("places: cannot read %s", src.c_str()); return -1; }
+
+    struct place { float v[3]; uint32_t name; };
+    std::vector<place> pl;
+    std::string        names;
+    std::vector<char*> col;
+    char*  line = nullptr;
+    size_t cap  = 0;
+    ssize_t len;
+    while ((len = getline(&line, &cap, f)) > 0) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) line[--len] = 0;
+        if (!len || line[0] == '#') continue;
+        split_tabs(line, col);
+        const char* nm; const char* cc; double lat, lng;
+        if (col.size() >= 15) {           // GeoNames: id, name, ascii, alt, lat, lng, class, code, cc, .., population
+            double pop = 0;
+            parse_num(col[14], pop);
+            if (pop < (double)min_population) continue;
+            nm = col[1]; cc = col[8];
+            if (!parse_num(col[4], lat) || !parse_num(col[5], lng)) continue;
+        } else if (col.size() >= 3) {
+            nm = col[0]; cc = col.size() > 3 ? col[3] : "";
+            if (!parse_num(col[1], lat) || !parse_num(col[2], lng)) continue;
+        } else {
+            continue;
+        }
+        if (!*nm || std::fabs(lat) > 90 || std::fabs(lng) > 180) continue;
+        place p;
+        unit(lat, lng, p.v);
+        p.name = (uint32_t)names.size();
+        names += nm;
+        if (*cc) { names += ", "; names += cc; }
+        names += '\0';
+        pl.push_back(p);
+    }
+    free(line);
+    fclose(f);
+    if (pl.empty() || names.size() > UINT32_MAX) { LLOGE("places: no places in %s", src.c_str()); return -3; }
+
+    // implicit k-d layout, cycling x, y, z
+    std::vector<uint32_t> ord(pl.size());
+    std::iota(ord.begin(), ord.end(), 0u);
+    struct range { size_t l, r; int axis; };
+    std::vector<range> stack{{0, pl.size() - 1, 0}};
+    while (!stack.empty()) {
+        const range g = stack.back();
+        stack.pop_back();
+        if (g.r - g.l < kLeaf) continue;
+        const size_t m = (g.l + g.r) / 2;
+        std::nth_element(ord.begin() + (ptrdiff_t)g.l, ord.begin() + (ptrdiff_t)m, ord.begin() + (ptrdiff_t)g.r + 1,
+                         [&](uint32_t a, uint32_t b) { return pl[a].v[g.axis] < pl[b].v[g.axis]; });
+        const int next = (g.axis + 1) % 3;
+        if (m > g.l) stack.push_back({g.l, m - 1, next});
+        stack.push_back({m + 1, g.r, next});
+    }
+
+    header h{};
+    h.magic      = kPlacesMagic;
+    h.version    = kPlacesVersion;
+    h.count      = (uint32_t)pl.size();
+    h.names_off  = sizeof(header) + pl.size() * 16;
+    h.names_size = names.size();
+
+    const std::string tmp = dst + ".tmp";
+    FILE* o = fopen(tmp.c_str(), "wb");
+    if (!o) { LLOGE("places: cannot write %s", tmp.c_str()); return -1; }
+    bool ok = fwrite(&h, sizeof(h), 1, o) == 1;
+    for (size_t i = 0; ok && i < ord.size(); ++i) {
+        const place& p = pl[ord[i]];
+        ok = fwrite(p.v, sizeof(float), 3, o) == 3 && fwrite(&p.name, sizeof(uint32_t), 1, o) == 1;
+    }
+    ok = ok && fwrite(names.data(), 1, names.size(), o) == names.size();
+    ok = (fclose(o) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), dst.c_str()) != 0) {
+        remove(tmp.c_str());
+        LLOGE("places: cannot write %s", dst.c_str());
+        return -1;
+    }
+    LLOGI("places: %zu places, %zu KiB index at %s", pl.size(),
+          (size_t)(h.names_off + h.names_size) / 1024, dst.c_str());
+    return (long)pl.size();
+}
@@ -0,0 +1,56 @@
+// llm_places.h — offline reverse geocoding over an mmapped place index
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Index file, little-endian:
+//   header (32 bytes): u32 magic "PLCS", u32 version, u32 count, u32 flags,
+//                      u64 names offset, u64 names size
+//   count records of { f32 x, y, z; u32 name offset }: unit vectors on the sphere, laid out
+//   as an implicit 3-d k-d tree (the split of every range [l, r] is its middle record)
+//   names: NUL-terminated "Name, CC" strings
+// Searching in 3-d makes the poles and the antimeridian ordinary places.
+constexpr uint32_t kPlacesMagic   = 0x53434C50u;   // "PLCS"
+constexpr uint32_t kPlacesVersion = 1;
+
+struct place_hit {
+    uint32_t id;
+    float    dist_m;   // great-circle
+};
+
+class places_index {
+public:
+    ~places_index();
+    places_index(const places_index&) = delete;
+    places_index& operator=(const places_index&) = delete;
+
+    // Maps the file read-only. rc: 0, -1 unreadable, -3 not an index.
+    static std::shared_ptr<const places_index> open(const std::string& path, int& rc);
+
+    size_t size() const { return n_; }
+    // Up to k nearest places, nearest first. Returns how many were written to out.
+    size_t nearest(double lat, double lng, size_t k, place_hit* out) const;
+    const char* name(uint32_t id) const;
+
+private:
+    struct rec { float x, y, z; uint32_t name; };
+    places_index() = default;
+    void search(size_t l, size_t r, int axis, const float q[3], size_t k, place_hit* best,
+                float* best_d2, size_t& found) const;
+
+    void*       base_  = nullptr;
+    size_t      size_  = 0;
+    const rec*  recs_  = nullptr;
+    const char* names_ = nullptr;
+    size_t      names_size_ = 0;
+    size_t      n_     = 0;
+};
+
+// Compiles a gazetteer into an index file (written to dst.tmp, then renamed). Lines are
+// tab-separated, '#' starts a comment: either GeoNames dumps (name, lat, lng, country and
+// population columns are used; places below min_population are left out) or plain
+// "name<TAB>lat<TAB>lng[<TAB>country]". Returns the number of places, -1 if src cannot be
+// read or dst written, -3 if no line parsed.
+long places_build(const std::string& src, const std::string& dst, long min_population);
@@ -0,0 +1,188 @@
+// llm_requant.cpp — requantization job (llama_model_quantize on a worker thread)
+#include "llm_requant.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include "llm_bridge.h"
+#include "llm_json.h"
+#include "llm_log.h"
+#include "llm_logbuf.h"
+
+namespace {
+
+struct candidate {
+    llama_ftype type;
+    double      bpw;
+};
+
+// Effective bits per weight as llama-quantize reports them (embeddings/output kept at
+// higher precision included). Best quality first.
+const candidate kCandidates[] = {
+    {LLAMA_FTYPE_MOSTLY_Q4_K_M, 4.89},
+    {LLAMA_FTYPE_MOSTLY_Q4_K_S, 4.58},
+    {LLAMA_FTYPE_MOSTLY_Q3_K_L, 4.27},
+    {LLAMA_FTYPE_MOSTLY_Q3_K_M, 3.91},
+    {LLAMA_FTYPE_MOSTLY_Q3_K_S, 3.50},
+    {LLAMA_FTYPE_MOSTLY_Q2_K,   3.35},
+};
+
+// compute buffers, allocator slack and the runtime itself
+constexpr double kOverheadBytes = 96.0 * 1024 * 1024;
+
+double bpw_of(llama_ftype t) {
+    for (const auto& c : kCandidates) if (c.type == t) return c.bpw;
+    return 4.89;
+}
+
+// ---------- job state ----------
+std::mutex         g_job_mu;   // start + message
+std::string        g_message;
+std::atomic<int>   g_state{LLM_REQUANT_IDLE};
+std::atomic<float> g_progress{0.f};
+std::atomic<int>   g_ftype{-1};
+std::atomic<bool>  g_cancel{false};
+thread_local bool  g_in_quantize = false;   // this thread is inside llama_model_quantize for the job
+
+struct cancelled : std::runtime_error {
+    cancelled() : std::runtime_error("cancelled") {}
+};
+
+// llama_model_quantize reports progress only through its log ("[  12/ 291] blk.0...")
+// and has no abort hook. Throwing from the per-tensor line unwinds into its own
+// catch-all, so cancel takes effect at the next tensor boundary. Everything else goes
+// on to the log ring.
+bool quant_tap(int /*level*/, const char* text) {
+    int i = 0, n = 0;
+    if (g_in_quantize && sscanf(text, " [ %d/ %d]", &i, &n) == 2 && n > 0) {
+        g_progress = 0.95f * (float)i / (float)n; // the rest is verify + swap
+        if (g_cancel.load()) throw cancelled();
+        return true;
+    }
+    return false;
+}
+
+void finish(int state, const std::string& msg) {
+    {
+        std::lock_guard<std::mutex> lock(g_job_mu);
+        g_message = msg;
+    }
+    g_state = state;
+    if (state == LLM_REQUANT_DONE) LLOGI("requant: done: %s", msg.c_str());
+    else                           LLOGW("requant: %s", msg.c_str());
+}
+
+void run_job(std::string src, std::string dst, int budget_mb, int n_ctx, int ftype, int n_threads) {
+    llama_backend_init();
+
+    // 1) source metadata (mmap only; tensors are not read)
+    llama_model_params mp = llama_model_default_params();
+    mp.use_mmap = true;
+    llama_model* m = llama_model_load_from_file(src.c_str(), mp);
+    if (!m) return finish(LLM_REQUANT_FAILED, "cannot read source model");
+
+    if (ftype < 0) ftype = requant_pick_type(m, (double)budget_mb * 1024.0 * 1024.0, n_ctx);
+    const uint64_t src_params = llama_model_n_params(m);
+    const int32_t  src_vocab  = llama_vocab_n_tokens(llama_model_get_vocab(m));
+    llama_model_free(m);
+    if (ftype < 0) return finish(LLM_REQUANT_FAILED, "no quantization type fits the budget");
+    g_ftype = ftype;
+
+    // 2) quantize into a temp file next to the destination
+    const std::string tmp = dst + ".part";
+    llama_model_quantize_params qp = llama_model_quantize_default_params();
+    qp.nthread          = n_threads > 0 ? n_threads : 4;
+    qp.ftype            = (llama_ftype)ftype;
+    qp.allow_requantize = true;
+
+    log_install();
+    log_set_tap(quant_tap);
+    g_in_quantize = true;
+    const uint32_t rc = llama_model_quantize(src.c_str(), tmp.c_str(), &qp);
+    g_in_quantize = false;
+    log_set_tap(nullptr);
+
+    if (g_cancel.load()) {
+        remove(tmp.c_str());
+        return finish(LLM_REQUANT_CANCELLED, "cancelled");
+    }
+    if (rc != 0) {
+        remove(tmp.c_str());
+        return finish(LLM_REQUANT_FAILED, "llama_model_quantize failed");
+    }
+
+    // 3) verify the result loads and describes the same model
+    std::string info(2048, '\0');
+    json_value  doc;
+    size_t      off = 0;
+    bool ok = llm_model_info(tmp.c_str(), &info[0], (int)info.size()) == 0;
+    info.resize(std::min(info.find('\0'), info.size()));
+    ok = ok && json_parse(info.data(), info.size(), doc, &off);
+    const json_value* np = ok ? doc.get("n_params") : nullptr;
+    const json_value* nv = ok ? doc.get("n_vocab")  : nullptr;
+    if (!np || !nv || (uint64_t)np->num != src_params || (int32_t)nv->num != src_vocab) {
+        remove(tmp.c_str());
+        return finish(LLM_REQUANT_FAILED, "verification failed");
+    }
+
+    // 4) atomic swap; a model still mapped from the old file keeps its inode
+    if (rename(tmp.c_str(), dst.c_str()) != 0) {
+        remove(tmp.c_str());
+        return finish(LLM_REQUANT_FAILED, "rename failed");
+    }
+    g_progress = 1.f;
+    finish(LLM_REQUANT_DONE, info);
+}
+
+} // namespace
+
+double requant_estimate_bytes(const llama_model* model, llama_ftype ftype, int n_ctx) {
+    const double weights = (double)llama_model_n_params(model) * bpw_of(ftype) / 8.0;
+    const double n_head  = std::max(1, llama_model_n_head(model));
+    const double kv_dim  = (double)llama_model_n_embd(model) * llama_model_n_head_kv(model) / n_head;
+    const double kv      = 2.0 /*K+V*/ * n_ctx * llama_model_n_layer(model) * kv_dim * 2.0 /*f16*/;
+    return weights + kv + kOverheadBytes;
+}
+
+int requant_pick_type(const llama_model* model, double budget_bytes, int n_ctx) {
+    const double n_params = (double)llama_model_n_params(model);
+    if (n_params <= 0) return -1;
+    const double current_bpw = (double)llama_model_size(model) * 8.0 / n_params;
+    for (const auto& c : kCandidates) {
+        if (c.bpw >= current_bpw - 0.05) continue; // would not shrink anything
+        if (requant_estimate_bytes(model, c.type, n_ctx) <= budget_bytes) return (int)c.type;
+    }
+    return -1;
+}
+
+int requant_start(const std::string& src, const std::string& dst, int budget_mb, int n_ctx, int ftype, int n_threads) {
+    std::lock_guard<std::mutex> lock(g_job_mu);
+    if (g_state.load() == LLM_REQUANT_RUNNING) return -1;
+
+    g_message.clear();
+    g_progress = 0.f;
+    g_ftype    = ftype;
+    g_cancel   = false;
+    g_state    = LLM_REQUANT_RUNNING;
+    // detached: the job only touches the atomics above and its own files
+    std::thread(run_job, src, dst, budget_mb, n_ctx > 0 ? n_ctx : 2048, ftype, n_threads).detach();
+    return 0;
+}
+
+int requant_poll(float* progress, int* ftype, std::string* message) {
+    if (progress) *progress = g_progress.load();
+    if (ftype)    *ftype    = g_ftype.load();
+    if (message) {
+        std::lock_guard<std::mutex> lock(g_job_mu);
+        *message = g_message;
+    }
+    return g_state.load();
+}
+
+void requant_cancel() {
+    g_cancel = true;
+}
@@ -0,0 +1,17 @@
+// llm_requant.h — background requantization of a GGUF to fit a RAM budget
+#pragma once
+#include <string>
+
+#include "llama.h"
+
+// Estimated resident bytes of `model` quantized to `ftype`, running with an n_ctx KV cache.
+double requant_estimate_bytes(const llama_model* model, llama_ftype ftype, int n_ctx);
+
+// Best (largest) candidate type whose estimate fits `budget_bytes` and is smaller than
+// what the model already is; -1 if none does.
+int requant_pick_type(const llama_model* model, double budget_bytes, int n_ctx);
+
+// One job at a time. See llm_requant_* in llm_bridge.h for the states.
+int  requant_start(const std::string& src, const std::string& dst, int budget_mb, int n_ctx, int ftype, int n_threads);
+int  requant_poll(float* progress, int* ftype, std::string* message);
+void requant_cancel();
@@ -0,0 +1,175 @@
+// llm_stream.cpp — spsc_ring, token_stream
+#include "llm_stream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace {
+
+bool utf8_cont(char c) { return ((uint8_t)c & 0xC0) == 0x80; }
+
+// Longest prefix of p[0..n) no longer than max that does not end inside a UTF-8 sequence;
+// 0 when even the first character does not fit (wait for room).
+size_t utf8_cut(const char* p, size_t n, size_t max) {
+    if (n <= max) return n;
+    size_t k = max;
+    while (k > 0 && utf8_cont(p[k])) --k;
+    if (k > 0) return k;
+    const uint8_t c = (uint8_t)p[0];
+    const size_t len = c >= 0xF8 ? 0 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 0;
+    if (len == 0 || len > n) return max;   // not UTF-8 after all: cut anywhere
+    for (size_t i = 1; i < len; ++i) if (!utf8_cont(p[i])) return max;
+    return len > max ? 0 : max;
+}
+
+} // namespace
+
+// ---------- ring ----------
+spsc_ring::spsc_ring(size_t capacity) {
+    size_t c = 64;
+    while (c < capacity) c <<= 1;
+    buf_.reset(new char[c]);
+    mask_ = c - 1;
+}
+
+size_t spsc_ring::free_space() const {
+    return capacity() - (tail_.load(std::memory_order_relaxed) - head_.load(std::memory_order_acquire));
+}
+
+size_t spsc_ring::readable() const {
+    return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_relaxed);
+}
+
+bool spsc_ring::push(const char* p, size_t n) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (capacity() - (tail - head_.load(std::memory_order_acquire)) < n) return false;
+    const size_t at = tail & mask_, first = std::min(n, capacity() - at);
+    memcpy(buf_.get() + at, p, first);
+    memcpy(buf_.get(), p + first, n - first);
+    tail_.store(tail + n, std::memory_order_release);
+    return true;
+}
+
+size_t spsc_ring::pop(std::string& out) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    const size_t n    = tail_.load(std::memory_order_acquire) - head;
+    if (n == 0) return 0;
+    const size_t at = head & mask_, first = std::min(n, capacity() - at);
+    out.append(buf_.get() + at, first);
+    out.append(buf_.get(), n - first);
+    head_.store(head + n, std::memory_order_release);
+    return n;
+}
+
+// ---------- stream ----------
+// Sleeping uses the usual flag-then-recheck handshake: a side about to wait sets its flag
+// and checks the ring again under mu_; the other side only takes mu_ to notify when it
+// sees the flag, which it reads after a full fence following its ring update.
+token_stream::token_stream(size_t capacity, stream_policy policy, llm_piece_cb cb, void* user)
+    : ring_(std::max<size_t>(capacity, 256)), policy_(policy), cb_(cb), user_(user) {
+    thread_ = std::thread(&token_stream::deliver, this);
+}
+
+int token_stream::publish_cb(const char* piece, int len, void* self) {
+    return ((token_stream*)self)->publish(piece, (size_t)std::max(0, len));
+}
+
+bool token_stream::push(const char* p, size_t n) {
+    if (!ring_.push(p, n)) return false;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (cons_waiting_.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(mu_);
+        cv_.notify_all();
+    }
+    return true;
+}
+
+void token_stream::flush_spill() {
+    size_t off = 0;
+    while (off < spill_.size()) {
+        const size_t n = utf8_cut(spill_.data() + off, spill_.size() - off, ring_.free_space());
+        if (n == 0 || !push(spill_.data() + off, n)) break;
+        off += n;
+    }
+    spill_.erase(0, off);
+}
+
+void token_stream::wait_room(size_t n) {
+    std::unique_lock<std::mutex> lock(mu_);
+    prod_waiting_.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    cv_.wait(lock, [&] { return ring_.free_space() >= n || stop_.load(); });
+    prod_waiting_.store(false);
+}
+
+int token_stream::publish(const char* piece, size_t n) {
+    if (stop_.load(std::memory_order_relaxed)) return 1;
+    if (!spill_.empty()) flush_spill();
+    // a piece bigger than the ring goes in as several, cut at characters
+    const size_t max = ring_.capacity() / 2;
+    while (n > 0) {
+        const size_t m = utf8_cut(piece, n, max);
+        if (!spill_.empty() || !push(piece, m)) {
+            switch (policy_) {
+            case STREAM_SPILL:
+                spill_.append(piece, m);
+                spill_peak_ = std::max(spill_peak_, spill_.size());
+                break;
+            case STREAM_DROP:
+                dropped_ += m;
+                break;
+            case STREAM_BLOCK:
+                while (!stop_.load() && !push(piece, m)) wait_room(m);
+                break;
+            }
+        }
+        piece += m;
+        n     -= m;
+    }
+    return stop_.load(std::memory_order_relaxed) ? 1 : 0;
+}
+
+void token_stream::close() {
+    if (closed_) return;
+    closed_ = true;
+    while (!spill_.empty() && !stop_.load()) {
+        flush_spill();
+        if (!spill_.empty()) wait_room(std::min(spill_.size(), ring_.capacity() / 2));
+    }
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        done_.store(true);
+        cv_.notify_all();
+    }
+    thread_.join();
+}
+
+void token_stream::deliver() {
+    std::string chunk;
+    for (;;) {
+        chunk.clear();
+        if (ring_.pop(chunk) > 0) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (prod_waiting_.load(std::memory_order_relaxed)) {
+                std::lock_guard<std::mutex> lock(mu_);
+                cv_.notify_all();
+            }
+            if (!stop_.load(std::memory_order_relaxed)) {
+                deliveries_.fetch_add(1, std::memory_order_relaxed);
+                if (cb_(chunk.data(), (int)chunk.size(), user_) != 0) {
+                    std::lock_guard<std::mutex> lock(mu_);
+                    stop_.store(true);
+                    cv_.notify_all();   // a producer waiting for room gives up
+                }
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mu_);
+        cons_waiting_.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        cv_.wait(lock, [&] { return ring_.readable() > 0 || done_.load(); });
+        cons_waiting_.store(false);
+        if (ring_.readable() == 0 && done_.load()) break;
+    }
+}
@@ -0,0 +1,87 @@
+// llm_stream.h — generated text from the decode loop to a consumer on its own thread
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "llm_bridge.h"
+
+// Bytes from one producer thread to one consumer thread. Each side owns one index and
+// only reads the other's, so neither ever waits for the other. Pushes are all or nothing,
+// so what the consumer sees always ends where a push ended.
+class spsc_ring {
+public:
+    explicit spsc_ring(size_t capacity);   // rounded up to a power of two
+
+    size_t capacity() const { return mask_ + 1; }
+
+    // producer
+    bool push(const char* p, size_t n);
+    size_t free_space() const;
+    // consumer: appends everything readable to out
+    size_t pop(std::string& out);
+    size_t readable() const;
+
+private:
+    std::unique_ptr<char[]> buf_;
+    size_t                  mask_;
+    alignas(64) std::atomic<size_t> head_{0};   // consumer's; bytes read
+    alignas(64) std::atomic<size_t> tail_{0};   // producer's; bytes written
+};
+
+// What the decode loop does with a piece the ring has no room for.
+enum stream_policy {
+    STREAM_SPILL = LLM_STREAM_SPILL,   // keep it in a side buffer, handed over as room frees up
+    STREAM_BLOCK = LLM_STREAM_BLOCK,   // wait for room: generation runs at the consumer's pace
+    STREAM_DROP  = LLM_STREAM_DROP,    // discard it and count the bytes
+};
+
+// One streamed request. The decode loop publishes pieces (complete UTF-8) into the ring;
+// a delivery thread drains it into cb, everything readable in one call, so a consumer
+// that falls behind gets fewer, larger pieces rather than holding up decoding.
+class token_stream {
+public:
+    token_stream(size_t capacity, stream_policy policy, llm_piece_cb cb, void* user);
+    ~token_stream() { close(); }
+
+    // Decode thread. Nonzero once the consumer asked to stop.
+    int publish(const char* piece, size_t n);
+    static int publish_cb(const char* piece, int len, void* self);
+
+    // Decode thread, after the last piece: hands over what was spilled and returns once
+    // the consumer has had everything.
+    void close();
+
+    uint64_t dropped() const { return dropped_; }       // bytes, STREAM_DROP
+    size_t   spill_peak() const { return spill_peak_; }  // bytes, STREAM_SPILL
+    uint64_t deliveries() const { return deliveries_.load(); }
+
+private:
+    bool push(const char* p, size_t n);   // into the ring, waking the consumer
+    void flush_spill();
+    void wait_room(size_t n);
+    void deliver();
+
+    spsc_ring          ring_;
+    stream_policy      policy_;
+    llm_piece_cb       cb_;
+    void*              user_;
+
+    std::string        spill_;            // producer only
+    size_t             spill_peak_ = 0;
+    uint64_t           dropped_    = 0;
+    bool               closed_     = false;
+
+    std::atomic<bool>      stop_{false};      // consumer asked to stop
+    std::atomic<bool>      done_{false};      // producer finished
+    std::atomic<bool>      cons_waiting_{false}, prod_waiting_{false};
+    std::atomic<uint64_t>  deliveries_{0};
+    std::mutex              mu_;              // sleeping only; never held while copying
+    std::condition_variable cv_;
+    std::thread             thread_;
+};
@@ -0,0 +1,276 @@
+// llm_template.cpp — prompt templates tokenized once, filled per request
+#include "llm_template.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace {
+
+// Text a slot value might start or end with: splicing must reproduce the tokenization
+// of the joined text for every one of them.
+const char* const kProbes[] = {
+    "a", "Z", "1", "9", " ", " x", "  ", "\n", "\n\n", "\t", ".", ",", ":", ";", "\"", "'",
+    "(", ")", "-", "_", "/", "{", "}", "[", "]", "\xC3\xA9", "\xE0\xA6\x95",
+    ":\n", ".\n", " 1", "1.", "x:", "'s",
+};
+
+std::vector<llama_token> tok(const llama_vocab* vocab, const std::string& s, bool add_special,
+                             bool parse_special) {
+    std::vector<llama_token> out;
+    if (s.empty() && !add_special) return out;
+    int32_t n = llama_tokenize(vocab, s.data(), (int32_t)s.size(), nullptr, 0, add_special, parse_special);
+    if (n < 0) n = -n;
+    out.resize((size_t)n);
+    if (n > 0) {
+        n = llama_tokenize(vocab, s.data(), (int32_t)s.size(), out.data(), n, add_special, parse_special);
+        out.resize((size_t)std::max(0, n));
+    }
+    return out;
+}
+
+std::string piece(const llama_vocab* vocab, llama_token t) {
+    char buf[256];
+    const int32_t n = llama_token_to_piece(vocab, t, buf, (int32_t)sizeof(buf), 0, /*special*/true);
+    if (n >= 0) return std::string(buf, (size_t)n);
+    std::string big((size_t)-n, '\0');
+    llama_token_to_piece(vocab, t, &big[0], (int32_t)big.size(), 0, true);
+    return big;
+}
+
+size_t n_control(const llama_vocab* vocab, const std::vector<llama_token>& v) {
+    return (size_t)std::count_if(v.begin(), v.end(), [&](llama_token id) { return llama_vocab_is_control(vocab, id); });
+}
+
+size_t common_prefix(const std::vector<llama_token>& a, const std::vector<llama_token>& b) {
+    size_t i = 0;
+    while (i < a.size() && i < b.size() && a[i] == b[i]) ++i;
+    return i;
+}
+
+size_t common_suffix(const std::vector<llama_token>& a, const std::vector<llama_token>& b) {
+    size_t i = 0;
+    while (i < a.size() && i < b.size() && a[a.size() - 1 - i] == b[b.size() - 1 - i]) ++i;
+    return i;
+}
+
+bool slot_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+           c == '_' || c == '.' || c == '-';
+}
+
+bool spliced_eq(const std::vector<llama_token>& whole, const std::vector<llama_token>& a,
+                size_t a0, size_t a1, const std::vector<llama_token>& b, size_t b0, size_t b1) {
+    if (whole.size() != (a1 - a0) + (b1 - b0)) return false;
+    return std::equal(a.begin() + (ptrdiff_t)a0, a.begin() + (ptrdiff_t)a1, whole.begin()) &&
+           std::equal(b.begin() + (ptrdiff_t)b0, b.begin() + (ptrdiff_t)b1, whole.begin() + (ptrdiff_t)(a1 - a0));
+}
+
+// Static part: split into edge text and fixed tokens. A boundary is accepted only where
+// splicing reproduces the tokenization of the joined text for every probe, which also
+// catches pretokenizer rules that look back across it. False if the part holds special
+// tokens but its pieces do not spell it (normalizing vocabs, stripping tokens): as edge
+// text they would be tokenized plain.
+bool split_static(const llama_vocab* vocab, prompt_template::part& p, bool slot_before, bool slot_after) {
+    const std::vector<llama_token> t = tok(vocab, p.text, false, /*parse_special*/true);
+    const size_t n = t.size();
+
+    // the pieces must spell the text exactly, or byte offsets mean nothing
+    std::vector<size_t> off(n + 1, 0);
+    std::string spelled;
+    for (size_t i = 0; i < n; ++i) {
+        spelled += piece(vocab, t[i]);
+        off[i + 1] = spelled.size();
+    }
+    if (spelled != p.text) {
+        if (n_control(vocab, t) > 0) return false;
+        p.head = p.text;
+        return true;
+    }
+
+    size_t last_special = 0, first_special = n;   // edges stay clear of special tokens
+    for (size_t j = 0; j < n; ++j)
+        if (llama_vocab_is_control(vocab, t[j])) { last_special = j + 1; first_special = std::min(first_special, j); }
+
+    size_t right = n;   // t[right..) is the tail edge
+    if (slot_after) {
+        for (const char* probe : kProbes) right = std::min(right, common_prefix(t, tok(vocab, p.text + probe, false, true)));
+        right = std::max(last_special, right > 0 ? right - 1 : 0);
+        for (; right > last_special; --right) {
+            const std::string tail = p.text.substr(off[right]);
+            bool ok = true;
+            for (const char* probe : kProbes) {
+                const std::vector<llama_token> w = tok(vocab, tail + probe, false, false);
+                if (!(ok = spliced_eq(tok(vocab, p.text + probe, false, true), t, 0, right, w, 0, w.size()))) break;
+            }
+            if (ok) break;
+        }
+    }
+    size_t left = 0;    // t[0..left) is the head edge
+    if (slot_before) {
+        size_t keep = n;
+        for (const char* probe : kProbes) keep = std::min(keep, common_suffix(t, tok(vocab, probe + p.text, false, true)));
+        left = std::min(first_special, std::min(n, n - keep + 1));
+        for (; left < std::min(first_special, right); ++left) {
+            const std::string head = p.text.substr(0, off[left]);
+            bool ok = true;
+            for (const char* probe : kProbes) {
+                const std::vector<llama_token> w = tok(vocab, probe + head, false, false);
+                if (!(ok = spliced_eq(tok(vocab, probe + p.text, false, true), w, 0, w.size(), t, left, n))) break;
+            }
+            if (ok) break;
+        }
+    }
+    if (left >= right) { p.head = p.text; return true; }   // all edge (no special tokens in it)
+    p.head = p.text.substr(0, off[left]);
+    p.mid.assign(t.begin() + (ptrdiff_t)left, t.begin() + (ptrdiff_t)right);
+    p.tail = p.text.substr(off[right]);
+    return true;
+}
+
+// Static part for vocabs that add a space prefix to every tokenize call (SPM). Those also
+// tokenize the text between two special tokens as if it were a call of its own, so the
+// part splits exactly at its first and last special token: the runs between them are
+// tokenized here one by one, the text outside them joins the values. False if a special
+// token's text cannot be placed, or it strips whitespace next to it.
+bool split_specials(const llama_vocab* vocab, prompt_template::part& p) {
+    const std::vector<llama_token> t = tok(vocab, p.text, false, /*parse_special*/true);
+    size_t at = 0, first = std::string::npos;
+    for (llama_token id : t) {
+        if (!llama_vocab_is_control(vocab, id)) continue;
+        if (llama_vocab_get_attr(vocab, id) & (LLAMA_TOKEN_ATTR_LSTRIP | LLAMA_TOKEN_ATTR_RSTRIP)) return false;
+        const std::string s = piece(vocab, id);
+        const size_t pos = s.empty() ? std::string::npos : p.text.find(s, at);
+        if (pos == std::string::npos) return false;
+        if (first == std::string::npos) first = pos;
+        else {
+            const std::vector<llama_token> run = tok(vocab, p.text.substr(at, pos - at), false, false);
+            p.mid.insert(p.mid.end(), run.begin(), run.end());
+        }
+        p.mid.push_back(id);
+        at = pos + s.size();
+    }
+    if (first == std::string::npos) { p.head = p.text; return true; }   // all edge
+    p.head = p.text.substr(0, first);
+    p.tail = p.text.substr(at);
+    return true;
+}
+
+} // namespace
+
+bool template_compile(const llama_vocab* vocab, const std::string& text, prompt_template& out,
+                      std::string& err) {
+    out = prompt_template();
+    for (size_t i = 0; i < text.size();) {
+        const size_t open = text.find("{{", i);
+        if (open == std::string::npos) {
+            prompt_template::part p;
+            p.text = text.substr(i);
+            out.parts.push_back(p);
+            break;
+        }
+        if (open > i) {
+            prompt_template::part p;
+            p.text = text.substr(i, open - i);
+            out.parts.push_back(p);
+        }
+        const size_t close = text.find("}}", open + 2);
+        if (close == std::string::npos) { err = "unclosed {{ at byte " + std::to_string(open); return false; }
+        size_t a = open + 2, b = close;
+        while (a < b && text[a] == ' ') ++a;
+        while (b > a && text[b - 1] == ' ') --b;
+        const std::string name = text.substr(a, b - a);
+        if (name.empty() || !std::all_of(name.begin(), name.end(), slot_char)) {
+            err = "bad slot name at byte " + std::to_string(open);
+            return false;
+        }
+        prompt_template::part p;
+        p.slot = name;
+        out.parts.push_back(p);
+        if (std::find(out.slots.begin(), out.slots.end(), name) == out.slots.end()) out.slots.push_back(name);
+        i = close + 2;
+    }
+    if (!vocab) return true;
+
+    out.add_bos = llama_vocab_get_add_bos(vocab);
+    out.add_eos = llama_vocab_get_add_eos(vocab);
+    const bool spm = llama_vocab_type(vocab) == LLAMA_VOCAB_TYPE_SPM;
+    out.static_tokens = out.add_bos ? 1 : 0;
+    for (size_t i = 0; i < out.parts.size(); ++i) {
+        prompt_template::part& p = out.parts[i];
+        if (!p.slot.empty()) continue;
+        const bool ok = spm ? split_specials(vocab, p) : split_static(vocab, p, i > 0, i + 1 < out.parts.size());
+        if (!ok) { out.spliced = false; out.static_tokens = 0; return true; }
+        out.static_tokens += p.mid.size();
+    }
+    return true;
+}
+
+bool template_text(const prompt_template& t, const slot_lookup& value, std::string& out,
+                   std::string& err) {
+    out.clear();
+    for (const prompt_template::part& p : t.parts) {
+        if (p.slot.empty()) { out += p.text; continue; }
+        const std::string* v = value(p.slot);
+        if (!v) { err = "no value for slot " + p.slot; return false; }
+        out += *v;
+    }
+    return true;
+}
+
+// Control tokens the template itself puts in every request: BOS / EOS and those of its
+// static parts.
+static size_t static_controls(const llama_vocab* vocab, const prompt_template& t) {
+    size_t n = n_control(vocab, tok(vocab, "", true, false));
+    for (const prompt_template::part& p : t.parts)
+        if (p.slot.empty()) n += n_control(vocab, tok(vocab, p.text, false, true));
+    return n;
+}
+
+bool template_render(const llama_vocab* vocab, const prompt_template& t, const slot_lookup& value,
+                     std::vector<llama_token>& out, std::string& err) {
+    out.clear();
+    if (!t.spliced) {
+        // whole text with special tokens parsed; the values must not add any
+        std::string text;
+        if (!template_text(t, value, text, err)) return false;
+        out = tok(vocab, text, /*add_special*/true, /*parse_special*/true);
+        if (n_control(vocab, out) != static_controls(vocab, t)) { err = "slot values hold special token text"; return false; }
+        return true;
+    }
+
+    if (t.add_bos) out.push_back(llama_vocab_bos(vocab));
+    std::string win;   // edges and values not yet tokenized
+    auto flush = [&]() {
+        const std::vector<llama_token> w = tok(vocab, win, false, /*parse_special*/false);
+        out.insert(out.end(), w.begin(), w.end());
+        win.clear();
+    };
+    for (const prompt_template::part& p : t.parts) {
+        if (!p.slot.empty()) {
+            const std::string* v = value(p.slot);
+            if (!v) { err = "no value for slot " + p.slot; return false; }
+            win += *v;
+            continue;
+        }
+        win += p.head;
+        if (p.mid.empty()) continue;
+        flush();
+        out.insert(out.end(), p.mid.begin(), p.mid.end());
+        win = p.tail;
+    }
+    flush();
+    if (t.add_eos) out.push_back(llama_vocab_eos(vocab));
+#ifndef NDEBUG
+    // every special token of the static parts is spliced in, and splicing reproduces the
+    // filled-in text tokenized whole, unless the values hold (or complete) special token
+    // text, which only the whole tokenization would parse
+    assert(n_control(vocab, out) == static_controls(vocab, t));
+    std::string text;
+    if (template_text(t, value, text, err)) {
+        const std::vector<llama_token> whole = tok(vocab, text, true, /*parse_special*/true);
+        assert(n_control(vocab, whole) != n_control(vocab, out) || out == whole);
+    }
+#endif
+    return true;
+}
@@ -0,0 +1,52 @@
+// llm_template.h — prompt templates tokenized once, filled per request
+#pragma once
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "llama.h"
+
+// A template is text with {{name}} slots. Its static parts are tokenized when it is
+// compiled; a request tokenizes only the slot values together with the few bytes of
+// static text on either side whose tokens could merge with them ("edges"), and splices
+// the result between the precomputed tokens. Edges are found by tokenizing each static
+// part followed (or preceded) by probe text and keeping what never changes, plus a token
+// of margin; special tokens never merge, so an edge never reaches past one. Vocabs that
+// add a space prefix to every tokenize call (SPM) split each static part at its outer
+// special tokens instead, since their tokenizer restarts after every special token.
+struct prompt_template {
+    struct part {
+        std::string              slot;   // "" = static text
+        std::string              text;   // static: all of it
+        std::string              head;   // static: edge text after the previous slot
+        std::vector<llama_token> mid;    // static: tokens no slot value can change
+        std::string              tail;   // static: edge text before the next slot
+    };
+    std::vector<part> parts;
+    std::vector<std::string> slots;      // distinct slot names, in order of appearance
+    bool   add_bos       = false;
+    bool   add_eos       = false;
+    bool   spliced       = true;         // false: a static part with special tokens could
+                                         // not be split (SPM: at its special tokens; others:
+                                         // pieces that do not spell it), so requests
+                                         // tokenize the filled text whole
+    size_t static_tokens = 0;            // precomputed tokens per request
+};
+
+// Splits text at {{name}} slots. With vocab, tokenizes the static parts; without one,
+// only parses (compile again once a model is loaded). Slot names are [A-Za-z0-9_.-]+.
+bool template_compile(const llama_vocab* vocab, const std::string& text, prompt_template& out,
+                      std::string& err);
+
+// Returns the value of a slot, or nullptr if the request did not give one.
+using slot_lookup = std::function<const std::string*(const std::string& name)>;
+
+// The template's tokens with the slot values filled in. Values are plain text and never
+// turn into special tokens; when not spliced, one that would is refused. False with err
+// if a slot has no value or holds special token text there.
+bool template_render(const llama_vocab* vocab, const prompt_template& t, const slot_lookup& value,
+                     std::vector<llama_token>& out, std::string& err);
+
+// The filled-in text, as a plain prompt would have been written.
+bool template_text(const prompt_template& t, const slot_lookup& value, std::string& out,
+                   std::string& err);
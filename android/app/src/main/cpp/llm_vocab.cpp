@@ -0,0 +1,185 @@
+// llm_vocab.cpp — piece table construction
+#include "llm_vocab.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+
+static std::atomic<uint32_t> g_table_serial{0};
+
+static int32_t trie_child(token_table& t, int32_t parent, uint8_t b) {
+    int32_t c = t.trie[parent].first_child;
+    while (c >= 0) {
+        if (t.trie[c].byte == b) return c;
+        c = t.trie[c].next_sibling;
+    }
+    token_table::node nd;
+    nd.byte         = b;
+    nd.next_sibling = t.trie[parent].first_child;
+    t.trie.push_back(nd);
+    const int32_t id = (int32_t)t.trie.size() - 1;
+    t.trie[parent].first_child = id;
+    return id;
+}
+
+bool token_table_build(const llama_vocab* vocab, token_table& out) {
+    out = token_table();
+    if (!vocab) return false;
+
+    const int32_t n = llama_vocab_n_tokens(vocab);
+    out.vocab   = vocab;
+    out.serial  = ++g_table_serial;
+    out.n_vocab = n;
+    out.off.resize((size_t)n + 1);
+    out.tok_next.assign((size_t)n, -1);
+    out.bytes.reserve((size_t)n * 6);
+    out.trie.reserve((size_t)n * 3);
+    out.trie.emplace_back();
+
+    std::vector<char> buf(256);
+    for (int32_t t = 0; t < n; ++t) {
+        out.off[t] = (uint32_t)out.bytes.size();
+        int32_t k = llama_token_to_piece(vocab, t, buf.data(), (int32_t)buf.size(), 0, false);
+        if (k < 0) {
+            buf.resize((size_t)-k);
+            k = llama_token_to_piece(vocab, t, buf.data(), (int32_t)buf.size(), 0, false);
+        }
+        if (k <= 0) continue;
+        out.bytes.append(buf.data(), (size_t)k);
+
+        int32_t nd = 0;
+        for (int32_t j = 0; j < k; ++j) nd = trie_child(out, nd, (uint8_t)buf[j]);
+        out.tok_next[t]     = out.trie[nd].token;
+        out.trie[nd].token  = t;
+    }
+    out.off[n] = (uint32_t)out.bytes.size();
+    return true;
+}
+
+// ---------- on-disk caches ----------
+// header: u32 magic, u32 version, u64 key; then length-prefixed arrays
+namespace {
+
+constexpr uint32_t kTableMagic = 0x5654544C; // "LTTV"
+constexpr uint32_t kToksMagic  = 0x4B54544C; // "LTTK"
+constexpr uint32_t kVersion    = 1;
+
+struct file_writer {
+    FILE* f;
+    bool  ok = true;
+    explicit file_writer(const std::string& path) : f(fopen(path.c_str(), "wb")) { ok = f != nullptr; }
+    ~file_writer() { if (f) fclose(f); }
+    void raw(const void* p, size_t n) { if (ok && n) ok = fwrite(p, 1, n, f) == n; }
+    template <typename T> void pod(const T& v) { raw(&v, sizeof(v)); }
+    template <typename T> void vec(const std::vector<T>& v) { pod((uint64_t)v.size()); raw(v.data(), v.size() * sizeof(T)); }
+    void str(const std::string& s) { pod((uint64_t)s.size()); raw(s.data(), s.size()); }
+};
+
+struct file_reader {
+    FILE* f;
+    bool  ok = true;
+    explicit file_reader(const std::string& path) : f(fopen(path.c_str(), "rb")) { ok = f != nullptr; }
+    ~file_reader() { if (f) fclose(f); }
+    void raw(void* p, size_t n) { if (ok && n) ok = fread(p, 1, n, f) == n; }
+    template <typename T> void pod(T& v) { raw(&v, sizeof(v)); }
+    uint64_t count(uint64_t limit) {
+        uint64_t n = 0;
+        pod(n);
+        if (n > limit) ok = false;
+        return ok ? n : 0;
+    }
+    template <typename T> void vec(std::vector<T>& v) { v.resize((size_t)count(1u << 28)); raw(v.data(), v.size() * sizeof(T)); }
+    void str(std::string& s) { s.resize((size_t)count(1u << 30)); raw(&s[0], s.size()); }
+};
+
+// writes to path + ".tmp" and renames, so a crash never leaves a torn cache behind
+template <typename F>
+bool write_atomic(const std::string& path, F&& body) {
+    const std::string tmp = path + ".tmp";
+    bool ok;
+    {
+        file_writer w(tmp);
+        body(w);
+        ok = w.ok;
+    }
+    if (ok) ok = rename(tmp.c_str(), path.c_str()) == 0;
+    if (!ok) remove(tmp.c_str());
+    return ok;
+}
+
+bool read_header(file_reader& r, uint32_t magic, uint64_t key) {
+    uint32_t m = 0, v = 0;
+    uint64_t k = 0;
+    r.pod(m); r.pod(v); r.pod(k);
+    return r.ok && m == magic && v == kVersion && k == key;
+}
+
+} // namespace
+
+bool token_table_save(const token_table& t, const std::string& path, uint64_t key) {
+    return write_atomic(path, [&](file_writer& w) {
+        w.pod(kTableMagic); w.pod(kVersion); w.pod(key);
+        w.pod(t.n_vocab);
+        w.vec(t.off);
+        w.str(t.bytes);
+        w.vec(t.tok_next);
+        w.vec(t.trie);
+    });
+}
+
+bool token_table_load(const std::string& path, uint64_t key, const llama_vocab* vocab, token_table& out) {
+    file_reader r(path);
+    if (!read_header(r, kTableMagic, key)) return false;
+
+    token_table t;
+    r.pod(t.n_vocab);
+    r.vec(t.off);
+    r.str(t.bytes);
+    r.vec(t.tok_next);
+    r.vec(t.trie);
+    if (!r.ok || !vocab || t.n_vocab != llama_vocab_n_tokens(vocab)) return false;
+    if (t.off.size() != (size_t)t.n_vocab + 1 || t.tok_next.size() != (size_t)t.n_vocab ||
+        t.trie.empty() || t.off.back() != t.bytes.size()) return false;
+
+    t.vocab  = vocab;
+    t.serial = ++g_table_serial;
+    out = std::move(t);
+    return true;
+}
+
+const std::vector<llama_token>* tok_cache::find(const std::string& text) {
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (entries[i].text != text) continue;
+        if (i) std::rotate(entries.begin(), entries.begin() + (long)i, entries.begin() + (long)i + 1);
+        return &entries[0].toks;
+    }
+    return nullptr;
+}
+
+void tok_cache::put(const std::string& text, const std::vector<llama_token>& toks) {
+    if (find(text)) return;
+    entries.insert(entries.begin(), entry{text, toks});
+    if (entries.size() > cap) entries.resize(cap);
+}
+
+bool tok_cache_save(const tok_cache& c, const std::string& path, uint64_t key) {
+    return write_atomic(path, [&](file_writer& w) {
+        w.pod(kToksMagic); w.pod(kVersion); w.pod(key);
+        w.pod((uint64_t)c.entries.size());
+        for (const auto& e : c.entries) { w.str(e.text); w.vec(e.toks); }
+    });
+}
+
+bool tok_cache_load(const std::string& path, uint64_t key, tok_cache& out) {
+    file_reader r(path);
+    if (!read_header(r, kToksMagic, key)) return false;
+
+    tok_cache c;
+    c.cap = out.cap;
+    const uint64_t n = r.count(c.cap);
+    c.entries.resize((size_t)n);
+    for (auto& e : c.entries) { r.str(e.text); r.vec(e.toks); }
+    if (!r.ok) return false;
+    out = std::move(c);
+    return true;
+}
@@ -0,0 +1,52 @@
+// llm_vocab.h — detokenized piece table + byte trie for the loaded vocab
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "llama.h"
+
+struct token_table {
+    struct node {
+        int32_t first_child  = -1;
+        int32_t next_sibling = -1;
+        int32_t token        = -1; // first token whose piece ends here (chain via tok_next)
+        uint8_t byte         = 0;
+    };
+
+    const llama_vocab*    vocab   = nullptr;
+    uint32_t              serial  = 0;  // changes on every rebuild; lets caches detect staleness
+    int32_t               n_vocab = 0;
+    std::vector<uint32_t> off;          // n_vocab + 1 offsets into bytes
+    std::string           bytes;        // all pieces, concatenated
+    std::vector<int32_t>  tok_next;     // next token with an identical piece, -1 terminated
+    std::vector<node>     trie;         // node 0 is the root
+
+    int32_t piece_len(llama_token t) const { return (int32_t)(off[t + 1] - off[t]); }
+    const char* piece(llama_token t) const { return bytes.data() + off[t]; }
+};
+
+// Detokenizes every token once (lstrip=0, special=false) and indexes the pieces in a trie.
+// Control tokens have empty pieces and are left out of the trie.
+bool token_table_build(const llama_vocab* vocab, token_table& out);
+
+// Cache files are tagged with `key` (see model identity in the bridge) and rejected on
+// mismatch. A loaded table gets a fresh serial, so grammar masks are rebuilt lazily.
+bool token_table_save(const token_table& t, const std::string& path, uint64_t key);
+bool token_table_load(const std::string& path, uint64_t key, const llama_vocab* vocab, token_table& out);
+
+// Recently tokenized prompts, exact-text match, most recent first.
+struct tok_cache {
+    struct entry {
+        std::string              text;
+        std::vector<llama_token> toks;
+    };
+    std::vector<entry> entries;
+    size_t             cap = 8;
+
+    const std::vector<llama_token>* find(const std::string& text);
+    void put(const std::string& text, const std::vector<llama_token>& toks);
+};
+
+bool tok_cache_save(const tok_cache& c, const std::string& path, uint64_t key);
+bool tok_cache_load(const std::string& path, uint64_t key, tok_cache& out);
@@ -0,0 +1,236 @@
+// llm_choice_check.cpp — llm_choose probabilities vs. a direct per-candidate reference
+//
+//   llm_choice_check -m model.gguf [--sets 40] [--seed 7] [--max-err 0.01] [-c 512] [-t 4]
+//
+// Scores random candidate sets (drawn from a list with shared prefixes, repeats and
+// candidates that end where others go on) with llm_choose, and recomputes the same
+// restricted probabilities without the trie: a second context of the same model decodes
+// the prompt and then every candidate prefix on its own, and each candidate's
+// log-probability is summed token by token from the full logits. The reference takes a
+// candidate's tokens from the prompt and candidate tokenized as one text, as the model
+// would have written them, never from the candidate tokenized alone. Every third set runs
+// with a session open, so the bridge scores on shifted sequence ids.
+//
+// Loads the model twice (bridge and reference); a small one is enough. Fails (exit 1)
+// when a probability differs from the reference by more than --max-err, or llm_choose
+// returns an error.
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "llama.h"
+#include "../llm_bridge.h"
+
+namespace {
+
+struct options {
+    std::string model;
+    int         sets      = 40;
+    unsigned    seed      = 7;
+    double      max_err   = 0.01;
+    int         n_ctx     = 512;
+    int         n_threads = (int)std::max(1u, std::min(8u, std::thread::hardware_concurrency()));
+};
+
+const char* const kPrompts[] = {
+    "Question: Is the sky blue on a clear day?\nAnswer:",
+    "Review: The soup was cold and the waiter ignored us.\nSentiment:",
+    "Q: What is two plus two?\nA:",
+};
+
+const char* const kWords[] = {
+    " yes", " no", " maybe", " yes please", " y", " nope", " n", " unknown", " ye", " no way",
+    " positive", " negative", " neutral", " four", " 4", " a", " ab", " abc", " b",
+};
+
+std::vector<llama_token> tokenize(const llama_vocab* vocab, const std::string& s, bool add_special) {
+    int32_t n = -llama_tokenize(vocab, s.data(), (int32_t)s.size(), nullptr, 0, add_special, add_special);
+    std::vector<llama_token> out((size_t)std::max(n, 0));
+    n = llama_tokenize(vocab, s.data(), (int32_t)s.size(), out.data(), (int32_t)out.size(), add_special, add_special);
+    out.resize((size_t)std::max(n, 0));
+    return out;
+}
+
+double log_sum_exp(const std::vector<double>& v) {
+    double m = -INFINITY;
+    for (double x : v) m = std::max(m, x);
+    double s = 0;
+    for (double x : v) s += std::exp(x - m);
+    return m + std::log(s);
+}
+
+// The model on its own context: the prompt stays in seq 0, each prefix is decoded after it.
+struct reference {
+    llama_model*       model = nullptr;
+    llama_context*     ctx   = nullptr;
+    const llama_vocab* vocab = nullptr;
+    int                n_vocab  = 0;
+    int                n_prompt = 0;
+    std::map<std::vector<llama_token>, std::vector<float>> memo;   // prefix -> next logits
+
+    bool load(const options& o) {
+        model = llama_model_load_from_file(o.model.c_str(), llama_model_default_params());
+        if (!model) return false;
+        llama_context_params cp = llama_context_default_params();
+        cp.n_ctx = (uint32_t)o.n_ctx;
+        cp.n_batch = (uint32_t)o.n_ctx;
+        cp.n_threads = cp.n_threads_batch = o.n_threads;
+        ctx = llama_init_from_model(model, cp);
+        vocab = llama_model_get_vocab(model);
+        n_vocab = llama_vocab_n_tokens(vocab);
+        return ctx != nullptr;
+    }
+
+    void free() {
+        if (ctx) llama_free(ctx);
+        if (model) llama_model_free(model);
+    }
+
+    bool decode(std::vector<llama_token> toks, std::vector<float>& logits) {
+        if (llama_decode(ctx, llama_batch_get_one(toks.data(), (int32_t)toks.size())) != 0) return false;
+        const float* l = llama_get_logits_ith(ctx, -1);
+        logits.assign(l, l + n_vocab);
+        return true;
+    }
+
+    bool set_prompt(const std::vector<llama_token>& prompt) {
+        memo.clear();
+        llama_memory_clear(llama_get_memory(ctx), true);
+        n_prompt = (int)prompt.size();
+        return decode(prompt, memo[{}]);
+    }
+
+    const std::vector<float>* after(const std::vector<llama_token>& prefix) {
+        auto it = memo.find(prefix);
+        if (it != memo.end()) return &it->second;
+        llama_memory_seq_rm(llama_get_memory(ctx), 0, n_prompt, -1);
+        std::vector<float> logits;
+        if (!decode(prefix, logits)) return nullptr;
+        return &(memo[prefix] = std::move(logits));
+    }
+
+    // Restricted log-probabilities, candidate by candidate: at each prefix the tokens that
+    // continue some candidate share the mass among themselves, except where a candidate
+    // ends there too, where it keeps what the vocab does not give to a continuation.
+    bool logprobs(const std::vector<std::vector<llama_token>>& cands, std::vector<double>& out) {
+        out.clear();
+        for (const auto& c : cands) {
+            double lp = 0;
+            for (size_t k = 0; k <= c.size(); ++k) {
+                const std::vector<llama_token> pre(c.begin(), c.begin() + (ptrdiff_t)k);
+                std::vector<llama_token> kids;
+                int ends = 0;
+                for (const auto& o : cands) {
+                    if (o.size() > k && std::equal(pre.begin(), pre.end(), o.begin())) kids.push_back(o[k]);
+                    if (o == pre) ++ends;
+                }
+                std::sort(kids.begin(), kids.end());
+                kids.erase(std::unique(kids.begin(), kids.end()), kids.end());
+                const bool last = k == c.size();
+                if (last && kids.empty()) { lp -= std::log((double)ends); break; }
+                const std::vector<float>* l = after(pre);
+                if (!l) return false;
+                double z;
+                if (k > 0 && ends > 0) {
+                    z = log_sum_exp(std::vector<double>(l->begin(), l->end()));
+                } else {
+                    std::vector<double> ks;
+                    for (llama_token t : kids) ks.push_back((*l)[(size_t)t]);
+                    z = log_sum_exp(ks);
+                }
+                if (!last) { lp += (*l)[(size_t)c[k]] - z; continue; }
+                double cont = 0;
+                for (llama_token t : kids) cont += std::exp((*l)[(size_t)t] - z);
+                lp += std::log(std::max(1e-12, 1 - cont)) - std::log((double)ends);
+            }
+            out.push_back(lp);
+        }
+        return true;
+    }
+};
+
+void usage(const char* argv0) {
+    fprintf(stderr, "usage: %s -m model.gguf [--sets 40] [--seed 7] [--max-err 0.01] [-c 512] [-t 4]\n", argv0);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    options o;
+    for (int i = 1; i < argc; ++i) {
+        const std::string a = argv[i];
+        auto next = [&]() -> const char* { return i + 1 < argc ? argv[++i] : nullptr; };
+        const char* v = nullptr;
+        if      (a == "-m" && (v = next()))          o.model     = v;
+        else if (a == "--sets" && (v = next()))      o.sets      = atoi(v);
+        else if (a == "--seed" && (v = next()))      o.seed      = (unsigned)atoi(v);
+        else if (a == "--max-err" && (v = next()))   o.max_err   = atof(v);
+        else if (a == "-c" && (v = next()))          o.n_ctx     = atoi(v);
+        else if (a == "-t" && (v = next()))          o.n_threads = atoi(v);
+        else { usage(argv[0]); return 2; }
+    }
+    if (o.model.empty() || o.sets < 1 || o.n_ctx < 64 || o.n_threads < 1) { usage(argv[0]); return 2; }
+
+    if (const int rc = llm_init(o.model.c_str(), o.n_ctx, 0, o.n_threads, 0)) {
+        fprintf(stderr, "llm_init failed (%d)\n", rc);
+        return 1;
+    }
+    reference ref;
+    if (!ref.load(o)) { fprintf(stderr, "cannot load %s for the reference\n", o.model.c_str()); return 1; }
+
+    std::mt19937 rng(o.seed);
+    const size_t n_words = sizeof(kWords) / sizeof(kWords[0]);
+    const size_t n_prompts = sizeof(kPrompts) / sizeof(kPrompts[0]);
+    double worst = 0;
+    int failures = 0, n_cands = 0;
+    for (int s = 0; s < o.sets; ++s) {
+        const char* prompt = kPrompts[(size_t)s % n_prompts];
+        const int n = 1 + (int)(rng() % 8);
+        std::vector<const char*> names;
+        std::vector<std::vector<llama_token>> cands;
+        std::vector<llama_token> shared = tokenize(ref.vocab, prompt, true);
+        size_t n_shared = shared.size();
+        for (int i = 0; i < n; ++i) {
+            names.push_back(kWords[rng() % n_words]);
+            cands.push_back(tokenize(ref.vocab, std::string(prompt) + names.back(), true));
+            n_shared = std::min(n_shared, (size_t)(std::mismatch(shared.begin(), shared.end(), cands.back().begin(),
+                                                                 cands.back().end()).first - shared.begin()));
+        }
+        shared.resize(n_shared);   // a candidate merging with the prompt's end takes the rest along
+        for (auto& c : cands) c.erase(c.begin(), c.begin() + (ptrdiff_t)n_shared);
+        n_cands += n;
+
+        const int session = s % 3 == 0 ? llm_session_open() : 0;
+        std::vector<float> probs((size_t)n);
+        const int rc = llm_choose(prompt, nullptr, names.data(), n, probs.data(), nullptr, 0);
+        if (session > 0) llm_session_close(session);
+        if (rc < 0) { fprintf(stderr, "set %d: llm_choose failed (%d)\n", s, rc); ++failures; continue; }
+
+        std::vector<double> lp;
+        if (!ref.set_prompt(shared) || !ref.logprobs(cands, lp)) {
+            fprintf(stderr, "set %d: reference decode failed\n", s);
+            return 1;
+        }
+        double err = 0;
+        for (int i = 0; i < n; ++i) err = std::max(err, std::fabs((double)probs[(size_t)i] - std::exp(lp[(size_t)i])));
+        worst = std::max(worst, err);
+        if (err > o.max_err) {
+            ++failures;
+            fprintf(stderr, "set %d: error %.3g:", s, err);
+            for (int i = 0; i < n; ++i) fprintf(stderr, " \"%s\" %.4f/%.4f", names[(size_t)i], probs[(size_t)i], std::exp(lp[(size_t)i]));
+            fprintf(stderr, "\n");
+        }
+    }
+    printf("%d sets, %d candidates, worst probability error %.3g (limit %.3g), %d failed\n", o.sets, n_cands,
+           worst, o.max_err, failures);
+
+    ref.free();
+    llm_dispose();
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,205 @@
+// llm_gen_bench.cpp — per-token cost of stepping generations through gen_scheduler
+//
+//   llm_gen_bench [--tokens 400000] [--gens 1,4,8] [--vocab 256,32000] [--reps 5]
+//                 [--max-overhead-ns 0]
+//
+// No model. A stand-in decode nudges a per-sequence logits vector so the greedy argmax
+// keeps moving, and every generation picks (argmax over the vocab) and appends each
+// token. The same work runs twice: as the plain step loop the bridge used to have, and
+// as gen_run-style coroutines driven by gen_scheduler with the decode in its callback.
+// Each row is the best of --reps runs of each; --tokens is the total per run at vocab
+// 256 and is scaled down for larger vocabs so every row takes about as long.
+//
+// Fails (exit 1) when the two disagree on the generated tokens, or when
+// --max-overhead-ns > 0 and a row's coroutine ns/token exceeds the loop's by more.
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../llm_gen.h"
+
+namespace {
+
+struct options {
+    long             tokens = 400000;
+    std::vector<int> gens   = {1, 4, 8};
+    std::vector<int> vocabs = {256, 32000};
+    int              reps   = 5;
+    double           max_overhead_ns = 0;
+};
+
+std::vector<int> parse_list(const char* s) {
+    std::vector<int> out;
+    for (const char* p = s; *p;) {
+        out.push_back(atoi(p));
+        const char* c = strchr(p, ',');
+        if (!c) break;
+        p = c + 1;
+    }
+    return out;
+}
+
+bool parse_args(int argc, char** argv, options& o) {
+    for (int i = 1; i < argc; ++i) {
+        const char* a = argv[i];
+        const char* v = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!v) { fprintf(stderr, "missing value for %s\n", a); return false; }
+        if      (!strcmp(a, "--tokens"))          o.tokens = atol(v);
+        else if (!strcmp(a, "--gens"))            o.gens   = parse_list(v);
+        else if (!strcmp(a, "--vocab"))           o.vocabs = parse_list(v);
+        else if (!strcmp(a, "--reps"))            o.reps   = atoi(v);
+        else if (!strcmp(a, "--max-overhead-ns")) o.max_overhead_ns = atof(v);
+        else { fprintf(stderr, "unknown option %s\n", a); return false; }
+        ++i;
+    }
+    return o.tokens > 0 && o.reps > 0 && !o.gens.empty() && !o.vocabs.empty();
+}
+
+double now_ns() {
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Stand-in model: logits per sequence; each decoded token moves mass so the argmax wanders.
+struct fake_model {
+    int vocab;
+    std::vector<std::vector<float>> logits;
+
+    fake_model(int n_seq, int v) : vocab(v), logits((size_t)n_seq, std::vector<float>((size_t)v)) {
+        for (int s = 0; s < n_seq; ++s)
+            for (int t = 0; t < v; ++t) logits[(size_t)s][(size_t)t] = (float)((t * 2654435761u + (unsigned)s) % 1000) * 1e-3f;
+    }
+    void decode(int seq, llama_token tok) {
+        std::vector<float>& l = logits[(size_t)seq];
+        l[(size_t)tok] -= 1.0f;
+        l[((size_t)tok * 7919u + 13u) % (size_t)vocab] += 1.25f;
+    }
+};
+
+// What the bridge's per-token stages amount to here: pick, count, append, limit.
+struct gen_state {
+    int         max_tokens = 0;
+    int         n_gen      = 0;
+    std::string text;
+    uint64_t    hash       = 0;
+};
+
+llama_token pick(const float* l, int vocab) {
+    int best = 0; float bv = -1e30f;
+    for (int t = 0; t < vocab; ++t) if (l[t] > bv) { bv = l[t]; best = t; }
+    return (llama_token)best;
+}
+
+bool accept(gen_state& g, llama_token tok) {
+    ++g.n_gen;
+    g.text.push_back((char)('a' + tok % 26));
+    g.hash = g.hash * 1099511628211ull + (uint64_t)tok;
+    return g.n_gen < g.max_tokens;
+}
+
+// The step loop gen_scheduler replaced: pick for every live generation, decode their
+// tokens, repeat.
+void run_loop(fake_model& m, std::vector<gen_state>& gs) {
+    const size_t n = gs.size();
+    std::vector<llama_token> next(n);
+    std::vector<char>        live(n);
+    for (size_t i = 0; i < n; ++i) {
+        next[i] = pick(m.logits[i].data(), m.vocab);
+        live[i] = accept(gs[i], next[i]);
+    }
+    for (;;) {
+        bool any = false;
+        for (size_t i = 0; i < n; ++i) if (live[i]) { m.decode((int)i, next[i]); any = true; }
+        if (!any) break;
+        for (size_t i = 0; i < n; ++i) {
+            if (!live[i]) continue;
+            next[i] = pick(m.logits[i].data(), m.vocab);
+            live[i] = accept(gs[i], next[i]);
+        }
+    }
+}
+
+gen_task generation(gen_slot& s, gen_state& g, int vocab) {
+    const float* l = s.logits;
+    for (;;) {
+        const llama_token tok = pick(l, vocab);
+        if (!accept(g, tok)) co_return;
+        l = co_await gen_step{s, tok};
+        if (!l) co_return;
+    }
+}
+
+void run_coro(fake_model& m, std::vector<gen_state>& gs) {
+    std::vector<gen_slot> slots(gs.size());
+    gen_scheduler sched;
+    for (size_t i = 0; i < gs.size(); ++i) {
+        slots[i].seq    = (llama_seq_id)i;
+        slots[i].logits = m.logits[i].data();
+        sched.add(generation(slots[i], gs[i], m.vocab), slots[i]);
+    }
+    sched.run([&](std::vector<gen_slot*>& ss) {
+        for (gen_slot* s : ss) {
+            m.decode(s->seq, s->pending);
+            s->logits = m.logits[(size_t)s->seq].data();
+        }
+    });
+}
+
+// ns per generated token, and the generations' combined hash
+template <class Run>
+double time_run(Run run, int n_gen, int vocab, int per_gen, uint64_t& hash) {
+    fake_model m(n_gen, vocab);
+    std::vector<gen_state> gs((size_t)n_gen);
+    for (gen_state& g : gs) { g.max_tokens = per_gen; g.text.reserve((size_t)per_gen); }
+    const double t0 = now_ns();
+    run(m, gs);
+    const double dt = now_ns() - t0;
+    hash = 0;
+    long total = 0;
+    for (const gen_state& g : gs) { hash = hash * 31 + g.hash; total += g.n_gen; }
+    return dt / (double)std::max(1L, total);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    options o;
+    if (!parse_args(argc, argv, o)) {
+        fprintf(stderr, "usage: %s [--tokens N] [--gens 1,4,8] [--vocab 256,32000] [--reps 5] [--max-overhead-ns X]\n",
+                argv[0]);
+        return 2;
+    }
+
+    int failures = 0;
+    printf("%5s %7s %9s %14s %14s %14s\n", "gens", "vocab", "tokens", "loop ns/tok", "coro ns/tok", "overhead ns");
+    for (int vocab : o.vocabs) {
+        if (vocab <= 1) continue;
+        const long tokens = std::max(1000L, (long)((double)o.tokens * 256.0 / vocab));
+        for (int n : o.gens) {
+            if (n <= 0) continue;
+            const int per_gen = (int)std::max(1L, tokens / n);
+            double best_loop = 1e300, best_coro = 1e300;
+            uint64_t h_loop = 0, h_coro = 0;
+            for (int r = 0; r < o.reps; ++r) {   // alternated, so drift hits both alike
+                best_loop = std::min(best_loop, time_run(run_loop, n, vocab, per_gen, h_loop));
+                best_coro = std::min(best_coro, time_run(run_coro, n, vocab, per_gen, h_coro));
+            }
+            const double over = best_coro - best_loop;
+            printf("%5d %7d %9ld %14.1f %14.1f %14.1f\n", n, vocab, (long)per_gen * n, best_loop, best_coro, over);
+            if (h_loop != h_coro) {
+                fprintf(stderr, "gens %d vocab %d: coroutine output differs from the loop\n", n, vocab);
+                ++failures;
+            }
+            if (o.max_overhead_ns > 0 && over > o.max_overhead_ns) {
+                fprintf(stderr, "gens %d vocab %d: overhead %.1f ns/token > %.1f\n", n, vocab, over, o.max_overhead_ns);
+                ++failures;
+            }
+        }
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,263 @@
+// llm_perplexity.cpp — host perplexity / quantization comparison harness
+//
+//   llm_perplexity -f corpus.txt [-c 512] [-s 4] [-t 8] [--chunks N] a-q4_0.gguf a-q4_k_m.gguf ...
+//
+// Every model is scored on the same text. The text is cut into n_ctx-token chunks,
+// `-s` chunks at a time are decoded together as separate sequences of one context,
+// and only the second half of each chunk is scored (the first half is context), as
+// llama.cpp's perplexity example does. One line per model: perplexity, prompt
+// tokens/s and peak RSS, so quantizations can be compared side by side.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#if defined(__linux__)
+#include <unistd.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "llama.h"
+
+namespace {
+
+struct options {
+    std::string              text_path;
+    int                      n_ctx     = 512;
+    int                      n_seq     = 4;
+    int                      n_threads = (int)std::max(1u, std::thread::hardware_concurrency());
+    int                      max_chunks = -1;
+    std::vector<std::string> models;
+};
+
+struct result {
+    double ppl       = 0.0;
+    double ppl_err   = 0.0;
+    double tok_per_s = 0.0;
+    double load_s    = 0.0;
+    double rss_mib   = 0.0;
+    double file_mib  = 0.0;
+    int    n_chunks  = 0;
+    int    n_scored  = 0;
+};
+
+double now_s() {
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+double rss_mib() {
+#if defined(__linux__)
+    long pages = 0, resident = 0;
+    if (FILE* f = fopen("/proc/self/statm", "r")) {
+        if (fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+        fclose(f);
+    }
+    return (double)resident * (double)sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+#else
+    rusage ru{};
+    getrusage(RUSAGE_SELF, &ru);
+    return (double)ru.ru_maxrss / (1024.0 * 1024.0); // bytes on macOS; lifetime peak
+#endif
+}
+
+double file_mib(const std::string& path) {
+    struct stat st{};
+    return stat(path.c_str(), &st) == 0 ? (double)st.st_size / (1024.0 * 1024.0) : 0.0;
+}
+
+std::vector<llama_token> tokenize(const llama_vocab* vocab, const std::string& text) {
+    int32_t n = -llama_tokenize(vocab, text.data(), (int32_t)text.size(), nullptr, 0, false, false);
+    std::vector<llama_token> out((size_t)std::max(n, 0));
+    if (n > 0) {
+        n = llama_tokenize(vocab, text.data(), (int32_t)text.size(), out.data(), n, false, false);
+        out.resize((size_t)std::max(n, 0));
+    }
+    return out;
+}
+
+// -log p(target) for each scored row, reduced over `n_threads` threads.
+struct row { int32_t batch_idx; llama_token target; };
+
+void score_rows(llama_context* ctx, const std::vector<row>& rows, int n_vocab, int n_threads,
+                double& nll, double& nll2) {
+    const int nt = std::max(1, std::min(n_threads, (int)rows.size()));
+    std::vector<double> part(nt, 0.0), part2(nt, 0.0);
+    std::vector<std::thread> pool;
+    for (int w = 0; w < nt; ++w) {
+        pool.emplace_back([&, w] {
+            for (size_t r = (size_t)w; r < rows.size(); r += (size_t)nt) {
+                const float* lg = llama_get_logits_ith(ctx, rows[r].batch_idx);
+                float mx = lg[0];
+                for (int t = 1; t < n_vocab; ++t) mx = std::max(mx, lg[t]);
+                double sum = 0.0;
+                for (int t = 0; t < n_vocab; ++t) sum += std::exp((double)(lg[t] - mx));
+                const double v = -((double)(lg[rows[r].target] - mx) - std::log(sum));
+                part[w]  += v;
+                part2[w] += v * v;
+            }
+        });
+    }
+    for (auto& th : pool) th.join();
+    for (int w = 0; w < nt; ++w) { nll += part[w]; nll2 += part2[w]; }
+}
+
+bool run_model(const options& o, const std::string& text, const std::string& path, result& res) {
+    res.file_mib = file_mib(path);
+    double peak = rss_mib();
+
+    const double t_load = now_s();
+    llama_model_params mp = llama_model_default_params();
+    mp.use_mmap = true;
+    llama_model* model = llama_model_load_from_file(path.c_str(), mp);
+    if (!model) { fprintf(stderr, "failed to load %s\n", path.c_str()); return false; }
+
+    const llama_vocab* vocab = llama_model_get_vocab(model);
+    const int  n_vocab = llama_vocab_n_tokens(vocab);
+    const bool add_bos = llama_vocab_get_add_bos(vocab);
+
+    const std::vector<llama_token> toks = tokenize(vocab, text);
+    int n_chunks = (int)(toks.size() / (size_t)o.n_ctx);
+    if (o.max_chunks > 0) n_chunks = std::min(n_chunks, o.max_chunks);
+    if (n_chunks == 0) {
+        fprintf(stderr, "%s: text too short (%zu tokens) for -c %d\n", path.c_str(), toks.size(), o.n_ctx);
+        llama_model_free(model);
+        return false;
+    }
+    const int n_seq = std::min(o.n_seq, n_chunks);
+
+    llama_context_params cp = llama_context_default_params();
+    cp.n_ctx           = (uint32_t)(o.n_ctx * n_seq);
+    cp.n_batch         = cp.n_ctx;
+    cp.n_seq_max       = (uint32_t)n_seq;
+    cp.n_threads       = o.n_threads;
+    cp.n_threads_batch = o.n_threads;
+    llama_context* ctx = llama_init_from_model(model, cp);
+    if (!ctx) {
+        fprintf(stderr, "%s: failed to create context\n", path.c_str());
+        llama_model_free(model);
+        return false;
+    }
+    res.load_s = now_s() - t_load;
+    peak = std::max(peak, rss_mib());
+
+    llama_batch batch = llama_batch_init((int32_t)cp.n_ctx, 0, 1);
+    const int first = o.n_ctx / 2;   // rows before this only provide context
+    double nll = 0.0, nll2 = 0.0, t_decode = 0.0;
+    long   n_decoded = 0;
+    std::vector<row> rows;
+
+    for (int c0 = 0; c0 < n_chunks; c0 += n_seq) {
+        const int n_here = std::min(n_seq, n_chunks - c0);
+        batch.n_tokens = 0;
+        rows.clear();
+        for (int s = 0; s < n_here; ++s) {
+            const size_t base = (size_t)(c0 + s) * (size_t)o.n_ctx;
+            for (int j = 0; j < o.n_ctx; ++j) {
+                const int i = batch.n_tokens++;
+                batch.token[i]     = (j == 0 && add_bos) ? llama_vocab_bos(vocab) : toks[base + j];
+                batch.pos[i]       = j;
+                batch.n_seq_id[i]  = 1;
+                batch.seq_id[i][0] = s;
+                batch.logits[i]    = (j >= first && j < o.n_ctx - 1) ? 1 : 0;
+                if (batch.logits[i]) rows.push_back({i, toks[base + j + 1]});
+            }
+        }
+
+        llama_memory_clear(llama_get_memory(ctx), true);
+        const double t0 = now_s();
+        if (llama_decode(ctx, batch) != 0) {
+            fprintf(stderr, "%s: decode failed at chunk %d\n", path.c_str(), c0);
+            break;
+        }
+        t_decode  += now_s() - t0;
+        n_decoded += batch.n_tokens;
+        peak = std::max(peak, rss_mib());
+
+        score_rows(ctx, rows, n_vocab, o.n_threads, nll, nll2);
+        res.n_scored += (int)rows.size();
+        res.n_chunks += n_here;
+
+        const double mean = nll / res.n_scored;
+        fprintf(stderr, "\r  %s: chunk %d/%d  ppl %.4f", path.c_str(), res.n_chunks, n_chunks, std::exp(mean));
+    }
+    fputc('\n', stderr);
+
+    if (res.n_scored > 1) {
+        const double mean = nll / res.n_scored;
+        const double var  = std::max(0.0, nll2 / res.n_scored - mean * mean);
+        res.ppl     = std::exp(mean);
+        res.ppl_err = res.ppl * std::sqrt(var / (res.n_scored - 1));
+    }
+    res.tok_per_s = t_decode > 0 ? n_decoded / t_decode : 0.0;
+    res.rss_mib   = peak;
+
+    llama_batch_free(batch);
+    llama_free(ctx);
+    llama_model_free(model);
+    return res.n_scored > 0;
+}
+
+void usage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s -f text.txt [-c n_ctx=512] [-s n_seq=4] [-t threads] [--chunks N] model.gguf [model.gguf ...]\n",
+            argv0);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    options o;
+    for (int i = 1; i < argc; ++i) {
+        const std::string a = argv[i];
+        auto next = [&]() -> const char* { return i + 1 < argc ? argv[++i] : nullptr; };
+        const char* v = nullptr;
+        if      (a == "-f" && (v = next()))        o.text_path  = v;
+        else if (a == "-c" && (v = next()))        o.n_ctx      = atoi(v);
+        else if (a == "-s" && (v = next()))        o.n_seq      = atoi(v);
+        else if (a == "-t" && (v = next()))        o.n_threads  = atoi(v);
+        else if (a == "--chunks" && (v = next()))  o.max_chunks = atoi(v);
+        else if (!a.empty() && a[0] != '-')        o.models.push_back(a);
+        else { usage(argv[0]); return 2; }
+    }
+    if (o.text_path.empty() || o.models.empty() || o.n_ctx < 16 || o.n_seq < 1 || o.n_threads < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    std::ifstream in(o.text_path, std::ios::binary);
+    if (!in) { fprintf(stderr, "cannot read %s\n", o.text_path.c_str()); return 1; }
+    std::stringstream ss;
+    ss << in.rdbuf();
+    const std::string text = ss.str();
+
+    llama_backend_init();
+
+    std::vector<result> results(o.models.size());
+    std::vector<bool>   ok(o.models.size(), false);
+    for (size_t m = 0; m < o.models.size(); ++m) ok[m] = run_model(o, text, o.models[m], results[m]);
+
+    printf("\n%-40s %9s %9s %8s %9s %8s %9s %7s\n",
+           "model", "size MiB", "ppl", "+/-", "tok/s", "load s", "RSS MiB", "chunks");
+    for (size_t m = 0; m < o.models.size(); ++m) {
+        std::string name = o.models[m];
+        const size_t slash = name.find_last_of('/');
+        if (slash != std::string::npos) name = name.substr(slash + 1);
+        if (!ok[m]) { printf("%-40s  failed\n", name.c_str()); continue; }
+        const result& r = results[m];
+        printf("%-40s %9.1f %9.4f %8.4f %9.1f %8.2f %9.1f %7d\n",
+               name.c_str(), r.file_mib, r.ppl, r.ppl_err, r.tok_per_s, r.load_s, r.rss_mib, r.n_chunks);
+    }
+
+    llama_backend_free();
+    return 0;
+}
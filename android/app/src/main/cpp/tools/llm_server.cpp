@@ -0,0 +1,652 @@
+// llm_server.cpp — OpenAI-compatible local daemon around the bridge engine
+//
+//   llm_server -m model.gguf [--socket PATH] [--port N] [-c 2048] [-t 4] [--workers 4] [--idle 600]
+//
+// Serves POST /v1/completions, /v1/chat/completions (both with "stream": true as SSE),
+// /v1/embeddings, plus GET /v1/models, /health and /metrics (Prometheus text), on a Unix
+// domain socket and/or 127.0.0.1:PORT. One model is loaded once and shared by every client.
+//
+// An epoll loop accepts connections and reads requests; complete requests go to a fixed
+// pool of workers, which run them through the bridge's C API and write the response.
+// Generation is serialized inside the engine (one context), so extra workers queue
+// there while the loop keeps accepting. Every response closes its connection.
+//
+// Sampling is the engine's: greedy. temperature/top_p/seed are accepted and ignored;
+// max_tokens, stop and response_format (json_object / json_schema) are honoured.
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../llm_bridge.h"
+#include "../llm_json.h"
+
+namespace {
+
+struct options {
+    std::string model;
+    std::string socket_path;
+    int         port      = 0;
+    int         n_ctx     = 2048;
+    int         n_threads = 4;
+    int         n_workers = 4;
+    int         idle_s    = 0;
+};
+
+constexpr size_t kMaxHeader = 64 * 1024;
+constexpr size_t kMaxBody   = 8 * 1024 * 1024;
+
+std::atomic<bool> g_quit{false};
+int               g_wake_fd = -1;     // write end of the self-pipe that wakes epoll
+std::string       g_model_id;
+std::atomic<long> g_next_id{1};
+
+// ---------- json building ----------
+json_value jobj() { json_value v; v.kind = json_value::OBJ; return v; }
+json_value jarr() { json_value v; v.kind = json_value::ARR; return v; }
+json_value jstr(const std::string& s) { json_value v; v.kind = json_value::STR; v.str = s; return v; }
+json_value jnull() { return json_value(); }
+json_value jnum(double d, const char* fmt = "%.0f") {
+    json_value v;
+    v.kind = json_value::NUM;
+    v.num  = d;
+    char b[32];
+    snprintf(b, sizeof(b), fmt, d);
+    v.str = b;
+    return v;
+}
+json_value& put(json_value& o, const char* k, json_value v) {
+    o.obj.emplace_back(k, std::move(v));
+    return o.obj.back().second;
+}
+std::string dump(const json_value& v) { std::string s; json_dump(v, s); return s; }
+
+// ---------- http ----------
+struct http_request {
+    std::string method, path, body;
+    std::vector<std::pair<std::string, std::string>> headers; // names lowercased
+
+    const std::string* header(const char* name) const {
+        for (const auto& h : headers) if (h.first == name) return &h.second;
+        return nullptr;
+    }
+};
+
+enum class parse_result { INCOMPLETE, DONE, BAD, TOO_LARGE };
+
+// Parses buf as one request; needs_continue is set when the client waits for "100 Continue".
+parse_result parse_http(const std::string& buf, http_request& req, bool& needs_continue) {
+    const size_t hdr_end = buf.find("\r\n\r\n");
+    if (hdr_end == std::string::npos) return buf.size() > kMaxHeader ? parse_result::TOO_LARGE : parse_result::INCOMPLETE;
+
+    req = http_request();
+    size_t line_end = buf.find("\r\n");
+    const std::string line = buf.substr(0, line_end);
+    const size_t sp1 = line.find(' '), sp2 = line.rfind(' ');
+    if (sp1 == std::string::npos || sp2 == sp1) return parse_result::BAD;
+    req.method = line.substr(0, sp1);
+    req.path   = line.substr(sp1 + 1, sp2 - sp1 - 1);
+    const size_t q = req.path.find('?');
+    if (q != std::string::npos) req.path.resize(q);
+
+    size_t p = line_end + 2;
+    while (p < hdr_end) {
+        const size_t e = buf.find("\r\n", p);
+        const std::string h = buf.substr(p, e - p);
+        p = e + 2;
+        const size_t colon = h.find(':');
+        if (colon == std::string::npos) return parse_result::BAD;
+        std::string name = h.substr(0, colon), value = h.substr(colon + 1);
+        for (auto& c : name) c = (char)tolower((unsigned char)c);
+        value.erase(0, value.find_first_not_of(" \t"));
+        value.erase(value.find_last_not_of(" \t") + 1);
+        req.headers.emplace_back(std::move(name), std::move(value));
+    }
+
+    if (req.header("transfer-encoding")) return parse_result::BAD;  // curl -d always sends a length
+    size_t len = 0;
+    if (const std::string* cl = req.header("content-length")) len = (size_t)strtoull(cl->c_str(), nullptr, 10);
+    if (len > kMaxBody) return parse_result::TOO_LARGE;
+    if (buf.size() < hdr_end + 4 + len) {
+        const std::string* ex = req.header("expect");
+        needs_continue = ex && strcasecmp(ex->c_str(), "100-continue") == 0;
+        return parse_result::INCOMPLETE;
+    }
+    req.body = buf.substr(hdr_end + 4, len);
+    return parse_result::DONE;
+}
+
+bool send_all(int fd, const char* p, size_t n) {
+    while (n) {
+        const ssize_t k = send(fd, p, n, MSG_NOSIGNAL);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return false;
+        p += k;
+        n -= (size_t)k;
+    }
+    return true;
+}
+bool send_all(int fd, const std::string& s) { return send_all(fd, s.data(), s.size()); }
+
+const char* status_text(int code) {
+    switch (code) {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 413: return "Payload Too Large";
+        case 500: return "Internal Server Error";
+        case 503: return "Service Unavailable";
+        default:  return "Error";
+    }
+}
+
+void respond(int fd, int code, const std::string& body, const char* type = "application/json") {
+    char head[256];
+    snprintf(head, sizeof(head),
+             "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+             code, status_text(code), type, body.size());
+    if (send_all(fd, head, strlen(head))) send_all(fd, body);
+}
+
+void respond_error(int fd, int code, const std::string& msg) {
+    json_value e = jobj();
+    json_value& inner = put(e, "error", jobj());
+    put(inner, "message", jstr(msg));
+    put(inner, "type", jstr(code >= 500 ? "server_error" : "invalid_request_error"));
+    respond(fd, code, dump(e));
+}
+
+// ---------- generation ----------
+struct gen_job {
+    int         fd     = -1;
+    bool        stream = false;
+    bool        chat   = false;
+    std::string id;
+    long        created = 0;
+
+    std::string text;         // everything generated so far (the engine cuts stop words)
+    bool        broken  = false;  // client went away
+    bool        role_sent = false;
+};
+
+json_value chunk(const gen_job& j, const std::string* piece, const char* finish) {
+    json_value c = jobj();
+    put(c, "id", jstr(j.id));
+    put(c, "object", jstr(j.chat ? "chat.completion.chunk" : "text_completion"));
+    put(c, "created", jnum((double)j.created));
+    put(c, "model", jstr(g_model_id));
+    json_value& choices = put(c, "choices", jarr());
+    json_value ch = jobj();
+    put(ch, "index", jnum(0));
+    if (j.chat) {
+        json_value& delta = put(ch, "delta", jobj());
+        if (!j.role_sent) put(delta, "role", jstr("assistant"));
+        if (piece) put(delta, "content", jstr(*piece));
+    } else {
+        put(ch, "text", jstr(piece ? *piece : std::string()));
+    }
+    put(ch, "finish_reason", finish ? jstr(finish) : jnull());
+    choices.arr.push_back(std::move(ch));
+    return c;
+}
+
+bool send_event(gen_job& j, const std::string* piece, const char* finish) {
+    const std::string ev = "data: " + dump(chunk(j, piece, finish)) + "\n\n";
+    j.role_sent = true;
+    if (!send_all(j.fd, ev)) j.broken = true;
+    return !j.broken;
+}
+
+// Pieces never include a possible start of a stop word: the engine holds those back.
+int on_piece(const char* piece, int len, void* user) {
+    gen_job& j = *(gen_job*)user;
+    j.text.append(piece, (size_t)len);
+    if (j.stream) {
+        const std::string out(piece, (size_t)len);
+        if (!send_event(j, &out, nullptr)) return 1;
+    }
+    return 0;
+}
+
+// Engine params from an OpenAI request body. Returns an error message or "".
+std::string engine_params(const json_value& req, std::string& params, int& max_tokens) {
+    max_tokens = 128;
+    if (const json_value* mt = req.get("max_tokens")) max_tokens = (int)mt->num;
+    if (const json_value* mt = req.get("max_completion_tokens")) max_tokens = (int)mt->num;
+    if (max_tokens <= 0) return "max_tokens must be positive";
+
+    json_value p = jobj();
+    put(p, "max_tokens", jnum(max_tokens));
+    if (const json_value* st = req.get("stop")) {
+        if (st->is(json_value::STR) || st->is(json_value::ARR)) put(p, "stop", *st);
+    }
+    if (const json_value* rf = req.get("response_format")) {
+        const json_value* type = rf->get("type");
+        const std::string t = type && type->is(json_value::STR) ? type->str : "";
+        if (t == "json_object") {
+            put(p, "json", jnum(1));
+        } else if (t == "json_schema") {
+            const json_value* js = rf->get("json_schema");
+            const json_value* schema = js ? js->get("schema") : nullptr;
+            if (!schema) return "response_format.json_schema.schema is required";
+            char err[256] = "";
+            const int id = llm_grammar_compile(dump(*schema).c_str(), err, sizeof(err));
+            if (id <= 0) return std::string("unsupported schema: ") + err;
+            put(p, "json", jnum(1));
+            put(p, "grammar", jnum(id));
+        } else if (!t.empty() && t != "text") {
+            return "unsupported response_format type";
+        }
+    }
+    params = dump(p);
+    return "";
+}
+
+void run_generation(int fd, const json_value& req, const std::string& prompt, bool chat) {
+    gen_job j;
+    j.fd      = fd;
+    j.chat    = chat;
+    j.id      = (chat ? "chatcmpl-" : "cmpl-") + std::to_string(g_next_id++);
+    j.created = (long)time(nullptr);
+    if (const json_value* s = req.get("stream")) j.stream = s->is(json_value::BOOL) && s->b;
+
+    std::string params;
+    int         max_tokens = 0;
+    const std::string err = engine_params(req, params, max_tokens);
+    if (!err.empty()) return respond_error(fd, 400, err);
+
+    if (j.stream) {
+        static const char head[] =
+            "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\nConnection: close\r\n\r\n";
+        if (!send_all(fd, head, sizeof(head) - 1)) return;
+    }
+
+    int usage[2] = {0, 0};
+    const int rc = llm_infer_stream(prompt.c_str(), params.c_str(), on_piece, &j, usage);
+    if (rc != 0) {
+        if (!j.stream) return respond_error(fd, rc == -10 ? 503 : 500, "engine error " + std::to_string(rc));
+        j.broken = true;   // headers are out; the best we can do is end the stream
+    }
+    const char* finish = usage[1] >= max_tokens ? "length" : "stop";
+
+    if (j.stream) {
+        if (j.broken) return;
+        if (send_event(j, nullptr, finish)) send_all(fd, std::string("data: [DONE]\n\n"));
+        return;
+    }
+
+    json_value r = jobj();
+    put(r, "id", jstr(j.id));
+    put(r, "object", jstr(chat ? "chat.completion" : "text_completion"));
+    put(r, "created", jnum((double)j.created));
+    put(r, "model", jstr(g_model_id));
+    json_value& choices = put(r, "choices", jarr());
+    json_value ch = jobj();
+    put(ch, "index", jnum(0));
+    if (chat) {
+        json_value& msg = put(ch, "message", jobj());
+        put(msg, "role", jstr("assistant"));
+        put(msg, "content", jstr(j.text));
+    } else {
+        put(ch, "text", jstr(j.text));
+    }
+    put(ch, "finish_reason", jstr(finish));
+    choices.arr.push_back(std::move(ch));
+    json_value& u = put(r, "usage", jobj());
+    put(u, "prompt_tokens", jnum(usage[0]));
+    put(u, "completion_tokens", jnum(usage[1]));
+    put(u, "total_tokens", jnum(usage[0] + usage[1]));
+    respond(fd, 200, dump(r));
+}
+
+void handle_completions(int fd, const json_value& req) {
+    const json_value* pr = req.get("prompt");
+    const json_value* one = pr && pr->is(json_value::ARR) && pr->arr.size() == 1 ? &pr->arr[0] : pr;
+    if (!one || !one->is(json_value::STR)) return respond_error(fd, 400, "prompt must be a string");
+    run_generation(fd, req, one->str, false);
+}
+
+void handle_chat(int fd, const json_value& req) {
+    const json_value* msgs = req.get("messages");
+    if (!msgs || !msgs->is(json_value::ARR) || msgs->arr.empty()) return respond_error(fd, 400, "messages required");
+
+    // content may also be an array of {"type":"text","text":...} parts
+    json_value flat = jarr();
+    for (const auto& m : msgs->arr) {
+        const json_value* role = m.get("role");
+        const json_value* content = m.get("content");
+        if (!role || !role->is(json_value::STR) || !content) return respond_error(fd, 400, "bad message");
+        std::string text;
+        if (content->is(json_value::STR)) text = content->str;
+        for (const auto& part : content->arr) {
+            const json_value* t = part.get("text");
+            if (t && t->is(json_value::STR)) text += t->str;
+        }
+        json_value fm = jobj();
+        put(fm, "role", jstr(role->str));
+        put(fm, "content", jstr(text));
+        flat.arr.push_back(std::move(fm));
+    }
+
+    std::string prompt(64 * 1024, '\0');
+    int rc = llm_chat_prompt(dump(flat).c_str(), &prompt[0], (int)prompt.size());
+    if (rc == -32) {
+        prompt.assign(kMaxBody * 2, '\0');
+        rc = llm_chat_prompt(dump(flat).c_str(), &prompt[0], (int)prompt.size());
+    }
+    if (rc != 0) return respond_error(fd, rc == -3 ? 400 : 500, "cannot apply chat template (" + std::to_string(rc) + ")");
+    prompt.resize(strlen(prompt.c_str()));
+    run_generation(fd, req, prompt, true);
+}
+
+void handle_embeddings(int fd, const json_value& req) {
+    const json_value* in = req.get("input");
+    std::vector<const std::string*> inputs;
+    if (in && in->is(json_value::STR)) inputs.push_back(&in->str);
+    if (in) for (const auto& s : in->arr) if (s.is(json_value::STR)) inputs.push_back(&s.str);
+    if (inputs.empty() || (in->is(json_value::ARR) && inputs.size() != in->arr.size())) {
+        return respond_error(fd, 400, "input must be a string or an array of strings");
+    }
+
+    json_value r = jobj();
+    put(r, "object", jstr("list"));
+    json_value& data = put(r, "data", jarr());
+    const int dim = llm_embed(nullptr, nullptr, 0);
+    if (dim <= 0) return respond_error(fd, dim == -10 ? 503 : 500, "embeddings unavailable (" + std::to_string(dim) + ")");
+    std::vector<float> vec((size_t)dim);
+    long n_tokens = 0;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        const int n = llm_embed(inputs[i]->c_str(), vec.data(), dim);
+        if (n <= 0) return respond_error(fd, n == -10 ? 503 : 500, "embedding failed (" + std::to_string(n) + ")");
+        n_tokens += std::max(0, llm_token_count(inputs[i]->c_str()));
+
+        json_value e = jobj();
+        put(e, "object", jstr("embedding"));
+        put(e, "index", jnum((double)i));
+        json_value& arr = put(e, "embedding", jarr());
+        arr.arr.reserve((size_t)n);
+        for (int k = 0; k < n; ++k) arr.arr.push_back(jnum(vec[(size_t)k], "%.7g"));
+        data.arr.push_back(std::move(e));
+    }
+    put(r, "model", jstr(g_model_id));
+    json_value& u = put(r, "usage", jobj());
+    put(u, "prompt_tokens", jnum((double)n_tokens));
+    put(u, "total_tokens", jnum((double)n_tokens));
+    respond(fd, 200, dump(r));
+}
+
+void handle(int fd, const http_request& req) {
+    if (req.method == "GET" && (req.path == "/health" || req.path == "/v1/health")) {
+        std::string stats(4096, '\0');
+        if (llm_stats(&stats[0], (int)stats.size()) != 0) stats = "{}";
+        stats.resize(strlen(stats.c_str()));
+        return respond(fd, 200, "{\"status\":\"ok\",\"engine\":" + stats + "}");
+    }
+    if (req.method == "GET" && req.path == "/metrics") {
+        std::string text(64 * 1024, '\0');
+        if (llm_metrics(LLM_METRICS_PROMETHEUS, &text[0], (int)text.size()) != 0) {
+            return respond_error(fd, 500, "metrics unavailable");
+        }
+        text.resize(strlen(text.c_str()));
+        return respond(fd, 200, text, "text/plain; version=0.0.4");
+    }
+    if (req.method == "GET" && req.path == "/v1/models") {
+        json_value r = jobj();
+        put(r, "object", jstr("list"));
+        json_value m = jobj();
+        put(m, "id", jstr(g_model_id));
+        put(m, "object", jstr("model"));
+        put(m, "owned_by", jstr("local"));
+        put(r, "data", jarr()).arr.push_back(std::move(m));
+        return respond(fd, 200, dump(r));
+    }
+
+    void (*route)(int, const json_value&) = nullptr;
+    if      (req.path == "/v1/completions")      route = handle_completions;
+    else if (req.path == "/v1/chat/completions") route = handle_chat;
+    else if (req.path == "/v1/embeddings")       route = handle_embeddings;
+    if (!route) return respond_error(fd, 404, "no route for " + req.path);
+    if (req.method != "POST") return respond_error(fd, 405, "use POST");
+
+    json_value body;
+    size_t     err = 0;
+    if (!json_parse(req.body.data(), req.body.size(), body, &err) || !body.is(json_value::OBJ)) {
+        return respond_error(fd, 400, "invalid JSON body at offset " + std::to_string(err));
+    }
+    route(fd, body);
+}
+
+// ---------- worker pool ----------
+struct job { int fd; http_request req; };
+
+std::mutex              g_q_mu;
+std::condition_variable g_q_cv;
+std::deque<job>         g_queue;
+
+void worker() {
+    for (;;) {
+        job jb;
+        {
+            std::unique_lock<std::mutex> lock(g_q_mu);
+            g_q_cv.wait(lock, [] { return g_quit.load() || !g_queue.empty(); });
+            if (g_queue.empty()) return;
+            jb = std::move(g_queue.front());
+            g_queue.pop_front();
+        }
+        fcntl(jb.fd, F_SETFL, fcntl(jb.fd, F_GETFL) & ~O_NONBLOCK);
+        handle(jb.fd, jb.req);
+        shutdown(jb.fd, SHUT_WR);
+        close(jb.fd);
+    }
+}
+
+// ---------- event loop ----------
+struct endpoint {
+    int         fd;
+    bool        listener;
+    std::string buf;
+    bool        continued = false;
+};
+
+int listen_unix(const std::string& path) {
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path)) { fprintf(stderr, "socket path too long\n"); return -1; }
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    unlink(path.c_str());
+    if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+        perror(path.c_str());
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int listen_tcp(int port) {
+    const int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    const int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);   // local tools only
+    if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+        perror("tcp listen");
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void drop(int ep, endpoint* e) {
+    epoll_ctl(ep, EPOLL_CTL_DEL, e->fd, nullptr);
+    close(e->fd);
+    delete e;
+}
+
+void on_readable(int ep, endpoint* e) {
+    char buf[16 * 1024];
+    bool closed = false;   // peer shut its side; it may still wait for the response
+    for (;;) {
+        const ssize_t n = recv(e->fd, buf, sizeof(buf), 0);
+        if (n > 0) { e->buf.append(buf, (size_t)n); continue; }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n < 0) return drop(ep, e);
+        closed = true;
+        break;
+    }
+
+    http_request req;
+    bool needs_continue = false;
+    switch (parse_http(e->buf, req, needs_continue)) {
+        case parse_result::INCOMPLETE:
+            if (closed) return drop(ep, e);   // closed before sending a full request
+            if (needs_continue && !e->continued) {
+                e->continued = true;
+                send_all(e->fd, std::string("HTTP/1.1 100 Continue\r\n\r\n"));
+            }
+            return;
+        case parse_result::BAD:       respond_error(e->fd, 400, "malformed request"); return drop(ep, e);
+        case parse_result::TOO_LARGE: respond_error(e->fd, 413, "request too large"); return drop(ep, e);
+        case parse_result::DONE:      break;
+    }
+
+    // hand the connection to a worker; the loop forgets it
+    epoll_ctl(ep, EPOLL_CTL_DEL, e->fd, nullptr);
+    {
+        std::lock_guard<std::mutex> lock(g_q_mu);
+        g_queue.push_back({e->fd, std::move(req)});
+    }
+    g_q_cv.notify_one();
+    delete e;
+}
+
+void on_signal(int) {
+    g_quit = true;
+    const char c = 'q';
+    if (g_wake_fd >= 0) (void)!write(g_wake_fd, &c, 1);
+}
+
+void usage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s -m model.gguf [--socket PATH] [--port N] [-c n_ctx=2048] [-t threads=4]\n"
+            "          [--workers 4] [--idle seconds]\n"
+            "  default: --socket $XDG_RUNTIME_DIR/llm.sock (or /tmp/llm-$UID.sock); --port listens on 127.0.0.1\n",
+            argv0);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    options o;
+    for (int i = 1; i < argc; ++i) {
+        const std::string a = argv[i];
+        auto next = [&]() -> const char* { return i + 1 < argc ? argv[++i] : nullptr; };
+        const char* v = nullptr;
+        if      (a == "-m" && (v = next()))          o.model       = v;
+        else if (a == "--socket" && (v = next()))    o.socket_path = v;
+        else if (a == "--port" && (v = next()))      o.port        = atoi(v);
+        else if (a == "-c" && (v = next()))          o.n_ctx       = atoi(v);
+        else if (a == "-t" && (v = next()))          o.n_threads   = atoi(v);
+        else if (a == "--workers" && (v = next()))   o.n_workers   = atoi(v);
+        else if (a == "--idle" && (v = next()))      o.idle_s      = atoi(v);
+        else { usage(argv[0]); return 2; }
+    }
+    if (o.model.empty() || o.n_workers < 1) { usage(argv[0]); return 2; }
+    if (o.socket_path.empty() && o.port == 0) {
+        const char* rt = getenv("XDG_RUNTIME_DIR");
+        o.socket_path = rt && *rt ? std::string(rt) + "/llm.sock" : "/tmp/llm-" + std::to_string(getuid()) + ".sock";
+    }
+
+    const size_t slash = o.model.find_last_of('/');
+    g_model_id = slash == std::string::npos ? o.model : o.model.substr(slash + 1);
+
+    if (o.idle_s > 0) llm_set_idle_unload(o.idle_s, 1, nullptr);
+    if (const int rc = llm_init(o.model.c_str(), o.n_ctx, 0, o.n_threads, 0)) {
+        fprintf(stderr, "llm_init failed: %d\n", rc);
+        return 1;
+    }
+
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC | O_NONBLOCK) != 0) { perror("pipe"); return 1; }
+    g_wake_fd = pipefd[1];
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    const int ep = epoll_create1(EPOLL_CLOEXEC);
+    std::vector<int> listeners;
+    if (!o.socket_path.empty()) listeners.push_back(listen_unix(o.socket_path));
+    if (o.port > 0)             listeners.push_back(listen_tcp(o.port));
+    std::vector<endpoint> listen_eps;
+    listen_eps.reserve(listeners.size());
+    for (int fd : listeners) {
+        if (fd < 0) return 1;
+        listen_eps.push_back(endpoint{fd, true, {}, false});
+        epoll_event ev{};
+        ev.events   = EPOLLIN;
+        ev.data.ptr = &listen_eps.back();
+        epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+    }
+    epoll_event wake{};
+    wake.events  = EPOLLIN;
+    wake.data.ptr = nullptr;
+    epoll_ctl(ep, EPOLL_CTL_ADD, pipefd[0], &wake);
+
+    std::vector<std::thread> pool;
+    for (int w = 0; w < o.n_workers; ++w) pool.emplace_back(worker);
+
+    fprintf(stderr, "llm_server: %s on %s%s%s\n", g_model_id.c_str(),
+            o.socket_path.empty() ? "" : o.socket_path.c_str(),
+            (!o.socket_path.empty() && o.port) ? " and " : "",
+            o.port ? ("127.0.0.1:" + std::to_string(o.port)).c_str() : "");
+
+    epoll_event events[64];
+    while (!g_quit) {
+        const int n = epoll_wait(ep, events, 64, -1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) { perror("epoll_wait"); break; }
+        for (int i = 0; i < n; ++i) {
+            endpoint* e = (endpoint*)events[i].data.ptr;
+            if (!e) continue;                    // wake pipe: g_quit is set
+            if (!e->listener) { on_readable(ep, e); continue; }
+            for (;;) {
+                const int c = accept4(e->fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (c < 0) break;
+                epoll_event ev{};
+                ev.events   = EPOLLIN | EPOLLRDHUP;
+                ev.data.ptr = new endpoint{c, false, {}, false};
+                epoll_ctl(ep, EPOLL_CTL_ADD, c, &ev);
+            }
+        }
+    }
+
+    fprintf(stderr, "llm_server: shutting down\n");
+    g_q_cv.notify_all();
+    for (auto& t : pool) t.join();
+    if (!o.socket_path.empty()) unlink(o.socket_path.c_str());
+    llm_dispose();
+    return 0;
+}
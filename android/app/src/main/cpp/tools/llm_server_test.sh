@@ -0,0 +1,112 @@
+#!/usr/bin/env bash
+# llm_server_test.sh — curl checks against a running or freshly started llm_server
+#
+#   tools/llm_server_test.sh build/llm_server model.gguf     # starts its own server
+#   LLM_SOCKET=/run/user/1000/llm.sock tools/llm_server_test.sh   # uses a running one
+#
+# Needs curl. Exit status is the number of failed checks.
+set -u
+
+SERVER=${1:-}
+MODEL=${2:-}
+SOCK=${LLM_SOCKET:-$(mktemp -u /tmp/llm-test-XXXXXX.sock)}
+PID=
+
+if [ -n "$SERVER" ]; then
+  "$SERVER" -m "$MODEL" --socket "$SOCK" --workers 4 2>/tmp/llm_server_test.log &
+  PID=$!
+  trap 'kill $PID 2>/dev/null; wait $PID 2>/dev/null' EXIT
+  for _ in $(seq 1 300); do [ -S "$SOCK" ] && break; sleep 0.1; done
+fi
+[ -S "$SOCK" ] || { echo "no server socket at $SOCK"; exit 1; }
+
+FAILS=0
+pass() { echo "PASS  $1"; }
+fail() { echo "FAIL  $1"; echo "      $2" | head -c 400; echo; FAILS=$((FAILS + 1)); }
+
+# req METHOD PATH [BODY] -> prints "<status>\n<body>"
+req() {
+  if [ $# -ge 3 ]; then
+    curl -s --unix-socket "$SOCK" -X "$1" -H 'Content-Type: application/json' -d "$3" \
+         -w '\n%{http_code}' "http://localhost$2"
+  else
+    curl -s --unix-socket "$SOCK" -X "$1" -w '\n%{http_code}' "http://localhost$2"
+  fi
+}
+
+# check NAME EXPECTED_STATUS PATTERN METHOD PATH [BODY]
+check() {
+  local name=$1 want=$2 pat=$3
+  shift 3
+  local out code
+  out=$(req "$@")
+  code=$(printf '%s' "$out" | tail -n1)
+  if [ "$code" = "$want" ] && printf '%s' "$out" | grep -q -- "$pat"; then pass "$name"; else fail "$name" "$code $out"; fi
+}
+
+check "health"                200 '"status":"ok"'            GET  /health
+check "models"                200 '"object":"model"'         GET  /v1/models
+check "metrics"               200 'llm_requests_total'       GET  /metrics
+check "completion"            200 '"text_completion"'        POST /v1/completions '{"prompt":"Say hi","max_tokens":8}'
+check "completion usage"      200 '"completion_tokens":'     POST /v1/completions '{"prompt":"Say hi","max_tokens":8}'
+check "completion length"     200 '"finish_reason":"length"' POST /v1/completions '{"prompt":"Count: 1 2 3","max_tokens":1}'
+check "chat"                  200 '"role":"assistant"'       POST /v1/chat/completions \
+      '{"messages":[{"role":"system","content":"Be brief."},{"role":"user","content":"Hi"}],"max_tokens":8}'
+check "chat content parts"    200 '"chat.completion"'        POST /v1/chat/completions \
+      '{"messages":[{"role":"user","content":[{"type":"text","text":"Hi"}]}],"max_tokens":4}'
+check "json_object"           200 '"content":"[{\[]'         POST /v1/chat/completions \
+      '{"messages":[{"role":"user","content":"Give a JSON list"}],"max_tokens":32,"response_format":{"type":"json_object"}}'
+check "embeddings"            200 '"embedding":\['           POST /v1/embeddings '{"input":"hello"}'
+check "embeddings batch"      200 '"index":1'                POST /v1/embeddings '{"input":["a","b"]}'
+check "bad json"              400 'invalid JSON'             POST /v1/completions '{"prompt":'
+check "missing prompt"        400 'prompt'                   POST /v1/completions '{"max_tokens":4}'
+check "unknown route"         404 'no route'                 GET  /v1/nothing
+check "wrong method"          405 'POST'                     GET  /v1/completions
+
+# streaming: chunks, then a finish_reason, then [DONE]
+out=$(curl -sN --unix-socket "$SOCK" -H 'Content-Type: application/json' \
+      -d '{"prompt":"Tell a story","max_tokens":16,"stream":true}' http://localhost/v1/completions)
+if printf '%s' "$out" | grep -q '^data: {' && printf '%s' "$out" | tail -n2 | grep -q '^data: \[DONE\]' \
+   && printf '%s' "$out" | grep -q '"finish_reason":"'; then pass "completion stream"; else fail "completion stream" "$out"; fi
+
+out=$(curl -sN --unix-socket "$SOCK" -H 'Content-Type: application/json' \
+      -d '{"messages":[{"role":"user","content":"Hi"}],"max_tokens":16,"stream":true}' http://localhost/v1/chat/completions)
+if printf '%s' "$out" | grep -q '"chat.completion.chunk"' && printf '%s' "$out" | grep -q '"delta":{"role":"assistant"' \
+   && printf '%s' "$out" | grep -q '^data: \[DONE\]'; then pass "chat stream"; else fail "chat stream" "$out"; fi
+
+# a stop word must not leak into the output, streamed or not
+full=$(req POST /v1/completions '{"prompt":"Count: 1 2 3","max_tokens":24}' | head -n1)
+text=$(printf '%s' "$full" | sed -n 's/.*"text":"\([^"]*\)".*/\1/p')
+word=$(printf '%s' "$text" | awk '{print $2}')
+if [ -n "$word" ]; then
+  check "stop word" 200 '"finish_reason":"stop"' POST /v1/completions \
+        "{\"prompt\":\"Count: 1 2 3\",\"max_tokens\":24,\"stop\":[\"$word\"]}"
+  out=$(curl -sN --unix-socket "$SOCK" -H 'Content-Type: application/json' \
+        -d "{\"prompt\":\"Count: 1 2 3\",\"max_tokens\":24,\"stream\":true,\"stop\":\"$word\"}" http://localhost/v1/completions)
+  if printf '%s' "$out" | sed -n 's/.*"text":"\([^"]*\)".*/\1/p' | tr -d '\n' | grep -qF -- "$word"; then
+    fail "stop word stream" "$out"
+  else
+    pass "stop word stream"
+  fi
+fi
+
+# concurrent clients all get answers (they queue on the engine)
+tmp=$(mktemp -d)
+pids=
+for i in 1 2 3 4 5 6; do
+  req POST /v1/completions "{\"prompt\":\"Number $i\",\"max_tokens\":4}" >"$tmp/$i" &
+  pids="$pids $!"
+done
+wait $pids
+ok=0
+for i in 1 2 3 4 5 6; do tail -n1 "$tmp/$i" | grep -q 200 && ok=$((ok + 1)); done
+rm -rf "$tmp"
+if [ "$ok" = 6 ]; then pass "concurrent"; else fail "concurrent" "$ok/6 succeeded"; fi
+
+# a client dropping mid-stream must not wedge the server
+curl -sN --max-time 0.3 --unix-socket "$SOCK" -H 'Content-Type: application/json' \
+     -d '{"prompt":"Write a long essay","max_tokens":256,"stream":true}' http://localhost/v1/completions >/dev/null
+check "after disconnect"      200 '"status":"ok"'            GET  /health
+
+echo "$FAILS failed"
+exit "$FAILS"
@@ -0,0 +1,232 @@
+// llm_stream_check.cpp — spsc_ring / token_stream under real threads, for ThreadSanitizer
+//
+//   llm_stream_check [--pieces 20000] [--ring 256] [--seed 1]
+//
+// No model. Built with -fsanitize=thread by default (LLM_TOOLS_TSAN), so a data race
+// in the ring or the delivery thread fails the run even when the bytes come out right.
+//
+//   ring:    one producer pushes random-sized runs of a counting byte pattern, one
+//            consumer pops; every byte must arrive once, in order, and every pop must
+//            end where a push ended.
+//   streams: a decode-loop stand-in publishes pieces (with a few larger than the ring
+//            and 2- to 4-byte UTF-8) through token_stream for every policy, with a fast
+//            and a slow consumer. Spill and block must deliver the exact text; drop must
+//            deliver a subsequence whose length plus dropped() is the whole.
+//   edge:    a held consumer, a ring filled to within 0..3 bytes, then a 2-, 3- or
+//            4-byte character that has to spill and come out whole.
+//   stop:    a consumer that asks to stop after a few calls; the producer must see it.
+//
+// Every delivered chunk must be whole UTF-8 characters: the app decodes each one.
+//
+// Fails (exit 1) on any mismatch.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../llm_stream.h"
+
+namespace {
+
+struct options {
+    int      pieces = 20000;
+    size_t   ring   = 256;
+    unsigned seed   = 1;
+};
+
+int check_ring(const options& o, std::mt19937& rng) {
+    spsc_ring ring(o.ring);
+    const size_t total = (size_t)o.pieces * 8;
+    std::vector<size_t> ends;   // push boundaries, producer side
+    ends.reserve((size_t)o.pieces * 2);
+    std::vector<size_t> sizes((size_t)o.pieces * 2);
+    for (size_t& s : sizes) s = 1 + rng() % std::min<size_t>(ring.capacity(), 24);
+
+    std::thread producer([&] {
+        std::string run;
+        size_t sent = 0, k = 0;
+        while (sent < total) {
+            const size_t n = std::min(sizes[k++ % sizes.size()], total - sent);
+            run.resize(n);
+            for (size_t i = 0; i < n; ++i) run[i] = (char)((sent + i) % 251);
+            while (!ring.push(run.data(), n)) std::this_thread::yield();
+            sent += n;
+            ends.push_back(sent);
+        }
+    });
+    std::string got, chunk;
+    std::vector<size_t> pops;
+    while (got.size() < total) {
+        chunk.clear();
+        if (ring.pop(chunk) == 0) { std::this_thread::yield(); continue; }
+        got += chunk;
+        pops.push_back(got.size());
+    }
+    producer.join();
+
+    int bad = 0;
+    for (size_t i = 0; i < got.size(); ++i) {
+        if (got[i] != (char)(i % 251)) { fprintf(stderr, "ring: byte %zu out of order\n", i); ++bad; break; }
+    }
+    for (size_t p : pops) {
+        if (!std::binary_search(ends.begin(), ends.end(), p)) { fprintf(stderr, "ring: pop ended inside a push at %zu\n", p); ++bad; break; }
+    }
+    printf("ring     capacity %zu: %zu bytes, %zu pushes, %zu pops %s\n", ring.capacity(), got.size(), ends.size(),
+           pops.size(), bad ? "FAILED" : "ok");
+    return bad;
+}
+
+const char* const kChars[] = {"\xC3\xA9", "\xE2\x82\xAC", "\xF0\x9F\x99\x82"};   // é € 🙂
+
+// Whether p[0..n) is a run of complete UTF-8 sequences.
+bool utf8_whole(const char* p, int n) {
+    for (int i = 0; i < n;) {
+        const uint8_t c = (uint8_t)p[i];
+        const int len = c < 0x80 ? 1 : c >= 0xF8 ? 0 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 0;
+        if (len == 0 || i + len > n) return false;
+        for (int k = 1; k < len; ++k) if (((uint8_t)p[i + k] & 0xC0) != 0x80) return false;
+        i += len;
+    }
+    return true;
+}
+
+struct sink {
+    std::string       got;
+    int               calls      = 0;
+    int               split      = 0;       // chunks ending or starting inside a character
+    int               stop_after = -1;
+    int               slow_us    = 0;
+    std::atomic<bool>* gate      = nullptr;  // held until set
+    std::atomic<bool>  held{false};
+};
+
+int on_piece(const char* p, int n, void* user) {
+    sink& s = *(sink*)user;
+    if (s.gate) {
+        s.held.store(true);
+        while (!s.gate->load()) std::this_thread::yield();
+    }
+    if (!utf8_whole(p, n)) ++s.split;
+    s.got.append(p, (size_t)n);
+    ++s.calls;
+    if (s.slow_us) std::this_thread::sleep_for(std::chrono::microseconds(s.slow_us));
+    return s.stop_after >= 0 && s.calls >= s.stop_after ? 1 : 0;
+}
+
+const char* policy_name(stream_policy p) {
+    return p == STREAM_SPILL ? "spill" : p == STREAM_BLOCK ? "block" : "drop";
+}
+
+int check_streams(const options& o, std::mt19937& rng) {
+    int bad = 0;
+    for (stream_policy pol : {STREAM_SPILL, STREAM_BLOCK, STREAM_DROP}) {
+        for (int slow_us : {0, 200}) {
+            sink s;
+            s.slow_us = slow_us;
+            std::string sent;
+            token_stream ts(o.ring, pol, on_piece, &s);
+            for (int i = 0; i < o.pieces; ++i) {
+                std::string piece;
+                const int n = 1 + (int)(rng() % (i % 997 == 0 ? 600 : 6));
+                for (int k = 0; k < n; ++k) piece += (char)('a' + (i + k) % 26);
+                if (i % 50 == 0) piece += kChars[(size_t)(i / 50) % 3];
+                sent += piece;
+                ts.publish(piece.data(), piece.size());
+            }
+            ts.close();
+            bool ok;
+            if (pol == STREAM_DROP) {
+                // what arrived is the text with whole pieces missing
+                size_t j = 0;
+                for (size_t i = 0; i < sent.size() && j < s.got.size(); ++i) if (sent[i] == s.got[j]) ++j;
+                ok = j == s.got.size() && s.got.size() + ts.dropped() == sent.size();
+            } else {
+                ok = s.got == sent;
+            }
+            ok = ok && s.split == 0;
+            printf("stream   %-5s %s consumer: %6d calls, %d split, dropped %llu, spill peak %zu %s\n",
+                   policy_name(pol), slow_us ? "slow" : "fast", s.calls, s.split, (unsigned long long)ts.dropped(),
+                   ts.spill_peak(), ok ? "ok" : "FAILED");
+            if (!ok) ++bad;
+        }
+    }
+    return bad;
+}
+
+// The consumer holds the first byte while the ring fills up to `room` bytes short, so the
+// character after it spills and is flushed into a ring with less room than it needs.
+int check_edge() {
+    int bad = 0;
+    for (const char* ch : kChars) {
+        for (size_t room = 0; room < 4; ++room) {
+            std::atomic<bool> gate{false};
+            sink s;
+            s.gate = &gate;
+            std::string sent = "a";
+            token_stream ts(256, STREAM_SPILL, on_piece, &s);
+            ts.publish("a", 1);
+            while (!s.held.load()) std::this_thread::yield();
+            const std::string fill(256 - room, 'b');
+            sent += fill + ch + "x";
+            ts.publish(fill.data(), fill.size());
+            ts.publish(ch, strlen(ch));
+            ts.publish("x", 1);
+            gate.store(true);
+            ts.close();
+            if (s.got != sent || s.split != 0) {
+                fprintf(stderr, "edge: %zu-byte character with %zu bytes free: %d split chunks%s\n", strlen(ch), room,
+                        s.split, s.got == sent ? "" : ", text differs");
+                ++bad;
+            }
+        }
+    }
+    printf("edge     characters into a nearly full ring %s\n", bad ? "FAILED" : "ok");
+    return bad;
+}
+
+int check_stop() {
+    sink s;
+    s.stop_after = 3;
+    s.slow_us    = 100;
+    token_stream ts(256, STREAM_BLOCK, on_piece, &s);
+    int i = 0;
+    for (; i < 100000 && !ts.publish("xyz", 3); ++i) {}
+    ts.close();
+    const bool ok = i < 100000 && s.calls >= 3;
+    printf("stop     producer noticed after %d pieces, %d calls %s\n", i, s.calls, ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+void usage(const char* argv0) {
+    fprintf(stderr, "usage: %s [--pieces 20000] [--ring 256] [--seed 1]\n", argv0);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    options o;
+    for (int i = 1; i < argc; ++i) {
+        const std::string a = argv[i];
+        auto next = [&]() -> const char* { return i + 1 < argc ? argv[++i] : nullptr; };
+        const char* v = nullptr;
+        if      (a == "--pieces" && (v = next()))  o.pieces = atoi(v);
+        else if (a == "--ring" && (v = next()))    o.ring   = (size_t)atol(v);
+        else if (a == "--seed" && (v = next()))    o.seed   = (unsigned)atoi(v);
+        else { usage(argv[0]); return 2; }
+    }
+    if (o.pieces < 1 || o.ring < 16) { usage(argv[0]); return 2; }
+
+    std::mt19937 rng(o.seed);
+    int bad = check_ring(o, rng);
+    bad += check_streams(o, rng);
+    bad += check_edge();
+    bad += check_stop();
+    return bad ? 1 : 0;
+}
@@ -0,0 +1,237 @@
+// llm_stress.cpp — concurrency stress for the bridge's locking
+//
+//   llm_stress -m model.gguf [-c 2048] [-t 4] [--gen 2] [--query 4] [--seconds 20]
+//              [--deadline-ms 60000] [--max-query-ms 25]
+//
+// Two phases against one engine. First the query threads run alone (baseline), then
+// again while generation threads keep long greedy generations going and a churn thread
+// opens, uses, forks and closes sessions. Query threads call the read-only entry points
+// (llm_stats, llm_model_info, llm_token_count, llm_metrics, llm_chat_prompt) in a loop
+// and record per-call latency.
+//
+// Fails (exit 1) when:
+//   - any call takes longer than --deadline-ms (reported by a watchdog as a probable
+//     deadlock, then the process exits at once with status 2),
+//   - a query returns an error,
+//   - the loaded query p99 exceeds --max-query-ms, i.e. readers queued behind decoding,
+//   - generation or session churn made no progress.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "../llm_bridge.h"
+
+namespace {
+
+struct options {
+    std::string model;
+    int n_ctx        = 2048;
+    int n_threads    = 4;
+    int n_gen        = 2;
+    int n_query      = 4;
+    int seconds      = 20;
+    int deadline_ms  = 60000;
+    int max_query_ms = 25;
+};
+
+int64_t now_ns() {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// One per worker thread: when the current call started (0 = between calls).
+struct slot {
+    const char*          role = "";
+    std::atomic<int64_t> since{0};
+    std::atomic<const char*> what{""};
+};
+
+struct call_scope {
+    slot& s;
+    call_scope(slot& sl, const char* what) : s(sl) { s.what = what; s.since = now_ns(); }
+    ~call_scope() { s.since = 0; }
+};
+
+std::atomic<bool>     g_stop{false};
+std::atomic<bool>     g_joined{false};    // watchdog keeps going until the workers are joined
+std::atomic<int>      g_errors{0};
+std::atomic<uint64_t> g_generations{0};
+std::atomic<uint64_t> g_churns{0};
+
+struct latencies {
+    std::mutex          mu;
+    std::vector<double> ms;
+    void add(const std::vector<double>& v) {
+        std::lock_guard<std::mutex> lock(mu);
+        ms.insert(ms.end(), v.begin(), v.end());
+    }
+    double pct(double p) {
+        if (ms.empty()) return 0;
+        std::sort(ms.begin(), ms.end());
+        return ms[std::min(ms.size() - 1, (size_t)(p * (double)ms.size()))];
+    }
+};
+
+void query_loop(slot& sl, latencies& out, int seed) {
+    std::vector<double> mine;
+    std::vector<char>   buf(64 * 1024);
+    const std::string   text = "The quick brown fox jumps over the lazy dog, " + std::to_string(seed);
+    const char*         chat = "[{\"role\":\"user\",\"content\":\"How far is the moon?\"}]";
+    for (int i = 0; !g_stop; ++i) {
+        int rc = 0;
+        const int64_t t0 = now_ns();
+        switch (i % 5) {
+        case 0: { call_scope c(sl, "llm_stats");       rc = llm_stats(buf.data(), (int)buf.size()); break; }
+        case 1: { call_scope c(sl, "llm_model_info");  rc = llm_model_info(nullptr, buf.data(), (int)buf.size()); break; }
+        case 2: { call_scope c(sl, "llm_token_count"); rc = llm_token_count(text.c_str()) > 0 ? 0 : -1; break; }
+        case 3: { call_scope c(sl, "llm_metrics");     rc = llm_metrics(LLM_METRICS_JSON, buf.data(), (int)buf.size()); break; }
+        case 4: { call_scope c(sl, "llm_chat_prompt"); rc = llm_chat_prompt(chat, buf.data(), (int)buf.size()); break; }
+        }
+        mine.push_back((double)(now_ns() - t0) / 1e6);
+        if (rc < 0) {
+            fprintf(stderr, "query %d failed: %d\n", i % 5, rc);
+            ++g_errors;
+        }
+    }
+    out.add(mine);
+}
+
+void gen_loop(slot& sl, int seed) {
+    std::vector<char> buf(16 * 1024);
+    for (int i = 0; !g_stop; ++i) {
+        // distinct prompts and no coalescing: every request really decodes
+        const std::string prompt = "Write a long story about lighthouse keeper number " +
+                                   std::to_string(seed * 100000 + i) + ".";
+        call_scope c(sl, "llm_infer");
+        const int rc = llm_infer(prompt.c_str(), "{\"max_tokens\":256,\"coalesce\":0}", buf.data(), (int)buf.size());
+        if (rc != 0) { fprintf(stderr, "generation failed: %d\n", rc); ++g_errors; continue; }
+        ++g_generations;
+    }
+}
+
+void churn_loop(slot& sl) {
+    std::vector<char> buf(4096);
+    for (int i = 0; !g_stop; ++i) {
+        int sid = 0;
+        { call_scope c(sl, "llm_session_open"); sid = llm_session_open(); }
+        if (sid == -40) { usleep(1000); continue; }   // all sequences busy: fine
+        if (sid < 0) { fprintf(stderr, "session_open failed: %d\n", sid); ++g_errors; continue; }
+
+        const std::string params = "{\"max_tokens\":8,\"coalesce\":0,\"session\":" + std::to_string(sid) + "}";
+        int rc = 0;
+        { call_scope c(sl, "llm_infer(session)"); rc = llm_infer("Say hi.", params.c_str(), buf.data(), (int)buf.size()); }
+        if (rc != 0) { fprintf(stderr, "session infer failed: %d\n", rc); ++g_errors; }
+
+        int fork = 0;
+        { call_scope c(sl, "llm_session_fork"); fork = llm_session_fork(sid); }
+        if (fork > 0) { call_scope c(sl, "llm_session_close"); llm_session_close(fork); }
+        { call_scope c(sl, "llm_session_close"); rc = llm_session_close(sid); }
+        if (rc != 0) { fprintf(stderr, "session_close failed: %d\n", rc); ++g_errors; }
+        ++g_churns;
+    }
+}
+
+void watchdog(std::vector<slot>& slots, int deadline_ms) {
+    while (!g_joined) {
+        usleep(100 * 1000);
+        const int64_t now = now_ns();
+        for (slot& s : slots) {
+            const int64_t since = s.since;
+            if (since && (now - since) / 1000000 > deadline_ms) {
+                fprintf(stderr, "FAIL  %s thread stuck in %s for %lld ms: probable deadlock\n",
+                        s.role, s.what.load(), (long long)((now - since) / 1000000));
+                fflush(stderr);
+                _exit(2);
+            }
+        }
+    }
+}
+
+// Runs the query threads (and optionally the load) for `seconds`.
+void phase(const options& o, bool loaded, latencies& lat) {
+    std::vector<slot> slots((size_t)(o.n_query + (loaded ? o.n_gen + 1 : 0)));
+    std::vector<std::thread> th;
+    g_stop   = false;
+    g_joined = false;
+    size_t k = 0;
+    for (int i = 0; i < o.n_query; ++i, ++k) {
+        slots[k].role = "query";
+        th.emplace_back(query_loop, std::ref(slots[k]), std::ref(lat), i);
+    }
+    if (loaded) {
+        for (int i = 0; i < o.n_gen; ++i, ++k) {
+            slots[k].role = "generation";
+            th.emplace_back(gen_loop, std::ref(slots[k]), i);
+        }
+        slots[k].role = "session";
+        th.emplace_back(churn_loop, std::ref(slots[k]));
+    }
+    std::thread wd(watchdog, std::ref(slots), o.deadline_ms);
+    sleep((unsigned)o.seconds);
+    g_stop = true;
+    for (auto& t : th) t.join();
+    g_joined = true;
+    wd.join();
+}
+
+bool parse(int argc, char** argv, options& o) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string a = argv[i];
+        auto next = [&]() -> const char* { return i + 1 < argc ? argv[++i] : nullptr; };
+        const char* v = nullptr;
+        if      (a == "-m")             { if (!(v = next())) return false; o.model = v; }
+        else if (a == "-c")             { if (!(v = next())) return false; o.n_ctx = atoi(v); }
+        else if (a == "-t")             { if (!(v = next())) return false; o.n_threads = atoi(v); }
+        else if (a == "--gen")          { if (!(v = next())) return false; o.n_gen = atoi(v); }
+        else if (a == "--query")        { if (!(v = next())) return false; o.n_query = atoi(v); }
+        else if (a == "--seconds")      { if (!(v = next())) return false; o.seconds = atoi(v); }
+        else if (a == "--deadline-ms")  { if (!(v = next())) return false; o.deadline_ms = atoi(v); }
+        else if (a == "--max-query-ms") { if (!(v = next())) return false; o.max_query_ms = atoi(v); }
+        else return false;
+    }
+    return !o.model.empty() && o.n_gen > 0 && o.n_query > 0 && o.seconds > 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    options o;
+    if (!parse(argc, argv, o)) {
+        fprintf(stderr, "usage: llm_stress -m model.gguf [-c 2048] [-t 4] [--gen 2] [--query 4] [--seconds 20]\n"
+                        "                  [--deadline-ms 60000] [--max-query-ms 25]\n");
+        return 1;
+    }
+    if (const int rc = llm_init(o.model.c_str(), o.n_ctx, 0, o.n_threads, 0)) {
+        fprintf(stderr, "llm_init failed: %d\n", rc);
+        return 1;
+    }
+
+    latencies idle, busy;
+    phase(o, false, idle);
+    phase(o, true, busy);
+    llm_dispose();
+
+    const double i50 = idle.pct(0.50), i99 = idle.pct(0.99);
+    const double b50 = busy.pct(0.50), b99 = busy.pct(0.99), bmax = busy.pct(1.0);
+    printf("queries alone:           %8zu calls  p50 %.3f ms  p99 %.3f ms\n", idle.ms.size(), i50, i99);
+    printf("queries under generation:%8zu calls  p50 %.3f ms  p99 %.3f ms  max %.3f ms\n", busy.ms.size(), b50, b99, bmax);
+    printf("generations %llu, session cycles %llu, errors %d\n",
+           (unsigned long long)g_generations.load(), (unsigned long long)g_churns.load(), g_errors.load());
+
+    int fails = 0;
+    if (g_errors)                 { printf("FAIL  %d call(s) returned an error\n", g_errors.load()); ++fails; }
+    if (b99 > o.max_query_ms)     { printf("FAIL  query p99 %.3f ms under generation > %d ms\n", b99, o.max_query_ms); ++fails; }
+    if (g_generations == 0)       { printf("FAIL  no generation completed\n"); ++fails; }
+    if (g_churns == 0)            { printf("FAIL  no session open/infer/close cycle completed\n"); ++fails; }
+    if (!fails) printf("PASS\n");
+    return fails ? 1 : 0;
+}
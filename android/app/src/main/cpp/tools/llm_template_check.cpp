@@ -0,0 +1,183 @@
+// llm_template_check.cpp — spliced template tokens vs. the filled-in text tokenized whole
+//
+//   llm_template_check -m model.gguf [--template file.txt] [--fills 500] [--seed 1]
+//
+// Compiles prompt templates against the model's vocab (llm_template.h) and fills their
+// slots with random values built from the text a slot value tends to start or end with:
+// letters, digits, spaces, newlines, punctuation, multi-byte UTF-8. Every fill is
+// rendered by splicing and compared with the filled-in text tokenized in one call.
+// Values whose text holds (or completes) a special token are skipped: only the whole
+// tokenization would parse it, splicing keeps it plain by design. A fill whose spliced
+// tokens lack a special token of the static parts is a mismatch either way. Templates are the
+// model's chat template with {{system}} and {{user}} slots plus a few plain ones, or
+// the one given with --template.
+//
+// One line per template: fills, skipped fills, mismatches and precomputed tokens; the
+// first few mismatches are printed with their values. Exit 1 on any mismatch.
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "llama.h"
+#include "../llm_template.h"
+
+namespace {
+
+struct options {
+    std::string model_path;
+    std::string template_path;
+    int         fills = 500;
+    unsigned    seed  = 1;
+};
+
+// What random values are made of.
+const char* const kBits[] = {
+    "a", "e", "Z", "x", "the", "ing", "1", "9", "42", " ", " x", "  ", "\n", "\n\n", "\t",
+    ".", ",", ":", ";", "\"", "'", "(", ")", "-", "_", "/", "{", "}", "[", "]", "<", ">",
+    "\xC3\xA9", "\xE0\xA6\x95", "\xF0\x9F\x99\x82", ":\n", ".\n", "'s", "http://", "#",
+};
+
+std::vector<llama_token> tokenize(const llama_vocab* vocab, const std::string& s) {
+    int32_t n = -llama_tokenize(vocab, s.data(), (int32_t)s.size(), nullptr, 0, true, true);
+    std::vector<llama_token> out((size_t)std::max(n, 0));
+    n = llama_tokenize(vocab, s.data(), (int32_t)s.size(), out.data(), (int32_t)out.size(), true, true);
+    out.resize((size_t)std::max(n, 0));
+    return out;
+}
+
+// A static part on its own, special tokens parsed.
+std::vector<llama_token> tokenize_part(const llama_vocab* vocab, const std::string& s) {
+    int32_t n = -llama_tokenize(vocab, s.data(), (int32_t)s.size(), nullptr, 0, false, true);
+    std::vector<llama_token> out((size_t)std::max(n, 0));
+    n = llama_tokenize(vocab, s.data(), (int32_t)s.size(), out.data(), (int32_t)out.size(), false, true);
+    out.resize((size_t)std::max(n, 0));
+    return out;
+}
+
+size_t n_control(const llama_vocab* vocab, const std::vector<llama_token>& v) {
+    return (size_t)std::count_if(v.begin(), v.end(), [&](llama_token t) { return llama_vocab_is_control(vocab, t); });
+}
+
+std::string random_value(std::mt19937& rng) {
+    std::string v;
+    const int n = (int)(rng() % 7);
+    for (int i = 0; i < n; ++i) v += kBits[rng() % (sizeof(kBits) / sizeof(kBits[0]))];
+    return v;
+}
+
+std::string chat_template(const llama_model* model) {
+    const char* tmpl = llama_model_chat_template(model, nullptr);
+    if (!tmpl) return "";
+    const llama_chat_message msgs[2] = {{"system", "{{system}}"}, {"user", "{{user}}"}};
+    std::vector<char> buf(4096);
+    int32_t n = llama_chat_apply_template(tmpl, msgs, 2, true, buf.data(), (int32_t)buf.size());
+    if (n > (int32_t)buf.size()) {
+        buf.resize((size_t)n);
+        n = llama_chat_apply_template(tmpl, msgs, 2, true, buf.data(), (int32_t)buf.size());
+    }
+    return n > 0 ? std::string(buf.data(), (size_t)n) : "";
+}
+
+// Returns the number of mismatching fills.
+int check(const llama_vocab* vocab, const std::string& name, const std::string& text, const options& o,
+          std::mt19937& rng) {
+    prompt_template t;
+    std::string err;
+    if (!template_compile(vocab, text, t, err)) {
+        fprintf(stderr, "%s: %s\n", name.c_str(), err.c_str());
+        return 1;
+    }
+    size_t n_static = n_control(vocab, tokenize(vocab, ""));   // BOS / EOS
+    for (const prompt_template::part& p : t.parts)
+        if (p.slot.empty()) n_static += n_control(vocab, tokenize_part(vocab, p.text));
+    int skipped = 0, bad = 0;
+    size_t total = 0;
+    std::map<std::string, std::string> values;
+    const slot_lookup lookup = [&](const std::string& s) { return &values[s]; };
+    for (int f = 0; f < o.fills; ++f) {
+        for (const std::string& s : t.slots) values[s] = random_value(rng);
+        std::vector<llama_token> spliced;
+        std::string filled;
+        if (!template_render(vocab, t, lookup, spliced, err) || !template_text(t, lookup, filled, err)) {
+            ++skipped;   // refused: a value holds special token text
+            continue;
+        }
+        const std::vector<llama_token> whole = tokenize(vocab, filled);
+        const bool lost = n_control(vocab, spliced) < n_static;   // static special tokens gone plain
+        if (!lost && n_control(vocab, whole) != n_control(vocab, spliced)) { ++skipped; continue; }
+        total += whole.size();
+        if (!lost && spliced == whole) continue;
+        if (++bad <= 3) {
+            fprintf(stderr, "%s: mismatch (%zu vs %zu tokens%s) for", name.c_str(), spliced.size(), whole.size(),
+                    lost ? ", special tokens lost" : "");
+            for (const auto& v : values) fprintf(stderr, " %s=\"%s\"", v.first.c_str(), v.second.c_str());
+            fprintf(stderr, "\n");
+        }
+    }
+    const int checked = o.fills - skipped;
+    printf("%-12s %7s %6d %8d %8d %10zu %10.1f\n", name.c_str(), t.spliced ? "yes" : "no", o.fills, skipped, bad,
+           t.static_tokens, checked > 0 ? (double)total / checked : 0.0);
+    return bad;
+}
+
+void usage(const char* argv0) {
+    fprintf(stderr, "usage: %s -m model.gguf [--template file.txt] [--fills 500] [--seed 1]\n", argv0);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    options o;
+    for (int i = 1; i < argc; ++i) {
+        const std::string a = argv[i];
+        auto next = [&]() -> const char* { return i + 1 < argc ? argv[++i] : nullptr; };
+        const char* v = nullptr;
+        if      (a == "-m" && (v = next()))          o.model_path    = v;
+        else if (a == "--template" && (v = next()))  o.template_path = v;
+        else if (a == "--fills" && (v = next()))     o.fills         = atoi(v);
+        else if (a == "--seed" && (v = next()))      o.seed          = (unsigned)atoi(v);
+        else { usage(argv[0]); return 2; }
+    }
+    if (o.model_path.empty() || o.fills < 1) { usage(argv[0]); return 2; }
+
+    std::vector<std::pair<std::string, std::string>> templates;
+    if (!o.template_path.empty()) {
+        std::ifstream in(o.template_path, std::ios::binary);
+        if (!in) { fprintf(stderr, "cannot read %s\n", o.template_path.c_str()); return 1; }
+        std::stringstream ss;
+        ss << in.rdbuf();
+        templates.emplace_back("file", ss.str());
+    }
+
+    llama_backend_init();
+    llama_model_params mp = llama_model_default_params();
+    mp.vocab_only = true;
+    llama_model* model = llama_model_load_from_file(o.model_path.c_str(), mp);
+    if (!model) { fprintf(stderr, "failed to load %s\n", o.model_path.c_str()); return 1; }
+    const llama_vocab* vocab = llama_model_get_vocab(model);
+
+    if (templates.empty()) {
+        const std::string chat = chat_template(model);
+        if (!chat.empty()) templates.emplace_back("chat", chat);
+        templates.emplace_back("summarize", "Summarize the following text.\n\n{{text}}\n\nSummary:");
+        templates.emplace_back("qa", "Q: {{question}}\nA:");
+        templates.emplace_back("adjacent", "{{a}}{{b}} and {{c}}.");
+    }
+
+    std::mt19937 rng(o.seed);
+    int bad = 0;
+    printf("%-12s %7s %6s %8s %8s %10s %10s\n", "template", "spliced", "fills", "skipped", "mismatch", "static tok",
+           "avg tok");
+    for (const auto& t : templates) bad += check(vocab, t.first, t.second, o, rng);
+
+    llama_model_free(model);
+    llama_backend_free();
+    return bad ? 1 : 0;
+}
@@ -0,0 +1,309 @@
+// lib/geo.dart
+import 'dart:ffi';
+import 'dart:io';
+import 'dart:math';
+import 'dart:typed_data';
+import 'package:ffi/ffi.dart';
+
+import 'package:llm_model/location_service.dart';
+
+/// Location history packed for the native geo kernels: (t, lat, lng) triples of
+/// unix seconds and degrees, oldest first.
+class GeoSeries {
+  static Float64List pack(List<Coord> coords) {
+    final sorted = List<Coord>.from(coords)..sort((a, b) => a.ts.compareTo(b.ts));
+    final out = Float64List(sorted.length * 3);
+    for (var i = 0; i < sorted.length; i++) {
+      final c = sorted[i];
+      out[3 * i] = c.ts.millisecondsSinceEpoch / 1000.0;
+      out[3 * i + 1] = c.lat;
+      out[3 * i + 2] = c.lng;
+    }
+    return out;
+  }
+}
+
+/// Per-bucket aggregates; every column is a flat typed array with one value per bucket.
+class GeoBuckets {
+  GeoBuckets._(this.start, this.bucket, this.used, Float32List all, int n, [this.places = const []])
+      : distM = Float32List.sublistView(all, 0 * n, 1 * n),
+        movingS = Float32List.sublistView(all, 1 * n, 2 * n),
+        stillS = Float32List.sublistView(all, 2 * n, 3 * n),
+        rogM = Float32List.sublistView(all, 3 * n, 4 * n),
+        points = Float32List.sublistView(all, 4 * n, 5 * n);
+
+  final DateTime start;
+  final Duration bucket;
+  /// Points that fell inside the buckets.
+  final int used;
+  final Float32List distM;
+  final Float32List movingS;
+  final Float32List stillS;
+  /// Radius of gyration: how spread out the bucket's points are.
+  final Float32List rogM;
+  final Float32List points;
+  /// Where each bucket's middle fix was (see [Geo.label]); empty without a place index.
+  final List<String> places;
+
+  int get length => distM.length;
+
+  /// One line per non-empty bucket, compact enough for an LLM prompt.
+  String describe() {
+    final b = StringBuffer();
+    for (var i = 0; i < length; i++) {
+      if (points[i] == 0 && distM[i] == 0) continue;
+      final t = start.add(bucket * i).toLocal();
+      final hh = t.hour.toString().padLeft(2, '0'), mm = t.minute.toString().padLeft(2, '0');
+      b.writeln('${t.month}/${t.day} $hh:$mm '
+          '${(distM[i] / 1000).toStringAsFixed(1)} km, '
+          'moving ${(movingS[i] / 60).round()} min, still ${(stillS[i] / 60).round()} min, '
+          'radius ${rogM[i].round()} m'
+          '${i < places.length && places[i].isNotEmpty ? ', ${places[i]}' : ''}');
+    }
+    return b.toString();
+  }
+}
+
+/// A map marker: one fix ([count] 1, [id] its index in the packed series) or a
+/// cluster of [count] fixes drawn at their centroid.
+class GeoMarker {
+  const GeoMarker(this.lat, this.lng, this.count, this.id);
+  final double lat;
+  final double lng;
+  final int count;
+  final int id;
+}
+
+/// A named place from the offline index and how far it is from the query point.
+class GeoPlace {
+  const GeoPlace(this.name, this.distM);
+  /// "Name, CC".
+  final String name;
+  final double distM;
+}
+
+/// Native aggregation over location history (llm_geo_* in llm_bridge.h).
+class Geo {
+  Geo._() {
+    bool resolve(DynamicLibrary lib) {
+      try {
+        _aggregate = lib
+            .lookup<NativeFunction<Int32 Function(Pointer<Double>, Int32, Double, Double, Int32, Double, Double, Pointer<Float>, Int32)>>('llm_geo_aggregate')
+            .asFunction();
+        _indexBuild = lib
+            .lookup<NativeFunction<Int32 Function(Pointer<Double>, Int32, Int32, Int32)>>('llm_geo_index_build')
+            .asFunction();
+        _clusters = lib
+            .lookup<NativeFunction<Int32 Function(Double, Double, Double, Double, Int32, Pointer<Double>, Int32)>>('llm_geo_clusters')
+            .asFunction();
+        _polyline = lib
+            .lookup<NativeFunction<Int32 Function(Double, Double, Double, Double, Int32, Pointer<Double>, Int32)>>('llm_geo_polyline')
+            .asFunction();
+        _placesBuild = lib
+            .lookup<NativeFunction<Int32 Function(Pointer<Utf8>, Pointer<Utf8>, Int32)>>('llm_places_build')
+            .asFunction();
+        _placesOpen = lib.lookup<NativeFunction<Int32 Function(Pointer<Utf8>)>>('llm_places_open').asFunction();
+        _placesNearest = lib
+            .lookup<NativeFunction<Int32 Function(Double, Double, Int32, Pointer<Utf8>, Int32, Pointer<Float>)>>('llm_places_nearest')
+            .asFunction();
+        return true;
+      } catch (_) {
+        return false;
+      }
+    }
+
+    try {
+      _ok = resolve(DynamicLibrary.process());
+    } catch (_) {}
+    if (!_ok) {
+      try {
+        _ok = resolve(DynamicLibrary.open(Platform.isAndroid ? 'libllama_android.so' : 'libllama.so'));
+      } catch (_) {}
+    }
+  }
+  static final Geo I = Geo._();
+
+  // C: int llm_geo_aggregate(pts, n, t0, bucketS, nBuckets, stillMps, maxGapS, float* out, int outLen)
+  late final int Function(Pointer<Double>, int, double, double, int, double, double, Pointer<Float>, int) _aggregate;
+  // C: int llm_geo_index_build(pts, n, radiusPx, maxZoom)
+  late final int Function(Pointer<Double>, int, int, int) _indexBuild;
+  // C: int llm_geo_clusters / llm_geo_polyline(west, south, east, north, zoom, double* out, int max)
+  late final int Function(double, double, double, double, int, Pointer<Double>, int) _clusters, _polyline;
+  // C: int llm_places_build(gazetteerPath, indexPath, minPopulation) / llm_places_open(indexPath)
+  late final int Function(Pointer<Utf8>, Pointer<Utf8>, int) _placesBuild;
+  late final int Function(Pointer<Utf8>) _placesOpen;
+  // C: int llm_places_nearest(lat, lng, k, char* out, int outSize, float* distM)
+  late final int Function(double, double, int, Pointer<Utf8>, int, Pointer<Float>) _placesNearest;
+  bool _ok = false;
+  bool _places = false;
+
+  // Query output, kept between calls: the map queries on every camera move.
+  Pointer<Double> _buf = nullptr;
+  int _bufLen = 0;
+
+  Pointer<Double> _scratch(int len) {
+    if (len > _bufLen) {
+      if (_bufLen > 0) malloc.free(_buf);
+      _buf = malloc<Double>(len);
+      _bufLen = len;
+    }
+    return _buf;
+  }
+
+  /// False when the native library is missing; the methods then return empty buckets.
+  bool get available => _ok;
+
+  static const _columns = 5; // LLM_GEO_COLUMNS
+
+  /// [buckets] buckets of [bucket] from [start] over a [GeoSeries.pack]ed series.
+  /// Segments slower than [stillMps] count as stationary; gaps longer than [maxGap]
+  /// add distance but no time.
+  GeoBuckets aggregate(Float64List series,
+      {required DateTime start,
+      Duration bucket = const Duration(hours: 1),
+      int buckets = 24,
+      double stillMps = 0.5,
+      Duration maxGap = const Duration(minutes: 15)}) {
+    final all = Float32List(buckets > 0 ? buckets * _columns : 0);
+    if (!_ok || buckets <= 0) return GeoBuckets._(start, bucket, 0, all, all.length ~/ _columns);
+
+    final n = series.length ~/ 3;
+    final pts = malloc<Double>(series.isEmpty ? 1 : series.length);
+    final out = malloc<Float>(all.length);
+    try {
+      pts.asTypedList(series.length).setAll(0, series);
+      final rc = _aggregate(pts, n, start.millisecondsSinceEpoch / 1000.0, bucket.inMilliseconds / 1000.0,
+          buckets, stillMps, maxGap.inMilliseconds / 1000.0, out, all.length);
+      if (rc < 0) throw Exception('llm_geo_aggregate failed (rc=$rc)');
+      all.setAll(0, out.asTypedList(all.length));
+      return GeoBuckets._(start, bucket, rc, all, buckets, _bucketPlaces(series, start, bucket, buckets));
+    } finally {
+      malloc
+        ..free(pts)
+        ..free(out);
+    }
+  }
+
+  /// Builds the map index over a [GeoSeries.pack]ed series, replacing the previous one:
+  /// markers clustered within [radiusPx] per zoom up to [maxZoom], and the track simplified
+  /// per zoom. Returns false when the native library is missing.
+  bool buildIndex(Float64List series, {int radiusPx = 60, int maxZoom = 18}) {
+    if (!_ok) return false;
+    final pts = malloc<Double>(series.isEmpty ? 1 : series.length);
+    try {
+      pts.asTypedList(series.length).setAll(0, series);
+      final rc = _indexBuild(pts, series.length ~/ 3, radiusPx, maxZoom);
+      if (rc < 0) throw Exception('llm_geo_index_build failed (rc=$rc)');
+      return true;
+    } finally {
+      malloc.free(pts);
+    }
+  }
+
+  /// Markers inside the box (degrees) at [zoom], at most [limit] of them.
+  List<GeoMarker> clusters(double west, double south, double east, double north, int zoom, {int limit = 2000}) {
+    if (!_ok || limit <= 0) return const [];
+    final out = _scratch(limit * 4);
+    final n = min(_clusters(west, south, east, north, zoom, out, limit), limit);
+    final v = out.asTypedList(n * 4);
+    return [for (var i = 0; i < n; i++) GeoMarker(v[4 * i], v[4 * i + 1], v[4 * i + 2].toInt(), v[4 * i + 3].toInt())];
+  }
+
+  /// The simplified track inside the box at [zoom] as separate runs of (lat, lng) pairs,
+  /// at most [limit] pairs in all.
+  List<Float64List> polyline(double west, double south, double east, double north, int zoom, {int limit = 20000}) {
+    if (!_ok || limit <= 0) return const [];
+    final out = _scratch(limit * 2);
+    final n = min(_polyline(west, south, east, north, zoom, out, limit), limit);
+    final v = out.asTypedList(n * 2);
+    final runs = <Float64List>[];
+    var start = 0;
+    for (var i = 0; i <= n; i++) {
+      if (i < n && !v[2 * i].isNaN) continue;
+      if (i - start >= 2) runs.add(v.sublist(2 * start, 2 * i)); // copies: the buffer is reused
+      start = i + 1;
+    }
+    return runs;
+  }
+
+  // The label of the middle fix of every bucket; empty without a place index.
+  List<String> _bucketPlaces(Float64List series, DateTime start, Duration bucket, int buckets) {
+    if (!_places) return const [];
+    final t0 = start.millisecondsSinceEpoch / 1000.0, bs = bucket.inMilliseconds / 1000.0;
+    final first = List<int>.filled(buckets, -1), last = List<int>.filled(buckets, -1);
+    for (var i = 0; i < series.length ~/ 3; i++) {
+      final b = ((series[3 * i] - t0) / bs).floor();
+      if (b < 0 || b >= buckets) continue;
+      if (first[b] < 0) first[b] = i;
+      last[b] = i;
+    }
+    String at(int i) => label(series[3 * i + 1], series[3 * i + 2]);
+    return [for (var b = 0; b < buckets; b++) first[b] < 0 ? '' : at((first[b] + last[b]) ~/ 2)];
+  }
+
+  /// Compiles a tab-separated gazetteer (GeoNames dump or name/lat/lng[/country] lines)
+  /// into a place index at [indexPath]. Returns the number of places.
+  int buildPlaces(String gazetteerPath, String indexPath, {int minPopulation = 0}) {
+    if (!_ok) return 0;
+    final src = gazetteerPath.toNativeUtf8(), dst = indexPath.toNativeUtf8();
+    try {
+      final rc = _placesBuild(src, dst, minPopulation);
+      if (rc < 0) throw Exception('llm_places_build failed (rc=$rc)');
+      return rc;
+    } finally {
+      malloc
+        ..free(src)
+        ..free(dst);
+    }
+  }
+
+  /// Maps a place index built by [buildPlaces] for [nearest] and [label].
+  /// Returns the number of places.
+  int openPlaces(String indexPath) {
+    if (!_ok) return 0;
+    final p = indexPath.toNativeUtf8();
+    try {
+      final rc = _placesOpen(p);
+      if (rc < 0) throw Exception('llm_places_open failed (rc=$rc)');
+      _places = true;
+      return rc;
+    } finally {
+      malloc.free(p);
+    }
+  }
+
+  bool get hasPlaces => _places;
+
+  /// Up to [k] named places nearest to [lat], [lng], nearest first.
+  List<GeoPlace> nearest(double lat, double lng, {int k = 1}) {
+    if (!_places || k <= 0) return const [];
+    final out = malloc<Uint8>(k * 128), dist = malloc<Float>(k);
+    try {
+      final n = _placesNearest(lat, lng, k, out.cast<Utf8>(), k * 128, dist);
+      if (n <= 0) return const [];
+      final names = out.cast<Utf8>().toDartString().split('\n');
+      return [for (var i = 0; i < n; i++) GeoPlace(names[i], dist[i].toDouble())];
+    } finally {
+      malloc
+        ..free(out)
+        ..free(dist);
+    }
+  }
+
+  /// A short description of a position for prompts: "Gulshan, BD" when a named place is
+  /// within [near] metres, "12 km from Dhaka, BD" otherwise, and rounded coordinates
+  /// without a place index.
+  String label(double lat, double lng, {double near = 1500}) {
+    final p = nearest(lat, lng);
+    if (p.isEmpty) return '${lat.toStringAsFixed(3)},${lng.toStringAsFixed(3)}';
+    final d = p.first.distM;
+    if (d <= near) return p.first.name;
+    return '${d < 10000 ? (d / 1000).toStringAsFixed(1) : (d / 1000).round()} km from ${p.first.name}';
+  }
+
+  /// Hourly buckets for the local day containing [day].
+  GeoBuckets day(List<Coord> coords, DateTime day) {
+    final d = day.toLocal();
+    return aggregate(GeoSeries.pack(coords), start: DateTime(d.year, d.month, d.day));
+  }
+}
@@ -3,6 +3,7 @@ import 'dart:async';
 import 'dart:convert';
 import 'dart:ffi';
 import 'dart:io';
+import 'dart:typed_data';
 import 'package:ffi/ffi.dart';
 
 /// Native-first LLM wrapper.
@@ -15,7 +16,57 @@ class LLM {
   late final int Function(Pointer<Utf8>, int, int, int, int) _init;
   // C: int llm_infer(const char* prompt, const char* paramsJson, char* outBuf, int outBufSize)
   late final int Function(Pointer<Utf8>, Pointer<Utf8>, Pointer<Utf8>, int) _infer;
+  // C: int llm_infer_ex(prompt, paramsJson, outBuf, outBufSize, unsigned char* sideBuf, int sideBufSize)
+  late final int Function(Pointer<Utf8>, Pointer<Utf8>, Pointer<Utf8>, int, Pointer<Uint8>, int) _inferEx;
   late final void Function() _dispose;
+  // C: int llm_grammar_compile(const char* schemaJson, char* errBuf, int errBufSize)
+  late final int Function(Pointer<Utf8>, Pointer<Utf8>, int) _grammarCompile;
+  // C: int llm_model_info(const char* modelPath, char* outJson, int outSize)
+  late final int Function(Pointer<Utf8>, Pointer<Utf8>, int) _modelInfo;
+  // C: int llm_requant_start(src, dst, budgetMb, nCtx, ftype, nThreads)
+  late final int Function(Pointer<Utf8>, Pointer<Utf8>, int, int, int, int) _requantStart;
+  // C: int llm_requant_poll(float* progress, int* ftype, char* msgBuf, int msgBufSize)
+  late final int Function(Pointer<Float>, Pointer<Int32>, Pointer<Utf8>, int) _requantPoll;
+  late final void Function() _requantCancel;
+  // C: int llm_set_idle_unload(int idleSeconds, int unloadModel, const char* cacheDir)
+  late final int Function(int, int, Pointer<Utf8>) _setIdleUnload;
+  // C: int llm_pool_configure(const int* sizes, int nSizes, int budgetMb)
+  late final int Function(Pointer<Int32>, int, int) _poolConfigure;
+  // C: int llm_session_open(void) / llm_session_fork(int) / llm_session_close(int)
+  late final int Function() _sessionOpen;
+  late final int Function(int) _sessionFork;
+  late final int Function(int) _sessionClose;
+  // C: int llm_kv_compact(char* outJson, int outSize)
+  late final int Function(Pointer<Utf8>, int) _kvCompact;
+  // C: int llm_kv_set_compact_threshold(float threshold)
+  late final int Function(double) _kvCompactThreshold;
+  // C: int llm_kv_paging(int enable, int maxResidentTokens, const char* pageFile)
+  late final int Function(int, int, Pointer<Utf8>) _kvPaging;
+  // C: int llm_log_config(int minLevel, const char* filePath, int maxFileKb, int maxFiles)
+  late final int Function(int, Pointer<Utf8>, int, int) _logConfig;
+  // C: int llm_log_read(unsigned long long* cursor, char* out, int outSize)
+  late final int Function(Pointer<Uint64>, Pointer<Utf8>, int) _logRead;
+  int _logCursor = 0;
+  // C: int llm_metrics(int format, char* out, int outSize)
+  late final int Function(int, Pointer<Utf8>, int) _metrics;
+  // C: int llm_stats(char* outJson, int outSize)
+  late final int Function(Pointer<Utf8>, int) _stats;
+  // C: int llm_infer_batch(prompts, paramsJson, n, outSlots, slotSize, int* status, statsJson, statsSize)
+  late final int Function(Pointer<Pointer<Utf8>>, Pointer<Pointer<Utf8>>, int, Pointer<Utf8>, int, Pointer<Int32>, Pointer<Utf8>, int) _inferBatch;
+  // C: int llm_stream_start(prompt, paramsJson, llm_stream_cb cb, void* user) / llm_stream_cancel(int)
+  late final int Function(Pointer<Utf8>, Pointer<Utf8>, Pointer<NativeFunction<_StreamCb>>, Pointer<Void>) _streamStart;
+  late final int Function(int) _streamCancel;
+  // C: int llm_choose(prompt, paramsJson, choices, n, float* probs, statsJson, statsSize)
+  late final int Function(Pointer<Utf8>, Pointer<Utf8>, Pointer<Pointer<Utf8>>, int, Pointer<Float>, Pointer<Utf8>, int) _choose;
+  // C: int llm_token_count(const char* text)
+  late final int Function(Pointer<Utf8>) _tokenCount;
+  // C: int llm_encode_table(values, rows, cols, columnsJson, out, outSize, reportJson, reportSize)
+  late final int Function(Pointer<Double>, int, int, Pointer<Utf8>, Pointer<Utf8>, int, Pointer<Utf8>, int) _encodeTable;
+  // C: int llm_template_register(const char* text, char* errBuf, int errBufSize) / llm_template_free(int)
+  late final int Function(Pointer<Utf8>, Pointer<Utf8>, int) _templateRegister;
+  late final int Function(int) _templateFree;
+  final Map<int, String> _mockTemplates = {};
+  int _mockTemplateId = 0;
 
   bool _ready = false;
   bool _mock = false;
@@ -34,9 +85,87 @@ class LLM {
         _infer = candidate
             .lookup<NativeFunction<Int32 Function(Pointer<Utf8>, Pointer<Utf8>, Pointer<Utf8>, Int32)>>('llm_infer')
             .asFunction();
+        _inferEx = candidate
+            .lookup<NativeFunction<Int32 Function(Pointer<Utf8>, Pointer<Utf8>, Pointer<Utf8>, Int32, Pointer<Uint8>, Int32)>>('llm_infer_ex')
+            .asFunction();
         _dispose = candidate
             .lookup<NativeFunction<Void Function()>>('llm_dispose')
             .asFunction();
+        _grammarCompile = candidate
+            .lookup<NativeFunction<Int32 Function(Pointer<Utf8>, Pointer<Utf8>, Int32)>>('llm_grammar_compile')
+            .asFunction();
+        _modelInfo = candidate
+            .lookup<NativeFunction<Int32 Function(Pointer<Utf8>, Pointer<Utf8>, Int32)>>('llm_model_info')
+            .asFunction();
+        _requantStart = candidate
+            .lookup<NativeFunction<Int32 Function(Pointer<Utf8>, Pointer<Utf8>, Int32, Int32, Int32, Int32)>>('llm_requant_start')
+            .asFunction();
+        _requantPoll = candidate
+            .lookup<NativeFunction<Int32 Function(Pointer<Float>, Pointer<Int32>, Pointer<Utf8>, Int32)>>('llm_requant_poll')
+            .asFunction();
+        _requantCancel = candidate
+            .lookup<NativeFunction<Void Function()>>('llm_requant_cancel')
+            .asFunction();
+        _setIdleUnload = candidate
+            .lookup<NativeFunction<Int32 Function(Int32, Int32, Pointer<Utf8>)>>('llm_set_idle_unload')
+            .asFunction();
+        _poolConfigure = candidate
+            .lookup<NativeFunction<Int32 Function(Pointer<Int32>, Int32, Int32)>>('llm_pool_configure')
+            .asFunction();
+        _sessionOpen = candidate
+            .lookup<NativeFunction<Int32 Function()>>('llm_session_open')
+            .asFunction();
+        _sessionFork = candidate
+            .lookup<NativeFunction<Int32 Function(Int32)>>('llm_session_fork')
+            .asFunction();
+        _sessionClose = candidate
+            .lookup<NativeFunction<Int32 Function(Int32)>>('llm_session_close')
+            .asFunction();
+        _kvCompact = candidate
+            .lookup<NativeFunction<Int32 Function(Pointer<Utf8>, Int32)>>('llm_kv_compact')
+            .asFunction();
+        _kvCompactThreshold = candidate
+            .lookup<NativeFunction<Int32 Function(Float)>>('llm_kv_set_compact_threshold')
+            .asFunction();
+        _kvPaging = candidate
+            .lookup<NativeFunction<Int32 Function(Int32, Int32, Pointer<Utf8>)>>('llm_kv_paging')
+            .asFunction();
+        _logConfig = candidate
+            .lookup<NativeFunction<Int32 Function(Int32, Pointer<Utf8>, Int32, Int32)>>('llm_log_config')
+            .asFunction();
+        _logRead = candidate
+            .lookup<NativeFunction<Int32 Function(Pointer<Uint64>, Pointer<Utf8>, Int32)>>('llm_log_read')
+            .asFunction();
+        _metrics = candidate
+            .lookup<NativeFunction<Int32 Function(Int32, Pointer<Utf8>, Int32)>>('llm_metrics')
+            .asFunction();
+        _stats = candidate
+            .lookup<NativeFunction<Int32 Function(Pointer<Utf8>, Int32)>>('llm_stats')
+            .asFunction();
+        _inferBatch = candidate
+            .lookup<NativeFunction<Int32 Function(Pointer<Pointer<Utf8>>, Pointer<Pointer<Utf8>>, Int32, Pointer<Utf8>, Int32, Pointer<Int32>, Pointer<Utf8>, Int32)>>('llm_infer_batch')
+            .asFunction();
+        _streamStart = candidate
+            .lookup<NativeFunction<Int32 Function(Pointer<Utf8>, Pointer<Utf8>, Pointer<NativeFunction<_StreamCb>>, Pointer<Void>)>>('llm_stream_start')
+            .asFunction();
+        _streamCancel = candidate
+            .lookup<NativeFunction<Int32 Function(Int32)>>('llm_stream_cancel')
+            .asFunction();
+        _choose = candidate
+            .lookup<NativeFunction<Int32 Function(Pointer<Utf8>, Pointer<Utf8>, Pointer<Pointer<Utf8>>, Int32, Pointer<Float>, Pointer<Utf8>, Int32)>>('llm_choose')
+            .asFunction();
+        _tokenCount = candidate
+            .lookup<NativeFunction<Int32 Function(Pointer<Utf8>)>>('llm_token_count')
+            .asFunction();
+        _encodeTable = candidate
+            .lookup<NativeFunction<Int32 Function(Pointer<Double>, Int32, Int32, Pointer<Utf8>, Pointer<Utf8>, Int32, Pointer<Utf8>, Int32)>>('llm_encode_table')
+            .asFunction();
+        _templateRegister = candidate
+            .lookup<NativeFunction<Int32 Function(Pointer<Utf8>, Pointer<Utf8>, Int32)>>('llm_template_register')
+            .asFunction();
+        _templateFree = candidate
+            .lookup<NativeFunction<Int32 Function(Int32)>>('llm_template_free')
+            .asFunction();
         return true;
       } catch (_) {
         return false;
@@ -112,7 +241,7 @@ class LLM {
     if (!_ready) throw StateError('LLM not initialized');
 
     if (_mock) {
-      final ans = _shortAnswer(prompt);
+      final ans = _shortAnswer(_mockPrompt(prompt, params));
       return jsonEncode({"answer": ans, "mode": "mock"});
     }
 
@@ -137,6 +266,506 @@ class LLM {
     }
   }
 
+  /// Like [infer], as the text is generated. Pieces come from a native delivery thread
+  /// and are posted to this isolate, so a slow listener never holds up decoding;
+  /// `params['stream_policy']` (0 spill, 1 block, 2 drop) and `params['stream_buffer']`
+  /// say what happens when it falls behind. Cancelling the subscription stops generation.
+  Stream<String> inferStream({
+    required String prompt,
+    required Map<String, dynamic> params,
+  }) {
+    if (!_ready) throw StateError('LLM not initialized');
+    if (_mock) {
+      return Stream.value(jsonEncode({"answer": _shortAnswer(_mockPrompt(prompt, params)), "mode": "mock"}));
+    }
+
+    var id = 0;
+    late final NativeCallable<_StreamCb> cb;
+    final ctl = StreamController<String>(onCancel: () {
+      if (id > 0) _streamCancel(id);
+    });
+    cb = NativeCallable<_StreamCb>.listener((int stream, Pointer<Utf8> piece, int len, Pointer<Void> _) {
+      if (piece == nullptr) {
+        cb.close();
+        if (len < 0) ctl.addError(Exception('llm_infer_stream failed (rc=$len)'));
+        ctl.close();
+        return;
+      }
+      // native pieces end on UTF-8 character boundaries
+      ctl.add(utf8.decode(piece.cast<Uint8>().asTypedList(len)));
+      malloc.free(piece);
+    });
+
+    final p  = prompt.toNativeUtf8();
+    final pj = const JsonEncoder().convert(params).toNativeUtf8();
+    try {
+      id = _streamStart(p, pj, cb.nativeFunction, nullptr);
+    } finally {
+      malloc
+        ..free(p)
+        ..free(pj);
+    }
+    if (id < 0) {
+      cb.close();
+      return Stream.error(Exception('llm_stream_start failed (rc=$id)'));
+    }
+    return ctl.stream;
+  }
+
+  /// Like [infer], but also returns what the native side computed alongside the
+  /// text. With `params['json'] = 1` the output is validated while it is being
+  /// generated and arrives already parsed (see [InferResult.json]), so nothing
+  /// has to be re-parsed on the UI isolate. Output that is not JSON (a preamble,
+  /// a code fence) is still generated in full and reported invalid, unless
+  /// `params['json_stop_on_error'] = 1`. `params['json_indent']` pretty-prints
+  /// valid output natively.
+  Future<InferResult> inferEx({
+    required String prompt,
+    required Map<String, dynamic> params,
+  }) async {
+    if (!_ready) throw StateError('LLM not initialized');
+
+    if (_mock) {
+      final value = {"answer": _shortAnswer(_mockPrompt(prompt, params)), "mode": "mock"};
+      final indent = (params['json_indent'] as int?) ?? 0;
+      final text = indent > 0
+          ? JsonEncoder.withIndent(' ' * indent).convert(value)
+          : jsonEncode(value);
+      return InferResult._(text, jsonStatus: 0, mockValue: value);
+    }
+
+    final p  = prompt.toNativeUtf8();
+    final pj = const JsonEncoder().convert(params).toNativeUtf8();
+
+    const outSize = 1024 * 1024;
+    const sideSize = 256 * 1024;
+    final outBufBytes = malloc.allocate<Uint8>(outSize);
+    final sideBuf = malloc.allocate<Uint8>(sideSize);
+    try {
+      final rc = _inferEx(p, pj, outBufBytes.cast<Utf8>(), outSize, sideBuf, sideSize);
+      if (rc != 0) {
+        throw Exception('llm_infer_ex failed (rc=$rc)');
+      }
+      final out = outBufBytes.cast<Utf8>().toDartString();
+      return InferResult._fromSide(out, sideBuf.asTypedList(sideSize));
+    } finally {
+      malloc
+        ..free(p)
+        ..free(pj)
+        ..free(outBufBytes)
+        ..free(sideBuf);
+    }
+  }
+
+  /// Runs [prompts] as one native batch: their common prefix is decoded once and
+  /// all items generate together. [params] is null or one map (or null) per prompt
+  /// with max_tokens, grammar, json, json_indent, stop, template, slots. Each output is cut
+  /// at [slotSize] bytes.
+  Future<BatchResult> inferBatch(List<String> prompts,
+      {List<Map<String, dynamic>?>? params, int slotSize = 16 * 1024}) async {
+    if (!_ready) throw StateError('LLM not initialized');
+    final n = prompts.length;
+    if (n == 0) return const BatchResult([], [], {});
+
+    if (_mock) {
+      return BatchResult([
+        for (var i = 0; i < n; i++)
+          jsonEncode({"answer": _shortAnswer(_mockPrompt(prompts[i], params?[i] ?? const {})), "mode": "mock"})
+      ], List.filled(n, 0), {'items': n, 'mode': 'mock'});
+    }
+
+    final ps = malloc<Pointer<Utf8>>(n);
+    final pj = params == null ? nullptr : malloc<Pointer<Utf8>>(n);
+    for (var i = 0; i < n; i++) {
+      ps[i] = prompts[i].toNativeUtf8();
+      if (params != null) {
+        final m = i < params.length ? params[i] : null;
+        pj[i] = m == null ? nullptr : jsonEncode(m).toNativeUtf8();
+      }
+    }
+    const statsSize = 64 * 1024;
+    final out = malloc.allocate<Uint8>(n * slotSize);
+    final status = malloc<Int32>(n);
+    final stats = malloc.allocate<Uint8>(statsSize);
+    try {
+      final rc = _inferBatch(ps, pj, n, out.cast<Utf8>(), slotSize, status, stats.cast<Utf8>(), statsSize);
+      if (rc != 0) throw Exception('llm_infer_batch failed (rc=$rc)');
+      return BatchResult(
+        [for (var i = 0; i < n; i++) Pointer<Utf8>.fromAddress(out.address + i * slotSize).toDartString()],
+        [for (var i = 0; i < n; i++) status[i]],
+        jsonDecode(stats.cast<Utf8>().toDartString()) as Map<String, dynamic>,
+      );
+    } finally {
+      for (var i = 0; i < n; i++) {
+        malloc.free(ps[i]);
+        if (pj != nullptr && pj[i] != nullptr) malloc.free(pj[i]);
+      }
+      malloc
+        ..free(ps)
+        ..free(out)
+        ..free(status)
+        ..free(stats);
+      if (pj != nullptr) malloc.free(pj);
+    }
+  }
+
+  /// JSON Schema → native grammar id (cached by schema hash on the native side,
+  /// so calling this per request is cheap). Pass it as `params['grammar']`.
+  /// Mock mode has no grammar support and returns 0 (= unconstrained).
+  int compileSchema(Map<String, dynamic> schema) {
+    if (_mock) return 0;
+
+    final sj = jsonEncode(schema).toNativeUtf8();
+    const errSize = 512;
+    final err = malloc.allocate<Uint8>(errSize);
+    try {
+      err.value = 0;
+      final id = _grammarCompile(sj, err.cast<Utf8>(), errSize);
+      if (id <= 0) {
+        throw Exception('llm_grammar_compile failed (rc=$id): ${err.cast<Utf8>().toDartString()}');
+      }
+      return id;
+    } finally {
+      malloc
+        ..free(sj)
+        ..free(err);
+    }
+  }
+
+  /// Metadata of a GGUF file, or of the loaded model when [modelPath] is null:
+  /// desc, ftype, size, n_params, n_vocab, n_ctx_train, n_embd, n_layer.
+  Map<String, dynamic> modelInfo([String? modelPath]) {
+    if (_mock) return {'path': modelPath ?? '', 'desc': 'mock'};
+
+    final mp = (modelPath ?? '').toNativeUtf8();
+    const outSize = 2048;
+    final out = malloc.allocate<Uint8>(outSize);
+    try {
+      final rc = _modelInfo(mp, out.cast<Utf8>(), outSize);
+      if (rc != 0) throw Exception('llm_model_info failed (rc=$rc)');
+      return jsonDecode(out.cast<Utf8>().toDartString()) as Map<String, dynamic>;
+    } finally {
+      malloc
+        ..free(mp)
+        ..free(out);
+    }
+  }
+
+  /// Starts requantizing [srcPath] in the background so that weights plus an
+  /// [nCtx] KV cache fit [budgetMb] (or to an explicit llama [ftype]).
+  /// [dstPath] null replaces the source once the result has been verified.
+  /// Follow it with [requantPoll]; only one job runs at a time.
+  void requantStart(String srcPath,
+      {String? dstPath, int budgetMb = 0, int nCtx = 2048, int ftype = -1, int threads = 4}) {
+    if (_mock) return;
+
+    final sp = srcPath.toNativeUtf8();
+    final dp = (dstPath ?? '').toNativeUtf8();
+    try {
+      final rc = _requantStart(sp, dp, budgetMb, nCtx, ftype, threads);
+      if (rc != 0) throw Exception('llm_requant_start failed (rc=$rc)');
+    } finally {
+      malloc
+        ..free(sp)
+        ..free(dp);
+    }
+  }
+
+  RequantStatus requantPoll() {
+    if (_mock) return const RequantStatus(RequantState.idle, 0, -1, '');
+
+    final progress = malloc<Float>();
+    final ftype = malloc<Int32>();
+    const msgSize = 2048;
+    final msg = malloc.allocate<Uint8>(msgSize);
+    try {
+      final st = _requantPoll(progress, ftype, msg.cast<Utf8>(), msgSize);
+      return RequantStatus(RequantState.values[st.clamp(0, RequantState.values.length - 1)],
+          progress.value, ftype.value, msg.cast<Utf8>().toDartString());
+    } finally {
+      malloc
+        ..free(progress)
+        ..free(ftype)
+        ..free(msg);
+    }
+  }
+
+  void requantCancel() {
+    if (_mock) return;
+    _requantCancel();
+  }
+
+  /// Frees the context after [idle] without requests ([Duration.zero] disables);
+  /// [unloadModel] frees the model as well. The next request reloads it, starting
+  /// from warm caches kept in [cacheDir] (default: next to the model file).
+  void setIdleUnload(Duration idle, {bool unloadModel = false, String? cacheDir}) {
+    if (_mock) return;
+
+    final dir = (cacheDir ?? '').toNativeUtf8();
+    try {
+      _setIdleUnload(idle.inSeconds, unloadModel ? 1 : 0, dir);
+    } finally {
+      malloc.free(dir);
+    }
+  }
+
+  /// Keeps warm standby contexts of the given [sizes] (n_ctx) within [budgetMb];
+  /// contexts handed back are reused. A zero budget disables the pool.
+  void configurePool(List<int> sizes, int budgetMb) {
+    if (_mock) return;
+
+    final arr = malloc.allocate<Int32>(sizeOf<Int32>() * (sizes.isEmpty ? 1 : sizes.length));
+    try {
+      for (var i = 0; i < sizes.length; i++) {
+        arr[i] = sizes[i];
+      }
+      final rc = _poolConfigure(arr, sizes.length, budgetMb);
+      if (rc != 0) throw Exception('llm_pool_configure failed (rc=$rc)');
+    } finally {
+      malloc.free(arr);
+    }
+  }
+
+  /// Opens a session: requests passing `params['session'] = id` keep their KV
+  /// between calls. [fromSession] forks an existing one (0 = the default sequence).
+  int openSession({int? fromSession}) {
+    if (_mock) return 1;
+    final id = fromSession == null ? _sessionOpen() : _sessionFork(fromSession);
+    if (id < 0) throw Exception('llm_session_open failed (rc=$id)');
+    return id;
+  }
+
+  void closeSession(int id) {
+    if (_mock) return;
+    _sessionClose(id);
+  }
+
+  /// Scores [choices] as answers to [prompt] without generating: one native decode
+  /// after the prompt covers every candidate. Candidates are tokenized on their own,
+  /// so give them the leading space the model would write (" yes"). [params] takes
+  /// template/slots as for [infer], temperature, prior and calibrate (see llm_choose).
+  Future<ChoiceResult> choose(String prompt, List<String> choices, {Map<String, dynamic>? params}) async {
+    if (!_ready) throw StateError('LLM not initialized');
+    final n = choices.length;
+    if (n == 0) throw ArgumentError('no choices');
+
+    if (_mock) {
+      return ChoiceResult(0, List.filled(n, 1 / n), {'mode': 'mock'});
+    }
+
+    final p = prompt.toNativeUtf8();
+    final pj = params == null ? nullptr : jsonEncode(params).toNativeUtf8();
+    final cs = malloc<Pointer<Utf8>>(n);
+    for (var i = 0; i < n; i++) {
+      cs[i] = choices[i].toNativeUtf8();
+    }
+    const statsSize = 16 * 1024;
+    final probs = malloc<Float>(n);
+    final stats = malloc.allocate<Uint8>(statsSize);
+    try {
+      final rc = _choose(p, pj, cs, n, probs, stats.cast<Utf8>(), statsSize);
+      if (rc < 0) throw Exception('llm_choose failed (rc=$rc)');
+      return ChoiceResult(rc, [for (var i = 0; i < n; i++) probs[i]],
+          jsonDecode(stats.cast<Utf8>().toDartString()) as Map<String, dynamic>);
+    } finally {
+      for (var i = 0; i < n; i++) {
+        malloc.free(cs[i]);
+      }
+      if (pj != nullptr) malloc.free(pj);
+      malloc
+        ..free(p)
+        ..free(cs)
+        ..free(probs)
+        ..free(stats);
+    }
+  }
+
+  /// Registers a prompt with `{{name}}` slots. Pass `params['template'] = id` and
+  /// `params['slots'] = {name: value}` to [infer], [inferEx] or [inferBatch] (the
+  /// prompt is then ignored): the static text is tokenized once, natively.
+  int registerTemplate(String text) {
+    if (_mock) {
+      final id = ++_mockTemplateId;
+      _mockTemplates[id] = text;
+      return id;
+    }
+    final t = text.toNativeUtf8();
+    const errSize = 256;
+    final err = malloc.allocate<Uint8>(errSize);
+    try {
+      final id = _templateRegister(t, err.cast<Utf8>(), errSize);
+      if (id < 0) throw Exception('llm_template_register failed (rc=$id): ${err.cast<Utf8>().toDartString()}');
+      return id;
+    } finally {
+      malloc
+        ..free(t)
+        ..free(err);
+    }
+  }
+
+  void freeTemplate(int id) {
+    if (_mock) {
+      _mockTemplates.remove(id);
+      return;
+    }
+    _templateFree(id);
+  }
+
+  String _mockPrompt(String prompt, Map<String, dynamic> params) {
+    final text = _mockTemplates[params['template']];
+    if (text == null) return prompt;
+    final slots = (params['slots'] as Map?) ?? const {};
+    return text.replaceAllMapped(RegExp(r'\{\{\s*([A-Za-z0-9_.-]+)\s*\}\}'), (m) => '${slots[m[1]] ?? ''}');
+  }
+
+  /// Packs the KV cache; returns fragmentation before/after, bytes moved and ms.
+  Map<String, dynamic> compactKv() {
+    if (_mock) return {};
+
+    const outSize = 1024;
+    final out = malloc.allocate<Uint8>(outSize);
+    try {
+      final rc = _kvCompact(out.cast<Utf8>(), outSize);
+      if (rc != 0) throw Exception('llm_kv_compact failed (rc=$rc)');
+      return jsonDecode(out.cast<Utf8>().toDartString()) as Map<String, dynamic>;
+    } finally {
+      malloc.free(out);
+    }
+  }
+
+  /// Automatic compaction above this estimated fragmentation (0..1; 0 = only on a full cache).
+  void setCompactThreshold(double threshold) {
+    if (_mock) return;
+    _kvCompactThreshold(threshold);
+  }
+
+  /// Pages idle sessions' KV out to [pageFile] (default: next to the model) once
+  /// more than [maxResidentTokens] cells are in use (0 = the context size).
+  void setKvPaging(bool enable, {int maxResidentTokens = 0, String? pageFile}) {
+    if (_mock) return;
+
+    final path = (pageFile ?? '').toNativeUtf8();
+    try {
+      final rc = _kvPaging(enable ? 1 : 0, maxResidentTokens, path);
+      if (rc != 0) throw Exception('llm_kv_paging failed (rc=$rc)');
+    } finally {
+      malloc.free(path);
+    }
+  }
+
+  /// Native log level (0 debug .. 3 error) and optional rotating log file.
+  void configureLogs({int minLevel = 1, String? file, int maxFileKb = 1024, int maxFiles = 3}) {
+    if (_mock) return;
+
+    final path = file == null ? nullptr : file.toNativeUtf8();
+    try {
+      _logConfig(minLevel, path.cast<Utf8>(), maxFileKb, maxFiles);
+    } finally {
+      if (path != nullptr) malloc.free(path);
+    }
+  }
+
+  /// Native log lines (llama/ggml and bridge) since the previous call.
+  String readLogs() {
+    if (_mock) return '';
+
+    const outSize = 64 * 1024;
+    final out = malloc.allocate<Uint8>(outSize);
+    final cursor = malloc<Uint64>()..value = _logCursor;
+    try {
+      final buf = StringBuffer();
+      for (;;) {
+        final n = _logRead(cursor, out.cast<Utf8>(), outSize);
+        if (n <= 0) break;
+        buf.write(out.cast<Utf8>().toDartString(length: n));
+      }
+      _logCursor = cursor.value;
+      return buf.toString();
+    } finally {
+      malloc.free(cursor);
+      malloc.free(out);
+    }
+  }
+
+  /// Request/token/cache counters and latency histograms (TTFT, per token, ...).
+  /// [prometheus] returns the text exposition format instead of JSON.
+  String metrics({bool prometheus = false}) {
+    if (_mock) return prometheus ? '' : '{}';
+
+    const outSize = 64 * 1024;
+    final out = malloc.allocate<Uint8>(outSize);
+    try {
+      final rc = _metrics(prometheus ? 1 : 0, out.cast<Utf8>(), outSize);
+      if (rc != 0) throw Exception('llm_metrics failed (rc=$rc)');
+      return out.cast<Utf8>().toDartString();
+    } finally {
+      malloc.free(out);
+    }
+  }
+
+  /// Prompt tokens [text] encodes to. Does not wait for a running generation.
+  int tokenCount(String text) {
+    if (_mock) return (text.length / 4).ceil();
+
+    final p = text.toNativeUtf8();
+    try {
+      final n = _tokenCount(p);
+      if (n < 0) throw Exception('llm_token_count failed (rc=$n)');
+      return n;
+    } finally {
+      malloc.free(p);
+    }
+  }
+
+  /// [rows] as compact CSV for a prompt, each column in whichever format costs the
+  /// fewest tokens with the loaded model (see llm_encode_table). `report` has tokens,
+  /// baseline_tokens, columns[] and row_saved[].
+  TableText encodeTable(List<List<double>> rows, List<TableColumn> columns) {
+    final nc = columns.length;
+    if (_mock || nc == 0) {
+      final text = '${columns.map((c) => c.name).join(',')}\n${rows.map((r) => r.join(',')).join('\n')}\n';
+      return TableText(text, {'rows': rows.length, 'mode': 'mock'});
+    }
+
+    final vals = malloc<Double>(rows.isEmpty ? 1 : rows.length * nc);
+    final spec = jsonEncode([for (final c in columns) c.toJson()]).toNativeUtf8();
+    final outSize = 64 + rows.length * nc * 24 + 256 * nc;
+    final reportSize = 4096 + rows.length * 8;
+    final out = malloc.allocate<Uint8>(outSize), report = malloc.allocate<Uint8>(reportSize);
+    try {
+      for (var i = 0; i < rows.length; i++) {
+        for (var c = 0; c < nc; c++) {
+          vals[i * nc + c] = c < rows[i].length ? rows[i][c] : double.nan;
+        }
+      }
+      final rc = _encodeTable(vals, rows.length, nc, spec, out.cast<Utf8>(), outSize, report.cast<Utf8>(), reportSize);
+      if (rc < 0) throw Exception('llm_encode_table failed (rc=$rc)');
+      return TableText(out.cast<Utf8>().toDartString(),
+          jsonDecode(report.cast<Utf8>().toDartString()) as Map<String, dynamic>);
+    } finally {
+      malloc
+        ..free(vals)
+        ..free(spec)
+        ..free(out)
+        ..free(report);
+    }
+  }
+
+  /// Engine state and unload/reload timings; see llm_stats in llm_bridge.h.
+  Map<String, dynamic> stats() {
+    if (_mock) return {'state': 'mock'};
+
+    const outSize = 4096;
+    final out = malloc.allocate<Uint8>(outSize);
+    try {
+      final rc = _stats(out.cast<Utf8>(), outSize);
+      if (rc != 0) throw Exception('llm_stats failed (rc=$rc)');
+      return jsonDecode(out.cast<Utf8>().toDartString()) as Map<String, dynamic>;
+    } finally {
+      malloc.free(out);
+    }
+  }
+
   void dispose() {
     if (_mock) return;
     if (_ready) {
@@ -153,3 +782,211 @@ class LLM {
     return 'This is a mock local response. Native lib not available.';
     }
 }
+
+
+/// Mirrors LLM_REQUANT_* in llm_bridge.h.
+enum RequantState { idle, running, done, failed, cancelled }
+
+class RequantStatus {
+  const RequantStatus(this.state, this.progress, this.ftype, this.message);
+
+  final RequantState state;
+  final double progress;
+  /// llama_ftype being produced (-1 until chosen).
+  final int ftype;
+  /// Error text, or the new model's info JSON once [state] is done.
+  final String message;
+}
+
+/// Outputs of [LLM.inferBatch], by prompt index.
+/// A column for [LLM.encodeTable]: [step] is the precision the model needs, in the
+/// column's units (seconds for [time] columns, which hold unix seconds).
+class TableColumn {
+  const TableColumn(this.name, {this.step = 0.01}) : time = false;
+  const TableColumn.time(this.name, {this.step = 60}) : time = true;
+
+  final String name;
+  final double step;
+  final bool time;
+
+  Map<String, dynamic> toJson() => {'name': name, 'kind': time ? 'time' : 'number', 'step': step};
+}
+
+class TableText {
+  const TableText(this.text, this.report);
+
+  final String text;
+  final Map<String, dynamic> report;
+}
+
+class BatchResult {
+  const BatchResult(this.outputs, this.status, this.stats);
+
+  final List<String> outputs;
+  /// 0, or the native error code of that item (its output is then empty).
+  final List<int> status;
+  /// shared_prefix_tokens, waves, steps, ms, results[] ...; see llm_infer_batch.
+  final Map<String, dynamic> stats;
+}
+
+// C: void (*llm_stream_cb)(int stream, char* piece, int len, void* user)
+typedef _StreamCb = Void Function(Int32, Pointer<Utf8>, Int32, Pointer<Void>);
+
+/// Result of [LLM.choose].
+class ChoiceResult {
+  const ChoiceResult(this.index, this.probs, this.stats);
+
+  /// The most probable candidate.
+  final int index;
+  /// Per candidate, summing to 1 (after calibration, if asked for).
+  final List<double> probs;
+  /// logprobs, prior, coverage, decoded_tokens, ms ...; see llm_choose.
+  final Map<String, dynamic> stats;
+}
+
+/// Text plus the structured side results of [LLM.inferEx].
+class InferResult {
+  InferResult._(this.text,
+      {this.jsonStatus, this.jsonOffset = -1, this.jsonTree, this.tokenIds, this.logprobs, this.topLogprobs, Object? mockValue})
+      : _mockValue = mockValue;
+
+  // side buffer layout: see llm_bridge.h
+  static const _sideMagic = 0x534D4C4C; // "LLMS"
+  static const _tagJson = 0x4E4F534A; // "JSON"
+  static const _tagTokens = 0x534B4F54; // "TOKS"
+
+  factory InferResult._fromSide(String text, Uint8List side) {
+    final bd = ByteData.sublistView(side);
+    if (bd.getUint32(0, Endian.little) != _sideMagic) return InferResult._(text);
+    final count = bd.getUint16(6, Endian.little);
+    final used = bd.getUint32(8, Endian.little);
+
+    int? jsonStatus;
+    var jsonOffset = -1;
+    Uint8List? jsonTree;
+    Int32List? tokenIds;
+    Float32List? logprobs;
+    List<List<({int token, double logprob})>>? topLogprobs;
+    var off = 16;
+    for (var i = 0; i < count && off + 8 <= used; i++) {
+      final tag = bd.getUint32(off, Endian.little);
+      final size = bd.getUint32(off + 4, Endian.little);
+      final body = off + 8;
+      if (tag == _tagJson && size >= 8) {
+        jsonStatus = bd.getInt32(body, Endian.little);
+        jsonOffset = bd.getInt32(body + 4, Endian.little);
+        if (size > 8) jsonTree = Uint8List.fromList(side.sublist(body + 8, body + size));
+      } else if (tag == _tagTokens && size >= 8) {
+        final n = bd.getUint32(body, Endian.little);
+        final topN = bd.getUint16(body + 4, Endian.little);
+        final withLp = (bd.getUint16(body + 6, Endian.little) & 1) != 0;
+        tokenIds = Int32List(n);
+        if (withLp) {
+          logprobs = Float32List(n);
+          topLogprobs = [];
+        }
+        var r = body + 8;
+        for (var k = 0; k < n; k++) {
+          tokenIds[k] = bd.getInt32(r, Endian.little);
+          r += 4;
+          if (!withLp) continue;
+          logprobs![k] = bd.getFloat32(r, Endian.little);
+          r += 4;
+          topLogprobs!.add([
+            for (var j = 0; j < topN; j++)
+              (token: bd.getInt32(r + j * 8, Endian.little), logprob: bd.getFloat32(r + j * 8 + 4, Endian.little)),
+          ]);
+          r += topN * 8;
+        }
+      }
+      off = body + size;
+    }
+    return InferResult._(text,
+        jsonStatus: jsonStatus,
+        jsonOffset: jsonOffset,
+        jsonTree: jsonTree,
+        tokenIds: tokenIds,
+        logprobs: logprobs,
+        topLogprobs: topLogprobs);
+  }
+
+  final String text;
+
+  /// 0 valid, 1 incomplete, 2 syntax error; null when JSON checking was off.
+  final int? jsonStatus;
+
+  /// First bad byte (status 2) or end of the JSON value in the raw output.
+  final int jsonOffset;
+
+  /// Parsed value as the native preorder binary tree (json_tree_type in llm_json.h).
+  final Uint8List? jsonTree;
+
+  /// Generated token ids (`output_ids`, `logprobs` or `top_logprobs` set).
+  final Int32List? tokenIds;
+
+  /// Log-probability of each generated token, normalised over the top-k logits.
+  final Float32List? logprobs;
+
+  /// Per generated token, the `top_logprobs` best alternatives.
+  final List<List<({int token, double logprob})>>? topLogprobs;
+
+  final Object? _mockValue;
+
+  bool get isValidJson => jsonStatus == 0;
+
+  /// The parsed value: Map / List / String / int / double / bool / null.
+  Object? get json {
+    if (_mockValue != null) return _mockValue;
+    final t = jsonTree;
+    return t == null ? null : _JsonTreeReader(t).read();
+  }
+}
+
+/// Walks the native binary tree; no text parsing involved.
+class _JsonTreeReader {
+  _JsonTreeReader(this._b) : _bd = ByteData.sublistView(_b);
+
+  final Uint8List _b;
+  final ByteData _bd;
+  var _i = 0;
+
+  String _str() {
+    final n = _bd.getUint32(_i, Endian.little);
+    final s = utf8.decode(Uint8List.sublistView(_b, _i + 4, _i + 4 + n));
+    _i += 4 + n;
+    return s;
+  }
+
+  Object? read() {
+    final type = _b[_i++];
+    switch (type) {
+      case 0: return null;
+      case 1: return false;
+      case 2: return true;
+      case 3:
+        final v = _bd.getInt64(_i, Endian.little);
+        _i += 8;
+        return v;
+      case 4:
+        final v = _bd.getFloat64(_i, Endian.little);
+        _i += 8;
+        return v;
+      case 5: return _str();
+      case 6:
+        final n = _bd.getUint32(_i, Endian.little);
+        _i += 4;
+        return [for (var k = 0; k < n; k++) read()];
+      case 7:
+        final n = _bd.getUint32(_i, Endian.little);
+        _i += 4;
+        final m = <String, Object?>{};
+        for (var k = 0; k < n; k++) {
+          final key = _str();
+          m[key] = read();
+        }
+        return m;
+      default:
+        throw FormatException('bad json tree node type $type at ${_i - 1}');
+    }
+  }
+}
@@ -1,5 +1,4 @@
 // lib/main.dart
-import 'dart:convert';
 import 'dart:io';
 import 'package:flutter/material.dart';
 import 'package:http/http.dart' as http;
@@ -102,6 +101,8 @@ class _LLMAppState extends State<LLMApp> {
           gpuLayers: 0,
           threads: Platform.isAndroid ? 6 : 4,
         );
+        // idle for a while: give the memory back instead of waiting for the LMK
+        _llm.setIdleUnload(const Duration(minutes: 10), unloadModel: true);
         _llmInitialized = true;
       }
 
@@ -153,18 +154,21 @@ Future<void> _run() async {
     if (!_ready) return;
     setState(() => _status = 'Running...');
     try {
-      final raw = await _llm.infer(
+      // validated + pretty-printed natively while generating; no re-parse here
+      final res = await _llm.inferEx(
         prompt: _prompt.text,
         params: {
           "temperature": 0.4, "top_p": 0.9, "top_k": 40,
-          "repeat_penalty": 1.1, "max_tokens": 128
+          "repeat_penalty": 1.1, "max_tokens": 128,
+          "json": 1, "json_indent": 2,
         },
       );
-      var pretty = raw;
-      try {
-        pretty = const JsonEncoder.withIndent('  ').convert(json.decode(raw));
-      } catch (_) {}
-      setState(() { _status = 'Done'; _output = pretty; });
+      final status = switch (res.jsonStatus) {
+        2 => 'Done (invalid JSON at byte ${res.jsonOffset})',
+        1 => 'Done (incomplete JSON)',
+        _ => 'Done',
+      };
+      setState(() { _status = status; _output = res.text; });
     } catch (e) {
       setState(() => _status = 'Error: $e');
     }
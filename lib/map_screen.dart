@@ -2,51 +2,130 @@
 import 'package:flutter/material.dart';
 import 'package:flutter_map/flutter_map.dart';
 import 'package:latlong2/latlong.dart';
+import 'package:llm_model/geo.dart';
 import 'package:llm_model/location_service.dart';
 
 
-class VisitedMapScreen extends StatelessWidget {
+class VisitedMapScreen extends StatefulWidget {
   const VisitedMapScreen({super.key});
 
+  @override
+  State<VisitedMapScreen> createState() => _VisitedMapScreenState();
+}
+
+class _VisitedMapScreenState extends State<VisitedMapScreen> {
+  final _map = MapController();
+  bool _ready = false;
+
+  // Native index (lib/geo.dart): rebuilt when the history changes, queried per camera move
+  // for just the markers and track inside the viewport.
+  List<Coord>? _indexed;
+  List<GeoMarker> _markers = const [];
+  List<List<LatLng>> _runs = const [];
+
+  void _reindex(List<Coord> list) {
+    if (identical(list, _indexed)) return;
+    _indexed = list;
+    Geo.I.buildIndex(GeoSeries.pack(list));
+    if (_ready) _query();
+  }
+
+  void _query() {
+    final cam = _map.camera;
+    final b = cam.visibleBounds;
+    final z = cam.zoom.round();
+    _markers = Geo.I.clusters(b.west, b.south, b.east, b.north, z);
+    _runs = [
+      for (final r in Geo.I.polyline(b.west, b.south, b.east, b.north, z))
+        [for (var i = 0; i + 1 < r.length; i += 2) LatLng(r[i], r[i + 1])],
+    ];
+  }
+
+  void _moved() {
+    if (!_ready) return;
+    setState(_query);
+  }
+
+  Marker _marker(GeoMarker m) {
+    final p = LatLng(m.lat, m.lng);
+    if (m.count == 1) {
+      return Marker(point: p, width: 28, height: 28, child: const Icon(Icons.place, size: 20));
+    }
+    final d = m.count < 10 ? 28.0 : m.count < 100 ? 34.0 : 40.0;
+    return Marker(
+      point: p,
+      width: d,
+      height: d,
+      child: GestureDetector(
+        onTap: () => _map.move(p, _map.camera.zoom + 2),
+        child: Container(
+          alignment: Alignment.center,
+          decoration: BoxDecoration(
+            color: Theme.of(context).colorScheme.primary.withOpacity(0.85),
+            shape: BoxShape.circle,
+          ),
+          child: Text('${m.count}',
+              style: TextStyle(color: Theme.of(context).colorScheme.onPrimary, fontSize: 12)),
+        ),
+      ),
+    );
+  }
+
   @override
   Widget build(BuildContext context) {
-    // রিয়েল-টাইম ম্যাপ চাইলে ValueListenableBuilder ব্যবহার করা হচ্ছে
+    // রিয়েল-টাইম ম্যাপ চাইলে ValueListenableBuilder ব্যবহার করা হচ্ছে
     return Scaffold(
       appBar: AppBar(title: const Text('Visited Map')),
       body: ValueListenableBuilder<List<Coord>>(
         valueListenable: LocationPolicyService.I.coords,
         builder: (_, list, __) {
-          final latlngs = list.map((c) => LatLng(c.lat, c.lng)).toList();
-          final center = latlngs.isNotEmpty
-              ? latlngs.first
+          final native = Geo.I.available;
+          if (native) _reindex(list);
+          final latlngs = native ? const <LatLng>[] : list.map((c) => LatLng(c.lat, c.lng)).toList();
+          final center = list.isNotEmpty
+              ? LatLng(list.first.lat, list.first.lng)
               : const LatLng(23.7806, 90.4070); // Dhaka fallback
 
           return FlutterMap(
+            mapController: _map,
             options: MapOptions(
               initialCenter: center,
               initialZoom: 12,
+              onMapReady: () {
+                _ready = true;
+                _moved();
+              },
+              onPositionChanged: (_, __) => _moved(),
             ),
             children: [
               TileLayer(
                 urlTemplate: 'https://tile.openstreetmap.org/{z}/{x}/{y}.png',
                 userAgentPackageName: 'com.example.llm_model',
               ),
-              if (latlngs.length >= 2)
+              if (native)
+                PolylineLayer(
+                  polylines: [
+                    for (final r in _runs) Polyline(points: r, strokeWidth: 3.0),
+                  ],
+                )
+              else if (latlngs.length >= 2)
                 PolylineLayer(
                   polylines: [
                     Polyline(points: latlngs, strokeWidth: 3.0),
                   ],
                 ),
               MarkerLayer(
-                markers: [
-                  for (final p in latlngs)
-                    Marker(
-                      point: p,
-                      width: 28,
-                      height: 28,
-                      child: const Icon(Icons.place, size: 20),
-                    ),
-                ],
+                markers: native
+                    ? [for (final m in _markers) _marker(m)]
+                    : [
+                        for (final p in latlngs)
+                          Marker(
+                            point: p,
+                            width: 28,
+                            height: 28,
+                            child: const Icon(Icons.place, size: 20),
+                          ),
+                      ],
               ),
             ],
           );
@@ -7,6 +7,10 @@
 
 #include "flutter/generated_plugin_registrant.h"
 
+#ifdef LLM_PREWARM
+#include "llm_bridge.h"
+#endif
+
 struct _MyApplication {
   GtkApplication parent_instance;
   char** dart_entrypoint_arguments;
@@ -14,6 +18,32 @@ struct _MyApplication {
 
 G_DEFINE_TYPE(MyApplication, my_application, GTK_TYPE_APPLICATION)
 
+#ifdef LLM_PREWARM
+// Starts loading the on-device model while GTK and the Flutter engine come up, so
+// that Dart's llm_init (after the first frame) adopts it instead of loading on the
+// critical path. The path and parameters mirror lib/main.dart; LLM_PREWARM_MODEL
+// overrides the path and LLM_PREWARM=0 turns this off.
+static void prewarm_model() {
+  const gchar* enabled = g_getenv("LLM_PREWARM");
+  if (enabled != nullptr && g_strcmp0(enabled, "0") == 0) return;
+
+  g_autofree gchar* path = nullptr;
+  const gchar* override_path = g_getenv("LLM_PREWARM_MODEL");
+  if (override_path != nullptr && *override_path != '\0') {
+    path = g_strdup(override_path);
+  } else {
+    // getApplicationDocumentsDirectory() on Linux
+    const gchar* docs = g_get_user_special_dir(G_USER_DIRECTORY_DOCUMENTS);
+    path = g_build_filename(docs != nullptr ? docs : g_get_home_dir(), "model-q4k.gguf", nullptr);
+  }
+  if (!g_file_test(path, G_FILE_TEST_IS_REGULAR)) return;  // first run: Dart downloads it
+
+  if (llm_prewarm(path, 2048, 0, 4) != 0) {
+    g_warning("Model prewarm not started: %s", path);
+  }
+}
+#endif
+
 // Implements GApplication::activate.
 static void my_application_activate(GApplication* application) {
   MyApplication* self = MY_APPLICATION(application);
@@ -86,6 +116,9 @@ static void my_application_startup(GApplication* application) {
   //MyApplication* self = MY_APPLICATION(object);
 
   // Perform any actions required at application startup.
+#ifdef LLM_PREWARM
+  prewarm_model();
+#endif
 
   G_APPLICATION_CLASS(my_application_parent_class)->startup(application);
 }